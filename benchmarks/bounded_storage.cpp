@@ -0,0 +1,134 @@
+// Peak memory of BoundedMemoryStateStorage vs MemoryStateStorage over a simulated day of one-off conversations.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/bounded_memory.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include "memory_usage.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+// Time of the simulation, advanced by the benchmark instead of the wall clock
+struct SimulatedClock {
+    using duration = std::chrono::seconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<SimulatedClock>;
+    static constexpr bool is_steady = true;
+
+    static inline time_point current{};
+
+    static time_point now() {
+        return current;
+    }
+};
+
+struct Greeting {};
+struct Questionnaire {
+    std::int32_t step;
+    std::string answers;
+};
+struct Done {};
+using State = std::variant<Greeting, Questionnaire, Done>;
+
+constexpr std::int64_t secondsPerDay = 24 * 60 * 60;
+constexpr std::int64_t usersPerSecond = 50;
+constexpr std::int64_t updatesPerUser = 4;
+constexpr std::int64_t secondsBetweenUpdates = 30;
+constexpr std::int64_t sampleEverySeconds = 600;
+
+StateKey keyOf(std::int64_t user) {
+    constexpr std::int64_t firstUser = 100'000'000;
+    return {.chatId = firstUser + user};
+}
+
+// Every second new users come, each one sends a few updates and never returns
+template <typename Storage>
+void simulateDay(benchmark::State& state, Storage& storage) {
+    std::size_t peakHeap = 0;
+    std::size_t peakResident = 0;
+    for (std::int64_t second = 0; second < secondsPerDay; ++second) {
+        SimulatedClock::current = SimulatedClock::time_point{std::chrono::seconds{second}};
+        for (std::int64_t update = 0; update < updatesPerUser; ++update) {
+            const std::int64_t arrival = second - update * secondsBetweenUpdates;
+            if (arrival < 0)
+                break;
+            for (std::int64_t u = 0; u < usersPerSecond; ++u) {
+                const StateKey key = keyOf(arrival * usersPerSecond + u);
+                if (update == 0) {
+                    storage.put(key, Greeting{});
+                } else if (update + 1 == updatesPerUser) {
+                    storage.put(key, Done{});
+                } else if (State* s = storage[key]) {
+                    const auto step = static_cast<std::int32_t>(update);
+                    storage.put(key, Questionnaire{step, std::string(24, 'a' + step)}); // NOLINT(*-magic-numbers)
+                    benchmark::DoNotOptimize(s);
+                }
+            }
+        }
+        if (second % sampleEverySeconds == 0) {
+            peakHeap = std::max(peakHeap, bench::heapInUse());
+            peakResident = std::max(peakResident, bench::residentBytes());
+        }
+    }
+    constexpr double mib = 1 << 20;
+    state.counters["peak_heap_MiB"] = static_cast<double>(peakHeap) / mib;
+    state.counters["peak_rss_MiB"] = static_cast<double>(peakResident) / mib;
+    state.counters["keys_at_end"] = static_cast<double>(storage.size());
+}
+
+// MemoryStateStorage doesn't expose its size, so it is wrapped to count keys
+struct CountingMemoryStorage {
+    using StateT = State;
+    MemoryStateStorage<State> storage;
+    std::size_t count = 0;
+
+    [[nodiscard]] State* operator[](const StateKey& key) {
+        return storage[key];
+    }
+
+    template <typename T>
+    State& put(const StateKey& key, T&& value) {
+        count += storage[key] == nullptr ? 1 : 0;
+        return storage.put(key, std::forward<T>(value));
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return count;
+    }
+};
+
+// Runs first: RSS only grows within a process, so the unbounded storage must not precede it
+void BM_BoundedDay(benchmark::State& state) {
+    for (auto _ : state) {
+        BoundedMemoryStateStorage<State, SimulatedClock> storage{{.ttl = std::chrono::hours{1}}};
+        simulateDay(state, storage);
+    }
+}
+
+void BM_MemoryDay(benchmark::State& state) {
+    for (auto _ : state) {
+        CountingMemoryStorage storage;
+        simulateDay(state, storage);
+    }
+}
+
+} // namespace
+
+BENCHMARK(BM_BoundedDay)->Iterations(1)->Unit(benchmark::kSecond);
+BENCHMARK(BM_MemoryDay)->Iterations(1)->Unit(benchmark::kSecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,123 @@
+// Backend round-trips per update with CachedStateStorage vs using the slow backend directly.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/cached.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+    std::int32_t step;
+};
+using State = std::variant<Idle, Typing>;
+
+struct BackendStats {
+    std::atomic<std::int64_t> reads = 0;
+    std::atomic<std::int64_t> writes = 0;
+};
+
+// A storage with a network round-trip per call, simulated by spinning
+class SlowBackend {
+    MemoryStateStorage<State> states;
+    BackendStats* stats;
+
+    static void roundTrip() {
+        constexpr auto latency = std::chrono::microseconds{20};
+        const auto until = std::chrono::steady_clock::now() + latency;
+        while (std::chrono::steady_clock::now() < until) {
+        }
+    }
+
+  public:
+    using StateT = State;
+
+    explicit SlowBackend(BackendStats& stats) : stats{&stats} {}
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        roundTrip();
+        ++stats->reads;
+        return states[key];
+    }
+
+    void erase(const StateKey& key) {
+        roundTrip();
+        ++stats->writes;
+        states.erase(key);
+    }
+
+    template <typename T>
+    StateT& put(const StateKey& key, T&& state) {
+        roundTrip();
+        ++stats->writes;
+        return states.put(key, std::forward<T>(state));
+    }
+};
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+// 90% of updates come from 1000 active chats, the rest from 100k others
+StateKey nextKey(std::uint64_t& rng) {
+    constexpr std::uint64_t hot = 1000;
+    constexpr std::uint64_t cold = 100'000;
+    const std::uint64_t r = nextRandom(rng);
+    return {.chatId = static_cast<std::int64_t>(r % 10 == 0 ? hot + r / 10 % cold : r / 10 % hot)};
+}
+
+// What a handler does: read the state, then switch it
+template <typename Storage>
+void handleUpdates(benchmark::State& state, Storage& storage, BackendStats& stats) {
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        const StateKey key = nextKey(rng);
+        if (State* s = storage[key]; s && std::holds_alternative<Typing>(*s))
+            storage.put(key, Typing{key.chatId, std::get<Typing>(*s).step + 1});
+        else
+            storage.put(key, Typing{key.chatId, 0});
+    }
+    state.SetItemsProcessed(state.iterations());
+    const auto updates = static_cast<double>(state.iterations());
+    state.counters["backend_reads_per_update"] = static_cast<double>(stats.reads) / updates;
+    state.counters["backend_writes_per_update"] = static_cast<double>(stats.writes) / updates;
+}
+
+void BM_Direct(benchmark::State& state) {
+    BackendStats stats;
+    SlowBackend storage{stats};
+    handleUpdates(state, storage, stats);
+}
+
+void BM_Cached(benchmark::State& state) {
+    BackendStats stats;
+    {
+        CachedStateStorage<SlowBackend> storage{SlowBackend{stats}, {.flushInterval = std::chrono::milliseconds{50}}};
+        handleUpdates(state, storage, stats);
+        storage.flush();
+    }
+    const auto updates = static_cast<double>(state.iterations());
+    state.counters["backend_writes_per_update"] = static_cast<double>(stats.writes) / updates;
+}
+
+} // namespace
+
+BENCHMARK(BM_Direct)->MinTime(2);
+BENCHMARK(BM_Cached)->MinTime(2);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,136 @@
+// Routing of command messages with 200 registered commands: the lookup alone, then a whole update.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/command.hpp"
+#include "tg_stater/dependencies.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+constexpr std::size_t commandCount = 200;
+
+// "c000" ... "c199"; a command must be a complete object to be referenced by `Events::Command`
+template <std::size_t K>
+struct CommandName {
+    static constexpr char value[] = {'c', // NOLINT(*-avoid-c-arrays)
+                                     static_cast<char>('0' + K / 100),
+                                     static_cast<char>('0' + K / 10 % 10),
+                                     static_cast<char>('0' + K % 10),
+                                     '\0'};
+};
+
+template <std::size_t... K>
+constexpr auto makeCommandNames(std::index_sequence<K...>) {
+    return std::array<std::string_view, sizeof...(K)>{CommandName<K>::value...};
+}
+constexpr auto commandNames = makeCommandNames(std::make_index_sequence<commandCount>{});
+
+struct Idle {};
+using State = std::variant<Idle>;
+
+std::int64_t handled = 0;
+
+template <std::size_t K>
+void handler(const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+template <std::size_t... K>
+auto makeStater(std::index_sequence<K...>)
+    -> Setup<State>::Stater<Handler<Events::Command{CommandName<K>::value}, handler<K>, HandlerTypes::AnyState{}>...,
+                            Handler<Events::UnknownCommand{}, handler<commandCount>, HandlerTypes::AnyState{}>>;
+using BenchStater = decltype(makeStater(std::make_index_sequence<commandCount>{}));
+
+// Every 8th command is unknown, a quarter of them are addressed to the bot and have arguments
+std::vector<std::string> makeTexts() {
+    std::vector<std::string> texts;
+    for (std::size_t i = 0; i < 1024; ++i) { // NOLINT(*-magic-numbers)
+        std::string text = "/";
+        text += i % 8 == 7 ? std::string_view{"unknown"} : commandNames[(i * 37) % commandCount];
+        if (i % 4 == 1)
+            text += "@benchmark_bot some arguments";
+        texts.push_back(std::move(text));
+    }
+    return texts;
+}
+
+// What TgBot does: the name is copied out of the text and looked up in a map of strings
+void BM_LookupStringMap(benchmark::State& state) {
+    std::unordered_map<std::string, std::size_t> commands;
+    for (std::size_t i = 0; i < commandCount; ++i)
+        commands.emplace(commandNames[i], i);
+    const auto texts = makeTexts();
+
+    for (auto _ : state)
+        for (const std::string& text : texts) {
+            const std::size_t end = text.find_first_of(" @");
+            const std::string name = text.substr(1, (end == std::string::npos ? text.size() : end) - 1);
+            auto it = commands.find(name);
+            benchmark::DoNotOptimize(it == commands.end() ? commandCount : it->second);
+        }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(texts.size()));
+}
+
+void BM_LookupPerfectHash(benchmark::State& state) {
+    static constexpr detail::PerfectHashTable<commandCount> commands{commandNames};
+    const auto texts = makeTexts();
+
+    for (auto _ : state)
+        for (const std::string& text : texts) {
+            const auto command = parseCommand(text);
+            benchmark::DoNotOptimize(command ? commands.find(command->name) : commands.npos);
+        }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(texts.size()));
+}
+
+void BM_DispatchCommand(benchmark::State& state) {
+    std::vector<TgBot::Update::Ptr> updates;
+    for (std::string& text : makeTexts()) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->message = std::make_shared<TgBot::Message>();
+        update->message->chat = std::make_shared<TgBot::Chat>();
+        update->message->chat->id = 1;
+        update->message->text = std::move(text);
+        updates.push_back(std::move(update));
+    }
+
+    TgBot::Bot bot{"benchmark"};
+    BenchStater stater;
+    stater.setup(bot);
+
+    for (auto _ : state)
+        for (const auto& update : updates)
+            bot.getEventHandler().handleUpdate(update);
+    benchmark::DoNotOptimize(handled);
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(updates.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_LookupStringMap);
+BENCHMARK(BM_LookupPerfectHash);
+BENCHMARK(BM_DispatchCommand);
+
+BENCHMARK_MAIN();
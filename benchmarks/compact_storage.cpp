@@ -0,0 +1,110 @@
+// Memory per key with one large state option that few keys are in: 99% of keys Idle, 0.9% Typing, 0.1% in a 248-byte
+// Form, at 1M and 10M keys. MemoryStateStorage and FlatMemoryStateStorage keep a whole State per key,
+// CompactMemoryStateStorage only what the key's option needs.
+#define TGBOTSTATER_LOG_OFF
+
+#include "memory_usage.hpp"
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/compact_memory.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+};
+struct Form {
+    std::int64_t step;
+    std::array<char, 240> draft;
+};
+using State = std::variant<Idle, Typing, Form>;
+
+StateKey keyOf(std::int64_t i) {
+    constexpr std::int64_t firstUser = 100'000'000;
+    return {.chatId = firstUser + i};
+}
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+template <typename Storage>
+void fill(Storage& storage, std::int64_t n) {
+    for (std::int64_t i = 0; i < n; ++i) {
+        if (const std::int64_t perMille = i % 1000; perMille == 0)
+            storage.put(keyOf(i), Form{.step = 1, .draft = {}});
+        else if (perMille < 10)
+            storage.put(keyOf(i), Typing{.messageId = i});
+        else
+            storage.put(keyOf(i), Idle{});
+    }
+}
+
+template <typename Storage>
+void BM_Fill(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    double bytesPerKey = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        const std::size_t before = bench::heapInUse();
+        auto storage = std::make_unique<Storage>();
+        state.ResumeTiming();
+
+        fill(*storage, n);
+
+        state.PauseTiming();
+        bytesPerKey = static_cast<double>(bench::heapInUse() - before) / static_cast<double>(n);
+        storage.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.counters["bytes_per_key"] = bytesPerKey;
+}
+
+// Random keys, reading the state as a handler would
+template <typename Storage>
+void BM_Lookup(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = std::make_unique<Storage>();
+    fill(*storage, n);
+
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        const State* found = (*storage)[keyOf(static_cast<std::int64_t>(nextRandom(rng) % n))];
+        benchmark::DoNotOptimize(found->index());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+constexpr std::int64_t million = 1'000'000;
+
+void sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(million)->Arg(10 * million)->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Fill, MemoryStateStorage<State>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Fill, FlatMemoryStateStorage<State>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Fill, CompactMemoryStateStorage<State>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, MemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+BENCHMARK_TEMPLATE(BM_Lookup, FlatMemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+BENCHMARK_TEMPLATE(BM_Lookup, CompactMemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,100 @@
+// Contention of state storages shared by several threads: 90% lookups, 10% transitions.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t counter;
+};
+using State = std::variant<Idle, Typing>;
+
+// What one has to do with MemoryStateStorage to share it: a single lock for everything.
+class GlobalLockStateStorage {
+    MemoryStateStorage<State> storage;
+    std::unique_ptr<std::mutex> mutex = std::make_unique<std::mutex>();
+
+  public:
+    using StateT = State;
+    static constexpr bool threadSafe = true;
+
+    StateT* operator[](const StateKey& key) {
+        std::lock_guard lock{*mutex};
+        return storage[key];
+    }
+
+    void erase(const StateKey& key) {
+        std::lock_guard lock{*mutex};
+        storage.erase(key);
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        std::lock_guard lock{*mutex};
+        return storage.put(key, std::forward<T>(state));
+    }
+};
+
+static_assert(concepts::ThreadSafeStateStorage<GlobalLockStateStorage>);
+static_assert(concepts::ThreadSafeStateStorage<ConcurrentMemoryStateStorage<State>>);
+
+constexpr std::int64_t keyCount = std::int64_t{1} << 20;
+
+template <typename Storage>
+Storage& sharedStorage() {
+    static Storage storage = [] {
+        Storage s;
+        for (std::int64_t i = 0; i < keyCount; ++i)
+            s.put(StateKey{.chatId = i}, Idle{});
+        return s;
+    }();
+    return storage;
+}
+
+template <typename Storage>
+void BM_MixedAccess(benchmark::State& state) {
+    Storage& storage = sharedStorage<Storage>();
+    // Each thread owns its own keys: accesses to one key must not race (see ConcurrentMemoryStateStorage).
+    const auto threads = static_cast<std::int64_t>(state.threads());
+    const auto index = static_cast<std::int64_t>(state.thread_index());
+    const std::int64_t ownKeys = keyCount / threads;
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL + static_cast<std::uint64_t>(index);
+
+    for (auto _ : state) {
+        rng ^= rng << 13U;
+        rng ^= rng >> 7U;
+        rng ^= rng << 17U;
+        const auto slot = static_cast<std::int64_t>(rng % static_cast<std::uint64_t>(ownKeys));
+        const StateKey key{.chatId = slot * threads + index};
+        if (rng % 10 == 0)
+            storage.put(key, Typing{static_cast<std::int64_t>(rng)});
+        else
+            benchmark::DoNotOptimize(storage[key]);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_MixedAccess, GlobalLockStateStorage)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_MixedAccess, ConcurrentMemoryStateStorage<State>)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
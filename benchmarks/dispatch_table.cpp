@@ -0,0 +1,83 @@
+// Overhead of routing an update to the handlers of the current state: 50 state options x 100 handlers.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dependencies.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+constexpr std::size_t stateCount = 50;
+constexpr std::size_t handlerCount = 100;
+
+template <std::size_t N>
+struct Step {};
+
+template <std::size_t... N>
+auto makeState(std::index_sequence<N...>) -> std::variant<Step<N>...>;
+using State = decltype(makeState(std::make_index_sequence<stateCount>{}));
+
+std::int64_t handled = 0;
+
+template <std::size_t K>
+void handler(Step<K % stateCount>& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+template <std::size_t... K>
+auto makeStater(std::index_sequence<K...>) -> Setup<State>::Stater<Handler<Events::AnyMessage{}, handler<K>>...>;
+using BenchStater = decltype(makeStater(std::make_index_sequence<handlerCount>{}));
+
+template <std::size_t... N>
+MemoryStateStorage<State> makeStorage(std::index_sequence<N...>) {
+    MemoryStateStorage<State> storage;
+    (storage.put(StateKey{.chatId = static_cast<std::int64_t>(N)}, Step<N>{}), ...);
+    return storage;
+}
+
+// Every chat is in its own state, so consecutive updates go to different table cells
+void BM_DispatchByState(benchmark::State& state) {
+    std::vector<TgBot::Update::Ptr> updates;
+    for (std::size_t i = 0; i < stateCount; ++i) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->message = std::make_shared<TgBot::Message>();
+        update->message->chat = std::make_shared<TgBot::Chat>();
+        update->message->chat->id = static_cast<std::int64_t>(i);
+        update->message->text = "hello";
+        updates.push_back(std::move(update));
+    }
+
+    TgBot::Bot bot{"benchmark"};
+    BenchStater stater{makeStorage(std::make_index_sequence<stateCount>{})};
+    stater.setup(bot);
+
+    for (auto _ : state)
+        for (const auto& update : updates)
+            bot.getEventHandler().handleUpdate(update);
+    benchmark::DoNotOptimize(handled);
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(updates.size()));
+}
+
+} // namespace
+
+BENCHMARK(BM_DispatchByState);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,86 @@
+// Throughput of inline dispatch vs sharded dispatch with handlers that block like an API call does.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+
+constexpr auto apiLatency = std::chrono::microseconds{200};
+constexpr std::size_t updatesPerIteration = 2000;
+constexpr std::int64_t chats = 1024;
+
+constexpr auto slowHandler = [](const TgBot::Message&) { std::this_thread::sleep_for(apiLatency); };
+
+using BenchStater = Setup<State, Dependencies<>, ConcurrentMemoryStateStorage<State>>::Stater<
+    Handler<Events::Message{}, slowHandler, HandlerTypes::NoState{}>>;
+
+std::vector<TgBot::Update::Ptr> makeUpdates() {
+    std::vector<TgBot::Update::Ptr> updates;
+    updates.reserve(updatesPerIteration);
+    for (std::size_t i = 0; i < updatesPerIteration; ++i) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->updateId = static_cast<std::int32_t>(i);
+        update->message = std::make_shared<TgBot::Message>();
+        update->message->chat = std::make_shared<TgBot::Chat>();
+        update->message->chat->id = static_cast<std::int64_t>(i) % chats;
+        update->message->text = "hello";
+        updates.push_back(std::move(update));
+    }
+    return updates;
+}
+
+void BM_Dispatch(benchmark::State& state) {
+    const auto shards = static_cast<std::size_t>(state.range(0));
+    const auto updates = makeUpdates();
+
+    TgBot::Bot bot{"benchmark"};
+    BenchStater stater{{}, {}, DispatchOptions{.shards = shards}};
+    stater.setup(bot);
+
+    for (auto _ : state) {
+        for (const auto& update : updates)
+            bot.getEventHandler().handleUpdate(update);
+        stater.drain();
+    }
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(updates.size()));
+}
+
+void shardArgs(benchmark::internal::Benchmark* b) {
+    b->Arg(0);
+    // handlers mostly wait, so it is worth going past the number of cores
+    const auto cores = static_cast<std::int64_t>(std::thread::hardware_concurrency());
+    for (std::int64_t n = 1; n <= std::max<std::int64_t>(16, 2 * cores); n *= 2)
+        b->Arg(n);
+}
+
+} // namespace
+
+BENCHMARK(BM_Dispatch)->Apply(shardArgs)->ArgName("shards")->UseRealTime()->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,107 @@
+// End to end against the local fake Bot API: long polling, JSON parsing, dispatch and a reply per update.
+// Args are updates per second, chats and shards; the counters are reply latencies from update generation.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dependencies.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/fake_api.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/logging.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Api.h>
+#include <tgbot/Bot.h>
+#include <tgbot/net/TgLongPoll.h>
+#include <tgbot/types/CallbackQuery.h>
+#include <tgbot/types/Message.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+using Storage = ConcurrentMemoryStateStorage<State>;
+
+void echo(const TgBot::Message& message, const TgBot::Api& api) {
+    api.sendMessage(message.chat->id, message.text);
+}
+
+void answer(const TgBot::CallbackQuery& query, const TgBot::Api& api) {
+    api.answerCallbackQuery(query.id);
+}
+
+using BenchStater = Setup<State, Dependencies<>, Storage>::Stater<
+    Handler<Events::Message{}, echo, HandlerTypes::NoState{}>,
+    Handler<Events::CallbackQuery{}, answer, HandlerTypes::NoState{}>>;
+
+void BM_EndToEnd(benchmark::State& state) {
+    const fake_api::LoadOptions load{.updatesPerSecond = static_cast<double>(state.range(0)),
+                                     .duration = std::chrono::seconds{2},
+                                     .chats = state.range(1),
+                                     .callbackQueryShare = 0.2}; // NOLINT(*-magic-numbers)
+    const auto shards = static_cast<std::size_t>(state.range(2));
+
+    fake_api::Stats stats;
+    for (auto _ : state) {
+        fake_api::Server server;
+        const fake_api::PlainHttpClient http;
+        TgBot::Bot bot{"benchmark", http, server.url()};
+        BenchStater stater{Storage{}, Dependencies<>{}, DispatchOptions{.shards = shards}};
+        stater.setup(bot);
+
+        std::atomic<bool> stopping{false};
+        std::thread poller{[&] {
+            TgBot::TgLongPoll longPoll{bot, 100, 1}; // NOLINT(*-magic-numbers)
+            while (!stopping.load(std::memory_order_relaxed)) {
+                try {
+                    longPoll.start();
+                } catch (const std::exception& e) { // retried, as in `start`
+                    logging::log<logging::ERROR>("{}", e.what());
+                }
+            }
+        }};
+
+        const auto start = std::chrono::steady_clock::now();
+        server.generate(load);
+        if (!server.waitForReplies(std::chrono::seconds{10})) // NOLINT(*-magic-numbers)
+            state.SkipWithError("Not every update was answered");
+        state.SetIterationTime(std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count());
+        stopping.store(true, std::memory_order_relaxed);
+        poller.join();
+        stater.drain();
+        stats = server.statistics();
+    }
+
+    const auto us = [&](double q) { return static_cast<double>(stats.latency.quantileNs(q)) / 1e3; }; // NOLINT
+    state.counters["p50_us"] = us(0.5);                                                                // NOLINT
+    state.counters["p90_us"] = us(0.9);                                                                // NOLINT
+    state.counters["p99_us"] = us(0.99);                                                               // NOLINT
+    state.counters["max_us"] = us(1);
+    state.counters["unmatched"] = static_cast<double>(stats.unmatchedReplies);
+    state.SetItemsProcessed(static_cast<std::int64_t>(stats.replies));
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(*-magic-numbers)
+BENCHMARK(BM_EndToEnd)
+    ->ArgNames({"rate", "chats", "shards"})
+    ->ArgsProduct({{500, 2000}, {10, 1000}, {0, 4}})
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,103 @@
+// Node-based MemoryStateStorage vs open-addressing FlatMemoryStateStorage at 1M-50M keys.
+#define TGBOTSTATER_LOG_OFF
+
+#include "memory_usage.hpp"
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+};
+using State = std::variant<Idle, Typing>;
+
+// Private chat ids are (roughly) sequential user ids
+StateKey keyOf(std::int64_t i) {
+    constexpr std::int64_t firstUser = 100'000'000;
+    return {.chatId = firstUser + i};
+}
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+template <typename Storage>
+void BM_Insert(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    double bytesPerKey = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        const std::size_t before = bench::heapInUse();
+        auto storage = std::make_unique<Storage>();
+        state.ResumeTiming();
+
+        for (std::int64_t i = 0; i < n; ++i)
+            storage->put(keyOf(i), Idle{});
+
+        state.PauseTiming();
+        bytesPerKey = static_cast<double>(bench::heapInUse() - before) / static_cast<double>(n);
+        storage.reset();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.counters["bytes_per_key"] = bytesPerKey;
+}
+
+template <typename Storage>
+void BM_Lookup(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = std::make_unique<Storage>();
+    for (std::int64_t i = 0; i < n; ++i)
+        storage->put(keyOf(i), Idle{});
+
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state)
+        benchmark::DoNotOptimize((*storage)[keyOf(static_cast<std::int64_t>(nextRandom(rng) % n))]);
+    state.SetItemsProcessed(state.iterations());
+}
+
+template <typename Storage>
+void BM_LookupMiss(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = std::make_unique<Storage>();
+    for (std::int64_t i = 0; i < n; ++i)
+        storage->put(keyOf(i), Idle{});
+
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state)
+        benchmark::DoNotOptimize((*storage)[keyOf(n + static_cast<std::int64_t>(nextRandom(rng) % n))]);
+    state.SetItemsProcessed(state.iterations());
+}
+
+constexpr std::int64_t million = 1'000'000;
+
+void sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(million)->Arg(10 * million)->Arg(50 * million)->Unit(benchmark::kMillisecond);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Insert, MemoryStateStorage<State>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Insert, FlatMemoryStateStorage<State>)->Apply(sizes);
+BENCHMARK_TEMPLATE(BM_Lookup, MemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+BENCHMARK_TEMPLATE(BM_Lookup, FlatMemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+BENCHMARK_TEMPLATE(BM_LookupMiss, MemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+BENCHMARK_TEMPLATE(BM_LookupMiss, FlatMemoryStateStorage<State>)->Apply(sizes)->Unit(benchmark::kNanosecond);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,272 @@
+// Regression suite for the hot paths: dispatch by event, handler and state counts, storage operations at scale,
+// StateProxy::put and state transitions. bench_hot_paths_logging runs the same with INFO logging into a null stream.
+#ifndef TGBOTSTATER_LOG_INFO
+#define TGBOTSTATER_LOG_OFF
+#endif
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/net/HttpClient.h>
+#include <tgbot/net/HttpReqArg.h>
+#include <tgbot/net/Url.h>
+#include <tgbot/types/CallbackQuery.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+#include <tgbot/types/User.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+// Answers every API call without the network
+class StubHttpClient : public TgBot::HttpClient {
+  public:
+    std::string makeRequest(const TgBot::Url& /*unused*/,
+                            const std::vector<TgBot::HttpReqArg>& /*unused*/) const override {
+        return R"({"ok":true,"result":true})";
+    }
+};
+
+class NullBuffer : public std::streambuf {
+  protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char* /*unused*/, std::streamsize n) override {
+        return n;
+    }
+};
+
+// Log output is discarded, so that only the cost of producing it is measured
+class SilenceLog {
+    NullBuffer null;
+    std::streambuf* original = std::clog.rdbuf(&null);
+
+  public:
+    SilenceLog() = default;
+    SilenceLog(const SilenceLog&) = delete;
+    SilenceLog& operator=(const SilenceLog&) = delete;
+    SilenceLog(SilenceLog&&) = delete;
+    SilenceLog& operator=(SilenceLog&&) = delete;
+    ~SilenceLog() {
+        std::clog.rdbuf(original);
+    }
+};
+
+constexpr std::int64_t chats = 256;
+
+template <std::size_t N>
+struct Step {};
+
+template <std::size_t... N>
+auto makeState(std::index_sequence<N...>) -> std::variant<Step<N>...>;
+template <std::size_t States>
+using State = decltype(makeState(std::make_index_sequence<States>{}));
+
+std::int64_t handled = 0;
+
+template <std::size_t States, std::size_t K>
+void onMessage(Step<K % States>& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+template <std::size_t States, std::size_t K>
+void onCallbackQuery(Step<K % States>& /*unused*/, const TgBot::CallbackQuery& /*unused*/) {
+    ++handled;
+}
+
+template <std::size_t States, std::size_t... K>
+auto makeMessageStater(std::index_sequence<K...>)
+    -> typename Setup<State<States>>::template Stater<Handler<Events::Message{}, onMessage<States, K>>...>;
+
+template <std::size_t States, std::size_t... K>
+auto makeCallbackQueryStater(std::index_sequence<K...>)
+    -> typename Setup<State<States>>::template Stater<Handler<Events::CallbackQuery{}, onCallbackQuery<States, K>>...>;
+
+// Chat i is in the state i % States
+template <std::size_t States>
+MemoryStateStorage<State<States>> makeStorage() {
+    MemoryStateStorage<State<States>> storage;
+    [&]<std::size_t... N>(std::index_sequence<N...>) {
+        for (std::int64_t i = 0; i < chats; ++i) {
+            const auto option = static_cast<std::size_t>(i) % States;
+            (void)((option == N ? (storage.put({.chatId = i}, Step<N>{}), true) : false) || ...);
+        }
+    }(std::make_index_sequence<States>{});
+    return storage;
+}
+
+std::vector<TgBot::Update::Ptr> makeMessages() {
+    std::vector<TgBot::Update::Ptr> updates;
+    for (std::int64_t i = 0; i < chats; ++i) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->message = std::make_shared<TgBot::Message>();
+        update->message->chat = std::make_shared<TgBot::Chat>();
+        update->message->chat->id = i;
+        update->message->text = "hello";
+        updates.push_back(std::move(update));
+    }
+    return updates;
+}
+
+std::vector<TgBot::Update::Ptr> makeCallbackQueries() {
+    std::vector<TgBot::Update::Ptr> updates;
+    for (std::int64_t i = 0; i < chats; ++i) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->callbackQuery = std::make_shared<TgBot::CallbackQuery>();
+        update->callbackQuery->from = std::make_shared<TgBot::User>();
+        update->callbackQuery->from->id = i;
+        update->callbackQuery->data = "button";
+        updates.push_back(std::move(update));
+    }
+    return updates;
+}
+
+template <typename Stater, std::size_t States>
+void runDispatch(benchmark::State& state, const std::vector<TgBot::Update::Ptr>& updates) {
+    const StubHttpClient http;
+    TgBot::Bot bot{"benchmark", http};
+    Stater stater{makeStorage<States>()};
+    stater.setup(bot);
+    const SilenceLog silence;
+
+    for (auto _ : state)
+        for (const auto& update : updates)
+            bot.getEventHandler().handleUpdate(update);
+    benchmark::DoNotOptimize(handled);
+    state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(updates.size()));
+}
+
+template <std::size_t Handlers, std::size_t States>
+void BM_DispatchMessage(benchmark::State& state) {
+    using Stater = decltype(makeMessageStater<States>(std::make_index_sequence<Handlers>{}));
+    runDispatch<Stater, States>(state, makeMessages());
+}
+
+template <std::size_t Handlers, std::size_t States>
+void BM_DispatchCallbackQuery(benchmark::State& state) {
+    using Stater = decltype(makeCallbackQueryStater<States>(std::make_index_sequence<Handlers>{}));
+    runDispatch<Stater, States>(state, makeCallbackQueries());
+}
+
+using StorageState = State<2>;
+
+MemoryStateStorage<StorageState> filledStorage(std::int64_t n) {
+    MemoryStateStorage<StorageState> storage;
+    for (std::int64_t i = 0; i < n; ++i)
+        storage.put({.chatId = i}, Step<0>{});
+    return storage;
+}
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+void BM_StorageGet(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = filledStorage(n);
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state)
+        benchmark::DoNotOptimize(storage[{.chatId = static_cast<std::int64_t>(nextRandom(rng) % n)}]);
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Replaces the state of an existing key
+void BM_StoragePut(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = filledStorage(n);
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state)
+        storage.put({.chatId = static_cast<std::int64_t>(nextRandom(rng) % n)}, Step<1>{});
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Erases a key and puts it back, so the size stays the same
+void BM_StorageEraseAndPut(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    auto storage = filledStorage(n);
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        const StateKey key{.chatId = static_cast<std::int64_t>(nextRandom(rng) % n)};
+        storage.erase(key);
+        storage.put(key, Step<0>{});
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+}
+
+// What a handler pays to switch the state, including the log line when logging is on
+void BM_StateProxyPut(benchmark::State& state) {
+    auto storage = filledStorage(chats);
+    const SilenceLog silence;
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        const StateProxy proxy{storage, StateKey{.chatId = i++ % chats}};
+        proxy.put(Step<1>{});
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// A handler switching the state: the update's lookup and the handler's put go through the same proxy,
+// so with a handle the put does not look the key up again
+template <template <typename> typename Storage, bool Emplace>
+void BM_StateTransition(benchmark::State& state) {
+    Storage<StorageState> storage;
+    for (std::int64_t i = 0; i < chats; ++i)
+        storage.put({.chatId = i}, Step<0>{});
+    const SilenceLog silence;
+    std::int64_t i = 0;
+    for (auto _ : state) {
+        const StateProxy proxy{storage, StateKey{.chatId = i++ % chats}};
+        benchmark::DoNotOptimize(proxy.get());
+        if constexpr (Emplace)
+            proxy.template emplace<Step<1>>();
+        else
+            proxy.put(Step<1>{});
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void storageSizes(benchmark::internal::Benchmark* b) {
+    for (const std::int64_t n : {1'000, 100'000, 1'000'000}) // NOLINT(*-magic-numbers)
+        b->Arg(n);
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_DispatchMessage, 1, 1);
+BENCHMARK_TEMPLATE(BM_DispatchMessage, 10, 5);
+BENCHMARK_TEMPLATE(BM_DispatchMessage, 100, 50);
+BENCHMARK_TEMPLATE(BM_DispatchCallbackQuery, 1, 1);
+BENCHMARK_TEMPLATE(BM_DispatchCallbackQuery, 10, 5);
+BENCHMARK_TEMPLATE(BM_DispatchCallbackQuery, 100, 50);
+BENCHMARK(BM_StorageGet)->Apply(storageSizes);
+BENCHMARK(BM_StoragePut)->Apply(storageSizes);
+BENCHMARK(BM_StorageEraseAndPut)->Apply(storageSizes);
+BENCHMARK(BM_StateProxyPut);
+BENCHMARK_TEMPLATE(BM_StateTransition, MemoryStateStorage, false);
+BENCHMARK_TEMPLATE(BM_StateTransition, MemoryStateStorage, true);
+BENCHMARK_TEMPLATE(BM_StateTransition, FlatMemoryStateStorage, false);
+BENCHMARK_TEMPLATE(BM_StateTransition, FlatMemoryStateStorage, true);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,4 @@
+// bench_hot_paths with INFO logging
+#define TGBOTSTATER_LOG_INFO
+
+#include "hot_paths.cpp" // NOLINT(bugprone-suspicious-include)
@@ -0,0 +1,75 @@
+// Logging overhead per update on the dispatch thread: synchronous output vs the asynchronous logger.
+// Each update logs what `StaterBase` logs for a message with one handler.
+#include "tg_stater/async_logging.hpp"
+#include "tg_stater/logging.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+namespace {
+
+using namespace tg_stater;
+
+// Formats the line as a real sink does and throws it away
+class NullSink : public logging::LogSink {
+    std::string line;
+
+  public:
+    void write(const logging::LogRecord& record) override {
+        line.clear();
+        logging::appendLine(line, record);
+        benchmark::DoNotOptimize(line.data());
+    }
+};
+
+class NullBuffer : public std::streambuf {
+  protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char* /*unused*/, std::streamsize n) override {
+        return n;
+    }
+};
+
+void logUpdate(std::int64_t i) {
+    const StateKey key{i % 1024}; // NOLINT(*-magic-numbers)
+    logging::log("Handling {} from {}", "non-command message", key);
+    logging::log("Running handler {}", "handleMessage");
+}
+
+void BM_LogSync(benchmark::State& state) {
+    NullBuffer null;
+    std::streambuf* const original = std::clog.rdbuf(&null);
+    std::int64_t i = 0;
+    for (auto _ : state)
+        logUpdate(i++);
+    std::clog.rdbuf(original);
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_LogAsync(benchmark::State& state) {
+    const auto overflow = static_cast<logging::AsyncLoggerOptions::Overflow>(state.range(0));
+    logging::AsyncLogger logger{std::make_unique<NullSink>(), {.overflow = overflow}};
+    std::int64_t i = 0;
+    for (auto _ : state)
+        logUpdate(i++);
+    state.counters["dropped"] = static_cast<double>(logger.droppedCount());
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_LogSync);
+BENCHMARK(BM_LogAsync)
+    ->ArgName("block")
+    ->Arg(static_cast<std::int64_t>(logging::AsyncLoggerOptions::Overflow::Drop))
+    ->Arg(static_cast<std::int64_t>(logging::AsyncLoggerOptions::Overflow::Block));
+
+BENCHMARK_MAIN();
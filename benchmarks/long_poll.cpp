@@ -0,0 +1,109 @@
+// A burst of updates queued at the fake Bot API at once, received by `TgLongPoll` or `PipelinedLongPoll`.
+// Args are the burst size, whether polling is pipelined and shards; every API response takes a 5 ms round trip.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dependencies.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/fake_api.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/logging.hpp"
+#include "tg_stater/polling.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Api.h>
+#include <tgbot/Bot.h>
+#include <tgbot/net/TgLongPoll.h>
+#include <tgbot/types/Message.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+using Storage = ConcurrentMemoryStateStorage<State>;
+
+void echo(const TgBot::Message& message, const TgBot::Api& api) {
+    api.sendMessage(message.chat->id, message.text);
+}
+
+using BenchStater =
+    Setup<State, Dependencies<>, Storage>::Stater<Handler<Events::Message{}, echo, HandlerTypes::NoState{}>>;
+
+template <typename LongPoll>
+void poll(LongPoll& longPoll, const std::atomic<bool>& stopping) {
+    while (!stopping.load(std::memory_order_relaxed)) {
+        try {
+            longPoll.start();
+        } catch (const std::exception& e) { // retried, as in `start`
+            logging::log<logging::ERROR>("{}", e.what());
+        }
+    }
+}
+
+void BM_LongPollBurst(benchmark::State& state) {
+    const auto burst = static_cast<double>(state.range(0));
+    const bool pipelined = state.range(1) != 0;
+    const auto shards = static_cast<std::size_t>(state.range(2));
+
+    fake_api::Stats stats;
+    for (auto _ : state) {
+        fake_api::Server server{{.workers = 64, .roundTrip = std::chrono::milliseconds{5}}}; // NOLINT
+        const fake_api::PlainHttpClient http;
+        TgBot::Bot bot{"benchmark", http, server.url()};
+        BenchStater stater{Storage{}, Dependencies<>{}, DispatchOptions{.shards = shards}};
+        stater.setup(bot);
+
+        // the whole burst is queued before polling starts
+        server.generate({.updatesPerSecond = burst * 1000, .duration = std::chrono::milliseconds{1}}); // NOLINT
+        const auto start = std::chrono::steady_clock::now();
+        std::atomic<bool> stopping{false};
+        std::thread poller{[&] {
+            if (pipelined) {
+                PipelinedLongPoll longPoll{bot, PollOptions{.timeout = 1}};
+                poll(longPoll, stopping);
+            } else {
+                TgBot::TgLongPoll longPoll{bot, 100, 1}; // NOLINT(*-magic-numbers)
+                poll(longPoll, stopping);
+            }
+        }};
+
+        if (!server.waitForReplies(std::chrono::seconds{60})) // NOLINT(*-magic-numbers)
+            state.SkipWithError("Not every update was answered");
+        state.SetIterationTime(std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count());
+        stopping.store(true, std::memory_order_relaxed);
+        poller.join();
+        stater.drain();
+        stats = server.statistics();
+    }
+
+    const auto ms = [&](double q) { return static_cast<double>(stats.latency.quantileNs(q)) / 1e6; }; // NOLINT
+    state.counters["p50_ms"] = ms(0.5);                                                                // NOLINT
+    state.counters["max_ms"] = ms(1);
+    state.counters["get_updates"] = static_cast<double>(stats.apiCalls["getUpdates"]);
+    state.SetItemsProcessed(static_cast<std::int64_t>(stats.replies));
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(*-magic-numbers)
+BENCHMARK(BM_LongPollBurst)
+    ->ArgNames({"burst", "pipelined", "shards"})
+    ->ArgsProduct({{500, 2000}, {0, 1}, {0, 8}})
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
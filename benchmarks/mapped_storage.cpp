@@ -0,0 +1,154 @@
+// Restart time of MappedStateStorage vs reloading MemoryStateStorage from a binary dump.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/mapped.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+    std::int32_t step;
+};
+using State = std::variant<Idle, Typing>;
+
+struct DumpRecord {
+    StateKey key;
+    State state;
+};
+
+StateKey keyOf(std::int64_t i) {
+    constexpr std::int64_t firstUser = 100'000'000;
+    return {.chatId = firstUser + i};
+}
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+std::string tempPath(const std::string& name, std::int64_t n) {
+    return (std::filesystem::temp_directory_path() / ("tgbotstater_" + name + "_" + std::to_string(n))).string();
+}
+
+// Files are created once per size, reused by all the iterations and removed at exit
+struct TempFiles {
+    std::map<std::int64_t, std::string> paths;
+
+    TempFiles() = default;
+    TempFiles(const TempFiles&) = delete;
+    TempFiles& operator=(const TempFiles&) = delete;
+    TempFiles(TempFiles&&) = delete;
+    TempFiles& operator=(TempFiles&&) = delete;
+
+    ~TempFiles() {
+        for (const auto& [n, path] : paths)
+            std::filesystem::remove(path);
+    }
+};
+
+const std::string& mappedFile(std::int64_t n) {
+    static TempFiles files;
+    auto [it, inserted] = files.paths.try_emplace(n, tempPath("mapped", n));
+    if (inserted) {
+        std::filesystem::remove(it->second);
+        MappedStateStorage<State> storage{it->second, 0, static_cast<std::size_t>(n)};
+        for (std::int64_t i = 0; i < n; ++i)
+            storage.put(keyOf(i), Typing{i, 1});
+    }
+    return it->second;
+}
+
+const std::string& dumpFile(std::int64_t n) {
+    static TempFiles files;
+    auto [it, inserted] = files.paths.try_emplace(n, tempPath("dump", n));
+    if (inserted) {
+        std::ofstream out{it->second, std::ios::binary | std::ios::trunc};
+        for (std::int64_t i = 0; i < n; ++i) {
+            const DumpRecord record{keyOf(i), Typing{i, 1}};
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record)); // NOLINT(*-reinterpret-cast)
+        }
+    }
+    return it->second;
+}
+
+// Time until the first update can be served
+void BM_OpenMapped(benchmark::State& state) {
+    const std::string& path = mappedFile(state.range(0));
+    for (auto _ : state) {
+        MappedStateStorage<State> storage{path};
+        benchmark::DoNotOptimize(storage[keyOf(0)]);
+    }
+}
+
+// Opening plus the first 1000 random lookups, which fault in their pages
+void BM_OpenMappedAndServe1000(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    const std::string& path = mappedFile(n);
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        MappedStateStorage<State> storage{path};
+        for (int i = 0; i < 1000; ++i) // NOLINT(*-magic-numbers)
+            benchmark::DoNotOptimize(storage[keyOf(static_cast<std::int64_t>(nextRandom(rng) % n))]);
+    }
+}
+
+// The alternative: read every record and put it into memory
+void BM_ReloadMemoryStorage(benchmark::State& state) {
+    const std::string& path = dumpFile(state.range(0));
+    std::vector<DumpRecord> buffer(4096); // NOLINT(*-magic-numbers)
+    for (auto _ : state) {
+        MemoryStateStorage<State> storage;
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        std::size_t read = 0;
+        while ((read = std::fread(buffer.data(), sizeof(DumpRecord), buffer.size(), file)) != 0)
+            for (std::size_t i = 0; i < read; ++i)
+                std::visit([&](const auto& option) { storage.put(buffer[i].key, option); }, buffer[i].state);
+        std::fclose(file);
+        benchmark::DoNotOptimize(storage[keyOf(0)]);
+    }
+}
+
+void BM_MappedPut(benchmark::State& state) {
+    const std::int64_t n = state.range(0);
+    MappedStateStorage<State> storage{mappedFile(n)};
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        const auto i = static_cast<std::int64_t>(nextRandom(rng) % n);
+        storage.put(keyOf(i), Typing{i, 2});
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+constexpr std::int64_t million = 1'000'000;
+
+void sizes(benchmark::internal::Benchmark* b) {
+    b->Arg(million)->Arg(10 * million);
+}
+
+} // namespace
+
+BENCHMARK(BM_OpenMapped)->Apply(sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_OpenMappedAndServe1000)->Apply(sizes)->Unit(benchmark::kMicrosecond);
+BENCHMARK(BM_ReloadMemoryStorage)->Apply(sizes)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_MappedPut)->Apply(sizes);
+
+BENCHMARK_MAIN();
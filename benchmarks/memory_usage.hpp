@@ -0,0 +1,39 @@
+#ifndef INCLUDE_tgbotstater_benchmarks_memory_usage
+#define INCLUDE_tgbotstater_benchmarks_memory_usage
+
+#include <cstddef>
+#include <fstream>
+
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+namespace tg_stater::bench {
+
+// Bytes currently allocated on the heap, or 0 if it can't be told on this platform
+inline std::size_t heapInUse() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    const struct mallinfo2 info = mallinfo2();
+    return info.uordblks + info.hblkhd;
+#else
+    return 0;
+#endif
+}
+
+// Resident set size of the process, or 0 if it can't be told on this platform
+inline std::size_t residentBytes() {
+#if defined(__linux__)
+    std::ifstream statm{"/proc/self/statm"};
+    std::size_t pages = 0;
+    std::size_t resident = 0;
+    statm >> pages >> resident;
+    constexpr std::size_t pageSize = 4096;
+    return resident * pageSize;
+#else
+    return 0;
+#endif
+}
+
+} // namespace tg_stater::bench
+
+#endif // INCLUDE_tgbotstater_benchmarks_memory_usage
@@ -0,0 +1,126 @@
+// Messages matched by both a specific handler and an AnyMessage one: text messages, known and unknown commands,
+// and AnyMessage handlers that may switch the state. `lookups_per_update` counts the state storage reads.
+#define TGBOTSTATER_LOG_OFF
+#define TGBOTSTATER_METRICS // for `lookups_per_update`
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+using Storage = MemoryStateStorage<State>;
+
+constexpr std::int64_t chats = 256;
+constexpr char startCommand[] = "start"; // NOLINT(*-avoid-c-arrays)
+
+std::int64_t handled = 0;
+
+void onAny(const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+// Takes the StateProxy, so the state is read again after it, through the proxy's handle
+void onAnySwitching(Idle& /*unused*/, const TgBot::Message& /*unused*/, const StateProxy<Storage>& /*unused*/) {
+    ++handled;
+}
+
+void onText(Idle& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+void onStart(Idle& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+void onUnknown(const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+template <auto AnyHandler, auto AnyType>
+using MessageStater = Setup<State>::Stater<Handler<Events::AnyMessage{}, AnyHandler, AnyType>,
+                                           Handler<Events::Message{}, onText>,
+                                           Handler<Events::Command{startCommand}, onStart>,
+                                           Handler<Events::UnknownCommand{}, onUnknown, HandlerTypes::AnyState{}>>;
+
+using PlainStater = MessageStater<onAny, HandlerTypes::AnyState{}>;
+using SwitchingStater = MessageStater<onAnySwitching, HandlerTypes::State{}>;
+
+std::vector<TgBot::Update::Ptr> makeMessages(const std::string& text) {
+    std::vector<TgBot::Update::Ptr> updates;
+    for (std::int64_t i = 0; i < chats; ++i) {
+        auto update = std::make_shared<TgBot::Update>();
+        update->message = std::make_shared<TgBot::Message>();
+        update->message->chat = std::make_shared<TgBot::Chat>();
+        update->message->chat->id = i;
+        update->message->text = text;
+        updates.push_back(std::move(update));
+    }
+    return updates;
+}
+
+template <typename Stater>
+void runDispatch(benchmark::State& state, const std::string& text) {
+    const std::vector<TgBot::Update::Ptr> updates = makeMessages(text);
+    TgBot::Bot bot{"benchmark"};
+    Storage storage;
+    for (std::int64_t i = 0; i < chats; ++i)
+        storage.put({.chatId = i}, Idle{});
+    Stater stater{std::move(storage)};
+    stater.setup(bot);
+
+    const std::uint64_t lookupsBefore = metrics::registry().storageGets.value();
+    for (auto _ : state)
+        for (const auto& update : updates)
+            bot.getEventHandler().handleUpdate(update);
+    benchmark::DoNotOptimize(handled);
+    const auto dispatched = state.iterations() * static_cast<std::int64_t>(updates.size());
+    state.counters["lookups_per_update"] =
+        static_cast<double>(metrics::registry().storageGets.value() - lookupsBefore) / static_cast<double>(dispatched);
+    state.SetItemsProcessed(dispatched);
+}
+
+template <typename Stater>
+void BM_Text(benchmark::State& state) {
+    runDispatch<Stater>(state, "hello");
+}
+
+template <typename Stater>
+void BM_Command(benchmark::State& state) {
+    runDispatch<Stater>(state, "/start");
+}
+
+template <typename Stater>
+void BM_UnknownCommand(benchmark::State& state) {
+    runDispatch<Stater>(state, "/help");
+}
+
+} // namespace
+
+BENCHMARK_TEMPLATE(BM_Text, PlainStater);
+BENCHMARK_TEMPLATE(BM_Command, PlainStater);
+BENCHMARK_TEMPLATE(BM_UnknownCommand, PlainStater);
+BENCHMARK_TEMPLATE(BM_Text, SwitchingStater);
+BENCHMARK_TEMPLATE(BM_Command, SwitchingStater);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,94 @@
+// Cost of collecting metrics: the primitives, and a whole update with one handler.
+// bench_metrics_off runs the same update with TGBOTSTATER_NO_METRICS, the difference is the overhead per update.
+#define TGBOTSTATER_LOG_OFF
+#define TGBOTSTATER_METRICS
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Editing {};
+using State = std::variant<Idle, Editing>;
+
+std::int64_t handled = 0;
+
+void handleMessage(Editing& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+using BenchStater = Setup<State>::Stater<Handler<Events::Message{}, handleMessage>>;
+
+void BM_HandleUpdate(benchmark::State& state) {
+    auto update = std::make_shared<TgBot::Update>();
+    update->message = std::make_shared<TgBot::Message>();
+    update->message->chat = std::make_shared<TgBot::Chat>();
+    update->message->chat->id = 1;
+    update->message->text = "hello";
+
+    TgBot::Bot bot{"benchmark"};
+    MemoryStateStorage<State> storage;
+    storage.put(StateKey{.chatId = 1}, Editing{});
+    BenchStater stater{std::move(storage)};
+    stater.setup(bot);
+
+    for (auto _ : state)
+        bot.getEventHandler().handleUpdate(update);
+    benchmark::DoNotOptimize(handled);
+    state.SetItemsProcessed(state.iterations());
+}
+
+#ifndef TGBOTSTATER_NO_METRICS
+// Threads increment one counter, each in its own shard
+void BM_CounterInc(benchmark::State& state) {
+    static metrics::Counter counter;
+    for (auto _ : state)
+        counter.inc();
+    state.SetItemsProcessed(state.iterations());
+}
+
+// What a handler invocation adds: two clock reads and a histogram update
+void BM_TimeAndRecord(benchmark::State& state) {
+    static metrics::Histogram histogram;
+    for (auto _ : state) {
+        const auto start = std::chrono::steady_clock::now();
+        histogram.record(metrics::detail::elapsedNs(start));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_PrometheusText(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(metrics::registry().prometheusText());
+}
+#endif
+
+} // namespace
+
+BENCHMARK(BM_HandleUpdate);
+#ifndef TGBOTSTATER_NO_METRICS
+BENCHMARK(BM_CounterInc)->ThreadRange(1, 8); // NOLINT(*-magic-numbers)
+BENCHMARK(BM_TimeAndRecord)->ThreadRange(1, 8); // NOLINT(*-magic-numbers)
+BENCHMARK(BM_PrometheusText);
+#endif
+
+BENCHMARK_MAIN();
@@ -0,0 +1,4 @@
+// bench_metrics with metrics compiled out
+#define TGBOTSTATER_NO_METRICS
+
+#include "metrics.cpp" // NOLINT(bugprone-suspicious-include)
@@ -0,0 +1,139 @@
+// Encode/decode throughput of serialization.hpp vs hand-written stream-based code.
+#include "tg_stater/serialization.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+namespace {
+
+namespace serialization = tg_stater::serialization;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+    std::int32_t step;
+};
+struct Survey {
+    std::string title;
+    std::vector<std::int32_t> answers;
+    std::vector<std::string> comments;
+
+    static constexpr auto serializedFields = std::tuple{&Survey::title, &Survey::answers, &Survey::comments};
+};
+using State = std::variant<Idle, Typing, Survey>;
+
+State typing() {
+    return Typing{123456789, 3};
+}
+
+State survey() {
+    return Survey{"Weekly feedback", {5, 4, 3, 5, 1, 2, 4, 4}, {"fast", "could be better", "ok"}};
+}
+
+// The way states are usually saved by hand: index and fields through a stream
+void streamEncode(const State& state, std::ostringstream& out) {
+    out << state.index() << ' ';
+    if (const auto* t = std::get_if<Typing>(&state)) {
+        out << t->messageId << ' ' << t->step << ' ';
+    } else if (const auto* s = std::get_if<Survey>(&state)) {
+        out << s->title.size() << ' ' << s->title << ' ' << s->answers.size() << ' ';
+        for (const std::int32_t a : s->answers)
+            out << a << ' ';
+        out << s->comments.size() << ' ';
+        for (const std::string& c : s->comments)
+            out << c.size() << ' ' << c << ' ';
+    }
+}
+
+std::string readSized(std::istringstream& in) {
+    std::size_t size = 0;
+    in >> size;
+    in.get();
+    std::string s(size, '\0');
+    in.read(s.data(), static_cast<std::streamsize>(size));
+    return s;
+}
+
+State streamDecode(std::istringstream& in) {
+    std::size_t index = 0;
+    in >> index;
+    if (index == 1) {
+        Typing t{};
+        in >> t.messageId >> t.step;
+        return t;
+    }
+    if (index == 2) {
+        Survey s;
+        s.title = readSized(in);
+        std::size_t n = 0;
+        in >> n;
+        s.answers.resize(n);
+        for (std::int32_t& a : s.answers)
+            in >> a;
+        in >> n;
+        s.comments.resize(n);
+        for (std::string& c : s.comments)
+            c = readSized(in);
+        return s;
+    }
+    return Idle{};
+}
+
+void BM_Encode(benchmark::State& state, const State& value) {
+    std::string out;
+    for (auto _ : state) {
+        out.clear();
+        serialization::encode(value, out);
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * out.size()));
+}
+
+void BM_Decode(benchmark::State& state, const State& value) {
+    const std::string bytes = serialization::encode(value);
+    for (auto _ : state)
+        benchmark::DoNotOptimize(serialization::decode<State>(bytes));
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes.size()));
+}
+
+void BM_StreamEncode(benchmark::State& state, const State& value) {
+    std::size_t size = 0;
+    for (auto _ : state) {
+        std::ostringstream out;
+        streamEncode(value, out);
+        size = out.view().size();
+        benchmark::DoNotOptimize(size);
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * size));
+}
+
+void BM_StreamDecode(benchmark::State& state, const State& value) {
+    std::ostringstream encoded;
+    streamEncode(value, encoded);
+    const std::string bytes = std::move(encoded).str();
+    for (auto _ : state) {
+        std::istringstream in{bytes};
+        benchmark::DoNotOptimize(streamDecode(in));
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * bytes.size()));
+}
+
+} // namespace
+
+BENCHMARK_CAPTURE(BM_Encode, typing, typing());
+BENCHMARK_CAPTURE(BM_StreamEncode, typing, typing());
+BENCHMARK_CAPTURE(BM_Decode, typing, typing());
+BENCHMARK_CAPTURE(BM_StreamDecode, typing, typing());
+BENCHMARK_CAPTURE(BM_Encode, survey, survey());
+BENCHMARK_CAPTURE(BM_StreamEncode, survey, survey());
+BENCHMARK_CAPTURE(BM_Decode, survey, survey());
+BENCHMARK_CAPTURE(BM_StreamDecode, survey, survey());
+
+BENCHMARK_MAIN();
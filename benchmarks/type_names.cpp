@@ -0,0 +1,110 @@
+// Names of handlers and states in the log with INFO logging: demangling on every call vs the cached names.
+// The log itself goes to a null stream, so the cost of naming is not hidden by the output.
+#include "tg_stater/bot.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/logging.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <streambuf>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Editing {};
+using State = std::variant<Idle, Editing>;
+
+std::int64_t handled = 0;
+
+void handleMessage(Editing& /*unused*/, const TgBot::Message& /*unused*/) {
+    ++handled;
+}
+
+using BenchStater = Setup<State>::Stater<Handler<Events::Message{}, handleMessage>>;
+
+// What `getHandlerName` looks at
+struct HandlerCallback {
+    static constexpr auto underlying = handleMessage;
+};
+
+class NullBuffer : public std::streambuf {
+  protected:
+    int overflow(int c) override {
+        return c;
+    }
+    std::streamsize xsputn(const char* /*unused*/, std::streamsize n) override {
+        return n;
+    }
+};
+
+void BM_HandlerNameDemangled(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(logging::detail::demangleHandlerName<HandlerCallback>());
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_HandlerNameCached(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(logging::getHandlerName<HandlerCallback>());
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_StateNameDemangled(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(logging::detail::demangleStateName<Editing>());
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_StateNameCached(benchmark::State& state) {
+    for (auto _ : state)
+        benchmark::DoNotOptimize(logging::getStateName<Editing>());
+    state.SetItemsProcessed(state.iterations());
+}
+
+// An update logs the event, the state and the handler
+void BM_HandleUpdate(benchmark::State& state) {
+    auto update = std::make_shared<TgBot::Update>();
+    update->message = std::make_shared<TgBot::Message>();
+    update->message->chat = std::make_shared<TgBot::Chat>();
+    update->message->chat->id = 1;
+    update->message->text = "hello";
+
+    TgBot::Bot bot{"benchmark"};
+    MemoryStateStorage<State> storage;
+    storage.put(StateKey{.chatId = 1}, Editing{});
+    BenchStater stater{std::move(storage)};
+    stater.setup(bot);
+
+    NullBuffer null;
+    std::streambuf* const original = std::clog.rdbuf(&null);
+    for (auto _ : state)
+        bot.getEventHandler().handleUpdate(update);
+    std::clog.rdbuf(original);
+    benchmark::DoNotOptimize(handled);
+    state.SetItemsProcessed(state.iterations());
+}
+
+} // namespace
+
+BENCHMARK(BM_HandlerNameDemangled);
+BENCHMARK(BM_HandlerNameCached);
+BENCHMARK(BM_StateNameDemangled);
+BENCHMARK(BM_StateNameCached);
+BENCHMARK(BM_HandleUpdate)->Iterations(1'000'000); // NOLINT(*-magic-numbers)
+
+BENCHMARK_MAIN();
@@ -0,0 +1,191 @@
+// Put throughput and recovery time of WalStateStorage vs MemoryStateStorage.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+#include "tg_stater/state_storage/wal.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t messageId;
+    std::int32_t step;
+};
+using State = std::variant<Idle, Typing>;
+
+struct DumpRecord {
+    StateKey key;
+    State state;
+};
+
+StateKey keyOf(std::int64_t i) {
+    constexpr std::int64_t firstUser = 100'000'000;
+    return {.chatId = firstUser + i};
+}
+
+std::uint64_t nextRandom(std::uint64_t& x) {
+    x ^= x << 13U;
+    x ^= x >> 7U;
+    x ^= x << 17U;
+    return x;
+}
+
+std::string tempPath(const std::string& name) {
+    return (std::filesystem::temp_directory_path() / ("tgbotstater_" + name)).string();
+}
+
+void removeWal(const std::string& path) {
+    for (const char* suffix : {".snapshot", ".log", ".log.compacting"})
+        std::filesystem::remove(path + suffix);
+}
+
+// Files are created once per size, reused by all the iterations and removed at exit
+struct TempFiles {
+    std::map<std::int64_t, std::string> paths;
+
+    TempFiles() = default;
+    TempFiles(const TempFiles&) = delete;
+    TempFiles& operator=(const TempFiles&) = delete;
+    TempFiles(TempFiles&&) = delete;
+    TempFiles& operator=(TempFiles&&) = delete;
+
+    ~TempFiles() {
+        for (const auto& [n, path] : paths) {
+            removeWal(path);
+            std::filesystem::remove(path);
+        }
+    }
+};
+
+constexpr std::int64_t transitionsPerKey = 4;
+
+// A log of `transitionsPerKey` puts per key, without a snapshot
+const std::string& logOnly(std::int64_t n) {
+    static TempFiles files;
+    auto [it, inserted] = files.paths.try_emplace(n, tempPath("wal_log_" + std::to_string(n)));
+    if (inserted) {
+        removeWal(it->second);
+        WalStateStorage<State> storage{it->second, {.sync = WalOptions::Sync::Never, .compactAfterBytes = SIZE_MAX}};
+        for (std::int64_t step = 0; step < transitionsPerKey; ++step)
+            for (std::int64_t i = 0; i < n; ++i)
+                storage.put(keyOf(i), Typing{i, static_cast<std::int32_t>(step)});
+    }
+    return it->second;
+}
+
+// The same transitions compacted into a snapshot
+const std::string& compacted(std::int64_t n) {
+    static TempFiles files;
+    auto [it, inserted] = files.paths.try_emplace(n, tempPath("wal_snapshot_" + std::to_string(n)));
+    if (inserted) {
+        removeWal(it->second);
+        std::filesystem::copy_file(logOnly(n) + ".log", it->second + ".log");
+        WalStateStorage<State>{it->second, {.sync = WalOptions::Sync::Never}}.compact();
+    }
+    return it->second;
+}
+
+const std::string& dumpFile(std::int64_t n) {
+    static TempFiles files;
+    auto [it, inserted] = files.paths.try_emplace(n, tempPath("wal_dump_" + std::to_string(n)));
+    if (inserted) {
+        std::ofstream out{it->second, std::ios::binary | std::ios::trunc};
+        for (std::int64_t i = 0; i < n; ++i) {
+            const DumpRecord record{keyOf(i), Typing{i, 1}};
+            out.write(reinterpret_cast<const char*>(&record), sizeof(record)); // NOLINT(*-reinterpret-cast)
+        }
+    }
+    return it->second;
+}
+
+template <typename Storage>
+void putRandom(benchmark::State& state, Storage& storage) {
+    const std::int64_t n = state.range(0);
+    std::uint64_t rng = 0x2545F4914F6CDD1DULL;
+    for (auto _ : state) {
+        const auto i = static_cast<std::int64_t>(nextRandom(rng) % n);
+        if (i % 8 == 0) // NOLINT(*-magic-numbers)
+            storage.put(keyOf(i), Idle{});
+        else
+            storage.put(keyOf(i), Typing{i, 2});
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+void BM_MemoryPut(benchmark::State& state) {
+    MemoryStateStorage<State> storage;
+    putRandom(state, storage);
+}
+
+template <WalOptions::Sync sync>
+void BM_WalPut(benchmark::State& state) {
+    const std::string path = tempPath("wal_put");
+    removeWal(path);
+    {
+        WalStateStorage<State> storage{path, {.sync = sync}};
+        putRandom(state, storage);
+    }
+    removeWal(path);
+}
+
+void BM_RecoverFromLog(benchmark::State& state) {
+    const std::string& path = logOnly(state.range(0));
+    for (auto _ : state) {
+        WalStateStorage<State> storage{path, {.compactAfterBytes = SIZE_MAX}};
+        benchmark::DoNotOptimize(storage[keyOf(0)]);
+    }
+}
+
+void BM_RecoverFromSnapshot(benchmark::State& state) {
+    const std::string& path = compacted(state.range(0));
+    for (auto _ : state) {
+        WalStateStorage<State> storage{path};
+        benchmark::DoNotOptimize(storage[keyOf(0)]);
+    }
+}
+
+// The baseline: MemoryStateStorage filled from a plain dump of the same keys
+void BM_ReloadMemoryStorage(benchmark::State& state) {
+    const std::string& path = dumpFile(state.range(0));
+    std::vector<DumpRecord> buffer(4096); // NOLINT(*-magic-numbers)
+    for (auto _ : state) {
+        MemoryStateStorage<State> storage;
+        std::FILE* file = std::fopen(path.c_str(), "rb");
+        std::size_t read = 0;
+        while ((read = std::fread(buffer.data(), sizeof(DumpRecord), buffer.size(), file)) != 0)
+            for (std::size_t i = 0; i < read; ++i)
+                std::visit([&](const auto& option) { storage.put(buffer[i].key, option); }, buffer[i].state);
+        std::fclose(file);
+        benchmark::DoNotOptimize(storage[keyOf(0)]);
+    }
+}
+
+constexpr std::int64_t keys = 100'000;
+constexpr std::int64_t million = 1'000'000;
+
+} // namespace
+
+BENCHMARK(BM_MemoryPut)->Arg(keys);
+BENCHMARK(BM_WalPut<WalOptions::Sync::Never>)->Arg(keys);
+BENCHMARK(BM_WalPut<WalOptions::Sync::Periodic>)->Arg(keys);
+BENCHMARK(BM_WalPut<WalOptions::Sync::EveryWrite>)->Arg(keys);
+BENCHMARK(BM_RecoverFromLog)->Arg(million)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_RecoverFromSnapshot)->Arg(million)->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_ReloadMemoryStorage)->Arg(million)->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
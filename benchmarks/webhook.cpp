@@ -0,0 +1,197 @@
+// A local load generator posting 10k updates per second to `TgBot::TgWebhookTcpServer` or `WebhookServer`.
+// Args are the server (0 is TgBot's, 1 is the epoll one) and the connections the load is spread over,
+// Telegram opens up to `maxConnections` of them. The counters are the times until the server answers.
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dependencies.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/fake_api.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+#include "tg_stater/webhook.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <benchmark/benchmark.h>
+#include <tgbot/Bot.h>
+#include <tgbot/net/TgWebhookTcpServer.h>
+#include <tgbot/types/Message.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+using Storage = ConcurrentMemoryStateStorage<State>;
+
+std::atomic<std::uint64_t> handled{0};
+
+void count(const TgBot::Message& /*unused*/) {
+    handled.fetch_add(1, std::memory_order_relaxed);
+}
+
+using BenchStater =
+    Setup<State, Dependencies<>, Storage>::Stater<Handler<Events::Message{}, count, HandlerTypes::NoState{}>>;
+
+constexpr std::uint16_t tgbotPort = 18443;
+constexpr double updatesPerSecond = 10000;
+constexpr std::chrono::seconds duration{2};
+
+std::string request(std::uint64_t updateId, std::int64_t chatId) {
+    const std::string chat = std::to_string(chatId);
+    const std::string body = R"({"update_id":)" + std::to_string(updateId) + R"(,"message":{"message_id":)" +
+                             std::to_string(updateId) + R"(,"date":0,"chat":{"id":)" + chat +
+                             R"(,"type":"private"},"from":{"id":)" + chat +
+                             R"(,"is_bot":false,"first_name":"user"},"text":"hello"}})";
+    return "POST /hook HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/json\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+int connectTo(std::uint16_t port) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    ::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    // NOLINTNEXTLINE(*-reinterpret-cast)
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1) {
+        ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Posts its share of the load over one connection, reconnecting when the server closes it
+void generate(std::uint16_t port,
+              std::size_t client,
+              std::size_t clients,
+              metrics::Histogram& latency,
+              std::atomic<std::uint64_t>& failures) {
+    using Clock = std::chrono::steady_clock;
+    const double rate = updatesPerSecond / static_cast<double>(clients);
+    const auto total = static_cast<std::uint64_t>(rate * std::chrono::duration<double>{duration}.count());
+    const Clock::time_point start = Clock::now();
+    int fd = -1;
+    std::string response;
+    std::array<char, 4096> buffer{}; // NOLINT(*-magic-numbers)
+    for (std::uint64_t i = 0; i < total; ++i) {
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                                                  std::chrono::duration<double>{static_cast<double>(i) / rate}));
+        const Clock::time_point sent = Clock::now();
+        if (fd == -1 && (fd = connectTo(port)) == -1) {
+            failures.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        try {
+            fake_api::detail::sendAll(fd, request(client * total + i + 1, static_cast<std::int64_t>(i % 100 + 1)));
+        } catch (const std::exception&) {
+            ::close(fd);
+            fd = -1;
+            failures.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        // responses of both servers have no body
+        response.clear();
+        bool closed = false;
+        while (response.find("\r\n\r\n") == std::string::npos) {
+            const ssize_t received = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (received <= 0) {
+                closed = true;
+                break;
+            }
+            response.append(buffer.data(), static_cast<std::size_t>(received));
+        }
+        if (response.find(" 200 ") == std::string::npos)
+            failures.fetch_add(1, std::memory_order_relaxed);
+        else
+            latency.record(metrics::detail::elapsedNs(sent));
+        if (closed || response.find("Connection: close") != std::string::npos) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    if (fd != -1)
+        ::close(fd);
+}
+
+void BM_Webhook(benchmark::State& state) {
+    const bool epoll = state.range(0) != 0;
+    const auto clients = static_cast<std::size_t>(state.range(1));
+
+    metrics::Histogram latency;
+    std::atomic<std::uint64_t> failures{0};
+    for (auto _ : state) {
+        TgBot::Bot bot{"benchmark"};
+        BenchStater stater{Storage{}, Dependencies<>{}, DispatchOptions{.shards = 4}};
+        stater.setup(bot);
+        std::optional<WebhookServer> epollServer;
+        std::optional<TgBot::TgWebhookTcpServer> tgbotServer;
+        if (epoll)
+            epollServer.emplace(WebhookOptions{.address = "127.0.0.1", .port = 0, .path = "/hook"},
+                                [&](const TgBot::Update::Ptr& update) { bot.getEventHandler().handleUpdate(update); });
+        else
+            tgbotServer.emplace(tgbotPort, "/hook", bot.getEventHandler());
+        std::thread server{[&] { epoll ? epollServer->run() : tgbotServer->start(); }};
+        const std::uint16_t port = epoll ? epollServer->port() : tgbotPort;
+
+        handled.store(0);
+        const auto start = std::chrono::steady_clock::now();
+        std::vector<std::thread> generators;
+        for (std::size_t i = 0; i < clients; ++i)
+            generators.emplace_back(generate, port, i, clients, std::ref(latency), std::ref(failures));
+        for (std::thread& generator : generators)
+            generator.join();
+        const std::uint64_t expected =
+            clients * static_cast<std::uint64_t>(updatesPerSecond / static_cast<double>(clients) *
+                                                 std::chrono::duration<double>{duration}.count());
+        while (handled.load() + failures.load() < expected &&
+               std::chrono::steady_clock::now() - start < duration * 10) // NOLINT(*-magic-numbers)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        state.SetIterationTime(std::chrono::duration<double>{std::chrono::steady_clock::now() - start}.count());
+
+        epoll ? epollServer->stop() : tgbotServer->stop();
+        server.join();
+        stater.drain();
+    }
+
+    const metrics::Histogram::Snapshot snapshot = latency.snapshot();
+    const auto us = [&](double q) { return static_cast<double>(snapshot.quantileNs(q)) / 1e3; }; // NOLINT
+    state.counters["ack_p50_us"] = us(0.5);                                                       // NOLINT
+    state.counters["ack_p99_us"] = us(0.99);                                                      // NOLINT
+    state.counters["ack_max_us"] = us(1);
+    state.counters["failures"] = static_cast<double>(failures.load());
+    state.SetItemsProcessed(static_cast<std::int64_t>(handled.load()));
+}
+
+} // namespace
+
+// NOLINTNEXTLINE(*-magic-numbers)
+BENCHMARK(BM_Webhook)
+    ->ArgNames({"epoll", "connections"})
+    ->ArgsProduct({{0, 1}, {1, 40}})
+    ->Iterations(1)
+    ->UseManualTime()
+    ->Unit(benchmark::kMillisecond);
+
+BENCHMARK_MAIN();
@@ -62,6 +62,8 @@ class TgBotStaterConan(ConanFile):
         self.cpp_info.libs = ["TgBotStater"]
         self.cpp_info.bindirs = []
         self.cpp_info.libdirs = []
+        if self.settings.os in ["Linux", "FreeBSD"]:
+            self.cpp_info.system_libs = ["pthread"]
 
     def package_id(self):
         self.info.clear()
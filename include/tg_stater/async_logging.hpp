@@ -0,0 +1,427 @@
+#ifndef INCLUDE_tgbotstater_async_logging
+#define INCLUDE_tgbotstater_async_logging
+
+#include "tg_stater/logging.hpp"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tg_stater::logging {
+
+struct LogRecord {
+    LoggingLevel level;
+    std::chrono::system_clock::time_point time;
+    std::string_view message;
+};
+
+// Appends `[LEVEL] [time] message\n`, the same line the synchronous logging writes
+inline void appendLine(std::string& out, const LogRecord& record) {
+    static constexpr std::array<std::string_view, 5> levelNames{"DEBUG", "INFO", "WARN", "ERROR", "FATAL"};
+    // converting to local time takes a lock on the time zone, so it is done once per second
+    thread_local std::time_t lastTime = -1;
+    thread_local std::array<char, 32> timeText{}; // NOLINT(*-magic-numbers)
+    thread_local std::size_t timeSize = 0;
+    if (const std::time_t time = std::chrono::system_clock::to_time_t(record.time); time != lastTime) {
+        const std::tm tm = detail::localTime(time);
+        timeSize = std::strftime(timeText.data(), timeText.size(), "%FT%T%z", &tm);
+        lastTime = time;
+    }
+
+    out += '[';
+    out += levelNames[static_cast<std::size_t>(record.level)];
+    out += "] [";
+    out.append(timeText.data(), timeSize);
+    out += "] ";
+    out += record.message;
+    out += '\n';
+}
+
+// Destination of the records of AsyncLogger. Sinks are only called from the logger's thread.
+class LogSink {
+  public:
+    LogSink() = default;
+    LogSink(const LogSink&) = delete;
+    LogSink& operator=(const LogSink&) = delete;
+    LogSink(LogSink&&) = delete;
+    LogSink& operator=(LogSink&&) = delete;
+    virtual ~LogSink() = default;
+
+    virtual void write(const LogRecord& record) = 0;
+    // Called once the queue is empty
+    virtual void flush() {}
+};
+
+class StderrSink : public LogSink {
+    std::string line;
+
+  public:
+    void write(const LogRecord& record) override {
+        line.clear();
+        appendLine(line, record);
+        std::clog.write(line.data(), static_cast<std::streamsize>(line.size()));
+    }
+
+    void flush() override {
+        std::clog.flush();
+    }
+};
+
+// Writes to `path` and renames it to `path.1` once it grows beyond `maxSize`, `path.1` to `path.2` and so on.
+// At most `maxFiles` old files are kept.
+class RotatingFileSink : public LogSink {
+    std::filesystem::path path;
+    std::size_t maxSize;
+    std::size_t maxFiles;
+    std::ofstream out;
+    std::size_t size = 0;
+    std::string line;
+
+    void open() {
+        out.open(path, std::ios::binary | std::ios::app);
+        if (!out)
+            throw std::runtime_error("Failed to open log file " + path.string());
+        std::error_code error;
+        const auto existing = std::filesystem::file_size(path, error);
+        size = error ? 0 : static_cast<std::size_t>(existing);
+    }
+
+    [[nodiscard]] std::filesystem::path numbered(std::size_t i) const {
+        return std::filesystem::path{path} += "." + std::to_string(i);
+    }
+
+    void rotate() {
+        out.close();
+        std::error_code error; // a missing old file is not an error
+        if (maxFiles == 0) {
+            std::filesystem::remove(path, error);
+        } else {
+            std::filesystem::remove(numbered(maxFiles), error);
+            for (std::size_t i = maxFiles - 1; i > 0; --i)
+                std::filesystem::rename(numbered(i), numbered(i + 1), error);
+            std::filesystem::rename(path, numbered(1), error);
+        }
+        open();
+    }
+
+  public:
+    // NOLINTNEXTLINE(*-magic-numbers)
+    RotatingFileSink(std::filesystem::path path, std::size_t maxSize, std::size_t maxFiles = 5)
+        : path{std::move(path)}, maxSize{maxSize}, maxFiles{maxFiles} {
+        open();
+    }
+
+    void write(const LogRecord& record) override {
+        line.clear();
+        appendLine(line, record);
+        if (size != 0 && size + line.size() > maxSize)
+            rotate();
+        out.write(line.data(), static_cast<std::streamsize>(line.size()));
+        size += line.size();
+    }
+
+    void flush() override {
+        out.flush();
+    }
+};
+
+// Sends each record as an RFC 3164 datagram to a local syslog daemon (or anything listening on a unix socket).
+// POSIX only.
+class SyslogSink : public LogSink {
+    static constexpr int facilityUser = 1;
+
+    int fd = -1;
+    std::string tag;
+    std::string datagram;
+
+    // syslog severities: 7 is debug, 6 is info, ..., 2 is critical
+    static int severity(LoggingLevel level) {
+        static constexpr std::array<int, 5> severities{7, 6, 4, 3, 2}; // NOLINT(*-magic-numbers)
+        return severities[static_cast<std::size_t>(level)];
+    }
+
+  public:
+    explicit SyslogSink(const std::string& socketPath = "/dev/log", std::string tag = "tg_stater")
+        : tag{std::move(tag)} {
+        sockaddr_un address{};
+        if (socketPath.size() >= sizeof(address.sun_path))
+            throw std::invalid_argument("Socket path is too long: " + socketPath);
+        address.sun_family = AF_UNIX;
+        std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+        fd = ::socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            throw std::system_error(errno, std::generic_category(), "Failed to create a syslog socket");
+        // NOLINTNEXTLINE(*-reinterpret-cast)
+        if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "Failed to connect to " + socketPath);
+        }
+    }
+
+    ~SyslogSink() override {
+        ::close(fd);
+    }
+
+    void write(const LogRecord& record) override {
+        datagram.clear();
+        datagram += '<';
+        datagram += std::to_string(facilityUser * 8 + severity(record.level)); // NOLINT(*-magic-numbers)
+        datagram += '>';
+        datagram += tag;
+        datagram += ": ";
+        datagram += record.message;
+        // a record that the daemon cannot take right now is lost rather than stalling the other sinks
+        ::send(fd, datagram.data(), datagram.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    }
+};
+
+struct AsyncLoggerOptions {
+    enum class Overflow : std::uint8_t {
+        Drop,  // a record that does not fit into the queue is dropped and counted, logging never waits
+        Block, // logging waits for a free slot
+    };
+
+    // Number of records the queue holds, rounded up to a power of 2
+    std::size_t capacity = 4096; // NOLINT(*-magic-numbers)
+    Overflow overflow = Overflow::Drop;
+};
+
+/*
+ * Moves the output of `logging::log` off the calling threads.
+ *
+ * While an AsyncLogger exists, a log call formats its message into a slot of a bounded lock-free queue and returns,
+ * the clock is read but the time is not formatted. A background thread drains the queue into the sinks.
+ * Messages longer than `detail::maxRecordSize` are truncated. Only one logger may exist at a time;
+ * the destructor returns logging to the synchronous mode, waits for the log calls that are still pushing
+ * and writes out the queued records.
+ *
+ * The queue is the bounded multi-producer queue by D. Vyukov: a producer claims a slot with one CAS
+ * and publishes it with a release store of the slot's sequence number, the only consumer is the logger's thread.
+ * The thread polls the queue and is woken by producers only when the queue is half full,
+ * so a record reaches the sinks up to 50 ms after it is logged (call `flush` to wait for it).
+ */
+class AsyncLogger final : detail::RecordQueue {
+  public:
+    using Overflow = AsyncLoggerOptions::Overflow;
+
+  private:
+    struct alignas(64) Slot { // NOLINT(*-magic-numbers)
+        std::atomic<std::size_t> sequence;
+        LoggingLevel level;
+        std::uint16_t size;
+        std::chrono::system_clock::time_point time;
+        std::array<char, detail::maxRecordSize> text;
+    };
+
+    std::vector<std::unique_ptr<LogSink>> sinks;
+    Overflow overflow;
+    std::size_t mask;
+    std::unique_ptr<Slot[]> slots; // NOLINT(*-avoid-c-arrays)
+
+    alignas(64) std::atomic<std::size_t> enqueuePos{0}; // NOLINT(*-magic-numbers)
+    alignas(64) std::atomic<std::size_t> dequeuePos{0}; // NOLINT(*-magic-numbers)
+    std::atomic<std::size_t> dropped{0};
+
+    // the worker sleeps only when the queue is empty
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable drained;
+    std::atomic<bool> sleeping{false};
+    std::size_t flushedPos = 0; // records before it are written and flushed
+    bool stopping = false;
+    std::thread worker;
+
+    // how long the worker sleeps on an empty queue while records keep coming and after a quiet period
+    static constexpr auto pollInterval = std::chrono::milliseconds{1};
+    static constexpr auto idleTimeout = std::chrono::milliseconds{50}; // NOLINT(*-magic-numbers)
+
+    void push(LoggingLevel level, std::chrono::system_clock::time_point time, std::string_view message) override {
+        std::size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        Slot* slot = nullptr;
+        while (true) {
+            slot = &slots[pos & mask];
+            const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+            if (diff == 0) {
+                if (enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if (diff < 0) {
+                // full
+                if (overflow == Overflow::Drop) {
+                    dropped.fetch_add(1, std::memory_order_relaxed);
+                    return;
+                }
+                wakeWorker();
+                std::this_thread::yield();
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        slot->level = level;
+        slot->time = time;
+        slot->size = static_cast<std::uint16_t>(message.size());
+        std::ranges::copy(message, slot->text.begin());
+        slot->sequence.store(pos + 1, std::memory_order_release);
+
+        // a wakeup costs a syscall, so the worker is woken only when the queue is filling up,
+        // otherwise it gets the record on its next poll
+        if (pos - dequeuePos.load(std::memory_order_relaxed) >= (mask + 1) / 2 &&
+            sleeping.load(std::memory_order_relaxed))
+            wakeWorker();
+    }
+
+    void wakeWorker() {
+        {
+            std::lock_guard lock{mutex};
+        }
+        wake.notify_one();
+    }
+
+    [[nodiscard]] bool ready() const {
+        const std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        return slots[pos & mask].sequence.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    // Returns false if the queue is empty
+    bool writeOne() {
+        const std::size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        Slot& slot = slots[pos & mask];
+        if (slot.sequence.load(std::memory_order_acquire) != pos + 1)
+            return false;
+        const LogRecord record{slot.level, slot.time, {slot.text.data(), slot.size}};
+        for (auto& sink : sinks) {
+            try {
+                sink->write(record);
+            } catch (...) { // NOLINT(*-empty-catch)
+                // there is nowhere to report it
+            }
+        }
+        slot.sequence.store(pos + mask + 1, std::memory_order_release);
+        dequeuePos.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    void flushSinks() {
+        for (auto& sink : sinks) {
+            try {
+                sink->flush();
+            } catch (...) { // NOLINT(*-empty-catch)
+            }
+        }
+    }
+
+    void run() {
+        while (true) {
+            bool written = false;
+            while (writeOne())
+                written = true;
+            if (written)
+                flushSinks();
+
+            std::unique_lock lock{mutex};
+            flushedPos = dequeuePos.load(std::memory_order_relaxed);
+            drained.notify_all();
+            if (!ready()) {
+                if (stopping)
+                    return;
+                sleeping.store(true, std::memory_order_relaxed);
+                wake.wait_for(lock, written ? pollInterval : idleTimeout);
+                sleeping.store(false, std::memory_order_relaxed);
+            }
+        }
+    }
+
+  public:
+    explicit AsyncLogger(std::vector<std::unique_ptr<LogSink>> sinks, AsyncLoggerOptions options = {})
+        : sinks{std::move(sinks)},
+          overflow{options.overflow},
+          mask{std::bit_ceil(std::max<std::size_t>(options.capacity, 2)) - 1},
+          slots{std::make_unique<Slot[]>(mask + 1)} { // NOLINT(*-avoid-c-arrays)
+        for (std::size_t i = 0; i <= mask; ++i)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+
+        worker = std::thread{&AsyncLogger::run, this};
+        detail::RecordQueue* expected = nullptr;
+        if (!detail::recordQueue.compare_exchange_strong(expected, this, std::memory_order_acq_rel)) {
+            {
+                std::lock_guard lock{mutex};
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+            throw std::logic_error("Another AsyncLogger is already installed.");
+        }
+    }
+
+    explicit AsyncLogger(std::unique_ptr<LogSink> sink, AsyncLoggerOptions options = {})
+        : AsyncLogger{[&] {
+                          std::vector<std::unique_ptr<LogSink>> v;
+                          v.push_back(std::move(sink));
+                          return v;
+                      }(),
+                      options} {}
+
+    AsyncLogger(const AsyncLogger&) = delete;
+    AsyncLogger& operator=(const AsyncLogger&) = delete;
+    AsyncLogger(AsyncLogger&&) = delete;
+    AsyncLogger& operator=(AsyncLogger&&) = delete;
+
+    ~AsyncLogger() {
+        detail::recordQueue.store(nullptr, std::memory_order_seq_cst);
+        // a log call that loaded the queue before the store may still be pushing into it.
+        // The worker keeps draining meanwhile, so a producer blocked on a full queue gets its slot.
+        while (detail::recordProducers.load(std::memory_order_seq_cst) != 0)
+            std::this_thread::yield();
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        wake.notify_one();
+        worker.join();
+    }
+
+    // Blocks until the records logged so far are written and the sinks are flushed
+    void flush() {
+        const std::size_t target = enqueuePos.load(std::memory_order_acquire);
+        std::unique_lock lock{mutex};
+        wake.notify_one();
+        drained.wait(lock, [&] { return flushedPos >= target; });
+    }
+
+    // Number of records dropped because the queue was full
+    [[nodiscard]] std::size_t droppedCount() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+};
+
+} // namespace tg_stater::logging
+
+#endif // INCLUDE_tgbotstater_async_logging
@@ -1,33 +1,52 @@
 #ifndef INCLUDE_tgbotstater_bot
 #define INCLUDE_tgbotstater_bot
 
+#include "tg_stater/command.hpp"
+#include "tg_stater/coroutine.hpp"
 #include "tg_stater/dependencies.hpp"
+#include "tg_stater/dispatcher.hpp"
 #include "tg_stater/handler/callback.hpp"
 #include "tg_stater/handler/event.hpp"
 #include "tg_stater/handler/type.hpp"
 #include "tg_stater/logging.hpp"
+#include "tg_stater/metrics.hpp"
 #include "tg_stater/meta.hpp"
+#include "tg_stater/outbox.hpp"
+#include "tg_stater/polling.hpp"
+#include "tg_stater/replay.hpp"
 #include "tg_stater/state.hpp"
 #include "tg_stater/state_storage/common.hpp"
 #include "tg_stater/state_storage/memory.hpp"
+#include "tg_stater/tracing.hpp"
+#include "tg_stater/webhook.hpp"
 
 #include <tgbot/Api.h>
 #include <tgbot/Bot.h>
-#include <tgbot/net/TgLongPoll.h>
-#include <tgbot/net/TgWebhookTcpServer.h>
+#include <tgbot/EventBroadcaster.h>
 #include <tgbot/types/InputFile.h>
 #include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
 #include <concepts>
+#include <cstddef>
 #include <cstdint>
 #include <exception>
+#include <fstream>
 #include <memory>
+#include <optional>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <tuple>
 #include <type_traits>
+#include <unordered_set>
 #include <utility>
 #include <variant>
+#include <vector>
 
 namespace tg_stater {
 
@@ -68,28 +87,6 @@ struct CheckIsCallback<Callback<F, StateT, StateOptionT, Event, HandlerType, Sta
                        DependenciesT> : std::true_type {};
 
 struct CallbackFinder {
-  private:
-    template <auto F, typename... Callbacks>
-    struct CallbackFilter;
-
-    template <auto F, typename Callback, typename... Callbacks>
-    struct CallbackFilter<F, Callback, Callbacks...> {
-      private:
-        static constexpr bool match = F.template operator()<Callback>();
-        using other = CallbackFilter<F, Callbacks...>::type;
-
-      public:
-        using type =
-            std::conditional_t<match,
-                               decltype(std::tuple_cat(std::declval<std::tuple<Callback>>(), std::declval<other>())),
-                               other>;
-    };
-
-    template <auto F>
-    struct CallbackFilter<F> {
-        using type = std::tuple<>;
-    };
-
   public:
     CallbackFinder() = delete;
 
@@ -108,10 +105,26 @@ struct CallbackFinder {
     static constexpr auto filterByEventType =
         []<typename Callback>() { return std::same_as<EventT, typename Callback::EventT>; };
 
+    // A single pack expansion instead of recursion keeps the instantiation depth constant
     template <auto Filter, typename... Callbacks>
-    using find = CallbackFilter<Filter, Callbacks...>::type;
+    using find = decltype(std::tuple_cat(
+        std::declval<
+            std::conditional_t<Filter.template operator()<Callbacks>(), std::tuple<Callbacks>, std::tuple<>>>()...));
+};
+
+// Callbacks of both listeners a message goes through, AnyMessage and the message's own event, run as one task
+template <typename AnyMessageCallbacks, typename OwnCallbacks>
+struct FusedMessageCallbacks {
+    using AnyMessage = AnyMessageCallbacks;
+    using Own = OwnCallbacks;
 };
 
+template <typename T>
+struct IsFusedMessageCallbacks : std::false_type {};
+
+template <typename AnyMessageCallbacks, typename OwnCallbacks>
+struct IsFusedMessageCallbacks<FusedMessageCallbacks<AnyMessageCallbacks, OwnCallbacks>> : std::true_type {};
+
 // Main implementation class.
 template <concepts::State StateT,
           concepts::StateStorage<StateT> StateStorageT,
@@ -121,9 +134,38 @@ template <concepts::State StateT,
 class StaterBase {
     StateStorageT stateStorage;
     DependenciesT dependencies;
+    DispatchOptions dispatchOptions;
+    std::unique_ptr<Outbox> outbox;
+    std::unique_ptr<KeySerializer> keySerializer; // only with coroutine handlers
+    // Declared last to be destroyed first: workers may still reference the storage, dependencies and outbox.
+    std::unique_ptr<ShardedDispatcher> dispatcher;
 
     struct AnyStateInvokeTag {};
 
+    static constexpr bool hasCoroutines = (Callbacks::isCoroutine || ...);
+    static_assert(!hasCoroutines || concepts::StableStateStorage<StateStorageT>,
+                  "Coroutine handlers keep their state across co_await, while this storage may move or free it "
+                  "when other keys are accessed. Use MemoryStateStorage or ConcurrentMemoryStateStorage.");
+
+    // What the handlers get besides the event and the state. Coroutines keep it until they complete.
+    struct HandlerContext {
+        ApiArg api;
+        StateProxy<StateStorageT> stateProxy;
+    };
+
+    template <typename Callback, typename... Args>
+    static void callHandler(Args&&... args) {
+        if constexpr (Callback::isCoroutine) {
+            metrics::Counter* exceptions = nullptr;
+            if constexpr (metrics::enabled)
+                exceptions = &metrics::handlerMetrics<Callback>().exceptions;
+            UpdateScope::current->spawn(
+                Callback::func(std::forward<Args>(args)...), logging::getHandlerName<Callback>(), exceptions);
+        } else {
+            Callback::func(std::forward<Args>(args)...);
+        }
+    }
+
     // Helper function to invoke handlers
     template <typename StateOption, typename Callback, typename... Args>
     static constexpr void invokeCallback(Args&&... args) {
@@ -140,7 +182,21 @@ class StaterBase {
             }
         }
 #endif
-        Callback::func(std::forward<Args>(args)...);
+        const tracing::Span span{logging::getHandlerName<Callback>()};
+        if constexpr (metrics::enabled) {
+            metrics::HandlerMetrics& handlerMetrics = metrics::handlerMetrics<Callback>();
+            const auto start = std::chrono::steady_clock::now();
+            try {
+                callHandler<Callback>(std::forward<Args>(args)...);
+            } catch (...) {
+                handlerMetrics.exceptions.inc();
+                handlerMetrics.latency.record(metrics::detail::elapsedNs(start));
+                throw;
+            }
+            handlerMetrics.latency.record(metrics::detail::elapsedNs(start));
+        } else {
+            callHandler<Callback>(std::forward<Args>(args)...);
+        }
     }
 
     // Helper function to invoke handlers
@@ -155,23 +211,78 @@ class StaterBase {
         }
     }
 
-    template <typename... EventCallbacks, typename... EventArgs>
-    void handleEvent(TgBot::Bot& bot, const StateKey& stateKey, EventArgs... eventArgs) {
-        const TgBot::Api& api = bot.getApi();
-        StateT* const mCurrentState = stateStorage[stateKey];
-        const StateProxy stateProxy{stateStorage, stateKey};
+    // Handlers of one event for each state option, as a table indexed by `StateT::index()`.
+    // The cell of an option without handlers is null, so such a state costs a comparison instead of a call.
+    template <typename EventArgsT, typename... EventCallbacks>
+    struct StateDispatchTable;
+
+    template <typename... EventArgs, typename... EventCallbacks>
+    struct StateDispatchTable<std::tuple<EventArgs...>, EventCallbacks...> {
+        using Cell = void (*)(
+            const StaterBase&, StateT&, const EventArgs&..., const ApiArg&, const StateProxy<StateStorageT>&);
+
+        template <std::size_t I>
+        using StateCallbacks =
+            CallbackFinder::find<CallbackFinder::filterByStateOption<std::variant_alternative_t<I, StateT>>,
+                                 EventCallbacks...>;
+
+        template <std::size_t I>
+        static void invoke(const StaterBase& self,
+                           StateT& state,
+                           const EventArgs&... eventArgs,
+                           const ApiArg& api,
+                           const StateProxy<StateStorageT>& stateProxy) {
+            invokeCallbacks<std::variant_alternative_t<I, StateT>>(meta::TupleToProxy<StateCallbacks<I>>{},
+                                                                   *std::get_if<I>(&state),
+                                                                   eventArgs...,
+                                                                   api,
+                                                                   stateProxy,
+                                                                   self.dependencies);
+        }
+
+        static constexpr auto cells = []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<Cell, sizeof...(I)>{
+                (std::tuple_size_v<StateCallbacks<I>> == 0 ? nullptr : &invoke<I>)...};
+        }(std::make_index_sequence<std::variant_size_v<StateT>>{});
+    };
 
+    // A put that threw may have left the state valueless: it has no index to dispatch on, so the key loses it
+    static StateT* dropValueless(StateT* state, const StateProxy<StateStorageT>& stateProxy) {
+        if (state && state->valueless_by_exception()) [[unlikely]] {
+            logging::log<logging::ERROR>("State of {} is valueless after an exception, erasing it",
+                                         stateProxy.getKey());
+            stateProxy.erase();
+            return nullptr;
+        }
+        return state;
+    }
+
+    // Through the handlers' proxy: if the storage gives out handles, the proxy keeps the one of the key,
+    // and the handlers' `get`, `put` and `erase` do not look the key up again
+    static StateT* lookUpState(const StateProxy<StateStorageT>& stateProxy) {
+        const tracing::Span span{"state lookup"};
+        if constexpr (metrics::enabled)
+            metrics::registry().storageGets.inc();
+        return dropValueless(stateProxy.get(), stateProxy);
+    }
+
+    static void countUpdate(const StateT* state) {
+        if constexpr (metrics::enabled) {
+            if (state)
+                metrics::stateCounters<StateT>()[state->index()]->inc();
+            else
+                metrics::registry().updatesWithoutState.inc();
+        }
+    }
+
+    template <typename... EventCallbacks, typename... EventArgs>
+    void runHandlers(StateT* const mCurrentState, const HandlerContext& context, const EventArgs&... eventArgs) {
+        const ApiArg& api = context.api;
+        const StateProxy<StateStorageT>& stateProxy = context.stateProxy;
         if (mCurrentState) {
-            StateT& currentStateRef = *mCurrentState;
-            std::visit(
-                [&](auto& state) {
-                    using StateOption = std::remove_reference_t<decltype(state)>;
-                    constexpr auto stateFilter = CallbackFinder::filterByStateOption<StateOption>;
-                    using StateCallbacks = CallbackFinder::find<stateFilter, EventCallbacks...>;
-                    invokeCallbacks<StateOption>(
-                        meta::TupleToProxy<StateCallbacks>{}, state, eventArgs..., api, stateProxy, dependencies);
-                },
-                currentStateRef);
+            using Table = StateDispatchTable<std::tuple<EventArgs...>, EventCallbacks...>;
+            if (const auto cell = Table::cells[mCurrentState->index()])
+                cell(*this, *mCurrentState, eventArgs..., api, stateProxy);
         } else {
             // no state handlers
             using NoStateCallbacks = CallbackFinder::find<CallbackFinder::noStateFilter, EventCallbacks...>;
@@ -183,6 +294,58 @@ class StaterBase {
             meta::TupleToProxy<AnyStateCallbacks>{}, eventArgs..., api, stateProxy, dependencies);
     }
 
+    template <typename... EventCallbacks, typename... EventArgs>
+    void handleEvent(TgBot::Bot& bot, const StateKey& stateKey, const EventArgs&... eventArgs) {
+        HandlerContext localContext{ApiArg{bot.getApi(), outbox.get()}, StateProxy{stateStorage, stateKey}};
+        const HandlerContext& context = [&]() -> const HandlerContext& {
+            if constexpr (hasCoroutines) {
+                auto kept = std::make_shared<const HandlerContext>(std::move(localContext));
+                UpdateScope::current->keepAlive(kept);
+                return *kept;
+            } else {
+                return localContext;
+            }
+        }();
+        StateT* const mCurrentState = lookUpState(context.stateProxy);
+        countUpdate(mCurrentState);
+        runHandlers<EventCallbacks...>(mCurrentState, context, eventArgs...);
+    }
+
+    // The AnyMessage handlers and then those of the message's own event, as TgBot calls the listeners,
+    // but with one lookup: the state is looked up again only if an AnyMessage handler could have switched it.
+    template <typename... AnyMessageCallbacks, typename... OwnCallbacks>
+    void handleMessage(meta::Proxy<AnyMessageCallbacks...> /*unused*/,
+                       meta::Proxy<OwnCallbacks...> /*unused*/,
+                       TgBot::Bot& bot,
+                       const StateKey& stateKey,
+                       const TgBot::Message& message) {
+        const HandlerContext context{ApiArg{bot.getApi(), outbox.get()}, StateProxy{stateStorage, stateKey}};
+        StateT* mCurrentState = lookUpState(context.stateProxy);
+        countUpdate(mCurrentState);
+        runHandlers<AnyMessageCallbacks...>(mCurrentState, context, message);
+        if constexpr ((AnyMessageCallbacks::takesStateProxy || ...)) {
+            // a handle still points to the slot unless a key was added or removed meanwhile
+            if constexpr (concepts::HandleStateStorage<StateStorageT>)
+                mCurrentState = dropValueless(context.stateProxy.get(), context.stateProxy);
+            else
+                mCurrentState = lookUpState(context.stateProxy);
+        }
+        runHandlers<OwnCallbacks...>(mCurrentState, context, message);
+    }
+
+    template <typename Callbacks_, typename Event>
+    void handleCallbacks(TgBot::Bot& bot, const StateKey& key, const Event& event) {
+        if constexpr (IsFusedMessageCallbacks<Callbacks_>::value) {
+            handleMessage(meta::TupleToProxy<typename Callbacks_::AnyMessage>{},
+                          meta::TupleToProxy<typename Callbacks_::Own>{},
+                          bot,
+                          key,
+                          event);
+        } else {
+            handleEventProxy(meta::TupleToProxy<Callbacks_>{}, bot, key, event);
+        }
+    }
+
     template <typename... EventCallbacks, typename... Args>
     void handleEventProxy(meta::Proxy<EventCallbacks...> /*unused*/, Args&&... args) {
         handleEvent<EventCallbacks...>(std::forward<Args>(args)...);
@@ -192,88 +355,332 @@ class StaterBase {
         logging::log("Handling {} from {}", event_type, key);
     }
 
-    template <typename Callbacks_>
-    auto makeMessageHandler(std::string_view event, TgBot::Bot& bot) {
-        return [&, event](const TgBot::Message::Ptr& mp) {
-            const StateKey key = EventCategories::Message::getStateKey(mp);
+    // Handles an update with coroutine handlers. Returns whether they are finished,
+    // otherwise the key serializer is told when their last coroutine completes.
+    template <typename Callbacks_, typename EventPtr>
+    bool handleUpdateScope(TgBot::Bot& bot, const StateKey& key, const EventPtr& ptr) {
+        const auto scope = std::make_shared<UpdateScope>(
+            [this, key](std::function<void()> resume) { dispatcher->resume(key, std::move(resume)); },
+            [this, key] { keySerializer->finish(key); });
+        scope->keepAlive(ptr);
+        {
+            const UpdateScope::Enter enter{*scope};
+            try {
+                handleEventProxy(meta::TupleToProxy<Callbacks_>{}, bot, key, *ptr);
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("{}", e.what());
+            }
+        }
+        return scope->release();
+    }
+
+    // Runs the handlers inline or hands them over to the dispatcher's worker.
+    // The event pointer is captured by the task, so the event outlives the listener call.
+    template <typename Callbacks_, typename EventPtr>
+    void dispatch(TgBot::Bot& bot, const StateKey& key, const EventPtr& ptr) {
+        if constexpr (hasCoroutines) {
+            // `setup` makes sure there is a dispatcher: its workers run the resumptions
+            dispatcher->post(key, [this, &bot, key, ptr, handoff = tracing::Handoff::current()]() mutable {
+                const tracing::Resume resume{std::move(handoff)};
+                keySerializer->run(key,
+                                   [this, &bot, key, ptr] { return handleUpdateScope<Callbacks_>(bot, key, ptr); });
+            });
+            return;
+        }
+        if (!dispatcher) {
+            handleCallbacks<Callbacks_>(bot, key, *ptr);
+            return;
+        }
+        dispatcher->post(key, [this, &bot, key, ptr, handoff = tracing::Handoff::current()]() mutable {
+            const tracing::Resume resume{std::move(handoff)};
+            handleCallbacks<Callbacks_>(bot, key, *ptr);
+        });
+    }
+
+    template <typename Category, typename Callbacks_>
+    auto makeEventHandler(std::string_view event, TgBot::Bot& bot) {
+        metrics::Counter* eventCounter = nullptr;
+        if constexpr (metrics::enabled)
+            eventCounter = &metrics::registry().event(event);
+        return [this, &bot, event, eventCounter](const auto& ptr) {
+            const StateKey key = Category::getStateKey(ptr);
+            if constexpr (metrics::enabled)
+                eventCounter->inc();
+            const tracing::UpdateSpan span{event, key};
             logEvent(event, key);
-            handleEventProxy(meta::TupleToProxy<Callbacks_>{}, bot, key, *mp);
+            dispatch<Callbacks_>(bot, key, ptr);
         };
     }
 
     template <typename EventT>
     using FindEventCallbacks = CallbackFinder::find<CallbackFinder::filterByEventType<EventT>, Callbacks...>;
 
-    template <typename T>
-    struct GroupCommandCallbacks;
+    // The AnyMessage handlers and then those of the message's own event, in one task unless coroutines have to
+    // complete in between, as they do between two listeners
+    template <typename OwnCallbacks>
+    void dispatchMessage(TgBot::Bot& bot, const StateKey& key, const TgBot::Message::Ptr& message) {
+        using AnyMessageCallbacks = FindEventCallbacks<Events::AnyMessage>;
+        constexpr bool anyMessage = std::tuple_size_v<AnyMessageCallbacks> != 0;
+        constexpr bool own = std::tuple_size_v<OwnCallbacks> != 0;
+        if constexpr (anyMessage && own && !hasCoroutines) {
+            dispatch<FusedMessageCallbacks<AnyMessageCallbacks, OwnCallbacks>>(bot, key, message);
+        } else {
+            if constexpr (anyMessage)
+                dispatch<AnyMessageCallbacks>(bot, key, message);
+            if constexpr (own)
+                dispatch<OwnCallbacks>(bot, key, message);
+        }
+    }
+
+    // Commands are routed by a perfect hash built at compile time instead of being registered one by one:
+    // the bot sees no commands and passes every one of them as unknown.
+    // Callbacks are grouped by indices computed from the command strings: sorting the callback types themselves
+    // takes compile time and memory quadratic in their number.
+    template <typename CommandCallbacksT>
+    struct CommandRouter;
 
     template <typename... CommandCallbacks>
-    struct GroupCommandCallbacks<std::tuple<CommandCallbacks...>> {
-        using type =
-            meta::group_by<[]<typename C>() { return std::string_view{C::event.command}; }, CommandCallbacks...>;
+    struct CommandRouter<std::tuple<CommandCallbacks...>> {
+        using Dispatch = void (StaterBase::*)(TgBot::Bot&, const StateKey&, const TgBot::Message::Ptr&);
+
+        static constexpr auto groups = detail::groupStrings(
+            std::array<std::string_view, sizeof...(CommandCallbacks)>{CommandCallbacks::event.command...});
+
+        template <std::size_t G, std::size_t... J>
+        static auto groupOf(std::index_sequence<J...>) -> std::tuple<
+            std::tuple_element_t<groups.members[groups.start[G] + J], std::tuple<CommandCallbacks...>>...>;
+
+        template <std::size_t G>
+        using Group = decltype(groupOf<G>(std::make_index_sequence<groups.start[G + 1] - groups.start[G]>{}));
+
+        static constexpr detail::PerfectHashTable<groups.count> commands{
+            []<std::size_t... G>(std::index_sequence<G...>) {
+                return std::array<std::string_view, groups.count>{groups.strings[G]...};
+            }(std::make_index_sequence<groups.count>{})};
+
+        static constexpr auto dispatches = []<std::size_t... G>(std::index_sequence<G...>) {
+            return std::array<Dispatch, groups.count>{&StaterBase::dispatchMessage<Group<G>>...};
+        }(std::make_index_sequence<groups.count>{});
     };
 
+    // A single listener for messages, commands and unknown commands. TgBot would pass a message to the AnyMessage
+    // listener and to the one of its kind, and each of them would compute the key and look up the state again.
+    // A message is a command if it starts with '/', as TgBot decides it.
+    auto makeMessageHandler(TgBot::Bot& bot) {
+        using Router = CommandRouter<FindEventCallbacks<Events::Command>>;
+        // Registered only when collected, so that the registry does not export counters that stay at zero
+        struct Counters {
+            metrics::Counter* message = nullptr;
+            metrics::Counter* nonCommand = nullptr;
+            metrics::Counter* command = nullptr;
+            metrics::Counter* unknownCommand = nullptr;
+        } counters;
+        if constexpr (metrics::enabled)
+            counters = {&metrics::registry().event("message"),
+                        &metrics::registry().event("non-command message"),
+                        &metrics::registry().event("command"),
+                        &metrics::registry().event("unknown command")};
+        return [this, &bot, counters](const TgBot::Message::Ptr& message) {
+            const StateKey key = EventCategories::Message::getStateKey(message);
+            if constexpr (metrics::enabled)
+                counters.message->inc();
+            if (!message->text.starts_with('/')) {
+                if constexpr (metrics::enabled)
+                    counters.nonCommand->inc();
+                const tracing::UpdateSpan span{"non-command message", key};
+                logEvent("non-command message", key);
+                dispatchMessage<FindEventCallbacks<Events::Message>>(bot, key, message);
+                return;
+            }
+            const tracing::UpdateSpan span{"command", key};
+            const std::optional<ParsedCommand> command = parseCommand(message->text);
+            const std::size_t i = command ? Router::commands.find(command->name) : Router::commands.npos;
+            if (i == Router::commands.npos) {
+                if constexpr (metrics::enabled)
+                    counters.unknownCommand->inc();
+                logEvent("unknown command", key);
+                dispatchMessage<FindEventCallbacks<Events::UnknownCommand>>(bot, key, message);
+                return;
+            }
+            if constexpr (metrics::enabled)
+                counters.command->inc();
+            logEvent("command", key);
+            (this->*Router::dispatches[i])(bot, key, message);
+        };
+    }
+
+    template <typename EventT>
+    auto makeHandler(std::string_view event, TgBot::Bot& bot) {
+        return makeEventHandler<typename EventT::Category, FindEventCallbacks<EventT>>(event, bot);
+    }
+
+    template <typename... EventTs>
+    static constexpr bool handlesAny = ((std::tuple_size_v<FindEventCallbacks<EventTs>> != 0) || ...);
+
+  public:
+    // Registers the handlers at the bot's event broadcaster. `start` and `startWebhook` call it themselves,
+    // so it is only needed when the bot's updates are delivered by some custom loop.
+    // Events without handlers get no listener, so their updates are not even looked at.
     void setup(TgBot::Bot& bot) {
-        bot.getEvents().onNonCommandMessage(
-            makeMessageHandler<FindEventCallbacks<Events::Message>>("non-command message", bot));
-        using Grouped = GroupCommandCallbacks<FindEventCallbacks<Events::Command>>::type;
-        [&]<typename... Groups>(meta::Proxy<Groups...>) {
-            (bot.getEvents().onCommand({std::tuple_element_t<0, Groups>::event.command},
-                                       makeMessageHandler<Groups>("command", bot)),
-             ...);
-        }(meta::TupleToProxy<Grouped>{});
-        bot.getEvents().onUnknownCommand(
-            makeMessageHandler<FindEventCallbacks<Events::UnknownCommand>>("unknown command", bot));
-        bot.getEvents().onAnyMessage(makeMessageHandler<FindEventCallbacks<Events::AnyMessage>>("message", bot));
-        bot.getEvents().onEditedMessage(
-            makeMessageHandler<FindEventCallbacks<Events::EditedMessage>>("message edit", bot));
-        bot.getEvents().onInlineQuery([&](const TgBot::InlineQuery::Ptr& iqp) {
-            const StateKey key = EventCategories::InlineQuery::getStateKey(iqp);
-            logEvent("inline query", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::InlineQuery>>{}, bot, key, *iqp);
-        });
-        bot.getEvents().onChosenInlineResult([&](const TgBot::ChosenInlineResult::Ptr& cirp) {
-            const StateKey key = EventCategories::ChosenInlineResult::getStateKey(cirp);
-            logEvent("chosen inline result", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::ChosenInlineResult>>{}, bot, key, *cirp);
-        });
-        bot.getEvents().onCallbackQuery([&](const TgBot::CallbackQuery::Ptr& cqp) {
-            const StateKey key = EventCategories::CallbackQuery::getStateKey(cqp);
-            logEvent("callback query", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::CallbackQuery>>{}, bot, key, *cqp);
-        });
-        bot.getEvents().onShippingQuery([&](const TgBot::ShippingQuery::Ptr& sqp) {
-            const StateKey key = EventCategories::ShippingQuery::getStateKey(sqp);
-            logEvent("shipping query", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::ShippingQuery>>{}, bot, key, *sqp);
-        });
-        bot.getEvents().onPreCheckoutQuery([&](const TgBot::PreCheckoutQuery::Ptr& pcqp) {
-            const StateKey key = EventCategories::PreCheckoutQuery::getStateKey(pcqp);
-            logEvent("precheckout query", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::PreCheckoutQuery>>{}, bot, key, *pcqp);
-        });
-        bot.getEvents().onPollAnswer([&](const TgBot::PollAnswer::Ptr& pap) {
-            const StateKey key = EventCategories::PollAnswer::getStateKey(pap);
-            logEvent("poll answer", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::PollAnswer>>{}, bot, key, *pap);
-        });
-        bot.getEvents().onMyChatMember([&](const TgBot::ChatMemberUpdated::Ptr& cmup) {
-            const StateKey key = EventCategories::ChatMemberUpdated::getStateKey(cmup);
-            logEvent("chat member update for bot", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::MyChatMember>>{}, bot, key, *cmup);
-        });
-        bot.getEvents().onChatMember([&](const TgBot::ChatMemberUpdated::Ptr& cmup) {
-            const StateKey key = EventCategories::ChatMemberUpdated::getStateKey(cmup);
-            logEvent("chat member update", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::ChatMember>>{}, bot, key, *cmup);
-        });
-        bot.getEvents().onChatJoinRequest([&](const TgBot::ChatJoinRequest::Ptr& cjrp) {
-            const StateKey key = EventCategories::ChatJoinRequest::getStateKey(cjrp);
-            logEvent("chat join request", key);
-            handleEventProxy(meta::TupleToProxy<FindEventCallbacks<Events::ChatJoinRequest>>{}, bot, key, *cjrp);
+        if constexpr ((Callbacks::takesOutbox || ...))
+            if (!dispatchOptions.outbox)
+                throw std::logic_error("A handler takes Outbox, but DispatchOptions::outbox is not set.");
+
+        TgBot::EventBroadcaster& events = bot.getEvents();
+        if constexpr (handlesAny<Events::Message, Events::Command, Events::UnknownCommand, Events::AnyMessage>)
+            events.onAnyMessage(makeMessageHandler(bot));
+        if constexpr (handlesAny<Events::EditedMessage>)
+            events.onEditedMessage(makeHandler<Events::EditedMessage>("message edit", bot));
+        if constexpr (handlesAny<Events::InlineQuery>)
+            events.onInlineQuery(makeHandler<Events::InlineQuery>("inline query", bot));
+        if constexpr (handlesAny<Events::ChosenInlineResult>)
+            events.onChosenInlineResult(makeHandler<Events::ChosenInlineResult>("chosen inline result", bot));
+        if constexpr (handlesAny<Events::CallbackQuery>)
+            events.onCallbackQuery(makeHandler<Events::CallbackQuery>("callback query", bot));
+        if constexpr (handlesAny<Events::ShippingQuery>)
+            events.onShippingQuery(makeHandler<Events::ShippingQuery>("shipping query", bot));
+        if constexpr (handlesAny<Events::PreCheckoutQuery>)
+            events.onPreCheckoutQuery(makeHandler<Events::PreCheckoutQuery>("precheckout query", bot));
+        if constexpr (handlesAny<Events::PollAnswer>)
+            events.onPollAnswer(makeHandler<Events::PollAnswer>("poll answer", bot));
+        if constexpr (handlesAny<Events::MyChatMember>)
+            events.onMyChatMember(makeHandler<Events::MyChatMember>("chat member update for bot", bot));
+        if constexpr (handlesAny<Events::ChatMember>)
+            events.onChatMember(makeHandler<Events::ChatMember>("chat member update", bot));
+        if constexpr (handlesAny<Events::ChatJoinRequest>)
+            events.onChatJoinRequest(makeHandler<Events::ChatJoinRequest>("chat join request", bot));
+
+        if (dispatchOptions.outbox)
+            outbox = std::make_unique<Outbox>(bot.getApi(), *dispatchOptions.outbox);
+        if constexpr (hasCoroutines) {
+            keySerializer = std::make_unique<KeySerializer>();
+            dispatcher = std::make_unique<ShardedDispatcher>(std::max<std::size_t>(dispatchOptions.shards, 1),
+                                                             dispatchOptions.queueCapacity);
+        } else if (dispatchOptions.shards != 0) {
+            dispatcher = std::make_unique<ShardedDispatcher>(dispatchOptions.shards, dispatchOptions.queueCapacity);
+        }
+    }
+
+    // Blocks until all the updates received so far are handled, including the coroutines they started.
+    // Makes sense only for sharded dispatch or coroutine handlers.
+    void drain() {
+        if (dispatcher)
+            dispatcher->drain();
+        // the dispatched updates have reached the key serializer, whose suspended coroutines are resumed
+        // through the dispatcher
+        if (keySerializer)
+            keySerializer->waitIdle();
+    }
+
+    /*
+     * Feeds recorded updates through the handlers, as `start` would deliver them, and reports how it went.
+     * `path` holds one update in the `getUpdates` JSON format per line. The handlers' API calls go to `http`,
+     * so the replay never reaches Telegram, and a custom client can be passed to inspect the calls afterwards.
+     */
+    ReplayReport replay(const std::string& path,
+                        const ReplayOptions& options = {},
+                        const RecordingHttpClient& http = RecordingHttpClient{}) {
+        std::ifstream in{path};
+        if (!in)
+            throw std::runtime_error("Failed to open the replay file " + path);
+        TgBot::Bot bot{"replay", http};
+        // the replay's outbox and dispatcher refer to the local bot, so they must not outlive it
+        const ReplayScope scope{*this};
+        setup(bot);
+
+        using Clock = std::chrono::steady_clock;
+        ReplayReport report;
+        const detail::UpdateReader reader;
+        std::vector<std::chrono::nanoseconds> latencies;
+        std::unordered_set<StateKey> keys;
+        std::optional<std::int64_t> firstDate;
+        const Clock::time_point start = Clock::now();
+        std::string line;
+        while (std::getline(in, line)) {
+            if (line.find_first_not_of(" \t\r") == std::string::npos)
+                continue;
+            TgBot::Update::Ptr update;
+            try {
+                update = reader.parse(line);
+                if (const auto key = detail::stateKeyOf(*update))
+                    keys.insert(*key);
+            } catch (const std::exception& e) {
+                logging::log<logging::WARN>("Skipping a replayed update: {}", e.what());
+                ++report.unparsedLines;
+                continue;
+            }
+
+            Clock::time_point due = Clock::now();
+            if (const auto date = detail::dateOf(*update); date && options.pace == ReplayOptions::Pace::Recorded) {
+                firstDate = firstDate.value_or(*date);
+                const std::chrono::duration<double> offset{static_cast<double>(*date - *firstDate) / options.speed};
+                due = start + std::chrono::duration_cast<Clock::duration>(offset);
+                std::this_thread::sleep_until(due);
+            }
+            try {
+                bot.getEventHandler().handleUpdate(update);
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("{}", e.what());
+            }
+            latencies.push_back(Clock::now() - due);
+            ++report.updates;
+        }
+        // the handlers' API calls must be recorded before they are counted
+        drain();
+        if (outbox)
+            outbox->flush();
+
+        report.elapsed = Clock::now() - start;
+        report.updatesPerSecond =
+            static_cast<double>(report.updates) / std::chrono::duration<double>{report.elapsed}.count();
+        report.latency = detail::percentiles(std::move(latencies));
+        for (const RecordingHttpClient::Call& call : http.recordedCalls())
+            ++report.apiCalls[call.method];
+
+        report.finalStates.reserve(keys.size());
+        for (const StateKey& key : keys) {
+            const StateT* const state = stateStorage[key];
+            std::string name = state ? std::string{std::visit(
+                                           []<typename S>(const S& /*unused*/) { return logging::getStateName<S>(); },
+                                           *state)}
+                                     : "no state";
+            ++report.stateCounts[name];
+            report.finalStates.emplace_back(key, std::move(name));
+        }
+        std::ranges::sort(report.finalStates, {}, [](const auto& entry) {
+            return std::tuple{entry.first.chatId, entry.first.threadId};
         });
+        return report;
     }
 
+  private:
+    // Sets the stater's outbox and dispatcher aside for a replay, and puts them back once the replay's ones are done
+    class ReplayScope {
+        StaterBase& stater;
+        std::unique_ptr<Outbox> outbox;
+        std::unique_ptr<KeySerializer> keySerializer;
+        std::unique_ptr<ShardedDispatcher> dispatcher;
+
+      public:
+        explicit ReplayScope(StaterBase& stater)
+            : stater{stater},
+              outbox{std::move(stater.outbox)},
+              keySerializer{std::move(stater.keySerializer)},
+              dispatcher{std::move(stater.dispatcher)} {}
+
+        ReplayScope(const ReplayScope&) = delete;
+        ReplayScope& operator=(const ReplayScope&) = delete;
+        ReplayScope(ReplayScope&&) = delete;
+        ReplayScope& operator=(ReplayScope&&) = delete;
+
+        ~ReplayScope() {
+            stater.drain();
+            stater.dispatcher = std::move(dispatcher);
+            stater.keySerializer = std::move(keySerializer);
+            stater.outbox = std::move(outbox);
+        }
+    };
+
     static void logPreStartMessage(const TgBot::Bot& bot) {
         if constexpr (logging::atLeast<logging::INFO>) {
             logging::log("Bot has started at https://t.me/{}", bot.getApi().getMe()->username);
@@ -285,21 +692,69 @@ class StaterBase {
 
   public:
     explicit constexpr StaterBase(StateStorageT stateStorage = StateStorageT{},
-                                  DependenciesT dependencies = DependenciesT{})
-        : stateStorage{std::move(stateStorage)}, dependencies{std::move(dependencies)} {}
+                                  DependenciesT dependencies = DependenciesT{},
+                                  DispatchOptions dispatchOptions = DispatchOptions{})
+        : stateStorage{std::move(stateStorage)},
+          dependencies{std::move(dependencies)},
+          dispatchOptions{dispatchOptions} {
+        if (dispatchOptions.shards > 1 && !concepts::ThreadSafeStateStorage<StateStorageT>)
+            throw std::invalid_argument("Dispatching to several shards requires a thread-safe state storage.");
+    }
+
+    StaterBase(const StaterBase&) = delete;
+    StaterBase& operator=(const StaterBase&) = delete;
+    StaterBase(StaterBase&&) noexcept = default;
+    StaterBase& operator=(StaterBase&&) noexcept = default;
+    // Suspended coroutines would resume on a destroyed dispatcher
+    ~StaterBase() {
+        drain();
+    }
 
     using UpdatesList = std::vector<std::string>;
 
+    // The update types some handler takes, used by `start` and `startWebhook` when `allowedUpdates` is null,
+    // so that Telegram doesn't send the others at all. Empty if there are no handlers, which means all types.
+    static UpdatesList allowedUpdateTypes() {
+        UpdatesList types;
+        const auto allowIf = [&](bool handled, const char* type) {
+            if (handled)
+                types.emplace_back(type);
+        };
+        // TgBot passes channel posts to the message listeners, and their edits to the edited message ones
+        constexpr bool messages =
+            handlesAny<Events::Message, Events::Command, Events::UnknownCommand, Events::AnyMessage>;
+        constexpr bool editedMessages = handlesAny<Events::EditedMessage>;
+        allowIf(messages, "message");
+        allowIf(messages, "channel_post");
+        allowIf(editedMessages, "edited_message");
+        allowIf(editedMessages, "edited_channel_post");
+        allowIf(handlesAny<Events::InlineQuery>, "inline_query");
+        allowIf(handlesAny<Events::ChosenInlineResult>, "chosen_inline_result");
+        allowIf(handlesAny<Events::CallbackQuery>, "callback_query");
+        allowIf(handlesAny<Events::ShippingQuery>, "shipping_query");
+        allowIf(handlesAny<Events::PreCheckoutQuery>, "pre_checkout_query");
+        allowIf(handlesAny<Events::PollAnswer>, "poll_answer");
+        allowIf(handlesAny<Events::MyChatMember>, "my_chat_member");
+        allowIf(handlesAny<Events::ChatMember>, "chat_member");
+        allowIf(handlesAny<Events::ChatJoinRequest>, "chat_join_request");
+        return types;
+    }
+
+  private:
+    static std::shared_ptr<UpdatesList> defaultAllowedUpdates() {
+        return std::make_shared<UpdatesList>(allowedUpdateTypes());
+    }
+
+  public:
     // rvalue reference means taking the ownership
-    void start(TgBot::Bot&& bot,          // NOLINT(*-rvalue-reference-param-not-moved)
-               std::int32_t limit = 100,  // NOLINT(*-magic-numbers)
-               std::int32_t timeout = 10, // NOLINT(*-magic-numbers)
-               const std::shared_ptr<UpdatesList>& allowedUpdates = std::make_shared<UpdatesList>()) {
+    void start(TgBot::Bot&& bot, // NOLINT(*-rvalue-reference-param-not-moved)
+               const PollOptions& options,
+               const std::shared_ptr<UpdatesList>& allowedUpdates = nullptr) {
         setup(bot);
         logPreStartMessage(bot);
 
         bot.getApi().deleteWebhook();
-        TgBot::TgLongPoll longPoll{bot, limit, timeout, allowedUpdates};
+        PipelinedLongPoll longPoll{bot, options, allowedUpdates ? allowedUpdates : defaultAllowedUpdates()};
         while (true) {
             try {
                 longPoll.start();
@@ -309,30 +764,65 @@ class StaterBase {
         }
     }
 
+    // `limit` caps the batch size and `timeout` is the long polling timeout while there is no backlog
+    void start(TgBot::Bot&& bot,
+               std::int32_t limit = 100,  // NOLINT(*-magic-numbers)
+               std::int32_t timeout = 10, // NOLINT(*-magic-numbers)
+               const std::shared_ptr<UpdatesList>& allowedUpdates = nullptr) {
+        start(std::move(bot), PollOptions{.maxLimit = limit, .timeout = timeout}, allowedUpdates);
+    }
+
+    // rvalue reference means taking the ownership
     void startWebhook(TgBot::Bot&& bot, // NOLINT(*-rvalue-reference-param-not-moved)
-                      unsigned short port,
                       const std::string& url,
-                      const std::string& path,
+                      const WebhookOptions& options,
                       TgBot::InputFile::Ptr certificate = nullptr,
-                      const std::shared_ptr<UpdatesList>& allowedUpdates = std::make_shared<UpdatesList>(),
+                      const std::shared_ptr<UpdatesList>& allowedUpdates = nullptr,
                       std::uint16_t maxConnections = 40, // NOLINT(*magic-numbers*)
                       const std::string& ipAddress = "",
-                      bool dropPendingUpdates = false,
-                      const std::string& secretToken = "") {
+                      bool dropPendingUpdates = false) {
         setup(bot);
         logPreStartMessage(bot);
 
-        bot.getApi().setWebhook(
-            url, std::move(certificate), maxConnections, allowedUpdates, ipAddress, dropPendingUpdates, secretToken);
-        TgBot::TgWebhookTcpServer server{port, path, bot.getEventHandler()};
+        bot.getApi().setWebhook(url,
+                                std::move(certificate),
+                                maxConnections,
+                                allowedUpdates ? allowedUpdates : defaultAllowedUpdates(),
+                                ipAddress,
+                                dropPendingUpdates,
+                                options.secretToken);
+        // the server hands the updates over one at a time and in order: without sharded dispatch
+        // the handlers run on its workers, with it they are only posted to the shards
+        WebhookServer server{options,
+                             [&](const TgBot::Update::Ptr& update) { bot.getEventHandler().handleUpdate(update); }};
         while (true) {
             try {
-                server.start();
+                server.run();
             } catch (const std::exception& e) {
                 logging::log<logging::ERROR>("{}", e.what());
             }
         }
     }
+
+    void startWebhook(TgBot::Bot&& bot,
+                      unsigned short port,
+                      const std::string& url,
+                      const std::string& path,
+                      TgBot::InputFile::Ptr certificate = nullptr,
+                      const std::shared_ptr<UpdatesList>& allowedUpdates = nullptr,
+                      std::uint16_t maxConnections = 40, // NOLINT(*magic-numbers*)
+                      const std::string& ipAddress = "",
+                      bool dropPendingUpdates = false,
+                      const std::string& secretToken = "") {
+        startWebhook(std::move(bot),
+                     url,
+                     WebhookOptions{.port = port, .path = path, .secretToken = secretToken},
+                     std::move(certificate),
+                     allowedUpdates,
+                     maxConnections,
+                     ipAddress,
+                     dropPendingUpdates);
+    }
 };
 
 } // namespace detail
@@ -0,0 +1,181 @@
+#ifndef INCLUDE_tgbotstater_command
+#define INCLUDE_tgbotstater_command
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <string_view>
+
+namespace tg_stater {
+
+// `/name@botName args`; the views point into the parsed text
+struct ParsedCommand {
+    std::string_view name;
+    std::string_view botName; // empty if the command is not addressed to a bot
+    std::string_view args;    // text after the first space, empty if none
+};
+
+// Splits a command the same way TgBot does: the name ends at the first space or '@'.
+// Returns nullopt if the text is not a command.
+constexpr std::optional<ParsedCommand> parseCommand(std::string_view text) {
+    if (!text.starts_with('/'))
+        return std::nullopt;
+    text.remove_prefix(1);
+
+    ParsedCommand command;
+    const std::size_t space = text.find(' ');
+    const std::string_view head = text.substr(0, space);
+    if (space != std::string_view::npos)
+        command.args = text.substr(space + 1);
+
+    const std::size_t at = head.find('@');
+    command.name = head.substr(0, at);
+    if (at != std::string_view::npos)
+        command.botName = head.substr(at + 1);
+    return command;
+}
+
+namespace detail {
+
+// NOLINTBEGIN(*-magic-numbers)
+constexpr std::uint64_t hashString(std::string_view s) {
+    std::uint64_t h = 0xCBF29CE484222325ULL; // FNV-1a
+    for (const char c : s)
+        h = (h ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+    return h;
+}
+
+constexpr std::uint64_t mixSeed(std::uint64_t h, std::uint64_t seed) {
+    h ^= seed * 0x9E3779B97F4A7C15ULL;
+    h ^= h >> 32U;
+    h *= 0xD6E8FEB86659FD93ULL;
+    return h ^ (h >> 32U);
+}
+// NOLINTEND(*-magic-numbers)
+
+/*
+ * Perfect hash of a set of strings known at compile time (hash and displace).
+ *
+ * Keys are split into buckets by their hash, each bucket gets the first seed that puts all of its keys into free
+ * slots of the table. A lookup hashes the string once, then reads one seed and one slot and compares one key,
+ * whether the string is in the set or not.
+ */
+template <std::size_t N>
+class PerfectHashTable {
+    static constexpr std::size_t bucketCount = std::bit_ceil(std::max<std::size_t>(N, 1));
+    // at most half full, so that a seed for the last buckets is found quickly
+    static constexpr std::size_t slotCount = std::bit_ceil(std::max<std::size_t>(2 * N, 1));
+    static constexpr std::uint32_t maxSeedAttempts = 1U << 20U;
+
+    std::array<std::string_view, N> keys{};
+    std::array<std::uint32_t, bucketCount> seeds{};
+    std::array<std::size_t, slotCount> slots{}; // index of the key, N for an empty slot
+
+  public:
+    static constexpr std::size_t npos = N;
+
+    consteval explicit PerfectHashTable(const std::array<std::string_view, N>& keyList) : keys{keyList} {
+        slots.fill(npos);
+        std::array<std::uint64_t, N> hashes{};
+        // keys grouped by bucket: bucket b holds members[bucketStart[b]..bucketStart[b + 1])
+        std::array<std::size_t, bucketCount + 1> bucketStart{};
+        for (std::size_t i = 0; i < N; ++i) {
+            hashes[i] = hashString(keyList[i]);
+            ++bucketStart[hashes[i] % bucketCount + 1];
+        }
+        for (std::size_t b = 0; b < bucketCount; ++b)
+            bucketStart[b + 1] += bucketStart[b];
+        std::array<std::size_t, N> members{};
+        std::array<std::size_t, bucketCount> filled{};
+        for (std::size_t i = 0; i < N; ++i) {
+            const std::size_t b = hashes[i] % bucketCount;
+            members[bucketStart[b] + filled[b]++] = i;
+        }
+
+        // the largest buckets are the hardest to place, so they go first
+        std::array<std::size_t, bucketCount> order{};
+        for (std::size_t b = 0; b < bucketCount; ++b)
+            order[b] = b;
+        std::ranges::sort(order, [&](std::size_t l, std::size_t r) {
+            return filled[l] != filled[r] ? filled[l] > filled[r] : l < r;
+        });
+
+        std::array<std::size_t, N> placed{};
+        for (const std::size_t bucket : order) {
+            if (filled[bucket] == 0)
+                break;
+            std::uint32_t seed = 0;
+            while (true) {
+                if (seed == maxSeedAttempts)
+                    throw std::logic_error("No perfect hash seed found: the keys have equal hashes.");
+                std::size_t count = 0;
+                for (std::size_t m = bucketStart[bucket]; m < bucketStart[bucket + 1]; ++m) {
+                    const std::size_t slot = mixSeed(hashes[members[m]], seed) % slotCount;
+                    if (slots[slot] != npos)
+                        break;
+                    slots[slot] = members[m];
+                    placed[count++] = slot;
+                }
+                if (count == filled[bucket])
+                    break;
+                for (std::size_t j = 0; j < count; ++j)
+                    slots[placed[j]] = npos;
+                ++seed;
+            }
+            seeds[bucket] = seed;
+        }
+    }
+
+    // Index of the key in the constructor's array, or npos
+    [[nodiscard]] constexpr std::size_t find(std::string_view key) const {
+        if constexpr (N == 0) {
+            return npos;
+        } else {
+            const std::uint64_t h = hashString(key);
+            const std::size_t i = slots[mixSeed(h, seeds[h % bucketCount]) % slotCount];
+            return i != npos && keys[i] == key ? i : npos;
+        }
+    }
+};
+
+// Distinct strings in the order of their first occurrence,
+// with the indices of all occurrences of the string `g` at members[start[g]..start[g + 1])
+template <std::size_t N>
+struct StringGroups {
+    std::size_t count = 0;
+    std::array<std::string_view, N> strings{};
+    std::array<std::size_t, N> members{};
+    std::array<std::size_t, N + 1> start{};
+};
+
+template <std::size_t N>
+consteval StringGroups<N> groupStrings(const std::array<std::string_view, N>& strings) {
+    StringGroups<N> groups;
+    std::array<std::size_t, N> groupOf{};
+    std::array<std::size_t, N + 1> sizes{};
+    for (std::size_t i = 0; i < N; ++i) {
+        std::size_t g = 0;
+        while (g < groups.count && groups.strings[g] != strings[i])
+            ++g;
+        if (g == groups.count)
+            groups.strings[groups.count++] = strings[i];
+        groupOf[i] = g;
+        ++sizes[g + 1];
+    }
+    for (std::size_t g = 0; g < N; ++g)
+        groups.start[g + 1] = groups.start[g] + sizes[g + 1];
+    std::array<std::size_t, N> filled{};
+    for (std::size_t i = 0; i < N; ++i)
+        groups.members[groups.start[groupOf[i]] + filled[groupOf[i]]++] = i;
+    return groups;
+}
+
+} // namespace detail
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_command
@@ -0,0 +1,518 @@
+#ifndef INCLUDE_tgbotstater_coroutine
+#define INCLUDE_tgbotstater_coroutine
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tg_stater {
+
+namespace detail {
+
+// Runs the resumptions of a handler's coroutines, on the dispatcher's worker of its StateKey
+using Executor = std::function<void(std::function<void()>)>;
+
+class UpdateScope;
+
+class TaskPromiseBase {
+  public:
+    Executor executor;
+    // Set for a coroutine awaited by another one
+    std::coroutine_handle<> continuation;
+    std::exception_ptr* exceptionOut = nullptr;
+    // Set for a coroutine started by the dispatcher
+    std::function<void(std::exception_ptr)> onDone;
+    std::exception_ptr exception;
+
+    struct FinalAwaiter {
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        // The frame is destroyed here, the results are moved out before
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+            TaskPromiseBase& promise = handle.promise();
+            promise.moveResult();
+            const std::coroutine_handle<> continuation = promise.continuation;
+            std::exception_ptr exception = std::move(promise.exception);
+            std::function<void(std::exception_ptr)> onDone = std::move(promise.onDone);
+            if (promise.exceptionOut)
+                *promise.exceptionOut = exception;
+            handle.destroy();
+            if (onDone)
+                onDone(std::move(exception));
+            return continuation ? continuation : std::noop_coroutine();
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    TaskPromiseBase() = default;
+    TaskPromiseBase(const TaskPromiseBase&) = delete;
+    TaskPromiseBase& operator=(const TaskPromiseBase&) = delete;
+    TaskPromiseBase(TaskPromiseBase&&) = delete;
+    TaskPromiseBase& operator=(TaskPromiseBase&&) = delete;
+    virtual ~TaskPromiseBase() = default;
+
+    // Hands the returned value over to the awaiting coroutine
+    virtual void moveResult() {}
+
+    [[nodiscard]] std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+
+    [[nodiscard]] FinalAwaiter final_suspend() const noexcept {
+        return {};
+    }
+
+    void unhandled_exception() {
+        exception = std::current_exception();
+    }
+};
+
+// The executor of the task being suspended, which must be started by the dispatcher
+template <typename Promise>
+Executor executorOf(std::coroutine_handle<Promise> handle) {
+    const TaskPromiseBase& promise = handle.promise();
+    if (!promise.executor) [[unlikely]]
+        throw std::logic_error("Only coroutines of handlers can await timers and the outbox.");
+    return promise.executor;
+}
+
+} // namespace detail
+
+/*
+ * Return type of coroutine handlers and of coroutines they await.
+ *
+ * A handler returning `Task<>` is started right away and runs until it suspends; its resumptions run on the
+ * dispatcher's worker of the update's StateKey, where other chats' updates keep being handled meanwhile.
+ * The next update of the same StateKey waits until the coroutines of the previous one complete.
+ * The handler's reference parameters stay valid until then. The state does too, since the stater requires
+ * a storage whose states are not moved by other keys (`concepts::StableStateStorage`), but it dies once
+ * the handler puts or erases its own key's state.
+ */
+template <typename T = void>
+class Task {
+  public:
+    class promise_type : public detail::TaskPromiseBase {
+        std::optional<T> value;
+
+      public:
+        std::optional<T>* valueOut = nullptr;
+
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        template <typename U>
+        void return_value(U&& result) {
+            value.emplace(std::forward<U>(result));
+        }
+
+        void moveResult() override {
+            if (valueOut && value)
+                *valueOut = std::move(value);
+        }
+    };
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle{handle} {}
+
+    template <typename>
+    friend class Task;
+    friend class detail::UpdateScope;
+
+  public:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task(Task&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    class Awaiter {
+        std::coroutine_handle<promise_type> child;
+        std::optional<T> value;
+        std::exception_ptr exception;
+
+      public:
+        explicit Awaiter(std::coroutine_handle<promise_type> child) : child{child} {}
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        // The child runs right away and resumes the parent when it completes
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> parent) {
+            child.promise().executor = parent.promise().executor;
+            child.promise().continuation = parent;
+            child.promise().exceptionOut = &exception;
+            child.promise().valueOut = &value;
+            return child;
+        }
+
+        T await_resume() {
+            if (exception)
+                std::rethrow_exception(exception);
+            return std::move(*value);
+        }
+    };
+
+    // The task is started by awaiting it
+    Awaiter operator co_await() && {
+        return Awaiter{std::exchange(handle, nullptr)};
+    }
+};
+
+template <>
+class Task<void> {
+  public:
+    class promise_type : public detail::TaskPromiseBase {
+      public:
+        Task get_return_object() {
+            return Task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+
+        void return_void() const noexcept {}
+    };
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit Task(std::coroutine_handle<promise_type> handle) : handle{handle} {}
+
+    friend class detail::UpdateScope;
+
+  public:
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    Task(Task&& other) noexcept : handle{std::exchange(other.handle, nullptr)} {}
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            if (handle)
+                handle.destroy();
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+    ~Task() {
+        if (handle)
+            handle.destroy();
+    }
+
+    class Awaiter {
+        std::coroutine_handle<promise_type> child;
+        std::exception_ptr exception;
+
+      public:
+        explicit Awaiter(std::coroutine_handle<promise_type> child) : child{child} {}
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> parent) {
+            child.promise().executor = parent.promise().executor;
+            child.promise().continuation = parent;
+            child.promise().exceptionOut = &exception;
+            return child;
+        }
+
+        void await_resume() const {
+            if (exception)
+                std::rethrow_exception(exception);
+        }
+    };
+
+    Awaiter operator co_await() && {
+        return Awaiter{std::exchange(handle, nullptr)};
+    }
+};
+
+namespace detail {
+
+// One thread firing the timers of all the staters
+class Timers {
+    using Clock = std::chrono::steady_clock;
+    using Entry = std::pair<Clock::time_point, std::function<void()>>;
+    struct Later {
+        bool operator()(const Entry& a, const Entry& b) const {
+            return a.first > b.first;
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::priority_queue<Entry, std::vector<Entry>, Later> entries;
+    bool stopping = false;
+    std::thread worker{[this] { run(); }};
+
+    void run() {
+        std::unique_lock lock{mutex};
+        while (!stopping) {
+            if (entries.empty()) {
+                changed.wait(lock);
+                continue;
+            }
+            // a copy: `add` may reallocate the queue while waiting
+            if (const Clock::time_point next = entries.top().first; Clock::now() < next) {
+                changed.wait_until(lock, next);
+                continue;
+            }
+            std::function<void()> fire = std::move(const_cast<Entry&>(entries.top()).second); // NOLINT
+            entries.pop();
+            lock.unlock();
+            fire();
+            lock.lock();
+        }
+    }
+
+  public:
+    Timers() = default;
+    Timers(const Timers&) = delete;
+    Timers& operator=(const Timers&) = delete;
+    Timers(Timers&&) = delete;
+    Timers& operator=(Timers&&) = delete;
+    ~Timers() {
+        {
+            const std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        changed.notify_one();
+        worker.join();
+    }
+
+    static Timers& instance() {
+        static Timers timers;
+        return timers;
+    }
+
+    void add(Clock::time_point at, std::function<void()> fire) {
+        {
+            const std::lock_guard lock{mutex};
+            entries.emplace(at, std::move(fire));
+        }
+        changed.notify_one();
+    }
+};
+
+/*
+ * The coroutines started by the handlers of one update. `current` is set for the thread while the handlers run.
+ * The dispatcher holds one reference until the handlers return: `release` tells whether the update is finished
+ * then, otherwise `onComplete` is called when its last coroutine completes.
+ */
+class UpdateScope : public std::enable_shared_from_this<UpdateScope> {
+    Executor executor;
+    std::function<void()> onComplete;
+    std::atomic<std::size_t> pending{1};
+    std::vector<std::shared_ptr<const void>> keptAlive;
+
+    void complete() {
+        if (pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            onComplete();
+    }
+
+  public:
+    static inline thread_local UpdateScope* current = nullptr;
+
+    UpdateScope(Executor executor, std::function<void()> onComplete)
+        : executor{std::move(executor)}, onComplete{std::move(onComplete)} {}
+
+    // Makes the scope current for the lifetime of the object
+    class Enter {
+        UpdateScope* outer;
+
+      public:
+        explicit Enter(UpdateScope& scope) : outer{std::exchange(current, &scope)} {}
+        Enter(const Enter&) = delete;
+        Enter& operator=(const Enter&) = delete;
+        Enter(Enter&&) = delete;
+        Enter& operator=(Enter&&) = delete;
+        ~Enter() {
+            current = outer;
+        }
+    };
+
+    // Objects the coroutines may reference
+    void keepAlive(std::shared_ptr<const void> object) {
+        keptAlive.push_back(std::move(object));
+    }
+
+    void spawn(Task<> task, std::string_view handlerName, metrics::Counter* exceptions) {
+        pending.fetch_add(1, std::memory_order_relaxed);
+        const auto handle = std::exchange(task.handle, nullptr);
+        handle.promise().executor = executor;
+        handle.promise().onDone = [self = shared_from_this(), handlerName, exceptions](std::exception_ptr e) {
+            if (e) {
+                if (exceptions)
+                    exceptions->inc();
+                try {
+                    std::rethrow_exception(e);
+                } catch (const std::exception& exception) {
+                    logging::log<logging::ERROR>("Caught exception in handler {}: {}", handlerName, exception.what());
+                } catch (...) {
+                    logging::log<logging::ERROR>("Non-std::exception exception was caught in handler {}", handlerName);
+                }
+            }
+            self->complete();
+        };
+        handle.resume();
+    }
+
+    // Returns whether no coroutine is pending
+    bool release() {
+        return pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+/*
+ * Keeps the updates of a StateKey one after another while some of them wait for their coroutines:
+ * later updates of the key are queued and run by the one that finishes the previous update.
+ * An update whose coroutines are suspended in a timer or in the outbox keeps its key's entry,
+ * so `waitIdle` also waits for the resumptions those hold.
+ */
+class KeySerializer {
+  public:
+    // Returns whether the work is finished, otherwise `finish` is called for the key later
+    using Work = std::function<bool()>;
+
+  private:
+    std::mutex mutex;
+    std::condition_variable idle;
+    std::unordered_map<StateKey, std::deque<Work>> waiting; // has an entry while a work of the key runs
+
+    // Under the lock
+    void erase(std::unordered_map<StateKey, std::deque<Work>>::iterator it) {
+        waiting.erase(it);
+        if (waiting.empty())
+            idle.notify_all();
+    }
+
+    // A loop rather than recursion: a long queue of finished works must not grow the stack
+    void drive(const StateKey& key, Work work) {
+        while (work()) {
+            const std::lock_guard lock{mutex};
+            const auto it = waiting.find(key);
+            if (it->second.empty()) {
+                erase(it);
+                return;
+            }
+            work = std::move(it->second.front());
+            it->second.pop_front();
+        }
+    }
+
+  public:
+    void run(const StateKey& key, Work work) {
+        {
+            const std::lock_guard lock{mutex};
+            const auto [it, idle] = waiting.try_emplace(key);
+            if (!idle) {
+                it->second.push_back(std::move(work));
+                return;
+            }
+        }
+        drive(key, std::move(work));
+    }
+
+    void finish(const StateKey& key) {
+        Work next;
+        {
+            const std::lock_guard lock{mutex};
+            const auto it = waiting.find(key);
+            if (it->second.empty()) {
+                erase(it);
+                return;
+            }
+            next = std::move(it->second.front());
+            it->second.pop_front();
+        }
+        drive(key, std::move(next));
+    }
+
+    // Blocks until the updates of every key are finished
+    void waitIdle() {
+        std::unique_lock lock{mutex};
+        idle.wait(lock, [this] { return waiting.empty(); });
+    }
+};
+
+template <typename T>
+struct IsTask : std::false_type {};
+
+template <typename T>
+struct IsTask<Task<T>> : std::true_type {};
+
+class SleepAwaiter {
+    std::chrono::steady_clock::time_point until;
+
+  public:
+    explicit SleepAwaiter(std::chrono::steady_clock::time_point until) : until{until} {}
+
+    [[nodiscard]] bool await_ready() const noexcept {
+        return std::chrono::steady_clock::now() >= until;
+    }
+
+    template <typename Promise>
+    void await_suspend(std::coroutine_handle<Promise> handle) const {
+        Timers::instance().add(until,
+                               [handle, executor = executorOf(handle)] { executor([handle] { handle.resume(); }); });
+    }
+
+    void await_resume() const noexcept {}
+};
+
+} // namespace detail
+
+// `co_await sleepFor(...)` suspends the task without blocking the dispatcher's worker
+template <typename Rep, typename Period>
+detail::SleepAwaiter sleepFor(std::chrono::duration<Rep, Period> duration) {
+    return detail::SleepAwaiter{std::chrono::steady_clock::now() +
+                                std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration)};
+}
+
+namespace concepts {
+
+template <typename T>
+concept Task = tg_stater::detail::IsTask<T>::value;
+
+} // namespace concepts
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_coroutine
@@ -0,0 +1,150 @@
+#ifndef INCLUDE_tgbotstater_dispatcher
+#define INCLUDE_tgbotstater_dispatcher
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/outbox.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tg_stater {
+
+struct DispatchOptions {
+    // Number of worker threads. 0 means that handlers run inline on the long poll/webhook thread.
+    std::size_t shards = 0;
+    // Maximum number of queued updates per shard. Receiving of updates blocks while the target shard is full.
+    std::size_t queueCapacity = 1024; // NOLINT(*-magic-numbers)
+    // If set, handlers may take `Outbox&` to send requests asynchronously within the rate limits
+    std::optional<OutboxOptions> outbox;
+};
+
+namespace detail {
+
+// Runs tasks on a fixed set of worker threads.
+// All tasks posted with the same StateKey go to the same worker, so they are executed in the posting order.
+class ShardedDispatcher {
+  public:
+    using Task = std::function<void()>;
+
+  private:
+    struct Shard {
+        std::mutex mutex;
+        std::condition_variable notEmpty;
+        std::condition_variable notFull;
+        std::condition_variable idle;
+        std::deque<Task> tasks;
+        bool busy = false;
+        bool stopping = false;
+        std::thread worker;
+    };
+
+    std::vector<std::unique_ptr<Shard>> shards;
+    std::size_t capacity;
+
+    static void run(Shard& shard) {
+        std::unique_lock lock{shard.mutex};
+        while (true) {
+            shard.notEmpty.wait(lock, [&] { return shard.stopping || !shard.tasks.empty(); });
+            if (shard.tasks.empty())
+                return;
+
+            Task task = std::move(shard.tasks.front());
+            shard.tasks.pop_front();
+            shard.busy = true;
+            lock.unlock();
+            shard.notFull.notify_one();
+
+            try {
+                task();
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("Caught exception in dispatcher: {}", e.what());
+            } catch (...) {
+                logging::log<logging::ERROR>("Non-std::exception exception was caught in dispatcher");
+            }
+
+            lock.lock();
+            shard.busy = false;
+            if (shard.tasks.empty())
+                shard.idle.notify_all();
+        }
+    }
+
+  public:
+    ShardedDispatcher(std::size_t shardCount, std::size_t queueCapacity)
+        : capacity{queueCapacity == 0 ? 1 : queueCapacity} {
+        shards.reserve(shardCount);
+        for (std::size_t i = 0; i < shardCount; ++i) {
+            auto& shard = *shards.emplace_back(std::make_unique<Shard>());
+            shard.worker = std::thread{[&shard] { run(shard); }};
+        }
+    }
+
+    ShardedDispatcher(const ShardedDispatcher&) = delete;
+    ShardedDispatcher& operator=(const ShardedDispatcher&) = delete;
+    ShardedDispatcher(ShardedDispatcher&&) = delete;
+    ShardedDispatcher& operator=(ShardedDispatcher&&) = delete;
+
+    // Already queued tasks are finished before the workers exit.
+    ~ShardedDispatcher() {
+        for (auto& shard : shards) {
+            {
+                std::lock_guard lock{shard->mutex};
+                shard->stopping = true;
+            }
+            shard->notEmpty.notify_one();
+        }
+        for (auto& shard : shards)
+            shard->worker.join();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return shards.size();
+    }
+
+    [[nodiscard]] std::size_t shardOf(const StateKey& key) const {
+        return std::hash<StateKey>{}(key) % shards.size();
+    }
+
+    void post(const StateKey& key, Task task) {
+        Shard& shard = *shards[shardOf(key)];
+        std::unique_lock lock{shard.mutex};
+        shard.notFull.wait(lock, [&] { return shard.tasks.size() < capacity; });
+        shard.tasks.push_back(std::move(task));
+        shard.notEmpty.notify_one();
+    }
+
+    // Queues a coroutine resumption without waiting for space: the timer and outbox threads post them, and
+    // a worker may itself wait for the outbox, so they must never wait for a worker. Their number is bounded
+    // by the suspended coroutines anyway.
+    void resume(const StateKey& key, Task task) {
+        Shard& shard = *shards[shardOf(key)];
+        // Notified under the lock: `drain` returning must not let the shard be destroyed while this touches it
+        const std::lock_guard lock{shard.mutex};
+        shard.tasks.push_back(std::move(task));
+        shard.notEmpty.notify_one();
+    }
+
+    // Blocks until every task posted so far is finished.
+    void drain() {
+        for (auto& shard : shards) {
+            std::unique_lock lock{shard->mutex};
+            shard->idle.wait(lock, [&] { return shard->tasks.empty() && !shard->busy; });
+        }
+    }
+};
+
+} // namespace detail
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_dispatcher
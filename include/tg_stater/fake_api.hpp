@@ -0,0 +1,517 @@
+#ifndef INCLUDE_tgbotstater_fake_api
+#define INCLUDE_tgbotstater_fake_api
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/tracing.hpp"
+
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <tgbot/net/HttpClient.h>
+#include <tgbot/net/HttpParser.h>
+#include <tgbot/net/HttpReqArg.h>
+#include <tgbot/net/Url.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tg_stater::fake_api {
+
+namespace detail {
+
+// Closes the socket when it goes out of scope
+class Socket {
+    int fd;
+
+  public:
+    explicit Socket(int fd) : fd{fd} {}
+    Socket(const Socket&) = delete;
+    Socket& operator=(const Socket&) = delete;
+    Socket(Socket&&) = delete;
+    Socket& operator=(Socket&&) = delete;
+    ~Socket() {
+        if (fd != -1)
+            ::close(fd);
+    }
+
+    [[nodiscard]] int get() const {
+        return fd;
+    }
+};
+
+inline void sendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        const ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent <= 0)
+            throw std::system_error(errno, std::generic_category(), "Failed to send to the fake Bot API");
+        data.remove_prefix(static_cast<std::size_t>(sent));
+    }
+}
+
+// Decodes `application/x-www-form-urlencoded` pairs into `args`
+inline void parseForm(std::string_view form, std::unordered_map<std::string, std::string>& args) {
+    const auto hex = [](char c) {
+        const int lower = std::tolower(static_cast<unsigned char>(c));
+        return lower <= '9' ? lower - '0' : lower - 'a' + 10; // NOLINT(*-magic-numbers)
+    };
+    const auto decode = [&](std::string_view s) {
+        std::string result;
+        result.reserve(s.size());
+        for (std::size_t i = 0; i < s.size(); ++i) {
+            if (s[i] == '+') {
+                result += ' ';
+            } else if (s[i] == '%' && i + 2 < s.size() && std::isxdigit(static_cast<unsigned char>(s[i + 1])) &&
+                       std::isxdigit(static_cast<unsigned char>(s[i + 2]))) {
+                result += static_cast<char>(hex(s[i + 1]) * 16 + hex(s[i + 2])); // NOLINT(*-magic-numbers)
+                i += 2;
+            } else {
+                result += s[i];
+            }
+        }
+        return result;
+    };
+    while (!form.empty()) {
+        const std::string_view pair = form.substr(0, form.find('&'));
+        form.remove_prefix(std::min(form.size(), pair.size() + 1));
+        const std::size_t eq = pair.find('=');
+        if (!pair.empty())
+            args[decode(pair.substr(0, eq))] = eq == std::string_view::npos ? "" : decode(pair.substr(eq + 1));
+    }
+}
+
+} // namespace detail
+
+/*
+ * HTTP client for `http://` Bot API URLs, such as the one of the fake server. The TLS-only default client
+ * of TgBot can't talk to it. One connection per call, like the default client.
+ */
+class PlainHttpClient : public TgBot::HttpClient {
+    TgBot::HttpParser parser;
+
+  public:
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        // TgBot::Url keeps the port in the host
+        const std::size_t colon = url.host.rfind(':');
+        const std::string host = url.host.substr(0, colon);
+        const std::string port = colon == std::string::npos ? "80" : url.host.substr(colon + 1);
+
+        addrinfo hints{};
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* addresses = nullptr;
+        if (const int error = ::getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses); error != 0)
+            throw std::runtime_error("Failed to resolve " + url.host + ": " + ::gai_strerror(error));
+        const detail::Socket connection{::socket(addresses->ai_family, SOCK_STREAM | SOCK_CLOEXEC, 0)};
+        const int connected =
+            connection.get() == -1 ? -1 : ::connect(connection.get(), addresses->ai_addr, addresses->ai_addrlen);
+        const int error = errno;
+        ::freeaddrinfo(addresses);
+        if (connected == -1)
+            throw std::system_error(error, std::generic_category(), "Failed to connect to " + url.host);
+
+        detail::sendAll(connection.get(), parser.generateRequest(url, args, false));
+        std::string response;
+        std::array<char, 4096> buffer{}; // NOLINT(*-magic-numbers)
+        while (true) {
+            const ssize_t received = ::recv(connection.get(), buffer.data(), buffer.size(), 0);
+            if (received < 0)
+                throw std::system_error(errno, std::generic_category(), "Failed to receive from " + url.host);
+            if (received == 0)
+                break;
+            response.append(buffer.data(), static_cast<std::size_t>(received));
+        }
+        return parser.extractBody(response);
+    }
+};
+
+struct ServerOptions {
+    std::string address = "127.0.0.1";
+    std::uint16_t port = 0;                 // any free port, see `Server::url`
+    std::size_t workers = 16;               // connections served at once, a pending long poll holds one
+    std::chrono::microseconds roundTrip{0}; // added to every response, to model the network to Telegram
+};
+
+struct LoadOptions {
+    double updatesPerSecond = 1000;           // NOLINT(*-magic-numbers)
+    std::chrono::milliseconds duration{1000}; // NOLINT(*-magic-numbers)
+    std::int64_t chats = 100;                 // NOLINT(*-magic-numbers) updates come from chats 1..chats at random
+    double callbackQueryShare = 0;            // the rest are text messages
+    std::string text = "hello";
+    std::string callbackData = "button";
+    std::uint64_t seed = 1;
+};
+
+struct Stats {
+    std::uint64_t updates = 0;          // generated
+    std::uint64_t delivered = 0;        // returned by getUpdates
+    std::uint64_t replies = 0;          // matched to an update
+    std::uint64_t unmatchedReplies = 0; // to a chat with no unanswered updates
+    std::map<std::string, std::uint64_t> apiCalls;
+    // From generating an update to receiving the bot's reply to it
+    metrics::Histogram::Snapshot latency;
+};
+
+/*
+ * A stand-in for the Telegram Bot API on a local socket, for end-to-end load tests of a bot:
+ * long polling, JSON parsing, dispatch and the replies all go through real HTTP.
+ *
+ * It implements `getUpdates`, `getMe`, `setWebhook`/`deleteWebhook`, `send*`/`edit*` methods (answered with
+ * a message in the requested chat) and `answerCallbackQuery`; other methods succeed with `true`.
+ * `generate` produces a synthetic update stream. A reply, i.e. a call with a `chat_id` or `answerCallbackQuery`,
+ * answers the oldest unanswered update of its chat. HTTP/1.0, one request per connection, POSIX only.
+ *
+ * Point a bot at it with `TgBot::Bot{token, plainHttpClient, server.url()}`, any token is accepted.
+ */
+class Server {
+    using Clock = std::chrono::steady_clock;
+    static constexpr int pollTimeoutMs = 200;
+    static constexpr std::size_t maxRequestSize = std::size_t{1} << 20U;
+
+    int fd = -1;
+    std::chrono::microseconds roundTrip;
+    std::atomic<bool> stopping{false};
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable updatesAdded;
+    std::deque<std::pair<std::int64_t, std::string>> updates; // not confirmed by the bot yet
+    std::int64_t nextUpdateId = 1;
+    std::int64_t lastDelivered = 0;
+    std::int64_t nextMessageId = 1;
+    std::unordered_map<std::int64_t, std::deque<Clock::time_point>> unanswered; // by chat
+    std::unordered_map<std::string, std::int64_t> callbackChats;               // callback query id -> chat
+    Stats stats;
+    metrics::Histogram latency;
+
+    [[noreturn]] void throwErrno(const std::string& what) {
+        const int error = errno;
+        if (fd != -1)
+            ::close(fd);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    static std::string userJson(std::int64_t id, bool isBot) {
+        return R"({"id":)" + std::to_string(id) + R"(,"is_bot":)" + (isBot ? "true" : "false") +
+               R"(,"first_name":"Fake","username":"fake_)" + std::to_string(id) + "\"}";
+    }
+
+    // A message in a private chat, sent by the user or by the bot
+    static std::string messageJson(std::int64_t messageId, std::int64_t chatId, bool byBot, std::string_view text) {
+        const auto date = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+        std::string json = R"({"message_id":)" + std::to_string(messageId) + R"(,"date":)" +
+                           std::to_string(date.count()) + R"(,"chat":{"id":)" + std::to_string(chatId) +
+                           R"(,"type":"private"},"from":)" + userJson(byBot ? 0 : chatId, byBot) + R"(,"text":)";
+        tracing::detail::appendJsonString(json, text);
+        json += '}';
+        return json;
+    }
+
+    // Must be called under the lock
+    void addUpdate(std::string json) {
+        updates.emplace_back(nextUpdateId, std::move(json));
+        ++nextUpdateId;
+        ++stats.updates;
+        updatesAdded.notify_all();
+    }
+
+    // Must be called under the lock
+    void answer(std::int64_t chatId, Clock::time_point now) {
+        const auto it = unanswered.find(chatId);
+        if (it == unanswered.end() || it->second.empty()) {
+            ++stats.unmatchedReplies;
+            return;
+        }
+        latency.record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - it->second.front()).count()));
+        it->second.pop_front();
+        ++stats.replies;
+    }
+
+    std::string getUpdates(const std::unordered_map<std::string, std::string>& args) {
+        const auto arg = [&](const char* name, std::int64_t fallback) {
+            const auto it = args.find(name);
+            return it == args.end() || it->second.empty() ? fallback : std::stoll(it->second);
+        };
+        const std::int64_t offset = arg("offset", 0);
+        const auto limit = static_cast<std::size_t>(std::clamp<std::int64_t>(arg("limit", 100), 1, 100)); // NOLINT
+        const std::chrono::seconds timeout{arg("timeout", 0)};
+
+        std::unique_lock lock{mutex};
+        while (!updates.empty() && updates.front().first < offset)
+            updates.pop_front();
+        updatesAdded.wait_for(lock, timeout, [&] { return !updates.empty() || stopping.load(); });
+
+        std::string result = R"({"ok":true,"result":[)";
+        for (std::size_t i = 0; i < updates.size() && i < limit; ++i) {
+            if (i != 0)
+                result += ',';
+            result += updates[i].second;
+            if (updates[i].first > lastDelivered) {
+                lastDelivered = updates[i].first;
+                ++stats.delivered;
+            }
+        }
+        result += "]}";
+        return result;
+    }
+
+    std::string handle(const std::string& method, const std::unordered_map<std::string, std::string>& args) {
+        if (method == "getUpdates") {
+            {
+                const std::lock_guard lock{mutex};
+                ++stats.apiCalls[method];
+            }
+            return getUpdates(args);
+        }
+
+        const Clock::time_point now = Clock::now();
+        const std::lock_guard lock{mutex};
+        ++stats.apiCalls[method];
+        if (method == "answerCallbackQuery") {
+            const auto it = args.find("callback_query_id");
+            if (it != args.end())
+                if (const auto chat = callbackChats.find(it->second); chat != callbackChats.end()) {
+                    answer(chat->second, now);
+                    callbackChats.erase(chat);
+                }
+            return R"({"ok":true,"result":true})";
+        }
+        if (method == "getMe")
+            return R"({"ok":true,"result":)" + userJson(0, true) + '}';
+
+        const auto chat = args.find("chat_id");
+        if (chat == args.end())
+            return R"({"ok":true,"result":true})";
+        const std::int64_t chatId = std::stoll(chat->second);
+        answer(chatId, now);
+        if (method.starts_with("send") || method.starts_with("edit") || method.starts_with("forward")) {
+            const auto text = args.find("text");
+            return R"({"ok":true,"result":)" +
+                   messageJson(nextMessageId++, chatId, true, text == args.end() ? "" : text->second) + '}';
+        }
+        return R"({"ok":true,"result":true})";
+    }
+
+    static void respond(int client, std::string_view status, std::string_view body) {
+        std::string response = "HTTP/1.0 ";
+        response += status;
+        response += "\r\nContent-Type: application/json\r\nContent-Length: ";
+        response += std::to_string(body.size());
+        response += "\r\nConnection: close\r\n\r\n";
+        response += body;
+        detail::sendAll(client, response);
+    }
+
+    void serve(int client) {
+        // a stuck client must not hold the worker for long
+        timeval timeout{.tv_sec = 5, .tv_usec = 0}; // NOLINT(*-magic-numbers)
+        ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        std::array<char, 4096> buffer{}; // NOLINT(*-magic-numbers)
+        std::size_t headerEnd = std::string::npos;
+        std::size_t contentLength = 0;
+        while (headerEnd == std::string::npos || request.size() < headerEnd + 4 + contentLength) {
+            const ssize_t received = ::recv(client, buffer.data(), buffer.size(), 0);
+            if (received <= 0 || request.size() > maxRequestSize)
+                return;
+            request.append(buffer.data(), static_cast<std::size_t>(received));
+            if (headerEnd == std::string::npos && (headerEnd = request.find("\r\n\r\n")) != std::string::npos) {
+                std::string headers = request.substr(0, headerEnd);
+                std::ranges::transform(headers, headers.begin(), [](unsigned char c) { return std::tolower(c); });
+                if (const std::size_t length = headers.find("\r\ncontent-length:"); length != std::string::npos)
+                    contentLength = std::stoull(headers.substr(length + 17)); // NOLINT(*-magic-numbers)
+            }
+        }
+
+        // "POST /bot<token>/<method> HTTP/1.1"
+        const std::string_view requestLine = std::string_view{request}.substr(0, request.find("\r\n"));
+        const std::size_t pathStart = requestLine.find(' ') + 1;
+        std::string_view path = requestLine.substr(pathStart, requestLine.find(' ', pathStart) - pathStart);
+        std::unordered_map<std::string, std::string> args;
+        if (const std::size_t query = path.find('?'); query != std::string_view::npos) {
+            detail::parseForm(path.substr(query + 1), args);
+            path = path.substr(0, query);
+        }
+        if (!path.starts_with("/bot") || path.rfind('/') == 0) {
+            respond(client, "404 Not Found", R"({"ok":false,"error_code":404,"description":"Not Found"})");
+            return;
+        }
+        // Multipart bodies (file uploads) are not parsed, the call is only counted
+        if (request.find("application/x-www-form-urlencoded") < headerEnd)
+            detail::parseForm(std::string_view{request}.substr(headerEnd + 4, contentLength), args);
+        const std::string body = handle(std::string{path.substr(path.rfind('/') + 1)}, args);
+        if (roundTrip.count() > 0)
+            std::this_thread::sleep_for(roundTrip);
+        respond(client, "200 OK", body);
+    }
+
+    void run() {
+        pollfd listening{.fd = fd, .events = POLLIN, .revents = 0};
+        while (!stopping.load(std::memory_order_relaxed)) {
+            if (::poll(&listening, 1, pollTimeoutMs) <= 0)
+                continue;
+            // several workers may be woken for one connection, the listening socket is non-blocking for that
+            const int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client == -1)
+                continue;
+            try {
+                serve(client);
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("Fake Bot API failed to respond: {}", e.what());
+            }
+            ::close(client);
+        }
+    }
+
+  public:
+    explicit Server(const ServerOptions& options = {}) : roundTrip{options.roundTrip} {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        if (::inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1)
+            throw std::invalid_argument("Invalid IPv4 address: " + options.address);
+
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (fd == -1)
+            throwErrno("Failed to create the fake Bot API socket");
+        const int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        // NOLINTNEXTLINE(*-reinterpret-cast)
+        if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+            throwErrno("Failed to bind the fake Bot API to " + options.address + ':' + std::to_string(options.port));
+        if (::listen(fd, SOMAXCONN) == -1)
+            throwErrno("Failed to listen on the fake Bot API socket");
+        workers.reserve(options.workers);
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.workers, 1); ++i)
+            workers.emplace_back(&Server::run, this);
+    }
+
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+    Server(Server&&) = delete;
+    Server& operator=(Server&&) = delete;
+
+    ~Server() {
+        {
+            const std::lock_guard lock{mutex};
+            stopping.store(true, std::memory_order_relaxed);
+        }
+        updatesAdded.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        ::close(fd);
+    }
+
+    // The Bot API URL to pass to TgBot::Bot
+    [[nodiscard]] std::string url() const {
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size); // NOLINT(*-reinterpret-cast)
+        std::array<char, INET_ADDRSTRLEN> host{};
+        ::inet_ntop(AF_INET, &address.sin_addr, host.data(), host.size());
+        return "http://" + std::string{host.data()} + ':' + std::to_string(ntohs(address.sin_port));
+    }
+
+    // Queues an update given as a JSON object without "update_id", which is assigned here.
+    // It takes no part in reply matching.
+    void push(std::string_view update) {
+        const std::lock_guard lock{mutex};
+        const std::string_view members = update.substr(update.find('{') + 1);
+        std::string json = R"({"update_id":)" + std::to_string(nextUpdateId);
+        // `{}` has no members to separate from the id
+        if (const std::size_t first = members.find_first_not_of(" \t\r\n");
+            first != std::string_view::npos && members[first] != '}')
+            json += ',';
+        json += members;
+        addUpdate(std::move(json));
+    }
+
+    // Generates updates at the given rate for the given duration, blocking the calling thread
+    void generate(const LoadOptions& options) {
+        std::mt19937_64 random{options.seed};
+        std::uniform_int_distribution<std::int64_t> chats{1, std::max<std::int64_t>(options.chats, 1)};
+        std::bernoulli_distribution isCallbackQuery{std::clamp(options.callbackQueryShare, 0.0, 1.0)};
+        const auto count = static_cast<std::uint64_t>(
+            options.updatesPerSecond * std::chrono::duration<double>{options.duration}.count());
+        const Clock::time_point start = Clock::now();
+
+        for (std::uint64_t i = 0; i < count; ++i) {
+            std::this_thread::sleep_until(
+                start + std::chrono::duration_cast<Clock::duration>(
+                            std::chrono::duration<double>{static_cast<double>(i) / options.updatesPerSecond}));
+            const std::int64_t chatId = chats(random);
+            const bool callbackQuery = isCallbackQuery(random);
+
+            const std::lock_guard lock{mutex};
+            const std::int64_t messageId = nextMessageId++;
+            std::string json = R"({"update_id":)" + std::to_string(nextUpdateId);
+            if (callbackQuery) {
+                const std::string id = std::to_string(nextUpdateId);
+                json += R"(,"callback_query":{"id":)";
+                tracing::detail::appendJsonString(json, id);
+                json += R"(,"from":)" + userJson(chatId, false) + R"(,"chat_instance":")" + std::to_string(chatId) +
+                        R"(","message":)" + messageJson(messageId, chatId, true, "") + R"(,"data":)";
+                tracing::detail::appendJsonString(json, options.callbackData);
+                json += "}}";
+                callbackChats.emplace(id, chatId);
+            } else {
+                json += R"(,"message":)" + messageJson(messageId, chatId, false, options.text) + '}';
+            }
+            unanswered[chatId].push_back(Clock::now());
+            addUpdate(std::move(json));
+        }
+    }
+
+    // Waits until every generated update is answered or the timeout expires. Returns whether all were answered.
+    bool waitForReplies(std::chrono::milliseconds timeout) {
+        const Clock::time_point deadline = Clock::now() + timeout;
+        while (Clock::now() < deadline) {
+            {
+                const std::lock_guard lock{mutex};
+                if (std::ranges::all_of(unanswered, [](const auto& chat) { return chat.second.empty(); }))
+                    return true;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        return false;
+    }
+
+    [[nodiscard]] Stats statistics() {
+        const std::lock_guard lock{mutex};
+        Stats result = stats;
+        result.latency = latency.snapshot();
+        return result;
+    }
+};
+
+} // namespace tg_stater::fake_api
+
+#endif // INCLUDE_tgbotstater_fake_api
@@ -16,8 +16,31 @@ class Api;
 
 namespace tg_stater {
 
+class Outbox;
+
+template <typename T>
+class Task;
+
 namespace detail {
 
+// Passed in the place of the API parameter, so that a handler can take either `const TgBot::Api&` or `Outbox&`
+class ApiArg {
+    const TgBot::Api& api;
+    Outbox* outbox;
+
+  public:
+    ApiArg(const TgBot::Api& api, Outbox* outbox) : api{api}, outbox{outbox} {}
+
+    operator const TgBot::Api&() const { // NOLINT(*-explicit-*)
+        return api;
+    }
+
+    // `Stater::setup` checks that the outbox is set if some handler takes it
+    operator Outbox&() const { // NOLINT(*-explicit-*)
+        return *outbox;
+    }
+};
+
 template <concepts::State StateT,
           concepts::OptionalStateOption<StateT> StateOptionT,
           concepts::HandlerType auto HandlerType,
@@ -50,7 +73,8 @@ struct CallbackHelper<StateT, StateOptionT, HandlerType, StateStorageProxyT, std
  *  * from `void(const EventArgs&...)`
  *  * up to `void(StateOption&, const EventArgs&..., const TgBot::Api&, const StateStorageProxy&, const Dependencies&)`
  *
- * Everything except for `EventArgs` is optional.
+ * Everything except for `EventArgs` is optional. `Outbox&` can be taken instead of `const TgBot::Api&`.
+ * A handler may return `Task<>` instead of `void` to be a coroutine.
  * Handlers that are not bound to a specific state can't take state parameter.
  * For the lists of `EventArgs` see `CallbackArgs` member at [event.hpp](include/tg_stater/handler/event.hpp)
  */
@@ -63,8 +87,9 @@ template <auto F,
           typename DependenciesT>
 class Callback {
   public:
-    using EventT = decltype(Event);
-    using TypeT = decltype(HandlerType);
+    // Some compilers make decltype of a class-type template parameter const
+    using EventT = std::remove_cvref_t<decltype(Event)>;
+    using TypeT = std::remove_cvref_t<decltype(HandlerType)>;
 
   private:
     using FT = decltype(F);
@@ -76,33 +101,45 @@ class Callback {
                                           typename EventT::Category::CallbackArgs,
                                           DependenciesT>;
     // using Func = Helper::type;
-    using ApiRef = const TgBot::Api&;
+    using ApiRef = const detail::ApiArg&;
     using SProxyRef = const SProxyT&;
     using DepRef = const DependenciesT&;
 
     static constexpr bool takesState = Helper::takesState;
 
+    using ResultT = typename meta::function_traits<FT>::ReturnT;
+    static_assert(std::is_void_v<ResultT> || std::is_same_v<ResultT, Task<void>>,
+                  "A handler must return void or tg_stater::Task<>.");
+
+    // Bit i is set if F has the i-th signature, in the order of the branches of `transform`
+    template <typename ApiT = ApiRef>
+    static constexpr unsigned signatureMatches() {
+        // NOLINTBEGIN(*-magic-numbers)
+        return (Helper::template invocableWithExtra<FT, false, ApiT, SProxyRef, DepRef> << 0) |
+               (Helper::template invocableWithExtra<FT, false, SProxyRef, DepRef> << 1) |
+               (Helper::template invocableWithExtra<FT, false, ApiT, DepRef> << 2) |
+               (Helper::template invocableWithExtra<FT, false, DepRef> << 3) |
+               (Helper::template invocableWithExtra<FT, false, ApiT, SProxyRef> << 4) |
+               (Helper::template invocableWithExtra<FT, false, SProxyRef> << 5) |
+               (Helper::template invocableWithExtra<FT, false, ApiT> << 6) |
+               (Helper::template invocableWithExtra<FT, false> << 7) |
+               (-static_cast<unsigned>(takesState) &
+                ((Helper::template invocableWithExtra<FT, true, ApiT, SProxyRef, DepRef> << 8) |
+                 (Helper::template invocableWithExtra<FT, true, SProxyRef, DepRef> << 9) |
+                 (Helper::template invocableWithExtra<FT, true, ApiT, DepRef> << 10) |
+                 (Helper::template invocableWithExtra<FT, true, DepRef> << 11) |
+                 (Helper::template invocableWithExtra<FT, true, ApiT, SProxyRef> << 12) |
+                 (Helper::template invocableWithExtra<FT, true, SProxyRef> << 13) |
+                 (Helper::template invocableWithExtra<FT, true, ApiT> << 14) |
+                 (Helper::template invocableWithExtra<FT, true> << 15)));
+        // NOLINTEND(*-magic-numbers)
+    }
+
     static constexpr auto transform() { // NOLINT(*-cognitive-complexity)
         // Inspired by the approach of "userver".
         // https://github.com/userver-framework/userver/blob/develop/libraries/easy/include/userver/easy.hpp
         // NOLINTBEGIN(*-magic-numbers)
-        constexpr unsigned matches = (Helper::template invocableWithExtra<FT, false, ApiRef, SProxyRef, DepRef> << 0) |
-                                     (Helper::template invocableWithExtra<FT, false, SProxyRef, DepRef> << 1) |
-                                     (Helper::template invocableWithExtra<FT, false, ApiRef, DepRef> << 2) |
-                                     (Helper::template invocableWithExtra<FT, false, DepRef> << 3) |
-                                     (Helper::template invocableWithExtra<FT, false, ApiRef, SProxyRef> << 4) |
-                                     (Helper::template invocableWithExtra<FT, false, SProxyRef> << 5) |
-                                     (Helper::template invocableWithExtra<FT, false, ApiRef> << 6) |
-                                     (Helper::template invocableWithExtra<FT, false> << 7) |
-                                     (-static_cast<unsigned>(takesState) &
-                                      ((Helper::template invocableWithExtra<FT, true, ApiRef, SProxyRef, DepRef> << 8) |
-                                       (Helper::template invocableWithExtra<FT, true, SProxyRef, DepRef> << 9) |
-                                       (Helper::template invocableWithExtra<FT, true, ApiRef, DepRef> << 10) |
-                                       (Helper::template invocableWithExtra<FT, true, DepRef> << 11) |
-                                       (Helper::template invocableWithExtra<FT, true, ApiRef, SProxyRef> << 12) |
-                                       (Helper::template invocableWithExtra<FT, true, SProxyRef> << 13) |
-                                       (Helper::template invocableWithExtra<FT, true, ApiRef> << 14) |
-                                       (Helper::template invocableWithExtra<FT, true> << 15)));
+        constexpr unsigned matches = signatureMatches();
         static_assert(matches != 0,
                       "Invalid signature for F template parameter of Callback. "
                       "Find it in \"callback.hpp: In instantiation of... [with auto F = <HERE>...]\" error). "
@@ -114,57 +151,57 @@ class Callback {
             if constexpr (!takesState) {
                 return [](const EventArgs&... args, ApiRef api, SProxyRef proxy, DepRef deps) {
                     if constexpr (matches >> 0U == 1) {
-                        F(args..., api, proxy, deps);
+                        return F(args..., api, proxy, deps);
                     } else if constexpr (matches >> 1U == 1) {
-                        F(args..., proxy, deps);
+                        return F(args..., proxy, deps);
                     } else if constexpr (matches >> 2U == 1) {
-                        F(args..., api, deps);
+                        return F(args..., api, deps);
                     } else if constexpr (matches >> 3U == 1) {
-                        F(args..., deps);
+                        return F(args..., deps);
                     } else if constexpr (matches >> 4U == 1) {
-                        F(args..., api, proxy);
+                        return F(args..., api, proxy);
                     } else if constexpr (matches >> 5U == 1) {
-                        F(args..., proxy);
+                        return F(args..., proxy);
                     } else if constexpr (matches >> 6U == 1) {
-                        F(args..., api);
+                        return F(args..., api);
                     } else if constexpr (matches >> 7U == 1) {
-                        F(args...);
+                        return F(args...);
                     };
                 };
             } else {
                 return [](StateOptionT& state, const EventArgs&... args, ApiRef api, SProxyRef proxy, DepRef deps) {
                     if constexpr (matches >> 0U == 1) {
-                        F(args..., api, proxy, deps);
+                        return F(args..., api, proxy, deps);
                     } else if constexpr (matches >> 1U == 1) {
-                        F(args..., proxy, deps);
+                        return F(args..., proxy, deps);
                     } else if constexpr (matches >> 2U == 1) {
-                        F(args..., api, deps);
+                        return F(args..., api, deps);
                     } else if constexpr (matches >> 3U == 1) {
-                        F(args..., deps);
+                        return F(args..., deps);
                     } else if constexpr (matches >> 4U == 1) {
-                        F(args..., api, proxy);
+                        return F(args..., api, proxy);
                     } else if constexpr (matches >> 5U == 1) {
-                        F(args..., proxy);
+                        return F(args..., proxy);
                     } else if constexpr (matches >> 6U == 1) {
-                        F(args..., api);
+                        return F(args..., api);
                     } else if constexpr (matches >> 7U == 1) {
-                        F(args...);
+                        return F(args...);
                     } else if constexpr (matches >> 8U == 1) {
-                        F(state, args..., api, proxy, deps);
+                        return F(state, args..., api, proxy, deps);
                     } else if constexpr (matches >> 9U == 1) {
-                        F(state, args..., proxy, deps);
+                        return F(state, args..., proxy, deps);
                     } else if constexpr (matches >> 10U == 1) {
-                        F(state, args..., api, deps);
+                        return F(state, args..., api, deps);
                     } else if constexpr (matches >> 11U == 1) {
-                        F(state, args..., deps);
+                        return F(state, args..., deps);
                     } else if constexpr (matches >> 12U == 1) {
-                        F(state, args..., api, proxy);
+                        return F(state, args..., api, proxy);
                     } else if constexpr (matches >> 13U == 1) {
-                        F(state, args..., proxy);
+                        return F(state, args..., proxy);
                     } else if constexpr (matches >> 14U == 1) {
-                        F(state, args..., api);
+                        return F(state, args..., api);
                     } else if constexpr (matches >> 15U == 1) {
-                        F(state, args...);
+                        return F(state, args...);
                     };
                 };
             }
@@ -177,6 +214,13 @@ class Callback {
 
     static constexpr auto underlying = F;
     static constexpr auto func = transform();
+    // The handler is a coroutine run by the dispatcher, see coroutine.hpp
+    static constexpr bool isCoroutine = std::is_same_v<ResultT, Task<void>>;
+    // The handler can switch the state, i.e. takes the StateProxy
+    static constexpr bool takesStateProxy = (signatureMatches() & 0x3333U) != 0; // NOLINT(*-magic-numbers)
+    // The handler takes `Outbox&`: its API parameter cannot be bound to `const TgBot::Api&`
+    static constexpr bool takesOutbox = (signatureMatches() & 0x5555U) != 0 && // NOLINT(*-magic-numbers)
+                                        (signatureMatches<const TgBot::Api&>() & 0x5555U) == 0;
     static constexpr auto event = Event;
     static constexpr auto type = HandlerType;
     using StateOption = StateOptionT;
@@ -7,6 +7,9 @@
 #include <boost/core/demangle.hpp>
 #endif
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <cstddef>
 #include <ctime>
@@ -14,6 +17,8 @@
 #include <iostream>
 #include <string>
 #include <string_view>
+#include <type_traits>
+#include <typeinfo>
 #include <utility>
 
 #if __cpp_lib_format >= 201907L
@@ -62,7 +67,7 @@ inline constexpr const char* loggingLevelName<FATAL> = "FATAL";
 
 constexpr LoggingLevel loggingLevel =
 #if defined(TGBOTSTATER_LOG_OFF)
-    OFF
+    LoggingLevel::OFF
 #elif defined(TGBOTSTATER_LOG_DEBUG)
     DEBUG
 #elif defined(TGBOTSTATER_LOG_INFO)
@@ -81,20 +86,94 @@ constexpr LoggingLevel loggingLevel =
 template <LoggingLevel level>
 static constexpr bool atLeast = loggingLevel <= level;
 
+namespace detail {
+
+// Longer messages are truncated when logged asynchronously
+inline constexpr std::size_t maxRecordSize = 256;
+
+// Receiver of formatted messages that replaces the synchronous output, see AsyncLogger in async_logging.hpp
+class RecordQueue {
+  public:
+    virtual void push(LoggingLevel level, std::chrono::system_clock::time_point time, std::string_view message) = 0;
+
+  protected:
+    RecordQueue() = default;
+    RecordQueue(const RecordQueue&) = default;
+    RecordQueue& operator=(const RecordQueue&) = default;
+    RecordQueue(RecordQueue&&) = default;
+    RecordQueue& operator=(RecordQueue&&) = default;
+    ~RecordQueue() = default;
+};
+
+inline std::atomic<RecordQueue*> recordQueue{nullptr};
+
+// Number of log calls that may be using the installed RecordQueue, which must not be destroyed until it drops to 0
+inline std::atomic<std::size_t> recordProducers{0};
+
+class RecordProducer {
+  public:
+    RecordProducer() {
+        // sequentially consistent with the store of `recordQueue` in the logger's destructor:
+        // either the destructor sees this producer or the producer sees no queue
+        recordProducers.fetch_add(1, std::memory_order_seq_cst);
+    }
+
+    RecordProducer(const RecordProducer&) = delete;
+    RecordProducer& operator=(const RecordProducer&) = delete;
+    RecordProducer(RecordProducer&&) = delete;
+    RecordProducer& operator=(RecordProducer&&) = delete;
+
+    ~RecordProducer() {
+        recordProducers.fetch_sub(1, std::memory_order_release);
+    }
+};
+
+// std::localtime is not thread-safe
+inline std::tm localTime(std::time_t time) {
+    std::tm tm{};
+#ifdef _WIN32
+    localtime_s(&tm, &time);
+#else
+    localtime_r(&time, &tm);
+#endif
+    return tm;
+}
+
+} // namespace detail
+
 template <LoggingLevel level = LoggingLevel::INFO, typename... Args>
     requires ValidLoggingLevel<level>
 void log(TGBOTSTATER_FMT_NAMESPACE::format_string<Args...> format, Args&&... args) {
     if constexpr (atLeast<level>) {
         using std::chrono::system_clock;
-        std::time_t time = system_clock::to_time_t(system_clock::now());
+        const auto now = system_clock::now();
+
+        if (detail::recordQueue.load(std::memory_order_relaxed)) {
+            const detail::RecordProducer producer;
+            if (detail::RecordQueue* queue = detail::recordQueue.load(std::memory_order_seq_cst)) {
+                // formatted right into a stack buffer, the rest is up to the logger's thread
+                std::array<char, detail::maxRecordSize> buffer; // NOLINT(*-member-init)
+                const auto result = TGBOTSTATER_FMT_NAMESPACE::format_to_n(
+                    buffer.data(), buffer.size(), format, std::forward<Args>(args)...);
+                const auto size = static_cast<std::size_t>(result.size);
+                if (size > buffer.size())
+                    std::ranges::fill(buffer.end() - 3, buffer.end(), '.');
+                queue->push(level, now, {buffer.data(), std::min(size, buffer.size())});
+                return;
+            }
+        }
+
+        const std::tm time = detail::localTime(system_clock::to_time_t(now));
         std::string message = TGBOTSTATER_FMT_NAMESPACE::format(format, std::forward<Args>(args)...);
-        std::clog << '[' << loggingLevelName<level> << "] [" << std::put_time(std::localtime(&time), "%FT%T%z") << "] "
-                  << message << '\n';
+        std::clog << '[' << loggingLevelName<level> << "] [" << std::put_time(&time, "%FT%T%z") << "] " << message
+                  << '\n';
     }
 }
 
+namespace detail {
+
 template <typename Callback>
-auto getHandlerName() {
+std::string demangleHandlerName() {
 #ifndef TGBOTSTATER_NOT_DEMANGLE_TYPES
     std::string nameWrapped = boost::core::demangle(typeid(meta::ValueProxy<Callback::underlying>).name());
 
@@ -148,11 +227,12 @@ auto getHandlerName() {
 }
 
 template <typename StateOption>
-auto getStateName() {
+std::string demangleStateName() {
 #ifndef TGBOTSTATER_NOT_DEMANGLE_TYPES
 #ifndef TGBOTSTATER_FULL_TYPE_NAMES
     std::string fullName = boost::core::demangle(typeid(StateOption).name());
-    fullName.erase(0, fullName.rfind("::") + 2);
+    if (const std::size_t namespaceEnd = fullName.rfind("::"); namespaceEnd != std::string::npos)
+        fullName.erase(0, namespaceEnd + 2);
     return fullName;
 #else
     return boost::core::demangle(typeid(StateOption).name());
@@ -162,6 +242,25 @@ auto getStateName() {
 #endif
 }
 
+} // namespace detail
+
+// Names are demangled once per type, the following calls return the cached string
+template <typename Callback>
+std::string_view getHandlerName() {
+    static const std::string name = detail::demangleHandlerName<Callback>();
+    return name;
+}
+
+template <typename StateOption>
+std::string_view getStateName() {
+    if constexpr (std::is_same_v<StateOption, std::remove_cvref_t<StateOption>>) {
+        static const std::string name = detail::demangleStateName<StateOption>();
+        return name;
+    } else {
+        return getStateName<std::remove_cvref_t<StateOption>>();
+    }
+}
+
 } // namespace tg_stater::logging
 
 #endif // INCLUDE_tgbotstater_detail_logging
@@ -0,0 +1,335 @@
+#ifndef INCLUDE_tgbotstater_metrics
+#define INCLUDE_tgbotstater_metrics
+
+#include "tg_stater/logging.hpp"
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <variant>
+
+namespace tg_stater::metrics {
+
+// Metrics are collected if TGBOTSTATER_METRICS is defined, and TGBOTSTATER_NO_METRICS overrides it.
+// Timing every handler costs two clock reads, so it is opt-in.
+constexpr bool enabled =
+#if defined(TGBOTSTATER_METRICS) && !defined(TGBOTSTATER_NO_METRICS)
+    true
+#else
+    false
+#endif
+    ;
+
+namespace detail {
+
+inline constexpr std::size_t shardCount = 16;
+
+// Threads are spread over the shards in the order they first record something
+inline std::size_t shardIndex() {
+    static std::atomic<std::size_t> nextThread{0};
+    thread_local const std::size_t index = nextThread.fetch_add(1, std::memory_order_relaxed) % shardCount;
+    return index;
+}
+
+// Nanoseconds since `start`
+inline std::uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+}
+
+} // namespace detail
+
+// A counter split into per-thread cache lines, so that threads never write to a shared line.
+// Reading sums the shards.
+class Counter {
+    struct alignas(64) Cell { // NOLINT(*-magic-numbers)
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<Cell, detail::shardCount> cells;
+
+  public:
+    void inc(std::uint64_t n = 1) {
+        cells[detail::shardIndex()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]] std::uint64_t value() const {
+        std::uint64_t sum = 0;
+        for (const Cell& cell : cells)
+            sum += cell.value.load(std::memory_order_relaxed);
+        return sum;
+    }
+};
+
+/*
+ * Latency histogram with log-linear buckets, as in HdrHistogram: each power of 2 of nanoseconds
+ * from 128 ns to 64 s is split into 4 buckets, so a bucket is at most 25% wide.
+ * Recording is a bit scan and a relaxed increment in the calling thread's shard.
+ */
+class Histogram {
+  public:
+    static constexpr unsigned subBits = 2;
+    static constexpr unsigned minExponent = 7;  // 128 ns, the bound of the first bucket
+    static constexpr unsigned maxExponent = 35; // 34-68 s is the last finite octave
+    // The first bucket, 4 per octave and +Inf
+    static constexpr std::size_t bucketCount = 1 + ((maxExponent - minExponent + 1) << subBits) + 1;
+
+    static constexpr std::size_t bucketOf(std::uint64_t ns) {
+        if (ns < (std::uint64_t{1} << minExponent))
+            return 0;
+        const auto exponent = static_cast<unsigned>(std::bit_width(ns) - 1);
+        if (exponent > maxExponent)
+            return bucketCount - 1;
+        const std::size_t sub = (ns >> (exponent - subBits)) & ((1U << subBits) - 1);
+        return 1 + ((exponent - minExponent) << subBits) + sub;
+    }
+
+    // Exclusive upper bound of a finite bucket in nanoseconds
+    static constexpr std::uint64_t upperBound(std::size_t bucket) {
+        if (bucket == 0)
+            return std::uint64_t{1} << minExponent;
+        const std::size_t exponent = minExponent + ((bucket - 1) >> subBits);
+        const std::size_t sub = (bucket - 1) & ((1U << subBits) - 1);
+        return ((1U << subBits) + sub + 1) << (exponent - subBits);
+    }
+
+  private:
+    struct alignas(64) Shard { // NOLINT(*-magic-numbers)
+        std::array<std::atomic<std::uint64_t>, bucketCount> buckets{};
+        std::atomic<std::uint64_t> sumNs{0};
+    };
+    std::array<Shard, detail::shardCount> shards;
+
+  public:
+    void record(std::uint64_t ns) {
+        Shard& shard = shards[detail::shardIndex()];
+        shard.buckets[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+        shard.sumNs.fetch_add(ns, std::memory_order_relaxed);
+    }
+
+    struct Snapshot {
+        std::array<std::uint64_t, bucketCount> buckets{};
+        std::uint64_t sumNs = 0;
+        std::uint64_t count = 0;
+
+        // Upper bound of the bucket holding the q-quantile, so at most 25% above the true value.
+        // Values past the last finite bucket are reported as its bound.
+        [[nodiscard]] std::uint64_t quantileNs(double q) const {
+            const auto rank = static_cast<std::uint64_t>(q * static_cast<double>(count));
+            std::uint64_t cumulative = 0;
+            for (std::size_t i = 0; i + 1 < bucketCount; ++i) {
+                cumulative += buckets[i];
+                if (cumulative > rank || cumulative == count)
+                    return count == 0 ? 0 : upperBound(i);
+            }
+            return upperBound(bucketCount - 2);
+        }
+    };
+
+    [[nodiscard]] Snapshot snapshot() const {
+        Snapshot result;
+        for (const Shard& shard : shards) {
+            for (std::size_t i = 0; i < bucketCount; ++i)
+                result.buckets[i] += shard.buckets[i].load(std::memory_order_relaxed);
+            result.sumNs += shard.sumNs.load(std::memory_order_relaxed);
+        }
+        for (const std::uint64_t n : result.buckets)
+            result.count += n;
+        return result;
+    }
+};
+
+struct HandlerMetrics {
+    Histogram latency; // its count is the number of invocations
+    Counter exceptions;
+};
+
+/*
+ * All the metrics of the process. Metrics are registered by name once, usually on the first update that touches them,
+ * and live as long as the process. Metrics with the same name are shared (e.g. two lambdas from one function).
+ */
+class Registry {
+    template <typename T>
+    struct Named {
+        std::string name;
+        T metric;
+    };
+
+    mutable std::mutex mutex; // guards registration, not the metrics
+    std::deque<Named<HandlerMetrics>> handlers;
+    std::deque<Named<Counter>> events;
+    std::deque<Named<Counter>> states;
+
+    template <typename T>
+    T& find(std::deque<Named<T>>& metrics, std::string_view name) {
+        std::lock_guard lock{mutex};
+        for (Named<T>& named : metrics)
+            if (named.name == name)
+                return named.metric;
+        return metrics.emplace_back(std::string{name}).metric;
+    }
+
+    static void appendLabel(std::string& out, std::string_view label, std::string_view value) {
+        out += label;
+        out += "=\"";
+        for (const char c : value) {
+            if (c == '\\' || c == '"')
+                out += '\\';
+            if (c == '\n')
+                out += "\\n";
+            else
+                out += c;
+        }
+        out += '"';
+    }
+
+    static void appendHeader(std::string& out, std::string_view name, std::string_view type, std::string_view help) {
+        out += "# HELP ";
+        out += name;
+        out += ' ';
+        out += help;
+        out += "\n# TYPE ";
+        out += name;
+        out += ' ';
+        out += type;
+        out += '\n';
+    }
+
+    static void appendSample(std::string& out, std::string_view name, std::string_view labels, std::string_view value) {
+        out += name;
+        if (!labels.empty()) {
+            out += '{';
+            out += labels;
+            out += '}';
+        }
+        out += ' ';
+        out += value;
+        out += '\n';
+    }
+
+    static void appendCounters(std::string& out,
+                               std::string_view name,
+                               std::string_view help,
+                               std::string_view label,
+                               const std::deque<Named<Counter>>& counters) {
+        appendHeader(out, name, "counter", help);
+        std::string labels;
+        for (const auto& [counterName, counter] : counters) {
+            labels.clear();
+            appendLabel(labels, label, counterName);
+            appendSample(out, name, labels, std::to_string(counter.value()));
+        }
+    }
+
+    // Exact decimal, so that bucket bounds read as 0.000000192 rather than 1.9200000000000003e-07
+    static std::string seconds(std::uint64_t ns) {
+        static constexpr std::uint64_t nsPerSecond = 1'000'000'000;
+        std::string fraction = std::to_string(ns % nsPerSecond + nsPerSecond).substr(1);
+        fraction.erase(fraction.find_last_not_of('0') + 1);
+        std::string result = std::to_string(ns / nsPerSecond);
+        if (!fraction.empty())
+            result += '.' + fraction;
+        return result;
+    }
+
+  public:
+    Counter updatesWithoutState;
+    Counter storageGets;
+    Counter storagePuts;
+    Counter storageErases;
+
+    HandlerMetrics& handler(std::string_view name) {
+        return find(handlers, name);
+    }
+
+    Counter& event(std::string_view name) {
+        return find(events, name);
+    }
+
+    Counter& state(std::string_view name) {
+        return find(states, name);
+    }
+
+    // All the metrics in the Prometheus text exposition format
+    [[nodiscard]] std::string prometheusText() const {
+        std::lock_guard lock{mutex};
+        std::string out;
+        std::string labels;
+
+        static constexpr std::string_view duration = "tgbotstater_handler_duration_seconds";
+        appendHeader(out, duration, "histogram", "Time spent in a handler.");
+        for (const auto& [name, metrics] : handlers) {
+            const Histogram::Snapshot snapshot = metrics.latency.snapshot();
+            labels.clear();
+            appendLabel(labels, "handler", name);
+            const std::size_t handlerLabelSize = labels.size();
+            std::uint64_t cumulative = 0;
+            for (std::size_t i = 0; i < Histogram::bucketCount; ++i) {
+                cumulative += snapshot.buckets[i];
+                labels.resize(handlerLabelSize);
+                labels += ',';
+                appendLabel(labels, "le", i + 1 == Histogram::bucketCount ? "+Inf" : seconds(Histogram::upperBound(i)));
+                appendSample(out, "tgbotstater_handler_duration_seconds_bucket", labels, std::to_string(cumulative));
+            }
+            labels.resize(handlerLabelSize);
+            appendSample(out, "tgbotstater_handler_duration_seconds_sum", labels, seconds(snapshot.sumNs));
+            appendSample(out, "tgbotstater_handler_duration_seconds_count", labels, std::to_string(snapshot.count));
+        }
+
+        static constexpr std::string_view exceptions = "tgbotstater_handler_exceptions_total";
+        appendHeader(out, exceptions, "counter", "Exceptions thrown by a handler.");
+        for (const auto& [name, metrics] : handlers) {
+            labels.clear();
+            appendLabel(labels, "handler", name);
+            appendSample(out, exceptions, labels, std::to_string(metrics.exceptions.value()));
+        }
+
+        appendCounters(out, "tgbotstater_events_total", "Updates received, by event type.", "event", events);
+        appendCounters(
+            out, "tgbotstater_state_updates_total", "Updates handled, by the current state.", "state", states);
+
+        static constexpr std::string_view withoutState = "tgbotstater_updates_without_state_total";
+        appendHeader(out, withoutState, "counter", "Updates handled when the chat had no state.");
+        appendSample(out, withoutState, {}, std::to_string(updatesWithoutState.value()));
+
+        static constexpr std::string_view storage = "tgbotstater_storage_operations_total";
+        appendHeader(out, storage, "counter", "Operations on the state storage.");
+        appendSample(out, storage, R"(operation="get")", std::to_string(storageGets.value()));
+        appendSample(out, storage, R"(operation="put")", std::to_string(storagePuts.value()));
+        appendSample(out, storage, R"(operation="erase")", std::to_string(storageErases.value()));
+        return out;
+    }
+};
+
+inline Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+// Metrics of a handler, looked up once per callback type
+template <typename Callback>
+HandlerMetrics& handlerMetrics() {
+    static HandlerMetrics& metrics = registry().handler(logging::getHandlerName<Callback>());
+    return metrics;
+}
+
+// Update counters of the state options, indexed by `StateT::index()`
+template <typename StateT>
+const auto& stateCounters() {
+    static const auto counters = []<std::size_t... I>(std::index_sequence<I...>) {
+        return std::array<Counter*, sizeof...(I)>{
+            &registry().state(logging::getStateName<std::variant_alternative_t<I, StateT>>())...};
+    }(std::make_index_sequence<std::variant_size_v<StateT>>{});
+    return counters;
+}
+
+} // namespace tg_stater::metrics
+
+#endif // INCLUDE_tgbotstater_metrics
@@ -0,0 +1,157 @@
+#ifndef INCLUDE_tgbotstater_metrics_exporter
+#define INCLUDE_tgbotstater_metrics_exporter
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/metrics.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace tg_stater::metrics {
+
+struct ExporterOptions {
+    std::string address = "0.0.0.0";
+    std::uint16_t port = 9464; // NOLINT(*-magic-numbers)
+};
+
+/*
+ * Serves `GET /metrics` with the registry in the Prometheus text format on a background thread.
+ *
+ * It is a minimal HTTP/1.0 server meant for a scraper: one connection at a time, the connection is closed
+ * after the response, any other request gets 404. POSIX only.
+ */
+class Exporter {
+    static constexpr int pollTimeoutMs = 200;
+    static constexpr std::size_t maxRequestSize = 8192;
+
+    int fd = -1;
+    std::atomic<bool> stopping{false};
+    std::thread worker;
+
+    [[noreturn]] void throwErrno(const std::string& what) {
+        const int error = errno;
+        if (fd != -1)
+            ::close(fd);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    static void sendAll(int client, std::string_view data) {
+        while (!data.empty()) {
+            const ssize_t sent = ::send(client, data.data(), data.size(), MSG_NOSIGNAL);
+            if (sent <= 0)
+                return;
+            data.remove_prefix(static_cast<std::size_t>(sent));
+        }
+    }
+
+    static void respond(int client, std::string_view status, std::string_view contentType, std::string_view body) {
+        std::string response = "HTTP/1.0 ";
+        response += status;
+        response += "\r\nContent-Type: ";
+        response += contentType;
+        response += "\r\nContent-Length: ";
+        response += std::to_string(body.size());
+        response += "\r\nConnection: close\r\n\r\n";
+        response += body;
+        sendAll(client, response);
+    }
+
+    static void serve(int client) {
+        // a slow client must not block the exporter for long
+        timeval timeout{.tv_sec = 1, .tv_usec = 0};
+        ::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        std::string request;
+        std::array<char, 1024> buffer{}; // NOLINT(*-magic-numbers)
+        while (request.find("\r\n\r\n") == std::string::npos && request.size() < maxRequestSize) {
+            const ssize_t received = ::recv(client, buffer.data(), buffer.size(), 0);
+            if (received <= 0)
+                return;
+            request.append(buffer.data(), static_cast<std::size_t>(received));
+        }
+
+        const std::string_view requestLine = std::string_view{request}.substr(0, request.find("\r\n"));
+        if (requestLine.starts_with("GET /metrics ") || requestLine.starts_with("GET /metrics?"))
+            respond(client, "200 OK", "text/plain; version=0.0.4; charset=utf-8", registry().prometheusText());
+        else
+            respond(client, "404 Not Found", "text/plain", "Not found\n");
+    }
+
+    void run() {
+        pollfd listening{.fd = fd, .events = POLLIN, .revents = 0};
+        while (!stopping.load(std::memory_order_relaxed)) {
+            if (::poll(&listening, 1, pollTimeoutMs) <= 0)
+                continue;
+            const int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+            if (client == -1)
+                continue;
+            try {
+                serve(client);
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("Metrics exporter failed to respond: {}", e.what());
+            }
+            ::close(client);
+        }
+    }
+
+  public:
+    explicit Exporter(const ExporterOptions& options = {}) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        if (::inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1)
+            throw std::invalid_argument("Invalid IPv4 address: " + options.address);
+
+        fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd == -1)
+            throwErrno("Failed to create the metrics socket");
+        const int reuse = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        // NOLINTNEXTLINE(*-reinterpret-cast)
+        if (::bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+            throwErrno("Failed to bind the metrics endpoint to " + options.address + ':' +
+                       std::to_string(options.port));
+        if (::listen(fd, SOMAXCONN) == -1)
+            throwErrno("Failed to listen on the metrics endpoint");
+        worker = std::thread{&Exporter::run, this};
+    }
+
+    Exporter(const Exporter&) = delete;
+    Exporter& operator=(const Exporter&) = delete;
+    Exporter(Exporter&&) = delete;
+    Exporter& operator=(Exporter&&) = delete;
+
+    ~Exporter() {
+        stopping.store(true, std::memory_order_relaxed);
+        worker.join();
+        ::close(fd);
+    }
+
+    // The bound port, useful when the options asked for port 0
+    [[nodiscard]] std::uint16_t port() const {
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &size); // NOLINT(*-reinterpret-cast)
+        return ntohs(address.sin_port);
+    }
+};
+
+} // namespace tg_stater::metrics
+
+#endif // INCLUDE_tgbotstater_metrics_exporter
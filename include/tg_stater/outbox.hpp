@@ -0,0 +1,386 @@
+#ifndef INCLUDE_tgbotstater_outbox
+#define INCLUDE_tgbotstater_outbox
+
+#include "tg_stater/coroutine.hpp"
+#include "tg_stater/logging.hpp"
+
+#include <tgbot/Api.h>
+#include <tgbot/TgException.h>
+#include <tgbot/types/Message.h>
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace tg_stater {
+
+// The defaults are the limits of the Bot API: about 30 messages per second in total and 1 per second per chat
+struct OutboxOptions {
+    std::size_t workers = 4;
+    double globalRate = 30;  // NOLINT(*-magic-numbers) requests per second
+    double globalBurst = 30; // NOLINT(*-magic-numbers)
+    double chatRate = 1;
+    double chatBurst = 3;    // NOLINT(*-magic-numbers)
+    // `post` blocks while this many requests are waiting. `async` doesn't, its requests are bounded by the coroutines.
+    std::size_t capacity = 10'000; // NOLINT(*-magic-numbers)
+    // Attempts of a request answered with 429 Too Many Requests, each after the `retry_after` it was told
+    unsigned maxAttempts = 5; // NOLINT(*-magic-numbers)
+};
+
+namespace detail {
+
+class TokenBucket {
+    using Clock = std::chrono::steady_clock;
+
+    double rate;
+    double burst;
+    double tokens;
+    Clock::time_point last;
+    Clock::time_point pausedUntil{};
+
+    void refill(Clock::time_point now) {
+        tokens = std::min(burst, tokens + (rate * std::chrono::duration<double>{now - last}.count()));
+        last = now;
+    }
+
+  public:
+    TokenBucket(double rate, double burst, Clock::time_point now)
+        : rate{rate}, burst{std::max(burst, 1.0)}, tokens{this->burst}, last{now} {}
+
+    [[nodiscard]] bool ready(Clock::time_point now) {
+        if (now < pausedUntil)
+            return false;
+        refill(now);
+        return tokens >= 1;
+    }
+
+    // Only after `ready`
+    void take() {
+        tokens -= 1;
+    }
+
+    [[nodiscard]] Clock::time_point readyAt() const {
+        const Clock::time_point refilled =
+            last + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>{(1 - tokens) / rate});
+        return std::max(pausedUntil, tokens >= 1 ? last : refilled);
+    }
+
+    // After 429: no requests until `until`
+    void pause(Clock::time_point until) {
+        pausedUntil = std::max(pausedUntil, until);
+        tokens = 0;
+    }
+
+    // Full and not paused, so that forgetting it changes nothing
+    [[nodiscard]] bool idle(Clock::time_point now) {
+        refill(now);
+        return tokens >= burst && now >= pausedUntil;
+    }
+};
+
+// `retry_after` of a 429 response. TgBot keeps only the description, "Too Many Requests: retry after N".
+// Called from a catch handler, so it must not throw: a missing or unparsable N is 1 second, a huge one an hour.
+inline std::optional<std::chrono::seconds> retryAfter(const TgBot::TgException& e) {
+    static constexpr std::size_t tooManyRequests = 429;
+    static constexpr std::chrono::seconds fallback{1};
+    static constexpr std::chrono::seconds longest = std::chrono::hours{1};
+    if (static_cast<std::size_t>(e.errorCode) != tooManyRequests)
+        return std::nullopt;
+    const std::string_view description = e.what();
+    const std::string_view digits = description.substr(description.find_last_not_of("0123456789") + 1);
+    std::uint64_t seconds = 0;
+    const std::errc error = std::from_chars(digits.data(), digits.data() + digits.size(), seconds).ec;
+    if (error == std::errc::result_out_of_range || seconds > static_cast<std::uint64_t>(longest.count()))
+        return longest;
+    if (error != std::errc{} || seconds == 0)
+        return fallback;
+    return std::chrono::seconds{static_cast<std::chrono::seconds::rep>(seconds)};
+}
+
+} // namespace detail
+
+/*
+ * Sends API requests from a pool of workers instead of the handler's thread, within the rate limits of the Bot API:
+ * a global token bucket and one per chat. Requests of a chat are sent one at a time and in order.
+ * A request answered with 429 waits for its `retry_after`, and so does the rest of its chat (or everything
+ * for a request without a chat).
+ *
+ * Requests go through the bot's HttpClient, so connections are reused as that client does it;
+ * the workers are long-lived, so a client that keeps a connection per thread keeps one per worker.
+ * Requests still queued when the outbox is destroyed are dropped, their futures get `broken_promise`.
+ */
+class Outbox {
+    using Clock = std::chrono::steady_clock;
+
+    struct Request {
+        std::optional<std::int64_t> chat;
+        // Sends the request and fulfils its promise. Returns the pause asked by a 429 if it may be retried.
+        std::function<std::optional<std::chrono::seconds>(const TgBot::Api&, bool lastAttempt)> send;
+        unsigned attempts = 0;
+    };
+
+    const TgBot::Api& api;
+    OutboxOptions options;
+
+    std::mutex mutex;
+    std::condition_variable changed; // a request is queued or finished
+    std::condition_variable spaceFreed;
+    std::deque<Request> queue;
+    std::unordered_map<std::int64_t, detail::TokenBucket> chatBuckets;
+    std::unordered_set<std::int64_t> chatsInFlight;
+    std::size_t cleanupSize = 4096; // NOLINT(*-magic-numbers)
+    detail::TokenBucket globalBucket;
+    std::size_t inFlight = 0;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    // The first queued request that may be sent now, or when to look again. Must be called under the lock.
+    std::optional<Request> takeReady(Clock::time_point now, Clock::time_point& wakeAt) {
+        wakeAt = Clock::time_point::max();
+        if (queue.empty())
+            return std::nullopt;
+        if (!globalBucket.ready(now)) {
+            wakeAt = globalBucket.readyAt();
+            return std::nullopt;
+        }
+        std::unordered_set<std::int64_t> waitingChats; // later requests of them must wait to keep the order
+        for (auto it = queue.begin(); it != queue.end(); ++it) {
+            if (it->chat) {
+                const std::int64_t chat = *it->chat;
+                if (chatsInFlight.contains(chat) || waitingChats.contains(chat))
+                    continue; // a finished request wakes the workers
+                detail::TokenBucket& bucket =
+                    chatBuckets.try_emplace(chat, options.chatRate, options.chatBurst, now).first->second;
+                if (!bucket.ready(now)) {
+                    wakeAt = std::min(wakeAt, bucket.readyAt());
+                    waitingChats.insert(chat);
+                    continue;
+                }
+                bucket.take();
+            }
+            globalBucket.take();
+            Request request = std::move(*it);
+            queue.erase(it);
+            return request;
+        }
+        return std::nullopt;
+    }
+
+    // Buckets of chats that have been quiet for a while are full, so they are forgotten once there are many
+    void forgetIdleChats() {
+        static constexpr std::size_t minCleanupSize = 4096;
+        if (chatBuckets.size() < cleanupSize)
+            return;
+        const Clock::time_point now = Clock::now();
+        for (auto it = chatBuckets.begin(); it != chatBuckets.end();)
+            it = !chatsInFlight.contains(it->first) && it->second.idle(now) ? chatBuckets.erase(it) : std::next(it);
+        cleanupSize = std::max(minCleanupSize, 2 * chatBuckets.size());
+    }
+
+    void run() {
+        std::unique_lock lock{mutex};
+        while (true) {
+            Clock::time_point wakeAt;
+            std::optional<Request> request;
+            while (!stopping && !(request = takeReady(Clock::now(), wakeAt))) {
+                if (wakeAt == Clock::time_point::max())
+                    changed.wait(lock);
+                else
+                    changed.wait_until(lock, wakeAt);
+            }
+            if (stopping)
+                return;
+
+            ++inFlight;
+            if (request->chat)
+                chatsInFlight.insert(*request->chat);
+            spaceFreed.notify_one();
+            lock.unlock();
+            const bool lastAttempt = ++request->attempts >= options.maxAttempts;
+            const std::optional<std::chrono::seconds> pause = request->send(api, lastAttempt);
+            lock.lock();
+
+            --inFlight;
+            if (request->chat)
+                chatsInFlight.erase(*request->chat);
+            if (pause) {
+                logging::log<logging::WARN>("Too many requests, retrying after {}s", pause->count());
+                const Clock::time_point until = Clock::now() + *pause;
+                if (request->chat)
+                    chatBuckets.at(*request->chat).pause(until);
+                else
+                    globalBucket.pause(until);
+                queue.push_front(std::move(*request));
+            }
+            forgetIdleChats();
+            changed.notify_all();
+        }
+    }
+
+    // Queues `call(api)`, whose result or exception goes to `sink->set_value`/`sink->set_exception`.
+    // Unless `waitForSpace`, the request is queued even beyond the capacity.
+    template <typename F, typename SinkPtr>
+    void enqueue(std::optional<std::int64_t> chat, F call, SinkPtr sink, bool waitForSpace = true) {
+        using R = std::invoke_result_t<F&, const TgBot::Api&>;
+        Request request{
+            chat,
+            [sink, call = std::move(call)](const TgBot::Api& api,
+                                           bool lastAttempt) mutable -> std::optional<std::chrono::seconds> {
+                try {
+                    if constexpr (std::is_void_v<R>) {
+                        call(api);
+                        sink->set_value();
+                    } else {
+                        sink->set_value(call(api));
+                    }
+                } catch (const TgBot::TgException& e) {
+                    if (const auto pause = detail::retryAfter(e); pause && !lastAttempt)
+                        return pause;
+                    sink->set_exception(std::current_exception());
+                } catch (...) {
+                    sink->set_exception(std::current_exception());
+                }
+                return std::nullopt;
+            }};
+
+        std::unique_lock lock{mutex};
+        if (waitForSpace)
+            spaceFreed.wait(lock, [&] { return queue.size() < options.capacity || stopping; });
+        queue.push_back(std::move(request));
+        changed.notify_one();
+    }
+
+  public:
+    explicit Outbox(const TgBot::Api& api, OutboxOptions options = {})
+        : api{api}, options{options}, globalBucket{options.globalRate, options.globalBurst, Clock::now()} {
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.workers, 1); ++i)
+            workers.emplace_back(&Outbox::run, this);
+    }
+
+    Outbox(const Outbox&) = delete;
+    Outbox& operator=(const Outbox&) = delete;
+    Outbox(Outbox&&) = delete;
+    Outbox& operator=(Outbox&&) = delete;
+
+    ~Outbox() {
+        {
+            const std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        changed.notify_all();
+        spaceFreed.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    // Awaited by a coroutine handler, see `async`
+    template <typename F>
+    class Awaiter {
+        using R = std::invoke_result_t<F&, const TgBot::Api&>;
+
+        Outbox& outbox;
+        std::optional<std::int64_t> chat;
+        F call;
+        std::optional<std::conditional_t<std::is_void_v<R>, std::monostate, R>> value;
+        std::exception_ptr exception;
+        std::function<void()> resume;
+
+      public:
+        Awaiter(Outbox& outbox, std::optional<std::int64_t> chat, F call)
+            : outbox{outbox}, chat{chat}, call{std::move(call)} {}
+
+        [[nodiscard]] bool await_ready() const noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        void await_suspend(std::coroutine_handle<Promise> handle) {
+            resume = [handle, executor = detail::executorOf(handle)] { executor([handle] { handle.resume(); }); };
+            // runs on a dispatcher's worker, which must not wait for the outbox's workers: they may be waiting
+            // to post resumptions to it
+            outbox.enqueue(chat, std::move(call), this, false);
+        }
+
+        // Called by the outbox's worker. Once the resumption is posted, the coroutine may run and destroy
+        // the awaiter, so the callback is moved out of it first.
+        template <typename... V>
+        void set_value(V&&... result) {
+            value.emplace(std::forward<V>(result)...);
+            std::exchange(resume, nullptr)();
+        }
+        void set_exception(std::exception_ptr e) {
+            exception = std::move(e);
+            std::exchange(resume, nullptr)();
+        }
+
+        R await_resume() {
+            if (exception)
+                std::rethrow_exception(exception);
+            if constexpr (!std::is_void_v<R>)
+                return std::move(*value);
+        }
+    };
+
+    /*
+     * Queues `call(api)` to be sent within the limits of `chat`, or only the global limit if there is no chat.
+     * The future gets its result or exception; a call answered with 429 is repeated, so it must be safe to repeat.
+     */
+    template <typename F>
+    auto post(std::optional<std::int64_t> chat, F call) -> std::future<std::invoke_result_t<F&, const TgBot::Api&>> {
+        auto promise = std::make_shared<std::promise<std::invoke_result_t<F&, const TgBot::Api&>>>();
+        auto future = promise->get_future();
+        enqueue(chat, std::move(call), std::move(promise));
+        return future;
+    }
+
+    // The same as `post`, but awaited by a coroutine handler: `auto message = co_await outbox.async(chat, call);`
+    template <typename F>
+    Awaiter<F> async(std::optional<std::int64_t> chat, F call) {
+        return Awaiter<F>{*this, chat, std::move(call)};
+    }
+
+    std::future<TgBot::Message::Ptr> sendMessage(std::int64_t chatId, std::string text) {
+        return post(chatId, [chatId, text = std::move(text)](const TgBot::Api& api) {
+            return api.sendMessage(chatId, text);
+        });
+    }
+
+    // Not bound to a chat, only the global limit applies
+    std::future<bool> answerCallbackQuery(std::string callbackQueryId, std::string text = "") {
+        return post(std::nullopt, [id = std::move(callbackQueryId), text = std::move(text)](const TgBot::Api& api) {
+            return api.answerCallbackQuery(id, text);
+        });
+    }
+
+    // Blocks until every request queued so far is sent
+    void flush() {
+        std::unique_lock lock{mutex};
+        changed.wait(lock, [&] { return (queue.empty() && inFlight == 0) || stopping; });
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_outbox
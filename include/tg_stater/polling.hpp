@@ -0,0 +1,180 @@
+#ifndef INCLUDE_tgbotstater_polling
+#define INCLUDE_tgbotstater_polling
+
+#include "tg_stater/logging.hpp"
+
+#include <tgbot/Api.h>
+#include <tgbot/Bot.h>
+#include <tgbot/EventHandler.h>
+#include <tgbot/types/Update.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace tg_stater {
+
+struct PollOptions {
+    std::int32_t minLimit = 10;  // NOLINT(*-magic-numbers)
+    std::int32_t maxLimit = 100; // NOLINT(*-magic-numbers) the most `getUpdates` returns
+    std::int32_t timeout = 10;   // NOLINT(*-magic-numbers) seconds, used while there is no backlog
+    std::size_t inFlight = 2;    // batches fetched but not yet dispatched
+};
+
+namespace detail {
+
+// `limit` and `timeout` of the next `getUpdates`, following the size of the last batch.
+// A full batch means more updates are waiting: the next request asks for more and returns at once.
+// A short one means the bot has caught up: smaller batches reach the handlers sooner and the request waits.
+class PollTuning {
+    std::int32_t minLimit;
+    std::int32_t maxLimit;
+    std::int32_t idleTimeout;
+    std::int32_t currentLimit;
+    bool backlog = false;
+
+  public:
+    explicit PollTuning(const PollOptions& options)
+        : minLimit{std::clamp(options.minLimit, 1, options.maxLimit)},
+          maxLimit{options.maxLimit},
+          idleTimeout{options.timeout},
+          currentLimit{minLimit} {}
+
+    void onBatch(std::size_t size) {
+        backlog = size >= static_cast<std::size_t>(currentLimit);
+        if (backlog)
+            currentLimit = std::min(currentLimit * 2, maxLimit);
+        else if (size < static_cast<std::size_t>(currentLimit) / 2)
+            currentLimit = std::max(currentLimit / 2, minLimit);
+    }
+
+    [[nodiscard]] std::int32_t limit() const {
+        return currentLimit;
+    }
+
+    [[nodiscard]] std::int32_t timeout() const {
+        return backlog ? 0 : idleTimeout;
+    }
+};
+
+} // namespace detail
+
+/*
+ * A drop-in for `TgBot::TgLongPoll` that fetches the next batch while the current one is dispatched.
+ * A fetching thread requests `getUpdates` with the offset past the last received update as soon as a batch arrives,
+ * and keeps at most `inFlight` batches waiting for `start`, so the network wait overlaps the handlers.
+ * The offset confirms the updates to Telegram before they are handled, so a crash loses the waiting batches,
+ * where `TgLongPoll` would get the current one again.
+ */
+class PipelinedLongPoll {
+    using Batch = std::vector<TgBot::Update::Ptr>;
+
+    const TgBot::Api& api;
+    const TgBot::EventHandler& eventHandler;
+    std::shared_ptr<std::vector<std::string>> allowedUpdates;
+    std::size_t inFlight;
+    detail::PollTuning tuning;
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Batch> batches;
+    std::exception_ptr error;
+    bool stopping = false;
+    std::thread fetcher;
+
+    void fetch() {
+        std::int32_t offset = 0;
+        std::unique_lock lock{mutex};
+        while (true) {
+            changed.wait(lock, [&] { return stopping || (batches.size() < inFlight && !error); });
+            if (stopping)
+                return;
+            lock.unlock();
+
+            Batch batch;
+            std::exception_ptr failure;
+            try {
+                batch = api.getUpdates(offset, tuning.limit(), tuning.timeout(), allowedUpdates);
+            } catch (...) {
+                failure = std::current_exception();
+            }
+            for (const TgBot::Update::Ptr& update : batch)
+                offset = std::max(offset, update->updateId + 1);
+            if (!failure)
+                tuning.onBatch(batch.size());
+
+            lock.lock();
+            if (failure)
+                error = failure;
+            else if (!batch.empty())
+                batches.push_back(std::move(batch));
+            else
+                continue;
+            changed.notify_all();
+        }
+    }
+
+  public:
+    PipelinedLongPoll(const TgBot::Bot& bot,
+                      const PollOptions& options = {},
+                      std::shared_ptr<std::vector<std::string>> allowedUpdates = nullptr)
+        : api{bot.getApi()},
+          eventHandler{bot.getEventHandler()},
+          allowedUpdates{std::move(allowedUpdates)},
+          inFlight{std::max<std::size_t>(options.inFlight, 1)},
+          tuning{options},
+          fetcher{[this] { fetch(); }} {}
+
+    PipelinedLongPoll(const PipelinedLongPoll&) = delete;
+    PipelinedLongPoll& operator=(const PipelinedLongPoll&) = delete;
+    PipelinedLongPoll(PipelinedLongPoll&&) = delete;
+    PipelinedLongPoll& operator=(PipelinedLongPoll&&) = delete;
+
+    // Waits for the request in progress, which takes up to `timeout` seconds
+    ~PipelinedLongPoll() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        changed.notify_all();
+        fetcher.join();
+    }
+
+    // Dispatches the next batch, waiting for it if needed. Rethrows a failed `getUpdates`, as `TgLongPoll` does,
+    // and the next call requests it again.
+    void start() {
+        Batch batch;
+        {
+            std::unique_lock lock{mutex};
+            changed.wait(lock, [&] { return !batches.empty() || error; });
+            if (batches.empty()) {
+                changed.notify_all();
+                std::rethrow_exception(std::exchange(error, nullptr));
+            }
+            batch = std::move(batches.front());
+            batches.pop_front();
+        }
+        changed.notify_all();
+        // the rest of the batch is already confirmed to Telegram, so one failed update must not drop it
+        for (const TgBot::Update::Ptr& update : batch) {
+            try {
+                eventHandler.handleUpdate(update);
+            } catch (const std::exception& e) {
+                logging::log<logging::ERROR>("{}", e.what());
+            }
+        }
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_polling
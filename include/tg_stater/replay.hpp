@@ -0,0 +1,190 @@
+#ifndef INCLUDE_tgbotstater_replay
+#define INCLUDE_tgbotstater_replay
+
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <tgbot/TgTypeParser.h>
+#include <tgbot/net/HttpClient.h>
+#include <tgbot/net/HttpReqArg.h>
+#include <tgbot/net/Url.h>
+#include <tgbot/types/Update.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace tg_stater {
+
+struct ReplayOptions {
+    enum class Pace : std::uint8_t {
+        AsFastAsPossible,
+        Recorded, // updates are delivered at the intervals between the dates of their messages
+    };
+
+    Pace pace = Pace::AsFastAsPossible;
+    // For `Pace::Recorded`: 2 replays twice as fast as recorded
+    double speed = 1.0;
+};
+
+struct ReplayReport {
+    std::size_t updates = 0;
+    std::size_t unparsedLines = 0;
+    std::chrono::nanoseconds elapsed{0};
+    double updatesPerSecond = 0;
+
+    // Time from the moment an update is due to the return of its listener.
+    // With sharded dispatch the listener only enqueues the update.
+    struct Latency {
+        std::chrono::nanoseconds p50{0};
+        std::chrono::nanoseconds p90{0};
+        std::chrono::nanoseconds p99{0};
+        std::chrono::nanoseconds max{0};
+    } latency;
+
+    std::map<std::string, std::size_t> apiCalls;   // by API method
+    std::map<std::string, std::size_t> stateCounts; // chats by their final state, "no state" for chats without one
+    std::vector<std::pair<StateKey, std::string>> finalStates; // every chat the replay touched, ordered by key
+
+    friend std::ostream& operator<<(std::ostream& out, const ReplayReport& report) {
+        using Ms = std::chrono::duration<double, std::milli>;
+        out << "Replayed " << report.updates << " updates in " << Ms{report.elapsed}.count() << " ms ("
+            << report.updatesPerSecond << " updates/s), " << report.unparsedLines << " lines skipped\n"
+            << "Latency: p50 " << Ms{report.latency.p50}.count() << " ms, p90 " << Ms{report.latency.p90}.count()
+            << " ms, p99 " << Ms{report.latency.p99}.count() << " ms, max " << Ms{report.latency.max}.count()
+            << " ms\n";
+        out << "API calls:\n";
+        for (const auto& [method, count] : report.apiCalls)
+            out << "  " << method << ": " << count << '\n';
+        out << "Final states:\n";
+        for (const auto& [state, count] : report.stateCounts)
+            out << "  " << state << ": " << count << '\n';
+        return out;
+    }
+};
+
+/*
+ * HTTP client that never leaves the process: it records every API call and answers with `respond(method)`.
+ * The default answer is a successful result holding a minimal message, which every method of TgBot::Api accepts.
+ * Thread-safe, as the calls may come from the dispatcher's workers.
+ */
+class RecordingHttpClient : public TgBot::HttpClient {
+  public:
+    struct Call {
+        std::string method;
+        std::vector<std::pair<std::string, std::string>> args;
+    };
+
+    std::function<std::string(std::string_view method)> respond = [](std::string_view /*unused*/) {
+        return std::string{R"({"ok":true,"result":{"message_id":1,"date":0,"chat":{"id":0,"type":"private"}}})"};
+    };
+
+  private:
+    mutable std::mutex mutex;
+    mutable std::vector<Call> calls;
+
+  public:
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        Call call{url.path.substr(url.path.rfind('/') + 1), {}};
+        call.args.reserve(args.size());
+        for (const TgBot::HttpReqArg& arg : args)
+            call.args.emplace_back(arg.name, arg.isFile ? "<file " + arg.fileName + '>' : arg.value);
+        std::string response = respond(call.method);
+        std::lock_guard lock{mutex};
+        calls.push_back(std::move(call));
+        return response;
+    }
+
+    [[nodiscard]] std::vector<Call> recordedCalls() const {
+        std::lock_guard lock{mutex};
+        return calls;
+    }
+};
+
+namespace detail {
+
+// Parses one update in the `getUpdates` JSON format
+class UpdateReader {
+    TgBot::TgTypeParser parser;
+
+  public:
+    [[nodiscard]] TgBot::Update::Ptr parse(const std::string& line) const {
+        std::istringstream in{line};
+        boost::property_tree::ptree tree;
+        boost::property_tree::read_json(in, tree);
+        return parser.parseJsonAndGetUpdate(tree);
+    }
+};
+
+// The chat the update belongs to, as the handlers of its event see it. Throws as they do on malformed updates.
+inline std::optional<StateKey> stateKeyOf(const TgBot::Update& update) {
+    if (update.message)
+        return EventCategories::Message::getStateKey(update.message);
+    if (update.editedMessage)
+        return EventCategories::Message::getStateKey(update.editedMessage);
+    if (update.channelPost)
+        return EventCategories::Message::getStateKey(update.channelPost);
+    if (update.editedChannelPost)
+        return EventCategories::Message::getStateKey(update.editedChannelPost);
+    if (update.inlineQuery)
+        return EventCategories::InlineQuery::getStateKey(update.inlineQuery);
+    if (update.chosenInlineResult)
+        return EventCategories::ChosenInlineResult::getStateKey(update.chosenInlineResult);
+    if (update.callbackQuery)
+        return EventCategories::CallbackQuery::getStateKey(update.callbackQuery);
+    if (update.shippingQuery)
+        return EventCategories::ShippingQuery::getStateKey(update.shippingQuery);
+    if (update.preCheckoutQuery)
+        return EventCategories::PreCheckoutQuery::getStateKey(update.preCheckoutQuery);
+    if (update.pollAnswer)
+        return EventCategories::PollAnswer::getStateKey(update.pollAnswer);
+    if (update.myChatMember)
+        return EventCategories::ChatMemberUpdated::getStateKey(update.myChatMember);
+    if (update.chatMember)
+        return EventCategories::ChatMemberUpdated::getStateKey(update.chatMember);
+    if (update.chatJoinRequest)
+        return EventCategories::ChatJoinRequest::getStateKey(update.chatJoinRequest);
+    return std::nullopt;
+}
+
+// Seconds since the epoch, if the update carries a message
+inline std::optional<std::int64_t> dateOf(const TgBot::Update& update) {
+    if (update.message)
+        return static_cast<std::int64_t>(update.message->date);
+    if (update.editedMessage)
+        return static_cast<std::int64_t>(update.editedMessage->date);
+    if (update.channelPost)
+        return static_cast<std::int64_t>(update.channelPost->date);
+    if (update.editedChannelPost)
+        return static_cast<std::int64_t>(update.editedChannelPost->date);
+    return std::nullopt;
+}
+
+inline ReplayReport::Latency percentiles(std::vector<std::chrono::nanoseconds> latencies) {
+    if (latencies.empty())
+        return {};
+    std::ranges::sort(latencies);
+    const auto at = [&](double q) {
+        return latencies[static_cast<std::size_t>(q * static_cast<double>(latencies.size() - 1))];
+    };
+    return {at(0.5), at(0.9), at(0.99), latencies.back()}; // NOLINT(*-magic-numbers)
+}
+
+} // namespace detail
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_replay
@@ -0,0 +1,402 @@
+#ifndef INCLUDE_tgbotstater_serialization
+#define INCLUDE_tgbotstater_serialization
+
+#include "tg_stater/meta.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <ranges>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+/*
+ * Compact binary encoding of states.
+ *
+ * A codec is chosen for every type at compile time:
+ *  * a struct with `static constexpr auto serializedFields = std::tuple{&T::a, &T::b, ...}` is encoded field by field;
+ *  * `std::variant` is encoded as a 32-bit tag of the held alternative followed by the alternative;
+ *  * any other trivially copyable type is copied byte by byte;
+ *  * `std::optional`, `std::pair`, `std::tuple` and `std::array` of other types are encoded element by element;
+ *  * containers (`std::string`, `std::vector`, `std::map`, ...) are prefixed with their size as a varint,
+ *    contiguous containers of trivially copyable elements are copied at once.
+ * Any other type can be supported by specializing `Codec`.
+ *
+ * The tag of an alternative is `T::serializationTag` if it is declared, or its index in the variant otherwise.
+ * So alternatives can be appended and types renamed without breaking encoded data, but reordering or removing
+ * alternatives without declared tags changes the tags of the others: declare tags before doing it,
+ * or increment the schema version of the storage. `static constexpr bool serializationTagFromName = true`
+ * makes a hash of the type's name the tag instead; it changes when the type is renamed or moved to another
+ * namespace, and may differ between compilers.
+ * Changing the layout of an alternative breaks its encoded data: give it a new tag.
+ * Numbers are in the native byte order.
+ */
+namespace tg_stater::serialization {
+
+class DecodeError : public std::runtime_error {
+  public:
+    using std::runtime_error::runtime_error;
+};
+
+class Writer {
+    std::string& out;
+
+  public:
+    explicit Writer(std::string& out) : out{out} {}
+
+    void bytes(const void* data, std::size_t size) {
+        out.append(static_cast<const char*>(data), size);
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    void raw(const T& value) {
+        bytes(&value, sizeof(T));
+    }
+
+    void varint(std::uint64_t value) {
+        constexpr unsigned bits = 7;
+        constexpr std::uint64_t more = 1U << bits;
+        for (; value >= more; value >>= bits)
+            out.push_back(static_cast<char>(value | more));
+        out.push_back(static_cast<char>(value));
+    }
+};
+
+class Reader {
+    std::string_view in;
+
+  public:
+    explicit Reader(std::string_view in) : in{in} {}
+
+    [[nodiscard]] std::size_t remaining() const {
+        return in.size();
+    }
+
+    std::string_view bytes(std::size_t size) {
+        if (in.size() < size)
+            throw DecodeError("Unexpected end of the encoded data.");
+        const std::string_view result = in.substr(0, size);
+        in.remove_prefix(size);
+        return result;
+    }
+
+    template <typename T>
+        requires std::is_trivially_copyable_v<T>
+    T raw() {
+        std::array<std::byte, sizeof(T)> buffer; // NOLINT(*-member-init)
+        std::memcpy(buffer.data(), bytes(sizeof(T)).data(), sizeof(T));
+        return std::bit_cast<T>(buffer);
+    }
+
+    std::uint64_t varint() {
+        constexpr unsigned bits = 7;
+        constexpr unsigned maxShift = 63;
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; shift <= maxShift; shift += bits) {
+            const auto byte = static_cast<std::uint8_t>(bytes(1)[0]);
+            value |= static_cast<std::uint64_t>(byte & ((1U << bits) - 1)) << shift;
+            if ((byte >> bits) == 0)
+                return value;
+        }
+        throw DecodeError("Malformed varint in the encoded data.");
+    }
+};
+
+// Specialize for a type to provide its encoding:
+//   static void encode(const T&, Writer&);
+//   static T decode(Reader&);
+template <typename T>
+struct Codec;
+
+template <typename T>
+concept Serializable = requires(const T& value, Writer& writer, Reader& reader) {
+    Codec<T>::encode(value, writer);
+    { Codec<T>::decode(reader) } -> std::same_as<T>;
+};
+
+namespace detail {
+
+template <typename T>
+concept TaggedByName = requires { requires T::serializationTagFromName; };
+
+template <typename T>
+concept DescribedStruct = requires { T::serializedFields; };
+
+template <typename T>
+concept TriviallyEncoded = std::is_trivially_copyable_v<T> && !DescribedStruct<T> &&
+                           !meta::is_of_template<T, std::variant>;
+
+template <typename C>
+concept Container = std::ranges::sized_range<C> && std::default_initializable<C> &&
+                    requires(C& c, std::ranges::range_value_t<C>&& value) { c.insert(c.end(), std::move(value)); };
+
+template <typename T>
+struct IsStdArray : std::false_type {};
+
+template <typename T, std::size_t N>
+struct IsStdArray<std::array<T, N>> : std::true_type {};
+
+// NOLINTBEGIN(*-magic-numbers)
+template <typename T>
+constexpr std::string_view rawTypeName() {
+#ifdef _MSC_VER
+    return __FUNCSIG__;
+#else
+    return __PRETTY_FUNCTION__;
+#endif
+}
+
+inline constexpr std::size_t typeNamePrefix = rawTypeName<int>().find("int");
+inline constexpr std::size_t typeNameSuffix = rawTypeName<int>().size() - typeNamePrefix - 3;
+
+template <typename T>
+constexpr std::string_view typeName() {
+    constexpr std::string_view raw = rawTypeName<T>();
+    return raw.substr(typeNamePrefix, raw.size() - typeNamePrefix - typeNameSuffix);
+}
+
+constexpr std::uint32_t fnv1a(std::string_view s) {
+    std::uint32_t h = 2166136261U;
+    for (const char c : s)
+        h = (h ^ static_cast<std::uint8_t>(c)) * 16777619U;
+    return h;
+}
+// NOLINTEND(*-magic-numbers)
+
+} // namespace detail
+
+// The tag of the alternative `T` at `index` of a variant
+template <typename T, std::size_t index>
+constexpr std::uint32_t tagOf() {
+    if constexpr (requires { T::serializationTag; })
+        return T::serializationTag;
+    else if constexpr (detail::TaggedByName<T>)
+        return detail::fnv1a(detail::typeName<T>());
+    else
+        return static_cast<std::uint32_t>(index);
+}
+
+template <detail::TriviallyEncoded T>
+struct Codec<T> {
+    static void encode(const T& value, Writer& writer) {
+        writer.raw(value);
+    }
+
+    static T decode(Reader& reader) {
+        return reader.template raw<T>();
+    }
+};
+
+template <detail::DescribedStruct T>
+    requires std::default_initializable<T>
+struct Codec<T> {
+    static void encode(const T& value, Writer& writer) {
+        std::apply(
+            [&](auto... fields) {
+                (Codec<std::remove_cvref_t<decltype(value.*fields)>>::encode(value.*fields, writer), ...);
+            },
+            T::serializedFields);
+    }
+
+    static T decode(Reader& reader) {
+        T value{};
+        std::apply(
+            [&](auto... fields) {
+                ((value.*fields = Codec<std::remove_cvref_t<decltype(value.*fields)>>::decode(reader)), ...);
+            },
+            T::serializedFields);
+        return value;
+    }
+};
+
+template <typename... Options>
+struct Codec<std::variant<Options...>> {
+    using VariantT = std::variant<Options...>;
+
+    static constexpr std::array<std::uint32_t, sizeof...(Options)> tags =
+        []<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<std::uint32_t, sizeof...(Options)>{tagOf<Options, I>()...};
+        }(std::index_sequence_for<Options...>{});
+
+    static_assert(
+        [] {
+            auto sorted = tags;
+            std::ranges::sort(sorted);
+            return std::ranges::adjacent_find(sorted) == sorted.end();
+        }(),
+        "Alternatives of a variant have equal serialization tags "
+        "(an alternative without a declared tag is tagged with its index).");
+
+    template <typename Option>
+    static constexpr std::size_t indexOf = [] {
+        constexpr std::array<bool, sizeof...(Options)> same{std::is_same_v<Option, Options>...};
+        return static_cast<std::size_t>(std::ranges::find(same, true) - same.begin());
+    }();
+
+    template <typename Option>
+        requires meta::is_part_of_variant<Option, VariantT>
+    static void encodeOption(const Option& option, Writer& writer) {
+        writer.raw(tags[indexOf<Option>]);
+        Codec<Option>::encode(option, writer);
+    }
+
+    static void encode(const VariantT& value, Writer& writer) {
+        std::visit([&writer](const auto& option) { encodeOption(option, writer); }, value);
+    }
+
+    static VariantT decode(Reader& reader) {
+        const auto tag = reader.template raw<std::uint32_t>();
+        std::optional<VariantT> result;
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            (void)((tag == tags[I] &&
+                    (result.emplace(std::in_place_index<I>, Codec<Options>::decode(reader)), true)) ||
+                   ...);
+        }(std::index_sequence_for<Options...>{});
+        if (!result)
+            throw DecodeError("Unknown tag of a variant alternative in the encoded data.");
+        return std::move(*result);
+    }
+};
+
+template <typename T>
+    requires(!std::is_trivially_copyable_v<std::optional<T>>)
+struct Codec<std::optional<T>> {
+    static void encode(const std::optional<T>& value, Writer& writer) {
+        writer.raw(value.has_value());
+        if (value)
+            Codec<T>::encode(*value, writer);
+    }
+
+    static std::optional<T> decode(Reader& reader) {
+        if (!reader.template raw<bool>())
+            return std::nullopt;
+        return Codec<T>::decode(reader);
+    }
+};
+
+template <typename A, typename B>
+    requires(!std::is_trivially_copyable_v<std::pair<A, B>>)
+struct Codec<std::pair<A, B>> {
+    static void encode(const std::pair<A, B>& value, Writer& writer) {
+        Codec<std::remove_const_t<A>>::encode(value.first, writer);
+        Codec<std::remove_const_t<B>>::encode(value.second, writer);
+    }
+
+    static std::pair<A, B> decode(Reader& reader) {
+        // braced initialization evaluates its elements in order
+        return std::pair<A, B>{Codec<std::remove_const_t<A>>::decode(reader),
+                               Codec<std::remove_const_t<B>>::decode(reader)};
+    }
+};
+
+template <typename... Ts>
+    requires(!std::is_trivially_copyable_v<std::tuple<Ts...>>)
+struct Codec<std::tuple<Ts...>> {
+    static void encode(const std::tuple<Ts...>& value, Writer& writer) {
+        std::apply([&writer](const auto&... elements) { (Codec<Ts>::encode(elements, writer), ...); }, value);
+    }
+
+    static std::tuple<Ts...> decode(Reader& reader) {
+        return std::tuple<Ts...>{Codec<Ts>::decode(reader)...};
+    }
+};
+
+template <typename T, std::size_t N>
+    requires(!std::is_trivially_copyable_v<std::array<T, N>>)
+struct Codec<std::array<T, N>> {
+    static void encode(const std::array<T, N>& value, Writer& writer) {
+        for (const T& element : value)
+            Codec<T>::encode(element, writer);
+    }
+
+    static std::array<T, N> decode(Reader& reader) {
+        return [&reader]<std::size_t... I>(std::index_sequence<I...>) {
+            return std::array<T, N>{(static_cast<void>(I), Codec<T>::decode(reader))...};
+        }(std::make_index_sequence<N>{});
+    }
+};
+
+template <detail::Container C>
+    requires(!std::is_trivially_copyable_v<C> && !detail::IsStdArray<C>::value)
+struct Codec<C> {
+    using ValueT = std::ranges::range_value_t<C>;
+    static constexpr bool bulk = std::ranges::contiguous_range<C> && std::is_trivially_copyable_v<ValueT> &&
+                                 requires(C& c) { c.resize(std::size_t{}); };
+
+    static void encode(const C& value, Writer& writer) {
+        writer.varint(std::ranges::size(value));
+        if constexpr (bulk) {
+            writer.bytes(std::ranges::data(value), std::ranges::size(value) * sizeof(ValueT));
+        } else {
+            for (const auto& element : value)
+                Codec<ValueT>::encode(element, writer);
+        }
+    }
+
+    static C decode(Reader& reader) {
+        const std::uint64_t size = reader.varint();
+        C value;
+        if constexpr (bulk) {
+            if (size > reader.remaining() / sizeof(ValueT))
+                throw DecodeError("Unexpected end of the encoded data.");
+            const auto count = static_cast<std::size_t>(size);
+            const std::string_view bytes = reader.bytes(count * sizeof(ValueT));
+            value.resize(count);
+            std::memcpy(std::ranges::data(value), bytes.data(), bytes.size());
+        } else {
+            // the size is not trusted for allocation beyond what the remaining data can hold
+            if constexpr (requires { value.reserve(std::size_t{}); })
+                value.reserve(static_cast<std::size_t>(std::min<std::uint64_t>(size, reader.remaining())));
+            for (std::uint64_t i = 0; i < size; ++i)
+                value.insert(value.end(), Codec<ValueT>::decode(reader));
+        }
+        return value;
+    }
+};
+
+template <Serializable T>
+void encode(const T& value, std::string& out) {
+    Writer writer{out};
+    Codec<T>::encode(value, writer);
+}
+
+template <Serializable T>
+[[nodiscard]] std::string encode(const T& value) {
+    std::string out;
+    encode(value, out);
+    return out;
+}
+
+// Encodes an alternative exactly as `VariantT` holding it would be encoded, without constructing the variant
+template <typename VariantT, typename Option>
+    requires Serializable<VariantT> && meta::is_part_of_variant<Option, VariantT>
+void encodeAs(const Option& option, std::string& out) {
+    Writer writer{out};
+    Codec<VariantT>::encodeOption(option, writer);
+}
+
+// Throws DecodeError if `bytes` is not exactly one encoded value
+template <Serializable T>
+[[nodiscard]] T decode(std::string_view bytes) {
+    Reader reader{bytes};
+    T value = Codec<T>::decode(reader);
+    if (reader.remaining() != 0)
+        throw DecodeError("Trailing bytes after the encoded value.");
+    return value;
+}
+
+} // namespace tg_stater::serialization
+
+#endif // INCLUDE_tgbotstater_serialization
@@ -0,0 +1,202 @@
+#ifndef INCLUDE_tgbotstater_state_storage_bounded_memory
+#define INCLUDE_tgbotstater_state_storage_bounded_memory
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace tg_stater {
+
+struct BoundedStorageOptions {
+    // A key that was not accessed for longer than this is evicted
+    std::chrono::nanoseconds ttl = std::chrono::nanoseconds::max();
+    // When a new key would exceed this count, the least recently accessed key is evicted
+    std::size_t maxKeys = std::numeric_limits<std::size_t>::max();
+};
+
+enum class EvictionReason : std::uint8_t { expired, capacity };
+
+namespace detail {
+
+// List of nodes of an unordered_map (which never move) ordered by recency, threaded through the nodes themselves.
+// `Node::second` must have `Node* newer` and `Node* older` members.
+template <typename Node>
+struct RecencyList {
+    Node* newest = nullptr;
+    Node* oldest = nullptr;
+
+    void unlink(Node& node) {
+        auto& e = node.second;
+        (e.newer ? e.newer->second.older : newest) = e.older;
+        (e.older ? e.older->second.newer : oldest) = e.newer;
+        e.newer = e.older = nullptr;
+    }
+
+    void pushNewest(Node& node) {
+        node.second.older = newest;
+        (newest ? newest->second.newer : oldest) = &node;
+        newest = &node;
+    }
+
+    void touch(Node& node) {
+        if (&node == newest)
+            return;
+        unlink(node);
+        pushNewest(node);
+    }
+};
+
+} // namespace detail
+
+/*
+ * In-memory storage that forgets abandoned conversations.
+ *
+ * Keys are kept in a list ordered by the last access (`operator[]` or `put`). Since the least recently accessed key
+ * is also the oldest one, both TTL expiry and LRU eviction only ever look at the tail of the list:
+ * every operation evicts expired keys from the tail, a put of a new key over `maxKeys` evicts the tail.
+ * All of it is amortized O(1), the table is never scanned.
+ *
+ * `onEvict` is called with the evicted key and state right before the state is destroyed.
+ * It must not access the storage.
+ *
+ * Lifetime of `StateT*` is the same as in MemoryStateStorage, but a key may also be evicted by any operation
+ * on another key. The key accessed last is never evicted by a put of another key (as long as `maxKeys` > 1),
+ * so a handler may use its state while putting states of other keys.
+ *
+ * `Clock` needs only a static `now()`, it may be replaced by a simulated clock.
+ */
+template <concepts::State StateT_, typename Clock = std::chrono::steady_clock>
+class BoundedMemoryStateStorage {
+  public:
+    using StateT = StateT_;
+    using EvictionHook = std::function<void(const StateKey&, const StateT&, EvictionReason)>;
+
+  private:
+    struct Entry;
+    using Map = std::unordered_map<StateKey, Entry>;
+    using Node = typename Map::value_type;
+
+    struct Entry {
+        StateT state;
+        typename Clock::time_point lastAccess;
+        Node* newer = nullptr;
+        Node* older = nullptr;
+
+        template <typename T>
+        Entry(T&& state, typename Clock::time_point lastAccess)
+            : state{std::forward<T>(state)}, lastAccess{lastAccess} {}
+    };
+
+    Map states;
+    detail::RecencyList<Node> recency;
+    BoundedStorageOptions options;
+    EvictionHook onEvict;
+
+    void touch(Node& node, typename Clock::time_point now) {
+        node.second.lastAccess = now;
+        recency.touch(node);
+    }
+
+    void evict(Node& node, EvictionReason reason) {
+        if (onEvict)
+            onEvict(node.first, node.second.state, reason);
+        recency.unlink(node);
+        // the key is copied since it lives in the node being erased
+        const StateKey key = node.first;
+        states.erase(key);
+    }
+
+    void expire(typename Clock::time_point now) {
+        if (options.ttl == std::chrono::nanoseconds::max())
+            return;
+        while (recency.oldest && now - recency.oldest->second.lastAccess > options.ttl)
+            evict(*recency.oldest, EvictionReason::expired);
+    }
+
+  public:
+    BoundedMemoryStateStorage() = default;
+
+    explicit BoundedMemoryStateStorage(BoundedStorageOptions options, EvictionHook onEvict = {})
+        : options{options}, onEvict{std::move(onEvict)} {}
+
+    BoundedMemoryStateStorage(const BoundedMemoryStateStorage&) = delete;
+    BoundedMemoryStateStorage& operator=(const BoundedMemoryStateStorage&) = delete;
+
+    BoundedMemoryStateStorage(BoundedMemoryStateStorage&& other) noexcept
+        : states{std::move(other.states)},
+          recency{std::exchange(other.recency, {})},
+          options{other.options},
+          onEvict{std::move(other.onEvict)} {
+        other.states.clear();
+    }
+
+    BoundedMemoryStateStorage& operator=(BoundedMemoryStateStorage&& other) noexcept {
+        std::swap(states, other.states);
+        std::swap(recency, other.recency);
+        std::swap(options, other.options);
+        std::swap(onEvict, other.onEvict);
+        return *this;
+    }
+
+    ~BoundedMemoryStateStorage() = default;
+
+    [[nodiscard]] std::size_t size() const {
+        return states.size();
+    }
+
+    // Evicts expired keys. They are evicted by every operation anyway, so it is needed only to free memory
+    // in the absence of traffic.
+    void expire() {
+        expire(Clock::now());
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        const auto now = Clock::now();
+        expire(now);
+        auto it = states.find(key);
+        if (it == states.end())
+            return nullptr;
+        touch(*it, now);
+        return &it->second.state;
+    }
+
+    void erase(const StateKey& key) {
+        expire(Clock::now());
+        if (auto it = states.find(key); it != states.end()) {
+            recency.unlink(*it);
+            states.erase(it);
+        }
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        const auto now = Clock::now();
+        // built before anything is evicted, since `state` may refer to an evicted state
+        StateT value{std::forward<T>(state)};
+        expire(now);
+        if (auto it = states.find(key); it != states.end()) {
+            it->second.state = std::move(value);
+            touch(*it, now);
+            return it->second.state;
+        }
+        if (states.size() >= options.maxKeys && recency.oldest)
+            evict(*recency.oldest, EvictionReason::capacity);
+        Node& node = *states.try_emplace(key, std::move(value), now).first;
+        recency.pushNewest(node);
+        return node.second.state;
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_bounded_memory
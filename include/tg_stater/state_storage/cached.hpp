@@ -0,0 +1,296 @@
+#ifndef INCLUDE_tgbotstater_state_storage_cached
+#define INCLUDE_tgbotstater_state_storage_cached
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/bounded_memory.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace tg_stater {
+
+struct CacheOptions {
+    // Dirty states are handed to the backend once per interval, so puts to one key within it are coalesced
+    std::chrono::milliseconds flushInterval{50}; // NOLINT(*-magic-numbers)
+    // States beyond this count are dropped from memory, least recently used first
+    std::size_t maxKeys = std::size_t{1} << 20U; // NOLINT(*-magic-numbers)
+};
+
+/*
+ * Write-back cache in front of a slow storage.
+ *
+ * Lookups are served from memory, a miss reads the state through from the backend (a missing state is cached too).
+ * Puts and erases only mark the cached state dirty. Once per `flushInterval` dirty states are copied into a batch
+ * that a background thread writes to the backend, so only the last put to a key within the interval reaches it.
+ *
+ * The cache itself is touched only by the calling (dispatch) thread: dirty states are handed over to the flusher
+ * by the first operation after the interval passes. Without traffic they wait in memory, so call `flush`
+ * (from the dispatch thread or when no updates are handled) before shutdown; the destructor flushes too.
+ * The backend is accessed by two threads, but never concurrently.
+ *
+ * Only put/erase mark states dirty: a change made in place through `StateT*` is not written back
+ * unless the state is put again.
+ *
+ * Lifetime of `StateT*` is the same as in BoundedMemoryStateStorage: a state may be dropped from the cache
+ * by an operation on another key, but never the one accessed last.
+ * Errors of background writes are logged, the states are retried by the next flush and the error is thrown by `flush`.
+ */
+template <typename Backend>
+    requires concepts::StateStorage<Backend, typename Backend::StateT>
+class CachedStateStorage {
+  public:
+    using StateT = Backend::StateT;
+    using BackendT = Backend;
+
+  private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry;
+    using Map = std::unordered_map<StateKey, Entry>;
+    using Node = Map::value_type;
+    // nullopt stands for an erased state
+    using Batch = std::unordered_map<StateKey, std::optional<StateT>>;
+
+    struct Entry {
+        std::optional<StateT> state; // nullopt if the key has no state
+        bool dirty = false;
+        Node* newer = nullptr;
+        Node* older = nullptr;
+    };
+
+    struct Core {
+        Backend backend;
+        CacheOptions options;
+
+        // owned by the dispatch thread
+        Map cache;
+        detail::RecencyList<Node> recency;
+        std::vector<StateKey> dirtyKeys;
+        Clock::time_point lastHandoff = Clock::now();
+
+        // shared with the flusher
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable flushed;
+        Batch queued;
+        Batch inFlight; // read by the flusher without the mutex, so changed only under it by the flusher
+        std::exception_ptr error;
+        bool stopping = false;
+
+        std::mutex backendMutex;
+        std::thread worker;
+
+        Core(Backend backend, CacheOptions options) : backend{std::move(backend)}, options{options} {
+            this->options.maxKeys = std::max<std::size_t>(this->options.maxKeys, 1);
+            worker = std::thread{&Core::run, this};
+        }
+
+        Core(const Core&) = delete;
+        Core& operator=(const Core&) = delete;
+        Core(Core&&) = delete;
+        Core& operator=(Core&&) = delete;
+
+        ~Core() {
+            handoff();
+            {
+                std::lock_guard lock{mutex};
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+
+        void write(const StateKey& key, const std::optional<StateT>& state) {
+            std::lock_guard lock{backendMutex};
+            if (state)
+                std::visit([&](const auto& option) { backend.put(key, option); }, *state);
+            else
+                backend.erase(key);
+        }
+
+        void run() {
+            std::unique_lock lock{mutex};
+            while (true) {
+                wake.wait(lock, [this] { return stopping || !queued.empty(); });
+                if (queued.empty())
+                    break;
+                inFlight.swap(queued);
+                lock.unlock();
+
+                auto it = inFlight.begin();
+                try {
+                    for (; it != inFlight.end(); ++it)
+                        write(it->first, it->second);
+                } catch (const std::exception& e) {
+                    logging::log<logging::ERROR>("Failed to write back states: {}", e.what());
+                    lock.lock();
+                    // states put again meanwhile are newer than the unwritten ones
+                    for (; it != inFlight.end(); ++it)
+                        queued.try_emplace(it->first, std::move(it->second));
+                    inFlight.clear();
+                    error = std::current_exception();
+                    flushed.notify_all();
+                    if (stopping)
+                        break;
+                    wake.wait_for(lock, options.flushInterval, [this] { return stopping; });
+                    continue;
+                }
+                lock.lock();
+                inFlight.clear();
+                flushed.notify_all();
+            }
+        }
+
+        // Moves dirty states of the cache into the queued batch
+        void handoff() {
+            lastHandoff = Clock::now();
+            if (dirtyKeys.empty())
+                return;
+            {
+                std::lock_guard lock{mutex};
+                for (const StateKey& key : dirtyKeys) {
+                    auto it = cache.find(key);
+                    if (it == cache.end() || !it->second.dirty)
+                        continue;
+                    queued.insert_or_assign(key, it->second.state);
+                    it->second.dirty = false;
+                }
+            }
+            dirtyKeys.clear();
+            wake.notify_one();
+        }
+
+        void maybeHandoff() {
+            if (Clock::now() - lastHandoff >= options.flushInterval)
+                handoff();
+        }
+
+        void markDirty(Entry& entry, const StateKey& key) {
+            if (!entry.dirty)
+                dirtyKeys.push_back(key);
+            entry.dirty = true;
+        }
+
+        void shrink() {
+            while (cache.size() > options.maxKeys) {
+                Node& node = *recency.oldest;
+                if (node.second.dirty) {
+                    std::lock_guard lock{mutex};
+                    queued.insert_or_assign(node.first, std::move(node.second.state));
+                    wake.notify_one();
+                }
+                recency.unlink(node);
+                // the key is copied since it lives in the node being erased
+                const StateKey key = node.first;
+                cache.erase(key);
+            }
+        }
+
+        // A state that is not cached is either waiting to be written or is in the backend
+        Node& load(const StateKey& key) {
+            std::optional<StateT> state;
+            bool pending = false;
+            {
+                std::lock_guard lock{mutex};
+                if (auto it = queued.find(key); it != queued.end()) {
+                    state = it->second;
+                    pending = true;
+                } else if (auto it = inFlight.find(key); it != inFlight.end()) {
+                    state = it->second;
+                    pending = true;
+                }
+            }
+            if (!pending) {
+                std::lock_guard lock{backendMutex};
+                if (StateT* found = backend[key])
+                    state = *found;
+            }
+            Node& node = *cache.try_emplace(key, Entry{std::move(state)}).first;
+            recency.pushNewest(node);
+            shrink();
+            return node;
+        }
+    };
+
+    std::unique_ptr<Core> core;
+
+  public:
+    CachedStateStorage()
+        requires std::default_initializable<Backend>
+        : CachedStateStorage(Backend{}) {}
+
+    explicit CachedStateStorage(Backend backend, CacheOptions options = {})
+        : core{std::make_unique<Core>(std::move(backend), options)} {}
+
+    [[nodiscard]] std::size_t cachedKeys() const {
+        return core->cache.size();
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        core->maybeHandoff();
+        auto it = core->cache.find(key);
+        Node& node = it != core->cache.end() ? *it : core->load(key);
+        core->recency.touch(node);
+        return node.second.state ? &*node.second.state : nullptr;
+    }
+
+    void erase(const StateKey& key) {
+        core->maybeHandoff();
+        auto [it, inserted] = core->cache.try_emplace(key);
+        if (inserted)
+            core->recency.pushNewest(*it);
+        else
+            core->recency.touch(*it);
+        it->second.state.reset();
+        core->markDirty(it->second, key);
+        core->shrink();
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        core->maybeHandoff();
+        auto [it, inserted] = core->cache.try_emplace(key);
+        if (inserted)
+            core->recency.pushNewest(*it);
+        else
+            core->recency.touch(*it);
+        std::optional<StateT>& cached = it->second.state;
+        if (cached)
+            *cached = std::forward<T>(state);
+        else
+            cached.emplace(std::forward<T>(state));
+        core->markDirty(it->second, key);
+        core->shrink();
+        return *cached;
+    }
+
+    // Writes all the changes to the backend and waits for it.
+    // Throws the error of a failed background write, if any happened since the last call.
+    void flush() {
+        core->handoff();
+        std::unique_lock lock{core->mutex};
+        core->flushed.wait(lock, [this] { return (core->queued.empty() && core->inFlight.empty()) || core->error; });
+        if (core->error)
+            std::rethrow_exception(std::exchange(core->error, nullptr));
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_cached
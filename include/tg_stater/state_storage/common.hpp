@@ -3,7 +3,9 @@
 
 #include "tg_stater/logging.hpp"
 #include "tg_stater/meta.hpp"
+#include "tg_stater/metrics.hpp"
 #include "tg_stater/state.hpp"
+#include "tg_stater/tracing.hpp"
 #include "tg_stater/tg_types.hpp"
 
 #ifdef TGBOTSTATER_USE_STD_FORMAT
@@ -14,11 +16,12 @@
 
 #include <concepts>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
 #include <optional>
-#include <sstream>
 #include <type_traits>
 #include <utility>
+#include <variant>
 
 namespace tg_stater {
 
@@ -33,6 +36,44 @@ struct StateKey {
     }
 };
 
+namespace detail {
+
+// NOLINTBEGIN(*-magic-numbers)
+// Finalizer of splitmix64: every input bit affects every output bit
+constexpr std::uint64_t mix64(std::uint64_t x) {
+    x ^= x >> 30U;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    x ^= x >> 27U;
+    x *= 0x94D049BB133111EBULL;
+    return x ^ (x >> 31U);
+}
+
+constexpr std::uint64_t hashStateKey(const StateKey& key) {
+    // The thread id is packed with a presence bit, so that "no thread" differs from thread 0
+    const std::uint64_t thread = key.threadId ? (1ULL << 32U) | static_cast<std::uint32_t>(*key.threadId) : 0;
+    return mix64(static_cast<std::uint64_t>(key.chatId) ^ mix64(thread));
+}
+// NOLINTEND(*-magic-numbers)
+
+// Hash of what defines the binary layout of a state: sizes and alignments of the options, and their order.
+// Persistent storages keep it in their files to reject files written for another state type.
+template <typename StateT>
+struct StateLayoutFingerprint;
+
+template <typename... Options>
+struct StateLayoutFingerprint<std::variant<Options...>> {
+    static constexpr std::uint64_t get(std::uint64_t schemaVersion) {
+        std::uint64_t h = mix64(schemaVersion);
+        for (const std::uint64_t v : {std::uint64_t{sizeof...(Options)},
+                                      std::uint64_t{sizeof(Options)}...,
+                                      std::uint64_t{alignof(Options)}...})
+            h = mix64(h ^ v);
+        return h;
+    }
+};
+
+} // namespace detail
+
 namespace concepts {
 
 namespace detail {
@@ -57,8 +98,51 @@ concept StateStorage = State<StateT> && requires(T& s, const StateKey& key) {
     requires meta::check_for_each_in_variant<StateT, meta::curry<detail::CanBePutIntoStorage, T>::template type>;
 };
 
+// A storage that can be used from several dispatcher threads at once must declare it explicitly
+template <typename T>
+concept ThreadSafeStateStorage = StateStorage<T, typename T::StateT> && requires {
+    requires T::threadSafe;
+};
+
+// A storage whose `StateT&` stays valid while other keys are accessed: only a put or an erase of its own key
+// replaces it. Coroutine handlers keep their state across `co_await`, so they require such a storage.
+template <typename T>
+concept StableStateStorage = StateStorage<T, typename T::StateT> && requires {
+    requires T::stableStateReferences;
+};
+
+// A storage that can also be accessed through handles of its keys. A handle caches where the state of its key is,
+// along with the storage's generation, which changes whenever a key is added or removed. A handle of an older
+// generation looks the key up again, so it never points to a moved or freed state.
+template <typename T>
+concept HandleStateStorage =
+    StateStorage<T, typename T::StateT> && requires(T& s, typename T::Handle& handle, const StateKey& key) {
+        typename T::Handle;
+        requires std::constructible_from<typename T::Handle, const StateKey&>;
+        { std::as_const(handle).key() } -> std::same_as<const StateKey&>;
+        { s[handle] } -> std::same_as<typename T::StateT*>;
+        { s.erase(handle) } -> std::same_as<void>;
+        { s.put(handle, std::declval<std::variant_alternative_t<0, typename T::StateT>>()) }
+            -> std::same_as<typename T::StateT&>;
+    };
+
 } // namespace concepts
 
+namespace detail {
+
+// What StateProxy reaches its state with: a handle if the storage has them, the key otherwise
+template <typename StorageT>
+struct StateProxyTarget {
+    using type = StateKey;
+};
+
+template <concepts::HandleStateStorage StorageT>
+struct StateProxyTarget<StorageT> {
+    using type = StorageT::Handle;
+};
+
+} // namespace detail
+
 template <typename StorageT_>
     requires concepts::StateStorage<StorageT_, typename StorageT_::StateT>
 class StateProxy {
@@ -68,17 +152,29 @@ class StateProxy {
 
   private:
     std::reference_wrapper<StorageT> storage;
-    StateKey key;
+    // With a handle, the first access looks the key up and the following ones of the update reuse its slot
+    mutable detail::StateProxyTarget<StorageT>::type target;
+
+    template <typename StateOption>
+    void notePut() const {
+        if constexpr (logging::atLeast<logging::INFO>)
+            logging::log("State of {} was switched to {}", getKey(), logging::getStateName<StateOption>());
+        if constexpr (metrics::enabled)
+            metrics::registry().storagePuts.inc();
+    }
 
   public:
-    explicit StateProxy(StorageT& storage, const StateKey& key) : storage{storage}, key{key} {}
+    explicit StateProxy(StorageT& storage, const StateKey& key) : storage{storage}, target{key} {}
 
     [[nodiscard]] const StateKey& getKey() const {
-        return key;
+        if constexpr (concepts::HandleStateStorage<StorageT>)
+            return target.key();
+        else
+            return target;
     }
 
     [[nodiscard]] StateT* get() const {
-        return storage.get()[key];
+        return storage.get()[target];
     }
 
     [[nodiscard]] StateT* operator()() const {
@@ -86,26 +182,42 @@ class StateProxy {
     }
 
     void erase() const {
-        storage.get().erase(key);
+        if constexpr (metrics::enabled)
+            metrics::registry().storageErases.inc();
+        const tracing::Span span{"state erase"};
+        storage.get().erase(target);
     }
 
     template <typename StateOption>
         requires meta::is_part_of_variant<std::remove_cvref_t<StateOption>, StateT>
     StateT& put(StateOption&& state) const {
-        if constexpr (logging::atLeast<logging::INFO>)
-            logging::log("State of {} was switched to {}", key, logging::getStateName<StateOption>());
-        return storage.get().put(key, std::forward<StateOption>(state));
+        notePut<StateOption>();
+        const tracing::Span span{"state put"};
+        return storage.get().put(target, std::forward<StateOption>(state));
+    }
+
+    // Constructs the new state in place if the storage can, instead of moving a temporary into it.
+    // The arguments are read before the current state is replaced, so they may refer to it, but references into it
+    // must not be used after the call. If the constructor throws, the current state is kept.
+    template <typename StateOption, typename... Args>
+        requires meta::is_part_of_variant<StateOption, StateT> && std::constructible_from<StateOption, Args&&...>
+    StateT& emplace(Args&&... args) const {
+        notePut<StateOption>();
+        const tracing::Span span{"state put"};
+        if constexpr (requires { storage.get().template emplace<StateOption>(target, std::forward<Args>(args)...); })
+            return storage.get().template emplace<StateOption>(target, std::forward<Args>(args)...);
+        else
+            return storage.get().put(target, StateOption(std::forward<Args>(args)...));
     }
 };
 
 } // namespace tg_stater
 
+// Chat ids are mostly sequential, so identity hashes of them cluster. The key is fully mixed instead.
 template <>
 struct std::hash<tg_stater::StateKey> {
     std::size_t operator()(const tg_stater::StateKey& key) const {
-        std::size_t h1 = hash<decltype(key.chatId)>{}(key.chatId);
-        std::size_t h2 = hash<decltype(key.threadId)>{}(key.threadId);
-        return h1 ^ (h2 << 1U);
+        return static_cast<std::size_t>(tg_stater::detail::hashStateKey(key));
     }
 };
 
@@ -122,26 +234,20 @@ struct std::formatter<tg_stater::StateKey> {
 
     template <class FmtContext>
     FmtContext::iterator format(const tg_stater::StateKey& key, FmtContext& ctx) const {
-        std::ostringstream out;
-        out << "{chatId=" << key.chatId;
-        if (key.threadId) {
-            out << ", threadId=" << *key.threadId;
-        }
-        out << '}';
-        return std::ranges::copy(std::move(out).str(), ctx.out()).out;
+        // formatted in place: this runs for every logged update
+        if (key.threadId)
+            return std::format_to(ctx.out(), "{{chatId={}, threadId={}}}", key.chatId, *key.threadId);
+        return std::format_to(ctx.out(), "{{chatId={}}}", key.chatId);
     }
 };
 #else
 template <>
 struct fmt::formatter<tg_stater::StateKey> : formatter<string_view> {
     format_context::iterator format(tg_stater::StateKey key, format_context& ctx) const {
-        std::ostringstream out;
-        out << "{chatId=" << key.chatId;
-        if (key.threadId) {
-            out << ", threadId=" << *key.threadId;
-        }
-        out << '}';
-        return formatter<string_view>::format(std::move(out).str(), ctx);
+        // formatted in place: this runs for every logged update
+        if (key.threadId)
+            return fmt::format_to(ctx.out(), "{{chatId={}, threadId={}}}", key.chatId, *key.threadId);
+        return fmt::format_to(ctx.out(), "{{chatId={}}}", key.chatId);
     }
 };
 #endif
@@ -0,0 +1,420 @@
+#ifndef INCLUDE_tgbotstater_state_storage_compact_memory
+#define INCLUDE_tgbotstater_state_storage_compact_memory
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace tg_stater {
+
+namespace detail {
+
+// Fixed-size blocks for objects of one type. Blocks are carved from chunks that double in size up to a limit,
+// a freed block is reused by the next allocation, and the chunks are kept until the pool is destroyed.
+template <typename T>
+class BlockPool {
+    union Block {
+        Block* next;
+        alignas(T) std::array<std::byte, sizeof(T)> object;
+    };
+
+    static constexpr std::size_t firstChunk = 16;
+    static constexpr std::size_t maxChunk = std::size_t{1} << 16U;
+
+    std::vector<std::unique_ptr<Block[]>> chunks; // NOLINT(*-avoid-c-arrays)
+    Block* freeList = nullptr;
+    std::size_t nextChunk = firstChunk;
+    std::size_t blocks = 0;
+
+  public:
+    BlockPool() = default;
+
+    BlockPool(const BlockPool&) = delete;
+    BlockPool& operator=(const BlockPool&) = delete;
+
+    // The pool moved from is left empty, its free list would point into the chunks it gave away
+    BlockPool(BlockPool&& other) noexcept
+        : chunks{std::exchange(other.chunks, {})},
+          freeList{std::exchange(other.freeList, nullptr)},
+          nextChunk{std::exchange(other.nextChunk, firstChunk)},
+          blocks{std::exchange(other.blocks, 0)} {}
+
+    BlockPool& operator=(BlockPool&& other) noexcept {
+        if (this != &other) {
+            chunks = std::exchange(other.chunks, {});
+            freeList = std::exchange(other.freeList, nullptr);
+            nextChunk = std::exchange(other.nextChunk, firstChunk);
+            blocks = std::exchange(other.blocks, 0);
+        }
+        return *this;
+    }
+
+    ~BlockPool() = default;
+
+    // Uninitialized storage for a T
+    void* allocate() {
+        if (!freeList) {
+            auto chunk = std::make_unique_for_overwrite<Block[]>(nextChunk); // NOLINT(*-avoid-c-arrays)
+            for (std::size_t i = 0; i < nextChunk; ++i)
+                freeList = std::construct_at(&chunk[i], Block{.next = freeList});
+            blocks += nextChunk;
+            chunks.push_back(std::move(chunk));
+            nextChunk = std::min(nextChunk * 2, maxChunk);
+        }
+        return std::exchange(freeList, freeList->next);
+    }
+
+    // Takes back storage whose T is already destroyed
+    void deallocate(void* object) {
+        freeList = std::construct_at(static_cast<Block*>(object), Block{.next = freeList});
+    }
+
+    [[nodiscard]] std::size_t allocatedBytes() const {
+        return blocks * sizeof(Block);
+    }
+};
+
+template <typename StateT>
+struct BlockPools;
+
+template <typename... Options>
+struct BlockPools<std::variant<Options...>> {
+    using type = std::tuple<BlockPool<Options>...>;
+};
+
+} // namespace detail
+
+/*
+ * In-memory storage where a key takes as much memory as its current state needs, not as the largest alternative.
+ *
+ * It is an open-addressing table like FlatMemoryStateStorage, but a slot has `InlineBytes` for the state
+ * instead of a whole `StateT`. An alternative that fits there (and is nothrow move constructible) is kept
+ * in the slot, a larger one in a pool of blocks of its own type, with the slot pointing to the block.
+ * With the default of one pointer, a slot is 32 bytes plus a control byte, so keys in small states
+ * such as `Idle{}` cost the same however large the other alternatives are, and a key in a large state adds
+ * one block. Pools keep their peak size.
+ *
+ * A whole `StateT` exists only for the key accessed last: `operator[]` and `put` move its state out of the slot
+ * into it, and it is moved back when another key is accessed. Hence the lifetime of `StateT*` and `StateT&`:
+ * they are valid until the storage is accessed for another key. A handler may change its state in place
+ * and put states of its own key, but must not use the state after accessing other keys
+ * (passing it to `put` of another key is fine, it is taken out before the slots change).
+ * Hence staters with coroutine handlers do not compile with it, see `concepts::StableStateStorage`.
+ */
+template <concepts::State StateT_, std::size_t InlineBytes = sizeof(void*)>
+class CompactMemoryStateStorage {
+  public:
+    using StateT = StateT_;
+
+  private:
+    static constexpr std::size_t payloadSize = std::max(InlineBytes, sizeof(void*));
+    static constexpr std::size_t payloadAlign = alignof(void*);
+    // The slot's state is moved out into `current`
+    static constexpr std::uint8_t vacant = 0xFF;
+    static_assert(std::variant_size_v<StateT> < vacant, "Too many state options for CompactMemoryStateStorage");
+
+    template <std::size_t I>
+    using Option = std::variant_alternative_t<I, StateT>;
+
+    template <std::size_t I>
+    static constexpr bool isInline = sizeof(Option<I>) <= payloadSize && alignof(Option<I>) <= payloadAlign &&
+                                     std::is_nothrow_move_constructible_v<Option<I>>;
+
+    // What a slot holds for the I-th option: the state itself or a pointer to its block
+    template <std::size_t I>
+    using Stored = std::conditional_t<isInline<I>, Option<I>, Option<I>*>;
+
+    struct Slot {
+        StateKey key;
+        alignas(payloadAlign) std::array<std::byte, payloadSize> payload;
+        std::uint8_t option = vacant;
+
+        explicit Slot(const StateKey& key) : key{key} {}
+
+        template <std::size_t I>
+        [[nodiscard]] Stored<I>* stored() {
+            return std::launder(reinterpret_cast<Stored<I>*>(payload.data())); // NOLINT(*-reinterpret-cast)
+        }
+    };
+    using Table = detail::FlatTable<Slot>;
+
+    std::unique_ptr<std::uint8_t[]> ctrl; // NOLINT(*-avoid-c-arrays)
+    Slot* slots = nullptr;
+    std::size_t capacity = 0;
+    std::size_t count = 0;
+    std::size_t growthLeft = 0;
+    detail::BlockPools<StateT>::type pools;
+    std::optional<StateT> current;
+    std::size_t currentSlot = Table::npos;
+
+    [[nodiscard]] Table table() const {
+        return {ctrl.get(), slots, capacity};
+    }
+
+    // Calls `f` with the option index as a compile-time constant
+    template <typename F>
+    static void withOption(std::size_t option, F&& f) {
+        [&]<std::size_t... I>(std::index_sequence<I...>) {
+            (void)((option == I && (f(std::integral_constant<std::size_t, I>{}), true)) || ...);
+        }(std::make_index_sequence<std::variant_size_v<StateT>>{});
+    }
+
+    void destroyStored(Slot& slot) {
+        withOption(slot.option, [&]<std::size_t I>(std::integral_constant<std::size_t, I>) {
+            if constexpr (isInline<I>) {
+                std::destroy_at(slot.template stored<I>());
+            } else {
+                Option<I>* const state = *slot.template stored<I>();
+                std::destroy_at(state);
+                std::get<I>(pools).deallocate(state);
+            }
+        });
+        slot.option = vacant;
+    }
+
+    // Moves the state of a slot into `current`
+    void decode(std::size_t i) {
+        Slot& slot = slots[i];
+        withOption(slot.option, [&]<std::size_t I>(std::integral_constant<std::size_t, I>) {
+            if constexpr (isInline<I>)
+                current.emplace(std::in_place_index<I>, std::move(*slot.template stored<I>()));
+            else
+                current.emplace(std::in_place_index<I>, std::move(**slot.template stored<I>()));
+        });
+        destroyStored(slot);
+        currentSlot = i;
+    }
+
+    // Moves `current` back into its slot
+    void encode() {
+        if (currentSlot == Table::npos)
+            return;
+        Slot& slot = slots[currentSlot];
+        if (current->valueless_by_exception()) {
+            // a put that threw: the key has no state
+            remove(currentSlot);
+            return;
+        }
+        withOption(current->index(), [&]<std::size_t I>(std::integral_constant<std::size_t, I>) {
+            Option<I>& state = *std::get_if<I>(&*current);
+            if constexpr (isInline<I>) {
+                std::construct_at(slot.template stored<I>(), std::move(state));
+            } else {
+                auto& pool = std::get<I>(pools);
+                void* const block = pool.allocate();
+                try {
+                    Option<I>* const moved = std::construct_at(static_cast<Option<I>*>(block), std::move(state));
+                    std::construct_at(slot.template stored<I>(), moved);
+                } catch (...) {
+                    pool.deallocate(block);
+                    throw;
+                }
+            }
+            slot.option = I;
+        });
+        current.reset();
+        currentSlot = Table::npos;
+    }
+
+    // Moves a slot to another place in the table. There is no vacant slot then, `current` is encoded before inserts.
+    static void relocate(Slot& from, Slot* to) {
+        std::construct_at(to, from.key);
+        withOption(from.option, [&]<std::size_t I>(std::integral_constant<std::size_t, I>) {
+            std::construct_at(to->template stored<I>(), std::move(*from.template stored<I>()));
+            std::destroy_at(from.template stored<I>());
+        });
+        to->option = from.option;
+        std::destroy_at(&from);
+    }
+
+    void remove(std::size_t i) {
+        if (i == currentSlot) {
+            current.reset();
+            currentSlot = Table::npos;
+        } else {
+            destroyStored(slots[i]);
+        }
+        std::destroy_at(slots + i);
+        --count;
+        if (table().release(i))
+            ++growthLeft;
+    }
+
+    void destroyAll() {
+        current.reset();
+        currentSlot = Table::npos;
+        for (std::size_t i = 0; i < capacity; ++i) {
+            if (Table::isFull(ctrl[i])) {
+                destroyStored(slots[i]);
+                std::destroy_at(slots + i);
+            }
+        }
+        std::allocator<Slot>{}.deallocate(slots, capacity);
+        slots = nullptr;
+    }
+
+    void resize(std::size_t newCapacity) {
+        std::unique_ptr<std::uint8_t[]> oldCtrl = std::move(ctrl); // NOLINT(*-avoid-c-arrays)
+        Slot* oldSlots = std::exchange(slots, std::allocator<Slot>{}.allocate(newCapacity));
+        const std::size_t oldCapacity = std::exchange(capacity, newCapacity);
+
+        ctrl = std::make_unique_for_overwrite<std::uint8_t[]>(newCapacity); // NOLINT(*-avoid-c-arrays)
+        std::fill_n(ctrl.get(), newCapacity, Table::Group::empty);
+        growthLeft = Table::maxLoad(newCapacity) - count;
+
+        const Table t = table();
+        for (std::size_t i = 0; i < oldCapacity; ++i) {
+            if (!Table::isFull(oldCtrl[i]))
+                continue;
+            const std::uint64_t hash = detail::hashStateKey(oldSlots[i].key);
+            const std::size_t j = t.findInsertSlot(hash);
+            relocate(oldSlots[i], slots + j);
+            ctrl[j] = Table::h2(hash);
+        }
+        std::allocator<Slot>{}.deallocate(oldSlots, oldCapacity);
+    }
+
+    void growIfNeeded() {
+        if (growthLeft != 0)
+            return;
+        // If the table is clogged mostly with deleted slots, they are just cleaned up
+        if (count + 1 > Table::maxLoad(capacity) / 2)
+            resize(std::max(Table::minCapacity, capacity * 2));
+        else
+            resize(capacity);
+    }
+
+    // Adds a vacant slot for a new key
+    std::size_t insert(const StateKey& key, std::uint64_t hash) {
+        growIfNeeded();
+        const std::size_t i = table().findInsertSlot(hash);
+        std::construct_at(slots + i, key);
+        if (ctrl[i] == Table::Group::empty)
+            --growthLeft;
+        ctrl[i] = Table::h2(hash);
+        ++count;
+        return i;
+    }
+
+    // Whether `object` lives within `current`
+    [[nodiscard]] bool inCurrent(const void* object) const {
+        if (!current)
+            return false;
+        const auto* const begin = reinterpret_cast<const std::byte*>(&*current); // NOLINT(*-reinterpret-cast)
+        const auto* const address = static_cast<const std::byte*>(object);
+        return std::less_equal<>{}(begin, address) && std::less<>{}(address, begin + sizeof(StateT));
+    }
+
+    // Makes a vacant slot current with the given state. The key is removed if constructing the state throws.
+    template <typename T>
+    StateT& adopt(std::size_t i, T&& state) {
+        try {
+            current.emplace(std::forward<T>(state));
+        } catch (...) {
+            remove(i);
+            throw;
+        }
+        currentSlot = i;
+        return *current;
+    }
+
+  public:
+    CompactMemoryStateStorage() = default;
+
+    CompactMemoryStateStorage(const CompactMemoryStateStorage&) = delete;
+    CompactMemoryStateStorage& operator=(const CompactMemoryStateStorage&) = delete;
+
+    CompactMemoryStateStorage(CompactMemoryStateStorage&& other) noexcept
+        : ctrl{std::move(other.ctrl)},
+          slots{std::exchange(other.slots, nullptr)},
+          capacity{std::exchange(other.capacity, 0)},
+          count{std::exchange(other.count, 0)},
+          growthLeft{std::exchange(other.growthLeft, 0)},
+          pools{std::move(other.pools)},
+          current{std::move(other.current)},
+          currentSlot{std::exchange(other.currentSlot, Table::npos)} {
+        other.current.reset();
+    }
+
+    CompactMemoryStateStorage& operator=(CompactMemoryStateStorage&& other) noexcept {
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(capacity, other.capacity);
+        std::swap(count, other.count);
+        std::swap(growthLeft, other.growthLeft);
+        std::swap(pools, other.pools);
+        std::swap(current, other.current);
+        std::swap(currentSlot, other.currentSlot);
+        return *this;
+    }
+
+    ~CompactMemoryStateStorage() {
+        if (slots)
+            destroyAll();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return count;
+    }
+
+    // Memory owned by the table and the pools (without memory owned by the states)
+    [[nodiscard]] std::size_t allocatedBytes() const {
+        const std::size_t pooled = std::apply([](const auto&... pool) { return (pool.allocatedBytes() + ...); }, pools);
+        return capacity * (sizeof(Slot) + 1) + pooled;
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        const std::size_t i = table().find(key, detail::hashStateKey(key));
+        if (i == Table::npos)
+            return nullptr;
+        if (i != currentSlot) {
+            encode();
+            decode(i);
+        }
+        return &*current;
+    }
+
+    void erase(const StateKey& key) {
+        if (const std::size_t i = table().find(key, detail::hashStateKey(key)); i != Table::npos)
+            remove(i);
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        const std::uint64_t hash = detail::hashStateKey(key);
+        const std::size_t i = table().find(key, hash);
+        if (i != Table::npos && i == currentSlot) {
+            *current = std::forward<T>(state);
+            return *current;
+        }
+        // the state of the current key is moved back into its slot below, so it is taken out of it first
+        if (inCurrent(std::addressof(state)))
+            return put(key, std::remove_cvref_t<T>(std::forward<T>(state)));
+        // `current` goes back to its slot before an insert, which may move the slots
+        encode();
+        if (i == Table::npos)
+            return adopt(insert(key, hash), std::forward<T>(state));
+        destroyStored(slots[i]);
+        return adopt(i, std::forward<T>(state));
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_compact_memory
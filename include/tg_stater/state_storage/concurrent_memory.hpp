@@ -0,0 +1,100 @@
+#ifndef INCLUDE_tgbotstater_state_storage_concurrent_memory
+#define INCLUDE_tgbotstater_state_storage_concurrent_memory
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace tg_stater {
+
+/*
+ * In-memory storage that can be shared by several dispatcher threads.
+ *
+ * Keys are spread over independently locked stripes, so operations on keys from different stripes never wait
+ * for each other, and lookups never wait for other lookups.
+ *
+ * Lifetime of `StateT*` returned by `operator[]`:
+ *  * it stays valid until the same key is erased, whatever happens to other keys;
+ *  * `put` for the same key assigns to the same object, so the pointer stays valid but the previous alternative dies.
+ * Accesses to one key (including reads through the pointer) must not race with each other.
+ * The sharded dispatcher guarantees that by handling updates of one key on one thread.
+ */
+template <concepts::State StateT_>
+class ConcurrentMemoryStateStorage {
+  public:
+    using StateT = StateT_;
+    static constexpr bool threadSafe = true;
+    static constexpr bool stableStateReferences = true;
+    static constexpr std::size_t defaultStripes = 64;
+
+  private:
+    struct alignas(64) Stripe { // NOLINT(*-magic-numbers)
+        mutable std::shared_mutex mutex; // const lookups take it shared
+        std::unordered_map<StateKey, StateT> states;
+    };
+
+    std::unique_ptr<Stripe[]> stripes; // NOLINT(*-avoid-c-arrays)
+    unsigned stripeBits;
+
+    [[nodiscard]] Stripe& stripeOf(const StateKey& key) const {
+        // The top bits of the hash select a stripe, the low ones are left for the stripe's map
+        const std::uint64_t h = detail::hashStateKey(key);
+        return stripes[stripeBits == 0 ? 0 : h >> (64U - stripeBits)]; // NOLINT(*-magic-numbers)
+    }
+
+  public:
+    ConcurrentMemoryStateStorage() : ConcurrentMemoryStateStorage(defaultStripes) {}
+
+    // The number of stripes is rounded up to a power of two
+    explicit ConcurrentMemoryStateStorage(std::size_t stripeCount)
+        : stripeBits{static_cast<unsigned>(std::countr_zero(std::bit_ceil(stripeCount == 0 ? 1 : stripeCount)))} {
+        stripes = std::make_unique<Stripe[]>(std::size_t{1} << stripeBits); // NOLINT(*-avoid-c-arrays)
+    }
+
+    [[nodiscard]] std::size_t stripeCount() const {
+        return std::size_t{1} << stripeBits;
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        Stripe& stripe = stripeOf(key);
+        std::shared_lock lock{stripe.mutex};
+        auto it = stripe.states.find(key);
+        return it == stripe.states.end() ? nullptr : &it->second;
+    }
+
+    [[nodiscard]] const StateT* operator[](const StateKey& key) const {
+        const Stripe& stripe = stripeOf(key);
+        std::shared_lock lock{stripe.mutex};
+        auto it = stripe.states.find(key);
+        return it == stripe.states.end() ? nullptr : &it->second;
+    }
+
+    void erase(const StateKey& key) {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard lock{stripe.mutex};
+        stripe.states.erase(key);
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        Stripe& stripe = stripeOf(key);
+        std::lock_guard lock{stripe.mutex};
+        // unordered_map's nodes are never moved, so the reference survives rehashing
+        return stripe.states.insert_or_assign(key, std::forward<T>(state)).first->second;
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_concurrent_memory
@@ -0,0 +1,397 @@
+#ifndef INCLUDE_tgbotstater_state_storage_flat_memory
+#define INCLUDE_tgbotstater_state_storage_flat_memory
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace tg_stater {
+
+namespace detail {
+
+// NOLINTBEGIN(*-magic-numbers)
+// 8 control bytes of a flat table processed at once as a 64-bit word (SWAR).
+// A control byte is either `empty`, `deleted`, or the lowest 7 bits of a full slot's hash.
+class FlatControlGroup {
+    static constexpr std::uint64_t lsbs = 0x0101010101010101ULL;
+    static constexpr std::uint64_t msbs = 0x8080808080808080ULL;
+
+    std::uint64_t word = 0;
+
+  public:
+    static constexpr std::size_t width = 8;
+    static constexpr std::uint8_t empty = 0x80;
+    static constexpr std::uint8_t deleted = 0xFE;
+
+    explicit FlatControlGroup(const std::uint8_t* ctrl) {
+        // compiles to a single load on little-endian targets
+        for (std::size_t i = 0; i < width; ++i)
+            word |= static_cast<std::uint64_t>(ctrl[i]) << (8 * i);
+    }
+
+    // The results are masks with the top bit of each matching byte set.
+    // `match` may give false positives, but only for full slots, so a key comparison filters them out.
+    [[nodiscard]] std::uint64_t match(std::uint8_t h2) const {
+        const std::uint64_t x = word ^ (lsbs * h2);
+        return (x - lsbs) & ~x & msbs;
+    }
+
+    [[nodiscard]] std::uint64_t matchEmpty() const {
+        return word & ~(word << 6U) & msbs;
+    }
+
+    [[nodiscard]] std::uint64_t matchEmptyOrDeleted() const {
+        return word & msbs;
+    }
+
+    [[nodiscard]] static std::size_t lowestIndex(std::uint64_t mask) {
+        return static_cast<std::size_t>(std::countr_zero(mask)) / 8;
+    }
+};
+
+// Open-addressing table over externally owned control bytes and slots.
+// `Slot` must have a `StateKey key` member. Capacity is 0 or a power of two not less than 2 groups.
+template <typename Slot>
+struct FlatTable {
+    using Group = FlatControlGroup;
+
+    static constexpr std::size_t npos = -1;
+    static constexpr std::size_t minCapacity = 2 * Group::width;
+
+    std::uint8_t* ctrl = nullptr;
+    Slot* slots = nullptr;
+    std::size_t capacity = 0;
+
+    static constexpr std::size_t maxLoad(std::size_t capacity) {
+        return capacity - capacity / 8;
+    }
+
+    static constexpr std::uint8_t h2(std::uint64_t hash) {
+        return static_cast<std::uint8_t>(hash & 0x7FU);
+    }
+
+    static constexpr std::uint64_t h1(std::uint64_t hash) {
+        return hash >> 7U;
+    }
+
+    static constexpr bool isFull(std::uint8_t c) {
+        return (c & Group::empty) == 0;
+    }
+
+    // Groups are probed with triangular steps, which visit every group when their number is a power of two.
+    // Returns the first non-npos result of `check`.
+    template <typename Check>
+    std::size_t probe(std::uint64_t hash, Check&& check) const {
+        const std::size_t groupMask = capacity / Group::width - 1;
+        std::size_t g = h1(hash) & groupMask;
+        for (std::size_t step = 1;; ++step) {
+            const Group group{ctrl + g * Group::width};
+            if (const std::size_t i = check(group, g * Group::width); i != npos)
+                return i;
+            g = (g + step) & groupMask;
+        }
+    }
+
+    [[nodiscard]] std::size_t find(const StateKey& key, std::uint64_t hash) const {
+        if (capacity == 0)
+            return npos;
+        std::size_t result = npos;
+        probe(hash, [&](const Group& group, std::size_t base) {
+            for (std::uint64_t m = group.match(h2(hash)); m != 0; m &= m - 1) {
+                const std::size_t i = base + Group::lowestIndex(m);
+                if (slots[i].key == key) {
+                    result = i;
+                    return i;
+                }
+            }
+            // the key would have been put into the first group with an empty slot
+            return group.matchEmpty() != 0 ? base : npos;
+        });
+        return result;
+    }
+
+    [[nodiscard]] std::size_t findInsertSlot(std::uint64_t hash) const {
+        return probe(hash, [](const Group& group, std::size_t base) {
+            const std::uint64_t m = group.matchEmptyOrDeleted();
+            return m != 0 ? base + Group::lowestIndex(m) : npos;
+        });
+    }
+
+    // Marks a slot whose object is already destroyed as free.
+    // Returns true if the slot became empty rather than a tombstone, i.e. the growth budget is restored.
+    bool release(std::size_t i) {
+        // Probing stops at a group with an empty slot. If this group has one, nobody probed past it,
+        // and the slot can become empty again instead of a tombstone.
+        const std::size_t base = i / Group::width * Group::width;
+        const bool empty = Group{ctrl + base}.matchEmpty() != 0;
+        ctrl[i] = empty ? Group::empty : Group::deleted;
+        return empty;
+    }
+};
+// NOLINTEND(*-magic-numbers)
+
+} // namespace detail
+
+/*
+ * Open-addressing (Swiss table-like) in-memory storage.
+ * Keys and states are stored inline in one array, a separate array of control bytes is probed 8 slots at a time.
+ * It makes no allocation per key and a lookup usually touches two cache lines.
+ *
+ * Lifetime of `StateT*` and `StateT&` obtained from the storage:
+ *  * `put` of a key that is not in the storage yet may move all the states, so it invalidates all of them;
+ *  * `put` of an existing key assigns in place;
+ *  * `erase` invalidates only the erased state.
+ * Hence a handler must not use its state parameter after it has put a state for some other new key.
+ */
+template <concepts::State StateT_>
+class FlatMemoryStateStorage {
+  public:
+    using StateT = StateT_;
+
+  private:
+    struct Slot {
+        StateKey key;
+        StateT state;
+
+        template <typename... Args>
+        Slot(const StateKey& key, Args&&... args) : key{key}, state{std::forward<Args>(args)...} {}
+    };
+    using Table = detail::FlatTable<Slot>;
+
+    std::unique_ptr<std::uint8_t[]> ctrl; // NOLINT(*-avoid-c-arrays)
+    Slot* slots = nullptr;
+    std::size_t capacity = 0;
+    std::size_t count = 0;
+    std::size_t growthLeft = 0;
+    // Changes when a key is added or removed: only then slot indices may change or be reused
+    std::uint64_t generation = 0;
+
+  public:
+    // The slot of a key, valid while the storage is of the same generation
+    class Handle {
+        friend FlatMemoryStateStorage;
+
+        StateKey key_;
+        std::uint64_t hash;
+        std::size_t index = Table::npos;
+        std::uint64_t generation = -1; // not looked up yet
+
+      public:
+        explicit Handle(const StateKey& key) : key_{key}, hash{detail::hashStateKey(key)} {}
+
+        [[nodiscard]] const StateKey& key() const {
+            return key_;
+        }
+    };
+
+  private:
+    [[nodiscard]] Table table() const {
+        return {ctrl.get(), slots, capacity};
+    }
+
+    void destroyAll() {
+        for (std::size_t i = 0; i < capacity; ++i)
+            if (Table::isFull(ctrl[i]))
+                std::destroy_at(slots + i);
+        std::allocator<Slot>{}.deallocate(slots, capacity);
+        slots = nullptr;
+    }
+
+    void resize(std::size_t newCapacity) {
+        std::unique_ptr<std::uint8_t[]> oldCtrl = std::move(ctrl); // NOLINT(*-avoid-c-arrays)
+        Slot* oldSlots = std::exchange(slots, std::allocator<Slot>{}.allocate(newCapacity));
+        const std::size_t oldCapacity = std::exchange(capacity, newCapacity);
+
+        ctrl = std::make_unique_for_overwrite<std::uint8_t[]>(newCapacity); // NOLINT(*-avoid-c-arrays)
+        std::fill_n(ctrl.get(), newCapacity, Table::Group::empty);
+        growthLeft = Table::maxLoad(newCapacity) - count;
+
+        const Table t = table();
+        for (std::size_t i = 0; i < oldCapacity; ++i) {
+            if (!Table::isFull(oldCtrl[i]))
+                continue;
+            const std::uint64_t hash = detail::hashStateKey(oldSlots[i].key);
+            const std::size_t j = t.findInsertSlot(hash);
+            std::construct_at(slots + j, std::move(oldSlots[i]));
+            std::destroy_at(oldSlots + i);
+            ctrl[j] = Table::h2(hash);
+        }
+        std::allocator<Slot>{}.deallocate(oldSlots, oldCapacity);
+        // every slot has moved, `reserve` included
+        ++generation;
+    }
+
+    std::size_t find(Handle& handle) {
+        if (handle.generation != generation) {
+            handle.index = table().find(handle.key_, handle.hash);
+            handle.generation = generation;
+        }
+        return handle.index;
+    }
+
+    void destroy(std::size_t i) {
+        std::destroy_at(slots + i);
+        --count;
+        ++generation;
+        if (table().release(i))
+            ++growthLeft;
+    }
+
+    template <typename... Args>
+    std::size_t insert(const StateKey& key, std::uint64_t hash, Args&&... args) {
+        growIfNeeded();
+        const std::size_t i = table().findInsertSlot(hash);
+        std::construct_at(slots + i, key, std::forward<Args>(args)...);
+        if (ctrl[i] == Table::Group::empty)
+            --growthLeft;
+        ctrl[i] = Table::h2(hash);
+        ++count;
+        ++generation;
+        return i;
+    }
+
+    void growIfNeeded() {
+        if (growthLeft != 0)
+            return;
+        // If the table is clogged mostly with deleted slots, they are just cleaned up
+        if (count + 1 > Table::maxLoad(capacity) / 2)
+            resize(std::max(Table::minCapacity, capacity * 2));
+        else
+            resize(capacity);
+    }
+
+  public:
+    FlatMemoryStateStorage() = default;
+
+    FlatMemoryStateStorage(const FlatMemoryStateStorage&) = delete;
+    FlatMemoryStateStorage& operator=(const FlatMemoryStateStorage&) = delete;
+
+    FlatMemoryStateStorage(FlatMemoryStateStorage&& other) noexcept
+        : ctrl{std::move(other.ctrl)},
+          slots{std::exchange(other.slots, nullptr)},
+          capacity{std::exchange(other.capacity, 0)},
+          count{std::exchange(other.count, 0)},
+          growthLeft{std::exchange(other.growthLeft, 0)},
+          generation{other.generation++} {}
+
+    FlatMemoryStateStorage& operator=(FlatMemoryStateStorage&& other) noexcept {
+        std::swap(ctrl, other.ctrl);
+        std::swap(slots, other.slots);
+        std::swap(capacity, other.capacity);
+        std::swap(count, other.count);
+        std::swap(growthLeft, other.growthLeft);
+        std::swap(generation, other.generation);
+        ++generation;
+        ++other.generation;
+        return *this;
+    }
+
+    ~FlatMemoryStateStorage() {
+        if (slots)
+            destroyAll();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return count;
+    }
+
+    // Memory owned by the table itself (without memory owned by the states)
+    [[nodiscard]] std::size_t allocatedBytes() const {
+        return capacity * (sizeof(Slot) + 1);
+    }
+
+    // Makes room for `n` keys, so that inserting them does not move the states
+    void reserve(std::size_t n) {
+        std::size_t newCapacity = std::max(Table::minCapacity, std::bit_ceil(n + n / 7 + 1));
+        if (Table::maxLoad(newCapacity) < n)
+            newCapacity *= 2;
+        if (newCapacity > capacity)
+            resize(newCapacity);
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        const std::size_t i = table().find(key, detail::hashStateKey(key));
+        return i == Table::npos ? nullptr : &slots[i].state;
+    }
+
+    [[nodiscard]] const StateT* operator[](const StateKey& key) const {
+        const std::size_t i = table().find(key, detail::hashStateKey(key));
+        return i == Table::npos ? nullptr : &slots[i].state;
+    }
+
+    [[nodiscard]] StateT* operator[](Handle& handle) {
+        const std::size_t i = find(handle);
+        return i == Table::npos ? nullptr : &slots[i].state;
+    }
+
+    void erase(const StateKey& key) {
+        if (const std::size_t i = table().find(key, detail::hashStateKey(key)); i != Table::npos)
+            destroy(i);
+    }
+
+    void erase(Handle& handle) {
+        if (const std::size_t i = find(handle); i != Table::npos) {
+            destroy(i);
+            handle.index = Table::npos;
+            handle.generation = generation;
+        }
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        const std::uint64_t hash = detail::hashStateKey(key);
+        if (const std::size_t i = table().find(key, hash); i != Table::npos) {
+            slots[i].state = std::forward<T>(state);
+            return slots[i].state;
+        }
+        // a grow moves the slots, which `state` may refer to
+        const std::size_t i = growthLeft == 0 ? insert(key, hash, StateT{std::forward<T>(state)})
+                                              : insert(key, hash, std::forward<T>(state));
+        // not `slots[insert(...)]`: `slots` would be read before the insert reallocates it
+        return slots[i].state;
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(Handle& handle, T&& state) {
+        if (const std::size_t i = find(handle); i != Table::npos)
+            return slots[i].state = std::forward<T>(state);
+        if (growthLeft == 0)
+            handle.index = insert(handle.key_, handle.hash, StateT{std::forward<T>(state)});
+        else
+            handle.index = insert(handle.key_, handle.hash, std::forward<T>(state));
+        handle.generation = generation;
+        return slots[handle.index].state;
+    }
+
+    // In place only for a new key that fits without moving the slots, which the arguments may refer to.
+    // Otherwise the new state is built first: a throwing constructor leaves the current one as it was.
+    template <typename T, typename... Args>
+        requires meta::is_part_of_variant<T, StateT>
+    StateT& emplace(Handle& handle, Args&&... args) {
+        if (const std::size_t i = find(handle); i != Table::npos) {
+            T state(std::forward<Args>(args)...);
+            slots[i].state.template emplace<T>(std::move(state));
+            return slots[i].state;
+        }
+        if (growthLeft == 0)
+            return put(handle, T(std::forward<Args>(args)...));
+        handle.index = insert(handle.key_, handle.hash, std::in_place_type<T>, std::forward<Args>(args)...);
+        handle.generation = generation;
+        return slots[handle.index].state;
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_flat_memory
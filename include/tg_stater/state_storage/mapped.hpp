@@ -0,0 +1,373 @@
+#ifndef INCLUDE_tgbotstater_state_storage_mapped
+#define INCLUDE_tgbotstater_state_storage_mapped
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+namespace tg_stater {
+
+/*
+ * Persistent storage on top of a memory-mapped file.
+ * The file holds the very same open-addressing table as FlatMemoryStateStorage, so opening an existing file
+ * is just `mmap`: there is no deserialization pass, pages are loaded lazily by the OS on first access.
+ *
+ * Requirements and limitations:
+ *  * every state option must be trivially copyable (no owning pointers, strings, vectors, etc.);
+ *  * a file can only be opened by a build with the same layout of `StateT`: the same alternatives in the same order,
+ *    the same compiler ABI and the same `schemaVersion`, otherwise the constructor throws;
+ *  * POSIX only;
+ *  * the file is locked while it is open, so a second storage on it, in this process or another one, throws;
+ *  * states are written in place. They survive a crash of the process since the pages belong to the OS.
+ *    To survive a crash of the OS, call `flush` at the points that must be durable.
+ *
+ * Lifetime of `StateT*` is the same as in FlatMemoryStateStorage: a put of a new key may move all the states.
+ */
+template <concepts::State StateT_>
+    requires meta::check_for_each_in_variant<StateT_, std::is_trivially_copyable>
+class MappedStateStorage {
+  public:
+    using StateT = StateT_;
+    static constexpr std::size_t defaultCapacity = 1024;
+
+  private:
+    struct Slot {
+        StateKey key;
+        StateT state;
+    };
+    using Table = detail::FlatTable<Slot>;
+
+    static constexpr std::array<char, 8> magic{'T', 'G', 'S', 'T', 'A', 'T', 'E', '1'};
+    static constexpr std::size_t pageAlign = 64;
+
+    struct Header {
+        std::array<char, 8> magic;
+        std::uint64_t fingerprint;
+        std::uint64_t capacity;
+        std::uint64_t count;
+        std::uint64_t growthLeft;
+    };
+
+    static constexpr std::size_t alignUp(std::size_t n, std::size_t a) {
+        return (n + a - 1) / a * a;
+    }
+
+    static constexpr std::size_t ctrlOffset = alignUp(sizeof(Header), pageAlign);
+
+    static constexpr std::size_t slotsOffset(std::size_t capacity) {
+        return alignUp(ctrlOffset + capacity, std::max(pageAlign, alignof(Slot)));
+    }
+
+    static constexpr std::size_t fileSize(std::size_t capacity) {
+        return slotsOffset(capacity) + capacity * sizeof(Slot);
+    }
+
+    struct Mapping {
+        int fd = -1;
+        void* region = nullptr;
+        std::size_t size = 0;
+
+        [[nodiscard]] Header& header() const {
+            return *static_cast<Header*>(region);
+        }
+
+        [[nodiscard]] Table table() const {
+            auto* base = static_cast<std::byte*>(region);
+            const auto capacity = static_cast<std::size_t>(header().capacity);
+            return {reinterpret_cast<std::uint8_t*>(base + ctrlOffset),     // NOLINT(*-reinterpret-cast)
+                    reinterpret_cast<Slot*>(base + slotsOffset(capacity)), // NOLINT(*-reinterpret-cast)
+                    capacity};
+        }
+
+        void close() {
+            if (region)
+                ::munmap(region, size);
+            if (fd != -1)
+                ::close(fd);
+            region = nullptr;
+            fd = -1;
+        }
+    };
+
+    std::string path;
+    std::uint64_t fingerprint;
+    Mapping mapping;
+
+    [[noreturn]] static void throwErrno(const std::string& what, int fdToClose = -1) {
+        const int error = errno;
+        if (fdToClose != -1)
+            ::close(fdToClose);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    // Two processes writing the same table would corrupt it
+    static void lock(int fd, const std::string& filePath) {
+        if (::flock(fd, LOCK_EX | LOCK_NB) == 0)
+            return;
+        if (errno != EWOULDBLOCK)
+            throwErrno("Failed to lock " + filePath, fd);
+        ::close(fd);
+        throw std::runtime_error("State file " + filePath + " is already in use by another storage.");
+    }
+
+    // Whether the file has been replaced by a grow since `fd` was opened
+    static bool replaced(int fd, const std::string& filePath) {
+        struct stat opened {};
+        struct stat current {};
+        if (::fstat(fd, &opened) == -1)
+            throwErrno("Failed to stat " + filePath, fd);
+        if (::stat(filePath.c_str(), &current) == -1) {
+            if (errno == ENOENT)
+                return true;
+            throwErrno("Failed to stat " + filePath, fd);
+        }
+        return opened.st_dev != current.st_dev || opened.st_ino != current.st_ino;
+    }
+
+    // A renamed file survives a crash of the OS only once its directory is synced
+    static void syncDirectory(const std::string& filePath) {
+        const std::filesystem::path parent = std::filesystem::path{filePath}.parent_path();
+        const std::string directory = parent.empty() ? "." : parent.string();
+        const int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY); // NOLINT(*-vararg)
+        if (fd == -1)
+            throwErrno("Failed to open " + directory);
+        if (::fsync(fd) == -1)
+            throwErrno("Failed to sync " + directory, fd);
+        ::close(fd);
+    }
+
+    static Mapping map(int fd, std::size_t size, const std::string& path) {
+        void* region = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) // NOLINT(*-cstyle-cast, *-int-to-ptr)
+            throwErrno("Failed to map " + path, fd);
+        return {fd, region, size};
+    }
+
+    // Creates (or truncates) a file with an empty table
+    Mapping create(const std::string& filePath, std::size_t capacity) const {
+        const int fd = ::open(filePath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); // NOLINT
+        if (fd == -1)
+            throwErrno("Failed to create " + filePath);
+        lock(fd, filePath);
+        return initialize(fd, filePath, capacity);
+    }
+
+    // Writes an empty table into a locked empty file
+    Mapping initialize(int fd, const std::string& filePath, std::size_t capacity) const {
+        if (::ftruncate(fd, static_cast<off_t>(fileSize(capacity))) == -1)
+            throwErrno("Failed to resize " + filePath, fd);
+        Mapping m = map(fd, fileSize(capacity), filePath);
+        // the file is zero-filled, so the slots are already valid empty memory
+        m.header() = Header{magic, fingerprint, capacity, 0, Table::maxLoad(capacity)};
+        std::fill_n(m.table().ctrl, capacity, Table::Group::empty);
+        return m;
+    }
+
+    Mapping open(int fd) const {
+        struct stat st {};
+        if (::fstat(fd, &st) == -1)
+            throwErrno("Failed to stat " + path, fd);
+        const auto size = static_cast<std::size_t>(st.st_size);
+        if (size < sizeof(Header)) {
+            ::close(fd);
+            throw std::runtime_error("State file " + path + " is truncated.");
+        }
+        Mapping m = map(fd, size, path);
+        const Header& h = m.header();
+        if (h.magic == magic && h.fingerprint != fingerprint) {
+            m.close();
+            throw std::runtime_error("State file " + path + " was written for another layout of the state.");
+        }
+        if (h.magic != magic || !std::has_single_bit(h.capacity) || h.capacity < Table::minCapacity ||
+            fileSize(h.capacity) != size) {
+            m.close();
+            throw std::runtime_error("State file " + path + " is corrupted.");
+        }
+        // A process killed in the middle of a put or an erase leaves the counters out of step with the control
+        // bytes, so they are recounted. Only the control bytes are read, the slots stay untouched.
+        const Table table = m.table();
+        std::size_t full = 0;
+        std::size_t deleted = 0;
+        bool valid = true;
+        for (std::size_t i = 0; i < table.capacity; ++i) {
+            const std::uint8_t c = table.ctrl[i];
+            if (Table::isFull(c))
+                ++full;
+            else if (c == Table::Group::deleted)
+                ++deleted;
+            else
+                valid &= c == Table::Group::empty;
+        }
+        // without an empty slot a lookup of a missing key would probe forever
+        if (!valid || full + deleted > Table::maxLoad(table.capacity)) {
+            m.close();
+            throw std::runtime_error("State file " + path + " is corrupted.");
+        }
+        m.header().count = full;
+        m.header().growthLeft = Table::maxLoad(table.capacity) - full - deleted;
+        return m;
+    }
+
+    // Rebuilds the table into a bigger file and atomically replaces the old one with it
+    void grow() {
+        Header& h = mapping.header();
+        const std::size_t capacity = h.count + 1 > Table::maxLoad(h.capacity) / 2 ? h.capacity * 2 : h.capacity;
+        const std::string tmpPath = path + ".grow";
+        Mapping next = create(tmpPath, capacity);
+
+        const Table from = mapping.table();
+        Table to = next.table();
+        for (std::size_t i = 0; i < from.capacity; ++i) {
+            if (!Table::isFull(from.ctrl[i]))
+                continue;
+            const std::uint64_t hash = detail::hashStateKey(from.slots[i].key);
+            const std::size_t j = to.findInsertSlot(hash);
+            std::memcpy(to.slots + j, from.slots + i, sizeof(Slot));
+            to.ctrl[j] = Table::h2(hash);
+        }
+        next.header().count = h.count;
+        next.header().growthLeft = Table::maxLoad(capacity) - h.count;
+
+        if (::msync(next.region, next.size, MS_SYNC) == -1 || std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+            const int error = errno;
+            next.close();
+            throw std::system_error(error, std::generic_category(), "Failed to replace " + path);
+        }
+        mapping.close();
+        mapping = next;
+        syncDirectory(path);
+    }
+
+  public:
+    // Opens the file or creates it with room for `capacity` states.
+    // Increment `schemaVersion` to reject old files when the meaning of states changes but their layout does not.
+    explicit MappedStateStorage(std::string path,
+                                std::uint64_t schemaVersion = 0,
+                                std::size_t capacity = defaultCapacity)
+        : path{std::move(path)},
+          fingerprint{detail::mix64(detail::StateLayoutFingerprint<StateT>::get(schemaVersion) ^
+                                    (sizeof(Slot) << 8U | alignof(Slot)))} { // NOLINT(*-magic-numbers)
+        int fd = -1;
+        // the file may be replaced by a grow of another storage between the open and the lock
+        do {
+            if (fd != -1)
+                ::close(fd);
+            fd = ::open(this->path.c_str(), O_RDWR | O_CREAT, 0644); // NOLINT
+            if (fd == -1)
+                throwErrno("Failed to open " + this->path);
+            lock(fd, this->path);
+        } while (replaced(fd, this->path));
+
+        struct stat st {};
+        if (::fstat(fd, &st) == -1)
+            throwErrno("Failed to stat " + this->path, fd);
+        if (st.st_size == 0) {
+            capacity = std::max(Table::minCapacity, std::bit_ceil(capacity + capacity / 7 + 1));
+            mapping = initialize(fd, this->path, capacity);
+        } else {
+            mapping = open(fd);
+        }
+    }
+
+    MappedStateStorage(const MappedStateStorage&) = delete;
+    MappedStateStorage& operator=(const MappedStateStorage&) = delete;
+
+    MappedStateStorage(MappedStateStorage&& other) noexcept
+        : path{std::move(other.path)}, fingerprint{other.fingerprint}, mapping{std::exchange(other.mapping, {})} {}
+
+    MappedStateStorage& operator=(MappedStateStorage&& other) noexcept {
+        std::swap(path, other.path);
+        std::swap(fingerprint, other.fingerprint);
+        std::swap(mapping, other.mapping);
+        return *this;
+    }
+
+    ~MappedStateStorage() {
+        mapping.close();
+    }
+
+    [[nodiscard]] std::size_t size() const {
+        return static_cast<std::size_t>(mapping.header().count);
+    }
+
+    // Synchronously writes all changes to the disk
+    void flush() {
+        if (::msync(mapping.region, mapping.size, MS_SYNC) == -1)
+            throwErrno("Failed to flush " + path);
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        const Table table = mapping.table();
+        const std::size_t i = table.find(key, detail::hashStateKey(key));
+        return i == Table::npos ? nullptr : &table.slots[i].state;
+    }
+
+    [[nodiscard]] const StateT* operator[](const StateKey& key) const {
+        const Table table = mapping.table();
+        const std::size_t i = table.find(key, detail::hashStateKey(key));
+        return i == Table::npos ? nullptr : &table.slots[i].state;
+    }
+
+    void erase(const StateKey& key) {
+        Table table = mapping.table();
+        const std::size_t i = table.find(key, detail::hashStateKey(key));
+        if (i == Table::npos)
+            return;
+        Header& h = mapping.header();
+        --h.count;
+        if (table.release(i))
+            ++h.growthLeft;
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        const std::uint64_t hash = detail::hashStateKey(key);
+        if (const std::size_t i = mapping.table().find(key, hash); i != Table::npos) {
+            mapping.table().slots[i].state = std::forward<T>(state);
+            return mapping.table().slots[i].state;
+        }
+
+        // built before a grow unmaps the table, which `state` may refer to
+        Slot slot{key, StateT{std::forward<T>(state)}};
+        if (mapping.header().growthLeft == 0)
+            grow();
+        Table table = mapping.table();
+        Header& h = mapping.header();
+        const std::size_t i = table.findInsertSlot(hash);
+        std::construct_at(table.slots + i, slot);
+        if (table.ctrl[i] == Table::Group::empty)
+            --h.growthLeft;
+        table.ctrl[i] = Table::h2(hash);
+        ++h.count;
+        return table.slots[i].state;
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_mapped
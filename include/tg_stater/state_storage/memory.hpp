@@ -5,19 +5,59 @@
 #include "tg_stater/state.hpp"
 #include "tg_stater/state_storage/common.hpp"
 
+#include <cstdint>
 #include <type_traits>
 #include <unordered_map>
 #include <utility>
+#include <variant>
 
 namespace tg_stater {
 
 template <concepts::State StateT_>
 class MemoryStateStorage {
-    std::unordered_map<StateKey, StateT_> states;
+    using Map = std::unordered_map<StateKey, StateT_>;
+
+    Map states;
+    // Changes when a key is added or removed: only then iterators may be invalidated by a rehash or an erase
+    std::uint64_t generation = 0;
 
   public:
     using StateT = StateT_;
+    static constexpr bool stableStateReferences = true; // nodes of the map never move
+
+    // The iterator of a key, valid while the storage is of the same generation
+    class Handle {
+        friend MemoryStateStorage;
+
+        StateKey key_;
+        Map::iterator it;
+        std::uint64_t generation = -1; // not looked up yet
 
+      public:
+        explicit Handle(const StateKey& key) : key_{key} {}
+
+        [[nodiscard]] const StateKey& key() const {
+            return key_;
+        }
+    };
+
+  private:
+    Map::iterator find(Handle& handle) {
+        if (handle.generation != generation) {
+            handle.it = states.find(handle.key_);
+            handle.generation = generation;
+        }
+        return handle.it;
+    }
+
+    template <typename... Args>
+    StateT& insert(Handle& handle, Args&&... args) {
+        handle.it = states.try_emplace(handle.key_, std::forward<Args>(args)...).first;
+        handle.generation = ++generation;
+        return handle.it->second;
+    }
+
+  public:
     [[nodiscard]] StateT* operator[](const StateKey& key) {
         auto it = states.find(key);
         return it == states.end() ? nullptr : &it->second;
@@ -28,15 +68,54 @@ class MemoryStateStorage {
         return it == states.end() ? nullptr : &it->second;
     }
 
+    [[nodiscard]] StateT* operator[](Handle& handle) {
+        const auto it = find(handle);
+        return it == states.end() ? nullptr : &it->second;
+    }
+
     void erase(const StateKey& key) {
-        if (auto it = states.find(key); it != states.end())
+        if (auto it = states.find(key); it != states.end()) {
+            states.erase(it);
+            ++generation;
+        }
+    }
+
+    void erase(Handle& handle) {
+        if (const auto it = find(handle); it != states.end()) {
             states.erase(it);
+            handle.it = states.end();
+            handle.generation = ++generation;
+        }
     }
 
     template <typename T>
         requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
     StateT& put(const StateKey& key, T&& state) {
-        return states.insert_or_assign(key, std::forward<T>(state)).first->second;
+        const auto [it, inserted] = states.insert_or_assign(key, std::forward<T>(state));
+        if (inserted)
+            ++generation;
+        return it->second;
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(Handle& handle, T&& state) {
+        if (const auto it = find(handle); it != states.end())
+            return it->second = std::forward<T>(state);
+        return insert(handle, std::forward<T>(state));
+    }
+
+    // In place only for a new key. The current state is replaced after the new one is built: the arguments may refer
+    // to it, and a throwing constructor leaves it as it was.
+    template <typename T, typename... Args>
+        requires meta::is_part_of_variant<T, StateT>
+    StateT& emplace(Handle& handle, Args&&... args) {
+        if (const auto it = find(handle); it != states.end()) {
+            T state(std::forward<Args>(args)...);
+            it->second.template emplace<T>(std::move(state));
+            return it->second;
+        }
+        return insert(handle, std::in_place_type<T>, std::forward<Args>(args)...);
     }
 };
 } // namespace tg_stater
@@ -0,0 +1,592 @@
+#ifndef INCLUDE_tgbotstater_state_storage_wal
+#define INCLUDE_tgbotstater_state_storage_wal
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/meta.hpp"
+#include "tg_stater/serialization.hpp"
+#include "tg_stater/state.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+
+namespace tg_stater {
+
+struct WalOptions {
+    enum class Sync : std::uint8_t {
+        EveryWrite, // each put/erase is written and fsynced before it returns
+        Periodic,   // records are written and fsynced in the background every `syncInterval`
+        Never,      // records are written when the buffer fills up, fsync is left to the OS
+    };
+
+    Sync sync = Sync::Periodic;
+    std::chrono::milliseconds syncInterval{100}; // NOLINT(*-magic-numbers)
+    // The log is compacted into the snapshot in the background once it grows beyond this size
+    std::size_t compactAfterBytes = std::size_t{64} << 20U; // NOLINT(*-magic-numbers)
+};
+
+namespace detail {
+
+// NOLINTBEGIN(*-magic-numbers)
+inline std::uint32_t walChecksum(std::string_view bytes) {
+    std::uint64_t h = mix64(bytes.size());
+    std::size_t i = 0;
+    for (; i + 8 <= bytes.size(); i += 8) {
+        std::uint64_t word = 0;
+        std::memcpy(&word, bytes.data() + i, 8);
+        h = mix64(h ^ word);
+    }
+    std::uint64_t tail = 0;
+    std::memcpy(&tail, bytes.data() + i, bytes.size() - i);
+    return static_cast<std::uint32_t>(mix64(h ^ tail));
+}
+// NOLINTEND(*-magic-numbers)
+
+/*
+ * The files of a write-ahead log storage, independent of the state type.
+ *
+ * `<path>.snapshot` holds a put record per key, `<path>.log` holds every put/erase made after the snapshot.
+ * Compaction renames the log to `<path>.log.compacting`, starts a new log and merges the old one into a new snapshot.
+ * Both files start with a magic and a fingerprint of the schema. Each record is framed as
+ * `[body size: u32][checksum of body: u32][body]`, so a record torn by a crash is detected and dropped on recovery.
+ * A body is `[op: u8][chatId: i64][has thread: u8][threadId: i32][encoded state, for puts]` in the native byte order.
+ */
+class WalJournal {
+  public:
+    enum class Op : std::uint8_t { put = 1, erase = 2 };
+    using Sync = WalOptions::Sync;
+
+  private:
+    static constexpr std::array<char, 8> logMagic{'T', 'G', 'W', 'A', 'L', 'O', 'G', '1'};
+    static constexpr std::array<char, 8> snapshotMagic{'T', 'G', 'W', 'A', 'L', 'S', 'N', '1'};
+    static constexpr std::size_t headerSize = logMagic.size() + sizeof(std::uint64_t);
+    static constexpr std::size_t frameSize = 2 * sizeof(std::uint32_t);
+    static constexpr std::size_t keySize = 1 + sizeof(ChatUserIdT) + 1 + sizeof(ThreadIdT);
+    static constexpr std::size_t bufferLimit = std::size_t{64} << 10U; // NOLINT(*-magic-numbers)
+
+    std::string snapshotPath;
+    std::string logPath;
+    std::string compactingPath;
+    std::uint64_t fingerprint;
+    WalOptions options;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string buffer;   // records that are not written to the log yet
+    std::string flushing; // records being written by the worker without holding `mutex`
+    int fd = -1;
+    std::size_t logSize = 0; // including the buffer
+    bool unsynced = false;
+    bool compactionRequested = false;
+    bool stopping = false;
+    std::exception_ptr backgroundError;
+    std::thread worker;
+
+    // Serializes compactions started by `compact` and by the worker
+    std::mutex compactionMutex;
+    // Held while the worker writes the log without holding `mutex`. Writes that may overlap it and rotation,
+    // which replaces the log, take it before `mutex`, or skip the write as `append` does.
+    std::mutex writeMutex;
+
+    [[noreturn]] static void throwErrno(const std::string& what, int fdToClose = -1) {
+        const int error = errno;
+        if (fdToClose != -1)
+            ::close(fdToClose);
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    static void syncFd(int fd, const std::string& path) {
+#ifdef __APPLE__
+        if (::fsync(fd) == -1)
+#else
+        if (::fdatasync(fd) == -1)
+#endif
+            throwErrno("Failed to sync " + path);
+    }
+
+    // Makes renames and creations of files in the directory of `path` durable
+    static void syncDirectory(const std::string& path) {
+        std::filesystem::path dir = std::filesystem::path{path}.parent_path();
+        if (dir.empty())
+            dir = ".";
+        const int fd = ::open(dir.c_str(), O_RDONLY); // NOLINT(*-vararg)
+        if (fd == -1)
+            throwErrno("Failed to open " + dir.string());
+        if (::fsync(fd) == -1)
+            throwErrno("Failed to sync " + dir.string(), fd);
+        ::close(fd);
+    }
+
+    static void writeAll(int fd, std::string_view data, const std::string& path) {
+        while (!data.empty()) {
+            const ::ssize_t written = ::write(fd, data.data(), data.size());
+            if (written == -1) {
+                if (errno == EINTR)
+                    continue;
+                throwErrno("Failed to write " + path);
+            }
+            data.remove_prefix(static_cast<std::size_t>(written));
+        }
+    }
+
+    static std::optional<std::string> readFile(const std::string& path) {
+        const int fd = ::open(path.c_str(), O_RDONLY); // NOLINT(*-vararg)
+        if (fd == -1) {
+            if (errno == ENOENT)
+                return std::nullopt;
+            throwErrno("Failed to open " + path);
+        }
+        struct stat st {};
+        if (::fstat(fd, &st) == -1)
+            throwErrno("Failed to stat " + path, fd);
+        std::string data(static_cast<std::size_t>(st.st_size), '\0');
+        std::size_t done = 0;
+        while (done < data.size()) {
+            const ::ssize_t n = ::read(fd, data.data() + done, data.size() - done);
+            if (n == -1 && errno == EINTR)
+                continue;
+            if (n == -1)
+                throwErrno("Failed to read " + path, fd);
+            if (n == 0)
+                break;
+            done += static_cast<std::size_t>(n);
+        }
+        ::close(fd);
+        data.resize(done);
+        return data;
+    }
+
+    std::string header(const std::array<char, 8>& magic) const {
+        std::string h(magic.data(), magic.size());
+        h.append(reinterpret_cast<const char*>(&fingerprint), sizeof(fingerprint)); // NOLINT(*-reinterpret-cast)
+        return h;
+    }
+
+    template <typename T>
+    static void appendRaw(std::string& out, const T& value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(T)); // NOLINT(*-reinterpret-cast)
+    }
+
+    template <typename T>
+    static T readRaw(const char* data) {
+        T value{};
+        std::memcpy(&value, data, sizeof(T));
+        return value;
+    }
+
+    // `encodeState(std::string&)` appends the state of a put record
+    template <typename EncodeState>
+    static void appendRecord(std::string& out, Op op, const StateKey& key, EncodeState&& encodeState) {
+        const std::size_t frame = out.size();
+        out.append(frameSize, '\0');
+        out.push_back(static_cast<char>(op));
+        appendRaw(out, key.chatId);
+        out.push_back(static_cast<char>(key.threadId.has_value()));
+        appendRaw(out, key.threadId.value_or(ThreadIdT{}));
+        std::forward<EncodeState>(encodeState)(out);
+
+        const std::string_view body = std::string_view{out}.substr(frame + frameSize);
+        const auto size = static_cast<std::uint32_t>(body.size());
+        const std::uint32_t checksum = walChecksum(body);
+        std::memcpy(out.data() + frame, &size, sizeof(size));
+        std::memcpy(out.data() + frame + sizeof(size), &checksum, sizeof(checksum));
+    }
+
+    // Calls `apply(op, key, state)` for each record following the header.
+    // Returns the size of the valid prefix of the file: a torn or corrupted record ends it.
+    template <typename Apply>
+    std::size_t parse(std::string_view data,
+                      const std::array<char, 8>& magic,
+                      const std::string& path,
+                      Apply& apply) const {
+        if (data.size() < headerSize)
+            return 0;
+        if (data.substr(0, magic.size()) != std::string_view{magic.data(), magic.size()})
+            throw std::runtime_error("State file " + path + " is corrupted.");
+        if (readRaw<std::uint64_t>(data.data() + magic.size()) != fingerprint)
+            throw std::runtime_error("State file " + path + " was written for another schema version.");
+
+        std::size_t pos = headerSize;
+        while (data.size() - pos >= frameSize) {
+            const auto size = readRaw<std::uint32_t>(data.data() + pos);
+            const auto checksum = readRaw<std::uint32_t>(data.data() + pos + sizeof(size));
+            if (size < keySize || data.size() - pos - frameSize < size)
+                break;
+            const std::string_view body = data.substr(pos + frameSize, size);
+            if (walChecksum(body) != checksum)
+                break;
+
+            const auto op = static_cast<Op>(body[0]);
+            std::size_t offset = 1;
+            StateKey key{readRaw<ChatUserIdT>(body.data() + offset)};
+            offset += sizeof(ChatUserIdT);
+            const bool hasThread = body[offset] != 0;
+            offset += 1;
+            if (hasThread)
+                key.threadId = readRaw<ThreadIdT>(body.data() + offset);
+            offset += sizeof(ThreadIdT);
+
+            if ((op != Op::put && op != Op::erase) || !apply(op, key, body.substr(offset)))
+                throw std::runtime_error("State file " + path + " is corrupted.");
+            pos += frameSize + size;
+        }
+        return pos;
+    }
+
+    void writeBuffer() {
+        writeAll(fd, buffer, logPath);
+        buffer.clear();
+        unsynced = true;
+    }
+
+    void syncLog() {
+        if (!buffer.empty())
+            writeBuffer();
+        if (unsynced)
+            syncFd(fd, logPath);
+        unsynced = false;
+    }
+
+    // Opens the log for appending, creating it or cutting off a torn tail left by a crash
+    void openLog(std::size_t validSize) {
+        fd = ::open(logPath.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644); // NOLINT
+        if (fd == -1)
+            throwErrno("Failed to open " + logPath);
+        if (validSize < headerSize) {
+            if (::ftruncate(fd, 0) == -1)
+                throwErrno("Failed to truncate " + logPath, fd);
+            writeAll(fd, header(logMagic), logPath);
+            syncFd(fd, logPath);
+            syncDirectory(logPath);
+            validSize = headerSize;
+        } else if (::ftruncate(fd, static_cast<off_t>(validSize)) == -1) {
+            throwErrno("Failed to truncate " + logPath, fd);
+        }
+        logSize = validSize;
+    }
+
+    // Moves the current log aside for compaction and starts a new one
+    void rotate() {
+        const std::lock_guard writing{writeMutex};
+        std::lock_guard lock{mutex};
+        syncLog();
+        // the descriptor stays valid after the rename, so a failure leaves the log usable
+        if (std::rename(logPath.c_str(), compactingPath.c_str()) != 0)
+            throwErrno("Failed to rename " + logPath);
+        ::close(fd);
+        fd = -1;
+        openLog(0);
+    }
+
+    // Merges the snapshot and the rotated log into a new snapshot
+    void mergeCompacting() {
+        std::unordered_map<StateKey, std::string> states;
+        auto collect = [&states](Op op, const StateKey& key, std::string_view state) {
+            if (op == Op::put)
+                states.insert_or_assign(key, std::string{state});
+            else
+                states.erase(key);
+            return true;
+        };
+        if (const auto snapshot = readFile(snapshotPath))
+            parse(*snapshot, snapshotMagic, snapshotPath, collect);
+        if (const auto log = readFile(compactingPath))
+            parse(*log, logMagic, compactingPath, collect);
+
+        const std::string tmpPath = snapshotPath + ".tmp";
+        const int out = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644); // NOLINT
+        if (out == -1)
+            throwErrno("Failed to create " + tmpPath);
+        try {
+            std::string chunk = header(snapshotMagic);
+            for (const auto& [key, state] : states) {
+                appendRecord(chunk, Op::put, key, [&state](std::string& o) { o.append(state); });
+                if (chunk.size() >= bufferLimit) {
+                    writeAll(out, chunk, tmpPath);
+                    chunk.clear();
+                }
+            }
+            writeAll(out, chunk, tmpPath);
+            syncFd(out, tmpPath);
+        } catch (...) {
+            ::close(out);
+            throw;
+        }
+        ::close(out);
+        if (std::rename(tmpPath.c_str(), snapshotPath.c_str()) != 0)
+            throwErrno("Failed to replace " + snapshotPath);
+        // The rename must be durable before the log goes: replaying the log over the new snapshot is harmless,
+        // losing both the log and the rename is not
+        syncDirectory(snapshotPath);
+        std::remove(compactingPath.c_str());
+        syncDirectory(snapshotPath);
+    }
+
+    // Writes and fsyncs the buffer with `mutex` released, so that appends do not wait for the disk
+    void syncInBackground(std::unique_lock<std::mutex>& lock) {
+        lock.unlock();
+        const std::lock_guard writing{writeMutex};
+        lock.lock();
+        if (buffer.empty() && !unsynced)
+            return;
+        flushing.swap(buffer);
+        const int logFd = fd;
+        unsynced = true;
+        lock.unlock();
+        try {
+            writeAll(logFd, flushing, logPath);
+            syncFd(logFd, logPath);
+        } catch (...) {
+            // the records are written again by the next sync
+            lock.lock();
+            flushing += buffer;
+            buffer.swap(flushing);
+            flushing.clear();
+            throw;
+        }
+        lock.lock();
+        flushing.clear();
+        // appends only buffered records meanwhile, so everything written is synced
+        unsynced = false;
+    }
+
+    void run() {
+        std::unique_lock lock{mutex};
+        while (!stopping) {
+            if (options.sync == Sync::Periodic)
+                wake.wait_for(lock, options.syncInterval, [this] { return stopping || compactionRequested; });
+            else
+                wake.wait(lock, [this] { return stopping || compactionRequested; });
+            if (stopping)
+                break;
+            try {
+                if (options.sync == Sync::Periodic)
+                    syncInBackground(lock);
+                if (compactionRequested) {
+                    lock.unlock();
+                    compact();
+                    lock.lock();
+                    compactionRequested = false;
+                }
+            } catch (const std::exception& e) {
+                if (!lock.owns_lock())
+                    lock.lock();
+                compactionRequested = false;
+                logging::log<logging::ERROR>("Write-ahead log {} failed: {}", logPath, e.what());
+                backgroundError = std::current_exception();
+            }
+        }
+    }
+
+  public:
+    WalJournal(const std::string& path, std::uint64_t fingerprint, WalOptions options)
+        : snapshotPath{path + ".snapshot"},
+          logPath{path + ".log"},
+          compactingPath{path + ".log.compacting"},
+          fingerprint{fingerprint},
+          options{options} {}
+
+    WalJournal(const WalJournal&) = delete;
+    WalJournal& operator=(const WalJournal&) = delete;
+    WalJournal(WalJournal&&) = delete;
+    WalJournal& operator=(WalJournal&&) = delete;
+
+    ~WalJournal() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        wake.notify_all();
+        if (worker.joinable())
+            worker.join();
+        if (fd == -1)
+            return;
+        try {
+            if (options.sync == Sync::Never)
+                writeBuffer();
+            else
+                syncLog();
+        } catch (const std::exception& e) {
+            logging::log<logging::ERROR>("Write-ahead log {} failed: {}", logPath, e.what());
+        }
+        ::close(fd);
+    }
+
+    // Replays the files through `apply(op, key, state) -> bool` (false means the state cannot be decoded),
+    // finishes a compaction interrupted by a crash and starts writing.
+    template <typename Apply>
+    void recover(Apply&& apply) {
+        if (const auto snapshot = readFile(snapshotPath))
+            parse(*snapshot, snapshotMagic, snapshotPath, apply);
+        const bool interrupted = std::filesystem::exists(compactingPath);
+        if (interrupted) {
+            if (const auto log = readFile(compactingPath))
+                parse(*log, logMagic, compactingPath, apply);
+        }
+        std::size_t validSize = 0;
+        if (const auto log = readFile(logPath))
+            validSize = parse(*log, logMagic, logPath, apply);
+
+        if (interrupted)
+            mergeCompacting();
+        openLog(validSize);
+        worker = std::thread{&WalJournal::run, this};
+    }
+
+    template <typename EncodeState>
+    void append(Op op, const StateKey& key, EncodeState&& encodeState) {
+        std::lock_guard lock{mutex};
+        if (backgroundError)
+            std::rethrow_exception(std::exchange(backgroundError, nullptr));
+
+        const std::size_t before = buffer.size();
+        appendRecord(buffer, op, key, std::forward<EncodeState>(encodeState));
+        logSize += buffer.size() - before;
+
+        if (options.sync == Sync::EveryWrite) {
+            syncLog();
+        } else if (buffer.size() >= bufferLimit) {
+            // while the worker writes, the buffer grows until it takes it
+            const std::unique_lock writing{writeMutex, std::try_to_lock};
+            if (writing)
+                writeBuffer();
+        }
+
+        if (logSize >= options.compactAfterBytes && !compactionRequested) {
+            compactionRequested = true;
+            wake.notify_one();
+        }
+    }
+
+    // Writes and fsyncs everything appended so far
+    void sync() {
+        const std::lock_guard writing{writeMutex};
+        std::lock_guard lock{mutex};
+        syncLog();
+    }
+
+    // Synchronously merges the log into the snapshot
+    void compact() {
+        std::lock_guard lock{compactionMutex};
+        // A log left by a failed merge must be merged before the current one is moved over it
+        if (!std::filesystem::exists(compactingPath))
+            rotate();
+        mergeCompacting();
+    }
+};
+
+} // namespace detail
+
+/*
+ * Durable storage: states live in memory (in `MemoryT`), and every put/erase is appended to a log file
+ * before it is applied. On start the storage replays the snapshot and the log.
+ * The log is periodically merged into the snapshot by a background thread, so recovery time is bounded
+ * by the number of keys rather than by the number of transitions ever made.
+ *
+ * Durability depends on `WalOptions::sync`:
+ *  * `EveryWrite` survives a crash of the OS, at the cost of an fsync per transition;
+ *  * `Periodic` may lose the transitions of the last `syncInterval` on any crash;
+ *  * `Never` may lose up to 64 KiB of buffered records on a crash of the process.
+ * Errors of background writes are thrown from the next put/erase.
+ *
+ * Only put/erase are logged: a change made in place through `StateT*` or a handler's state parameter
+ * is lost on restart unless the state is put again.
+ *
+ * States are encoded with serialization.hpp, so state options may be appended between runs, and reordered
+ * if they declare their `serializationTag`.
+ * Files written with another `schemaVersion` are rejected. POSIX only.
+ */
+template <concepts::State StateT_, typename MemoryT = MemoryStateStorage<StateT_>>
+    requires serialization::Serializable<StateT_> && concepts::StateStorage<MemoryT, StateT_>
+class WalStateStorage {
+  public:
+    using StateT = StateT_;
+    static constexpr bool stableStateReferences = concepts::StableStateStorage<MemoryT>;
+
+  private:
+    using Op = detail::WalJournal::Op;
+
+    MemoryT live;
+    std::unique_ptr<detail::WalJournal> journal;
+
+  public:
+    // Files are `<path>.snapshot` and `<path>.log`.
+    // Increment `schemaVersion` to reject old files when the encoding or the meaning of states changes.
+    explicit WalStateStorage(const std::string& path, WalOptions options = {}, std::uint64_t schemaVersion = 0)
+        : journal{std::make_unique<detail::WalJournal>(path, detail::mix64(schemaVersion), options)} {
+        journal->recover([this](Op op, const StateKey& key, std::string_view state) {
+            if (op == Op::erase) {
+                live.erase(key);
+                return true;
+            }
+            std::optional<StateT> decoded;
+            try {
+                decoded = serialization::decode<StateT>(state);
+            } catch (const serialization::DecodeError&) {
+                return false;
+            }
+            std::visit([&](auto&& option) { live.put(key, std::forward<decltype(option)>(option)); },
+                       std::move(*decoded));
+            return true;
+        });
+    }
+
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        return live[key];
+    }
+
+    [[nodiscard]] const StateT* operator[](const StateKey& key) const {
+        return live[key];
+    }
+
+    void erase(const StateKey& key) {
+        journal->append(Op::erase, key, [](std::string&) {});
+        live.erase(key);
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        journal->append(Op::put, key, [&state](std::string& out) { serialization::encodeAs<StateT>(state, out); });
+        return live.put(key, std::forward<T>(state));
+    }
+
+    // Writes and fsyncs all the transitions made so far, whatever the sync policy is
+    void sync() {
+        journal->sync();
+    }
+
+    // Merges the log into the snapshot now instead of waiting for the log to grow
+    void compact() {
+        journal->compact();
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_state_storage_wal
@@ -0,0 +1,437 @@
+#ifndef INCLUDE_tgbotstater_tracing
+#define INCLUDE_tgbotstater_tracing
+
+#include "tg_stater/logging.hpp"
+
+#include <tgbot/net/HttpClient.h>
+#include <tgbot/net/HttpReqArg.h>
+#include <tgbot/net/Url.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace tg_stater::tracing {
+
+struct TracingOptions {
+    enum class Format : std::uint8_t {
+        ChromeTrace, // a JSON array of trace events, opens in Perfetto and chrome://tracing
+        OtlpJson,    // a line of OTLP/JSON ExportTraceServiceRequest per update, as the OpenTelemetry file exporter
+    };
+
+    std::string path;
+    Format format = Format::ChromeTrace;
+    // Fraction of updates that are traced
+    double sampleRate = 1.0;
+    std::string serviceName = "tg_stater";
+};
+
+class Tracer;
+
+namespace detail {
+
+inline std::atomic<Tracer*> tracer{nullptr};
+
+inline std::int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// NOLINTBEGIN(*-magic-numbers)
+inline std::uint64_t random() {
+    thread_local std::uint64_t state =
+        static_cast<std::uint64_t>(nowNs()) ^ reinterpret_cast<std::uintptr_t>(&state); // NOLINT(*-reinterpret-cast)
+    // splitmix64
+    std::uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30U)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27U)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31U);
+}
+// NOLINTEND(*-magic-numbers)
+
+inline std::uint32_t threadNumber() {
+    static std::atomic<std::uint32_t> next{1};
+    thread_local const std::uint32_t number = next.fetch_add(1, std::memory_order_relaxed);
+    return number;
+}
+
+inline void appendHex(std::string& out, std::uint64_t value) {
+    static constexpr std::string_view digits = "0123456789abcdef";
+    for (int shift = 60; shift >= 0; shift -= 4) // NOLINT(*-magic-numbers)
+        out += digits[(value >> static_cast<unsigned>(shift)) & 0xFU];
+}
+
+inline void appendJsonString(std::string& out, std::string_view s) {
+    out += '"';
+    for (const char c : s) {
+        switch (c) {
+        case '"':
+            out += "\\\"";
+            break;
+        case '\\':
+            out += "\\\\";
+            break;
+        case '\n':
+            out += "\\n";
+            break;
+        default:
+            if (static_cast<unsigned char>(c) < 0x20) { // NOLINT(*-magic-numbers)
+                out += "\\u00";
+                out += "0123456789abcdef"[static_cast<unsigned char>(c) >> 4U];
+                out += "0123456789abcdef"[static_cast<unsigned char>(c) & 0xFU];
+            } else {
+                out += c;
+            }
+        }
+    }
+    out += '"';
+}
+
+// Trace event timestamps are in microseconds
+inline void appendMicros(std::string& out, std::int64_t ns) {
+    static constexpr std::int64_t nsPerUs = 1000;
+    out += std::to_string(ns / nsPerUs);
+    const auto fraction = std::to_string(ns % nsPerUs + nsPerUs);
+    out += '.';
+    out += std::string_view{fraction}.substr(1);
+}
+
+} // namespace detail
+
+/*
+ * Spans of one traced update. It is shared by the thread that received the update and the dispatcher's worker
+ * that handles it, and is written out when the last of them lets it go.
+ */
+class Trace : public std::enable_shared_from_this<Trace> {
+  public:
+    struct Span {
+        std::string name;
+        std::uint64_t id;
+        std::uint64_t parent; // 0 for the root
+        std::int64_t startNs;
+        std::int64_t endNs = 0;
+        std::uint32_t thread;
+    };
+
+    std::array<std::uint64_t, 2> id{detail::random(), detail::random()};
+    std::string chat;
+
+  private:
+    std::mutex mutex;
+    std::vector<Span> spans;
+
+  public:
+    explicit Trace(std::string chat) : chat{std::move(chat)} {}
+
+    Trace(const Trace&) = delete;
+    Trace& operator=(const Trace&) = delete;
+    Trace(Trace&&) = delete;
+    Trace& operator=(Trace&&) = delete;
+    ~Trace();
+
+    // Returns the span's id
+    std::uint64_t open(std::string name, std::uint64_t parent, std::int64_t startNs = detail::nowNs()) {
+        const std::uint64_t spanId = detail::random() | 1U; // never 0
+        std::lock_guard lock{mutex};
+        spans.push_back({std::move(name), spanId, parent, startNs, 0, detail::threadNumber()});
+        return spanId;
+    }
+
+    void close(std::uint64_t spanId) {
+        const std::int64_t endNs = detail::nowNs();
+        std::lock_guard lock{mutex};
+        for (auto it = spans.rbegin(); it != spans.rend(); ++it)
+            if (it->id == spanId) {
+                it->endNs = endNs;
+                return;
+            }
+    }
+
+    // Valid once no other thread uses the trace
+    [[nodiscard]] const std::vector<Span>& finishedSpans() const {
+        return spans;
+    }
+};
+
+namespace detail {
+
+// The trace and the innermost open span of the calling thread, if its update is traced
+struct Context {
+    Trace* trace = nullptr;
+    std::uint64_t span = 0;
+};
+inline thread_local Context context;
+
+} // namespace detail
+
+/*
+ * Writes sampled traces to a file. Updates are traced only while a Tracer exists, at most one may exist at a time.
+ * It must outlive the bot, so that every started trace is written.
+ */
+class Tracer {
+    using Format = TracingOptions::Format;
+
+    TracingOptions options;
+    std::uint64_t sampleThreshold;
+    std::mutex mutex;
+    std::ofstream out;
+    bool first = true;
+    std::string buffer;
+
+    void appendChrome(const Trace& trace) {
+        for (const Trace::Span& span : trace.finishedSpans()) {
+            buffer += first ? "\n" : ",\n";
+            first = false;
+            buffer += R"({"name":)";
+            detail::appendJsonString(buffer, span.name);
+            buffer += R"(,"cat":"tg_stater","ph":"X","ts":)";
+            detail::appendMicros(buffer, span.startNs);
+            buffer += R"(,"dur":)";
+            detail::appendMicros(buffer, span.endNs - span.startNs);
+            buffer += R"(,"pid":1,"tid":)";
+            buffer += std::to_string(span.thread);
+            buffer += R"(,"args":{"trace":")";
+            detail::appendHex(buffer, trace.id[0]);
+            detail::appendHex(buffer, trace.id[1]);
+            buffer += R"(","chat":)";
+            detail::appendJsonString(buffer, trace.chat);
+            buffer += "}}";
+        }
+    }
+
+    void appendOtlp(const Trace& trace) {
+        buffer += R"({"resourceSpans":[{"resource":{"attributes":[{"key":"service.name","value":{"stringValue":)";
+        detail::appendJsonString(buffer, options.serviceName);
+        buffer += R"(}}]},"scopeSpans":[{"scope":{"name":"tg_stater"},"spans":[)";
+        bool firstSpan = true;
+        for (const Trace::Span& span : trace.finishedSpans()) {
+            if (!firstSpan)
+                buffer += ',';
+            firstSpan = false;
+            buffer += R"({"traceId":")";
+            detail::appendHex(buffer, trace.id[0]);
+            detail::appendHex(buffer, trace.id[1]);
+            buffer += R"(","spanId":")";
+            detail::appendHex(buffer, span.id);
+            if (span.parent != 0) {
+                buffer += R"(","parentSpanId":")";
+                detail::appendHex(buffer, span.parent);
+            }
+            buffer += R"(","name":)";
+            detail::appendJsonString(buffer, span.name);
+            buffer += R"(,"kind":1,"startTimeUnixNano":")";
+            buffer += std::to_string(span.startNs);
+            buffer += R"(","endTimeUnixNano":")";
+            buffer += std::to_string(span.endNs);
+            buffer += R"(","attributes":[{"key":"chat","value":{"stringValue":)";
+            detail::appendJsonString(buffer, trace.chat);
+            buffer += R"(}},{"key":"thread.id","value":{"intValue":")";
+            buffer += std::to_string(span.thread);
+            buffer += R"("}}]})";
+        }
+        buffer += "]}]}]}\n";
+    }
+
+  public:
+    explicit Tracer(TracingOptions options_) : options{std::move(options_)} {
+        const double threshold = options.sampleRate * 0x1p64; // NOLINT(*-magic-numbers)
+        sampleThreshold = threshold >= 0x1p64 ? UINT64_MAX // NOLINT(*-magic-numbers)
+                          : threshold <= 0    ? 0
+                                              : static_cast<std::uint64_t>(threshold);
+
+        // traces finished by other threads once this tracer is installed wait for the file to be ready
+        std::lock_guard lock{mutex};
+        // not truncated until installed, so a rejected tracer leaves the trace of the installed one alone
+        out.open(options.path, std::ios::binary | std::ios::app);
+        if (!out)
+            throw std::runtime_error("Failed to open trace file " + options.path);
+        Tracer* expected = nullptr;
+        if (!detail::tracer.compare_exchange_strong(expected, this, std::memory_order_acq_rel))
+            throw std::logic_error("Another Tracer is already installed.");
+
+        std::error_code error;
+        std::filesystem::resize_file(options.path, 0, error);
+        if (error)
+            logging::log<logging::ERROR>("Failed to truncate trace file {}: {}", options.path, error.message());
+        if (options.format == Format::ChromeTrace)
+            out << '[';
+    }
+
+    Tracer(const Tracer&) = delete;
+    Tracer& operator=(const Tracer&) = delete;
+    Tracer(Tracer&&) = delete;
+    Tracer& operator=(Tracer&&) = delete;
+
+    ~Tracer() {
+        detail::tracer.store(nullptr, std::memory_order_release);
+        std::lock_guard lock{mutex};
+        if (options.format == Format::ChromeTrace)
+            out << "\n]\n";
+    }
+
+    [[nodiscard]] bool sample() const {
+        return sampleThreshold == UINT64_MAX || detail::random() < sampleThreshold;
+    }
+
+    void write(const Trace& trace) {
+        std::lock_guard lock{mutex};
+        buffer.clear();
+        if (options.format == Format::ChromeTrace)
+            appendChrome(trace);
+        else
+            appendOtlp(trace);
+        // flushed per update, so that the traces before a crash are readable
+        out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+        out.flush();
+    }
+};
+
+inline Trace::~Trace() {
+    if (Tracer* t = detail::tracer.load(std::memory_order_acquire)) {
+        try {
+            t->write(*this);
+        } catch (const std::exception& e) {
+            logging::log<logging::ERROR>("Failed to write a trace: {}", e.what());
+        }
+    }
+}
+
+// A child span of the current one, if the current update is traced; costs a thread-local read otherwise
+class Span {
+    Trace* trace;
+    std::uint64_t id = 0;
+    std::uint64_t parent = 0;
+
+  public:
+    explicit Span(std::string_view name) : trace{detail::context.trace} {
+        if (!trace)
+            return;
+        parent = detail::context.span;
+        id = trace->open(std::string{name}, parent);
+        detail::context.span = id;
+    }
+
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+    Span(Span&&) = delete;
+    Span& operator=(Span&&) = delete;
+
+    ~Span() {
+        if (!trace)
+            return;
+        trace->close(id);
+        detail::context.span = parent;
+    }
+};
+
+// The root span of an update. Decides whether the update is sampled.
+class UpdateSpan {
+    std::shared_ptr<Trace> trace;
+    detail::Context previous;
+    std::uint64_t id = 0;
+
+  public:
+    template <typename Key>
+    UpdateSpan(std::string_view event, const Key& key) {
+        Tracer* const tracer = detail::tracer.load(std::memory_order_acquire);
+        if (!tracer || !tracer->sample())
+            return;
+        trace = std::make_shared<Trace>(TGBOTSTATER_FMT_NAMESPACE::format("{}", key));
+        id = trace->open(std::string{event}, 0);
+        previous = std::exchange(detail::context, {trace.get(), id});
+    }
+
+    UpdateSpan(const UpdateSpan&) = delete;
+    UpdateSpan& operator=(const UpdateSpan&) = delete;
+    UpdateSpan(UpdateSpan&&) = delete;
+    UpdateSpan& operator=(UpdateSpan&&) = delete;
+
+    ~UpdateSpan() {
+        if (!trace)
+            return;
+        trace->close(id);
+        detail::context = previous;
+    }
+};
+
+// Carries the current trace over to another thread, see Resume
+struct Handoff {
+    std::shared_ptr<Trace> trace;
+    std::uint64_t parent = 0;
+    std::int64_t postedNs = 0;
+
+    static Handoff current() {
+        const detail::Context& context = detail::context;
+        if (!context.trace)
+            return {};
+        // the trace is owned by an UpdateSpan or a Resume up the stack
+        return {context.trace->shared_from_this(), context.span, detail::nowNs()};
+    }
+};
+
+// Continues a handed off trace on the calling thread, with a span for the time it waited in the queue
+class Resume {
+    std::shared_ptr<Trace> trace;
+    detail::Context previous;
+
+  public:
+    explicit Resume(Handoff handoff) : trace{std::move(handoff.trace)} {
+        if (!trace)
+            return;
+        trace->close(trace->open("queued", handoff.parent, handoff.postedNs));
+        previous = std::exchange(detail::context, {trace.get(), handoff.parent});
+    }
+
+    Resume(const Resume&) = delete;
+    Resume& operator=(const Resume&) = delete;
+    Resume(Resume&&) = delete;
+    Resume& operator=(Resume&&) = delete;
+
+    ~Resume() {
+        if (trace)
+            detail::context = previous;
+    }
+};
+
+/*
+ * Wraps the HTTP client of a TgBot::Bot to add a span for each API call made while handling a traced update:
+ * ```cpp
+ * TgBot::CurlHttpClient curl;
+ * tg_stater::tracing::TracingHttpClient client{curl};
+ * TgBot::Bot bot{token, client};
+ * ```
+ * The span is named after the API method, the token in the URL never gets into the trace.
+ */
+class TracingHttpClient : public TgBot::HttpClient {
+    TgBot::HttpClient& client;
+
+  public:
+    explicit TracingHttpClient(TgBot::HttpClient& client) : client{client} {
+        _timeout = client._timeout;
+    }
+
+    std::string makeRequest(const TgBot::Url& url, const std::vector<TgBot::HttpReqArg>& args) const override {
+        client._timeout = _timeout;
+        if (!detail::context.trace)
+            return client.makeRequest(url, args);
+        const std::string_view path = url.path;
+        const Span span{"api " + std::string{path.substr(path.rfind('/') + 1)}};
+        return client.makeRequest(url, args);
+    }
+};
+
+} // namespace tg_stater::tracing
+
+#endif // INCLUDE_tgbotstater_tracing
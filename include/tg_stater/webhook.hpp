@@ -0,0 +1,464 @@
+#ifndef INCLUDE_tgbotstater_webhook
+#define INCLUDE_tgbotstater_webhook
+
+#include "tg_stater/logging.hpp"
+#include "tg_stater/replay.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <tgbot/types/Update.h>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace tg_stater {
+
+struct WebhookOptions {
+    std::string address = "0.0.0.0";
+    std::uint16_t port = 8080;         // NOLINT(*-magic-numbers)
+    std::string path = "/";            // requests to other paths get 404
+    std::string secretToken;           // compared with X-Telegram-Bot-Api-Secret-Token unless empty
+    std::size_t workers = 4;           // threads parsing the updates and calling the handlers
+    std::size_t queueCapacity = 10000; // NOLINT(*-magic-numbers) acknowledged updates not handed over, 503 beyond
+};
+
+namespace detail {
+
+// The head of an HTTP request, with only the headers the webhook needs
+struct RequestHead {
+    std::string_view method;
+    std::string_view path;
+    std::string_view secretToken;
+    std::size_t contentLength = 0;
+    bool chunked = false;
+    bool keepAlive = true;
+    bool valid = true;
+};
+
+inline bool equalsIgnoreCase(std::string_view a, std::string_view b) {
+    return std::ranges::equal(
+        a, b, [](unsigned char x, unsigned char y) { return std::tolower(x) == std::tolower(y); });
+}
+
+inline std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+        s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+        s.remove_suffix(1);
+    return s;
+}
+
+// `head` is everything before the empty line
+inline RequestHead parseRequestHead(std::string_view head) {
+    RequestHead result;
+    std::string_view line = head.substr(0, head.find("\r\n"));
+    head.remove_prefix(std::min(head.size(), line.size() + 2));
+
+    // "POST /path?query HTTP/1.1"
+    const std::size_t methodEnd = line.find(' ');
+    const std::size_t targetEnd = line.rfind(' ');
+    if (methodEnd == std::string_view::npos || targetEnd == methodEnd) {
+        result.valid = false;
+        return result;
+    }
+    result.method = line.substr(0, methodEnd);
+    result.path = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+    result.path = result.path.substr(0, result.path.find('?'));
+    result.keepAlive = line.substr(targetEnd + 1) != "HTTP/1.0";
+
+    while (!head.empty()) {
+        line = head.substr(0, head.find("\r\n"));
+        head.remove_prefix(std::min(head.size(), line.size() + 2));
+        const std::size_t colon = line.find(':');
+        if (colon == std::string_view::npos)
+            continue;
+        const std::string_view name = trim(line.substr(0, colon));
+        const std::string_view value = trim(line.substr(colon + 1));
+        if (equalsIgnoreCase(name, "content-length")) {
+            std::size_t length = 0;
+            for (const char c : value) {
+                if (c < '0' || c > '9' || length > (std::size_t{1} << 40U)) { // NOLINT(*-magic-numbers)
+                    result.valid = false;
+                    break;
+                }
+                length = length * 10 + static_cast<std::size_t>(c - '0'); // NOLINT(*-magic-numbers)
+            }
+            result.contentLength = length;
+        } else if (equalsIgnoreCase(name, "x-telegram-bot-api-secret-token")) {
+            result.secretToken = value;
+        } else if (equalsIgnoreCase(name, "transfer-encoding")) {
+            result.chunked = true;
+        } else if (equalsIgnoreCase(name, "connection")) {
+            if (equalsIgnoreCase(value, "close"))
+                result.keepAlive = false;
+            else if (equalsIgnoreCase(value, "keep-alive"))
+                result.keepAlive = true;
+        }
+    }
+    return result;
+}
+
+// Takes as long for every `given` of the expected size, so the secret can't be guessed byte by byte
+inline bool secretMatches(std::string_view expected, std::string_view given) {
+    unsigned char difference = expected.size() == given.size() ? 0 : 1;
+    for (std::size_t i = 0; i < expected.size(); ++i)
+        difference |= static_cast<unsigned char>(expected[i] ^ (i < given.size() ? given[i] : 0));
+    return difference == 0;
+}
+
+} // namespace detail
+
+/*
+ * Webhook server in place of `TgBot::TgWebhookTcpServer`, which reads, parses and handles one connection at a time.
+ * One thread runs an epoll loop over keep-alive connections: it checks the secret token from the headers,
+ * queues the body and answers 200 right away. A pool of workers parses the queued updates and passes them to `sink`
+ * in the order they were received, one at a time: the worker that parses the next update in order hands it over,
+ * along with the later ones already parsed. Telegram doesn't order updates across its `maxConnections`,
+ * but it sends the updates of a chat one after another.
+ * Plain HTTP, so a reverse proxy terminates TLS as for `TgWebhookTcpServer`. Linux only.
+ */
+class WebhookServer {
+  public:
+    using UpdateSink = std::function<void(const TgBot::Update::Ptr&)>;
+
+  private:
+    static constexpr std::size_t maxHeadSize = std::size_t{16} << 10U;
+    static constexpr std::size_t maxBodySize = std::size_t{1} << 20U;
+    static constexpr int maxEvents = 256;
+
+    struct Connection {
+        std::string in;
+        std::string out;
+        bool writing = false; // waits for EPOLLOUT
+        bool closing = false; // closed once `out` is sent
+    };
+
+    WebhookOptions options;
+    UpdateSink sink;
+    const detail::UpdateReader reader{};
+
+    int listening = -1;
+    int epoll = -1;
+    int wakeup = -1; // eventfd for `stop`
+    std::atomic<bool> stopped{false};
+    std::unordered_map<int, Connection> connections; // only touched by `run`
+
+    std::mutex mutex;
+    std::condition_variable notEmpty;
+    std::deque<std::pair<std::uint64_t, std::string>> queue; // sequence numbers and bodies
+    std::uint64_t received = 0;                               // sequence number of the next body
+    // Updates parsed ahead of an earlier one, at `sequence - delivered`; null if malformed, nullopt if not parsed yet
+    std::deque<std::optional<TgBot::Update::Ptr>> reorder;
+    std::uint64_t delivered = 0;
+    bool delivering = false;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+
+    void closeFds() {
+        for (const int fd : {wakeup, epoll, listening})
+            if (fd != -1)
+                ::close(fd);
+    }
+
+    [[noreturn]] void throwErrno(const std::string& what) {
+        const int error = errno;
+        closeFds();
+        throw std::system_error(error, std::generic_category(), what);
+    }
+
+    void watch(int fd, std::uint32_t events, int operation) const {
+        epoll_event event{.events = events, .data = {.fd = fd}};
+        if (::epoll_ctl(epoll, operation, fd, &event) == -1)
+            throw std::system_error(errno, std::generic_category(), "Failed to watch a webhook socket");
+    }
+
+    bool enqueue(std::string body) {
+        {
+            std::lock_guard lock{mutex};
+            if (received - delivered >= options.queueCapacity)
+                return false;
+            queue.emplace_back(received++, std::move(body));
+        }
+        notEmpty.notify_one();
+        return true;
+    }
+
+    void handOver(const TgBot::Update::Ptr& update) {
+        try {
+            sink(update);
+        } catch (const std::exception& e) {
+            logging::log<logging::ERROR>("{}", e.what());
+        } catch (...) {
+            logging::log<logging::ERROR>("Non-std::exception exception was caught in webhook");
+        }
+    }
+
+    // Hands over the updates that are next in order, with the lock held. Updates parsed meanwhile are handed over
+    // too, so a worker waits for no one: it either delivers or leaves its update to the one delivering.
+    void deliver(std::unique_lock<std::mutex>& lock) {
+        delivering = true;
+        while (!reorder.empty() && reorder.front()) {
+            const TgBot::Update::Ptr update = std::move(*reorder.front());
+            reorder.pop_front();
+            ++delivered;
+            if (!update)
+                continue;
+            lock.unlock();
+            handOver(update);
+            lock.lock();
+        }
+        delivering = false;
+    }
+
+    void work() {
+        std::unique_lock lock{mutex};
+        while (true) {
+            notEmpty.wait(lock, [&] { return stopping || !queue.empty(); });
+            if (queue.empty())
+                return;
+            const auto [sequence, body] = std::move(queue.front());
+            queue.pop_front();
+            lock.unlock();
+
+            TgBot::Update::Ptr update;
+            try {
+                update = reader.parse(body);
+            } catch (const std::exception& e) {
+                logging::log<logging::WARN>("Skipping a malformed webhook update: {}", e.what());
+            }
+            lock.lock();
+            const auto slot = static_cast<std::size_t>(sequence - delivered);
+            if (reorder.size() <= slot)
+                reorder.resize(slot + 1);
+            reorder[slot] = std::move(update);
+            if (!delivering)
+                deliver(lock);
+        }
+    }
+
+    static void respond(Connection& connection, std::string_view status, bool keepAlive) {
+        connection.out += "HTTP/1.1 ";
+        connection.out += status;
+        connection.out += "\r\nContent-Length: 0\r\n";
+        connection.out += keepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+        connection.closing = !keepAlive;
+    }
+
+    // Answers every complete request in `in`
+    void process(Connection& connection) {
+        while (!connection.closing) {
+            const std::size_t headEnd = connection.in.find("\r\n\r\n");
+            if (headEnd == std::string::npos) {
+                if (connection.in.size() > maxHeadSize)
+                    respond(connection, "431 Request Header Fields Too Large", false);
+                return;
+            }
+            const detail::RequestHead head =
+                detail::parseRequestHead(std::string_view{connection.in}.substr(0, headEnd));
+            // everything but a well-formed update closes the connection without reading the body
+            if (!head.valid) {
+                respond(connection, "400 Bad Request", false);
+            } else if (!options.secretToken.empty() && !detail::secretMatches(options.secretToken, head.secretToken)) {
+                respond(connection, "401 Unauthorized", false);
+            } else if (head.path != options.path) {
+                respond(connection, "404 Not Found", false);
+            } else if (head.method != "POST") {
+                respond(connection, "405 Method Not Allowed", false);
+            } else if (head.chunked) {
+                respond(connection, "411 Length Required", false);
+            } else if (head.contentLength > maxBodySize) {
+                respond(connection, "413 Content Too Large", false);
+            }
+            if (connection.closing)
+                return;
+
+            const std::size_t bodyStart = headEnd + 4;
+            if (connection.in.size() < bodyStart + head.contentLength)
+                return;
+            const bool keepAlive = head.keepAlive;
+            const bool queued = enqueue(connection.in.substr(bodyStart, head.contentLength));
+            connection.in.erase(0, bodyStart + head.contentLength);
+            // Telegram repeats an update that was not answered with 2xx
+            respond(connection, queued ? "200 OK" : "503 Service Unavailable", keepAlive);
+        }
+    }
+
+    void close(int fd) {
+        connections.erase(fd);
+        ::close(fd);
+    }
+
+    // Sends what `out` holds and closes the connection if it is done. Returns false if it was closed.
+    bool flush(int fd, Connection& connection) {
+        while (!connection.out.empty()) {
+            const ssize_t sent = ::send(fd, connection.out.data(), connection.out.size(), MSG_NOSIGNAL);
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                if (!connection.writing)
+                    watch(fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, EPOLL_CTL_MOD);
+                connection.writing = true;
+                return true;
+            }
+            if (sent <= 0) {
+                close(fd);
+                return false;
+            }
+            connection.out.erase(0, static_cast<std::size_t>(sent));
+        }
+        if (connection.closing) {
+            close(fd);
+            return false;
+        }
+        if (connection.writing)
+            watch(fd, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_MOD);
+        connection.writing = false;
+        return true;
+    }
+
+    void read(int fd, Connection& connection) {
+        std::array<char, 16384> buffer{}; // NOLINT(*-magic-numbers)
+        bool peerClosed = false;
+        while (true) {
+            const ssize_t received = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (received > 0) {
+                if (!connection.closing)
+                    connection.in.append(buffer.data(), static_cast<std::size_t>(received));
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+            peerClosed = true;
+            break;
+        }
+        process(connection);
+        connection.closing = connection.closing || peerClosed;
+        flush(fd, connection);
+    }
+
+    void accept() {
+        while (true) {
+            const int client = ::accept4(listening, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (client == -1)
+                return;
+            connections.try_emplace(client);
+            watch(client, EPOLLIN | EPOLLRDHUP, EPOLL_CTL_ADD);
+        }
+    }
+
+  public:
+    WebhookServer(WebhookOptions webhookOptions, UpdateSink updateSink)
+        : options{std::move(webhookOptions)}, sink{std::move(updateSink)} {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(options.port);
+        if (::inet_pton(AF_INET, options.address.c_str(), &address.sin_addr) != 1)
+            throw std::invalid_argument("Invalid IPv4 address: " + options.address);
+
+        listening = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        if (listening == -1)
+            throwErrno("Failed to create the webhook socket");
+        const int reuse = 1;
+        ::setsockopt(listening, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        // NOLINTNEXTLINE(*-reinterpret-cast)
+        if (::bind(listening, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+            throwErrno("Failed to bind the webhook to " + options.address + ':' + std::to_string(options.port));
+        if (::listen(listening, SOMAXCONN) == -1)
+            throwErrno("Failed to listen on the webhook socket");
+        if ((epoll = ::epoll_create1(EPOLL_CLOEXEC)) == -1)
+            throwErrno("Failed to create the webhook epoll");
+        if ((wakeup = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+            throwErrno("Failed to create the webhook eventfd");
+        watch(listening, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeup, EPOLLIN, EPOLL_CTL_ADD);
+
+        workers.reserve(options.workers);
+        for (std::size_t i = 0; i < std::max<std::size_t>(options.workers, 1); ++i)
+            workers.emplace_back([this] { work(); });
+    }
+
+    WebhookServer(const WebhookServer&) = delete;
+    WebhookServer& operator=(const WebhookServer&) = delete;
+    WebhookServer(WebhookServer&&) = delete;
+    WebhookServer& operator=(WebhookServer&&) = delete;
+
+    // Already acknowledged updates are handled before the workers exit
+    ~WebhookServer() {
+        {
+            std::lock_guard lock{mutex};
+            stopping = true;
+        }
+        notEmpty.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+        for (const auto& [fd, connection] : connections)
+            ::close(fd);
+        closeFds();
+    }
+
+    // The port the server listens on, useful with port 0
+    [[nodiscard]] std::uint16_t port() const {
+        sockaddr_in address{};
+        socklen_t size = sizeof(address);
+        ::getsockname(listening, reinterpret_cast<sockaddr*>(&address), &size); // NOLINT(*-reinterpret-cast)
+        return ntohs(address.sin_port);
+    }
+
+    // Serves the connections on the calling thread until `stop`
+    void run() {
+        std::array<epoll_event, maxEvents> events{};
+        while (!stopped.load(std::memory_order_relaxed)) {
+            const int count = ::epoll_wait(epoll, events.data(), maxEvents, -1);
+            if (count == -1 && errno != EINTR)
+                throw std::system_error(errno, std::generic_category(), "Failed to wait for webhook sockets");
+            for (int i = 0; i < count; ++i) {
+                const int fd = events[i].data.fd; // NOLINT(*-union-access)
+                if (fd == wakeup || fd == listening) {
+                    if (fd == listening)
+                        accept();
+                    continue;
+                }
+                const auto connection = connections.find(fd);
+                if (connection == connections.end())
+                    continue;
+                if ((events[i].events & EPOLLOUT) != 0 && !flush(fd, connection->second))
+                    continue;
+                if ((events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) != 0)
+                    read(fd, connection->second);
+            }
+        }
+    }
+
+    // Makes `run` return, may be called from any thread
+    void stop() {
+        stopped.store(true, std::memory_order_relaxed);
+        const std::uint64_t one = 1;
+        [[maybe_unused]] const ssize_t written = ::write(wakeup, &one, sizeof(one));
+    }
+};
+
+} // namespace tg_stater
+
+#endif // INCLUDE_tgbotstater_webhook
@@ -0,0 +1,277 @@
+#include "temp_dir.hpp"
+
+#include "tg_stater/async_logging.hpp"
+#include "tg_stater/logging.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+using logging::AsyncLogger;
+using logging::AsyncLoggerOptions;
+using logging::LogRecord;
+using logging::LogSink;
+
+// What a RecordingSink has written, kept outside of the sink, which the logger owns
+struct Recorded {
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::vector<std::string> messages;
+    bool entered = false;   // the logger's thread is in `write`
+    bool held = false;      // `write` waits until it is released
+    std::size_t flushes = 0;
+
+    void hold() {
+        const std::lock_guard lock{mutex};
+        held = true;
+    }
+
+    void release() {
+        {
+            const std::lock_guard lock{mutex};
+            held = false;
+        }
+        changed.notify_all();
+    }
+
+    void waitEntered() {
+        std::unique_lock lock{mutex};
+        changed.wait(lock, [this] { return entered; });
+    }
+
+    [[nodiscard]] std::vector<std::string> all() {
+        const std::lock_guard lock{mutex};
+        return messages;
+    }
+
+    [[nodiscard]] std::size_t count() {
+        const std::lock_guard lock{mutex};
+        return messages.size();
+    }
+};
+
+class RecordingSink : public LogSink {
+    Recorded& recorded;
+
+  public:
+    explicit RecordingSink(Recorded& recorded) : recorded{recorded} {}
+
+    void write(const LogRecord& record) override {
+        std::unique_lock lock{recorded.mutex};
+        recorded.entered = true;
+        recorded.changed.notify_all();
+        recorded.changed.wait(lock, [this] { return !recorded.held; });
+        recorded.messages.emplace_back(record.message);
+    }
+
+    void flush() override {
+        const std::lock_guard lock{recorded.mutex};
+        ++recorded.flushes;
+    }
+};
+
+std::string readFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+// Log calls made without a logger go to std::clog, which is silenced while the test runs
+class SilentClog {
+    std::streambuf* previous = std::clog.rdbuf(nullptr);
+
+  public:
+    SilentClog() = default;
+    SilentClog(const SilentClog&) = delete;
+    SilentClog& operator=(const SilentClog&) = delete;
+    SilentClog(SilentClog&&) = delete;
+    SilentClog& operator=(SilentClog&&) = delete;
+
+    ~SilentClog() {
+        std::clog.rdbuf(previous);
+        std::clog.clear();
+    }
+};
+
+TEST(AsyncLogger, DropsRecordsThatDoNotFit) {
+    Recorded recorded;
+    recorded.hold();
+    AsyncLogger logger{std::make_unique<RecordingSink>(recorded),
+                       {.capacity = 2, .overflow = AsyncLoggerOptions::Overflow::Drop}};
+    // the first record keeps its slot until the sink returns
+    logging::log("0");
+    recorded.waitEntered();
+    for (int i = 1; i < 4; ++i)
+        logging::log("{}", i);
+    EXPECT_EQ(logger.droppedCount(), 2);
+
+    recorded.release();
+    logger.flush();
+    EXPECT_EQ(recorded.all(), (std::vector<std::string>{"0", "1"}));
+}
+
+TEST(AsyncLogger, BlocksUntilARecordFits) {
+    Recorded recorded;
+    recorded.hold();
+    AsyncLogger logger{std::make_unique<RecordingSink>(recorded),
+                       {.capacity = 2, .overflow = AsyncLoggerOptions::Overflow::Block}};
+    logging::log("0");
+    recorded.waitEntered();
+    logging::log("1");
+    auto blocked = std::async(std::launch::async, [] { logging::log("2"); });
+    EXPECT_EQ(blocked.wait_for(100ms), std::future_status::timeout);
+
+    recorded.release();
+    blocked.get();
+    logger.flush();
+    EXPECT_EQ(recorded.all(), (std::vector<std::string>{"0", "1", "2"}));
+    EXPECT_EQ(logger.droppedCount(), 0);
+}
+
+TEST(AsyncLogger, FlushWritesAndFlushesEverythingLogged) {
+    Recorded recorded;
+    AsyncLogger logger{std::make_unique<RecordingSink>(recorded)};
+    for (int i = 0; i < 100; ++i)
+        logging::log("{}", i);
+    logger.flush();
+    const std::vector<std::string> messages = recorded.all();
+    ASSERT_EQ(messages.size(), 100);
+    EXPECT_EQ(messages.back(), "99");
+    const std::lock_guard lock{recorded.mutex};
+    EXPECT_GT(recorded.flushes, 0);
+}
+
+TEST(AsyncLogger, FlushWaitsForRecordsBeingPublished) {
+    Recorded recorded;
+    AsyncLogger logger{std::make_unique<RecordingSink>(recorded),
+                       {.capacity = 64, .overflow = AsyncLoggerOptions::Overflow::Block}};
+    constexpr int threads = 4;
+    constexpr int perThread = 5000;
+    std::atomic<int> logged{0};
+    std::vector<std::thread> producers;
+    for (int t = 0; t < threads; ++t)
+        producers.emplace_back([&] {
+            for (int i = 0; i < perThread; ++i) {
+                logging::log("record");
+                logged.fetch_add(1, std::memory_order_release);
+            }
+        });
+    // Flushing while the producers run catches records that are claimed but not published yet:
+    // flush must not return before every record logged before it is written
+    while (logged.load(std::memory_order_acquire) < threads * perThread) {
+        const int before = logged.load(std::memory_order_acquire);
+        logger.flush();
+        ASSERT_GE(recorded.count(), static_cast<std::size_t>(before));
+    }
+    for (std::thread& producer : producers)
+        producer.join();
+    logger.flush();
+    EXPECT_EQ(recorded.count(), static_cast<std::size_t>(threads * perThread));
+}
+
+TEST(AsyncLogger, OnlyOneIsInstalledAtATime) {
+    Recorded first;
+    {
+        const AsyncLogger logger{std::make_unique<RecordingSink>(first)};
+        EXPECT_NE(logging::detail::recordQueue.load(), nullptr);
+        Recorded second;
+        EXPECT_THROW(AsyncLogger{std::make_unique<RecordingSink>(second)}, std::logic_error);
+        // the rejected logger leaves the installed one in place
+        EXPECT_NE(logging::detail::recordQueue.load(), nullptr);
+        logging::log("kept");
+    }
+    EXPECT_EQ(logging::detail::recordQueue.load(), nullptr);
+    EXPECT_EQ(first.all(), (std::vector<std::string>{"kept"}));
+
+    Recorded next;
+    {
+        AsyncLogger logger{std::make_unique<RecordingSink>(next)};
+        logging::log("next");
+    }
+    EXPECT_EQ(next.all(), (std::vector<std::string>{"next"}));
+}
+
+TEST(AsyncLogger, IsDestroyedWhileOtherThreadsLog) {
+    const SilentClog silent;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> producers;
+    for (int t = 0; t < 4; ++t)
+        producers.emplace_back([&stop] {
+            while (!stop.load(std::memory_order_relaxed))
+                logging::log("busy");
+        });
+    for (int round = 0; round < 50; ++round) {
+        Recorded recorded;
+        const AsyncLogger logger{std::make_unique<RecordingSink>(recorded),
+                                 {.capacity = 2, .overflow = AsyncLoggerOptions::Overflow::Block}};
+        std::this_thread::sleep_for(1ms);
+    }
+    stop = true;
+    for (std::thread& producer : producers)
+        producer.join();
+}
+
+class RotatingFileSinkTest : public test::TempDir {};
+
+TEST_F(RotatingFileSinkTest, RotatesAndKeepsMaxFiles) {
+    const std::string file = path("bot.log");
+    {
+        // every record but the first one overflows the file
+        logging::RotatingFileSink sink{file, 1, 2};
+        for (const char* message : {"a", "b", "c", "d"})
+            sink.write({logging::INFO, std::chrono::system_clock::now(), message});
+        sink.flush();
+    }
+    EXPECT_TRUE(readFile(file).ends_with("] d\n"));
+    EXPECT_TRUE(readFile(file + ".1").ends_with("] c\n"));
+    EXPECT_TRUE(readFile(file + ".2").ends_with("] b\n"));
+    EXPECT_FALSE(std::filesystem::exists(file + ".3"));
+}
+
+TEST_F(RotatingFileSinkTest, AppendsToAnExistingFile) {
+    const std::string file = path("bot.log");
+    {
+        logging::RotatingFileSink sink{file, 1024};
+        sink.write({logging::WARN, std::chrono::system_clock::now(), "first"});
+    }
+    {
+        // the existing size counts towards the limit
+        logging::RotatingFileSink sink{file, std::filesystem::file_size(file) + 1};
+        sink.write({logging::ERROR, std::chrono::system_clock::now(), "second"});
+    }
+    const std::string rotated = readFile(file + ".1");
+    EXPECT_TRUE(rotated.starts_with("[WARN] ["));
+    EXPECT_TRUE(rotated.ends_with("] first\n"));
+    EXPECT_TRUE(readFile(file).starts_with("[ERROR] ["));
+}
+
+TEST_F(RotatingFileSinkTest, KeepsNoOldFilesWithMaxFilesZero) {
+    const std::string file = path("bot.log");
+    {
+        logging::RotatingFileSink sink{file, 1, 0};
+        sink.write({logging::INFO, std::chrono::system_clock::now(), "old"});
+        sink.write({logging::INFO, std::chrono::system_clock::now(), "new"});
+    }
+    EXPECT_TRUE(readFile(file).ends_with("] new\n"));
+    EXPECT_FALSE(std::filesystem::exists(file + ".1"));
+}
+
+} // namespace
@@ -0,0 +1,172 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/bounded_memory.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+
+// Time passes only when a test says so
+struct FakeClock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<FakeClock>;
+    static constexpr bool is_steady = true;
+
+    static inline time_point current{};
+
+    static time_point now() {
+        return current;
+    }
+};
+
+struct Idle {};
+struct Named {
+    std::string name;
+};
+using State = std::variant<Idle, Named>;
+using Storage = BoundedMemoryStateStorage<State, FakeClock>;
+
+struct Eviction {
+    std::int64_t chat;
+    std::string state;
+    EvictionReason reason;
+
+    bool operator==(const Eviction&) const = default;
+};
+
+class BoundedMemoryStateStorageTest : public ::testing::Test {
+  protected:
+    std::vector<Eviction> evictions;
+
+    void SetUp() override {
+        FakeClock::current = {};
+    }
+
+    Storage make(BoundedStorageOptions options) {
+        return Storage{options, [this](const StateKey& key, const State& state, EvictionReason reason) {
+                           const auto* named = std::get_if<Named>(&state);
+                           evictions.push_back({key.chatId, named ? named->name : "<idle>", reason});
+                       }};
+    }
+
+    static void advance(std::chrono::nanoseconds by) {
+        FakeClock::current += by;
+    }
+};
+
+TEST_F(BoundedMemoryStateStorageTest, ExpiresKeysNotAccessedForTtl) {
+    Storage storage = make({.ttl = 10s});
+    storage.put({.chatId = 1}, Named{"one"});
+    advance(5s);
+    storage.put({.chatId = 2}, Named{"two"});
+    advance(5s);
+    // exactly the TTL is not over it yet
+    storage.expire();
+    EXPECT_EQ(storage.size(), 2);
+    EXPECT_TRUE(evictions.empty());
+
+    advance(1ns);
+    // an access evicts the expired keys, whatever key it is for
+    EXPECT_NE(storage[{.chatId = 2}], nullptr);
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(evictions, (std::vector<Eviction>{{1, "one", EvictionReason::expired}}));
+
+    // the access of key 2 has restarted its TTL
+    advance(10s);
+    storage.expire();
+    EXPECT_EQ(storage.size(), 1);
+    advance(1ns);
+    storage.expire();
+    EXPECT_EQ(storage.size(), 0);
+    EXPECT_EQ(evictions.back(), (Eviction{2, "two", EvictionReason::expired}));
+}
+
+TEST_F(BoundedMemoryStateStorageTest, EvictsLeastRecentlyAccessedOverMaxKeys) {
+    Storage storage = make({.maxKeys = 3});
+    storage.put({.chatId = 1}, Named{"one"});
+    storage.put({.chatId = 2}, Named{"two"});
+    storage.put({.chatId = 3}, Idle{});
+    // a read and a put of an existing key both count as an access
+    (void)storage[{.chatId = 1}];
+    storage.put({.chatId = 2}, Named{"two again"});
+
+    storage.put({.chatId = 4}, Idle{});
+    storage.put({.chatId = 5}, Idle{});
+    EXPECT_EQ(storage.size(), 3);
+    EXPECT_EQ(evictions,
+              (std::vector<Eviction>{{3, "<idle>", EvictionReason::capacity}, {1, "one", EvictionReason::capacity}}));
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 2}]).name, "two again");
+}
+
+TEST_F(BoundedMemoryStateStorageTest, EraseIsNotAnEviction) {
+    Storage storage = make({.maxKeys = 2});
+    storage.put({.chatId = 1}, Idle{});
+    storage.put({.chatId = 2}, Idle{});
+    storage.erase({.chatId = 1});
+    storage.put({.chatId = 3}, Idle{});
+    EXPECT_TRUE(evictions.empty());
+    EXPECT_EQ(storage.size(), 2);
+}
+
+TEST_F(BoundedMemoryStateStorageTest, PutsTheStateOfTheKeyItEvicts) {
+    Storage storage = make({.maxKeys = 1});
+    const std::string name(100, 'x'); // not a small string, so a dangling source is not masked
+    storage.put({.chatId = 1}, Named{name});
+    storage.put({.chatId = 2}, std::get<Named>(*storage[{.chatId = 1}]));
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 2}]).name, name);
+}
+
+TEST_F(BoundedMemoryStateStorageTest, PutsTheStateOfAKeyThatExpires) {
+    Storage storage = make({.ttl = 10s});
+    const std::string name(100, 'x');
+    storage.put({.chatId = 1}, Named{name});
+    State& expiring = *storage[{.chatId = 1}];
+    advance(11s);
+    storage.put({.chatId = 2}, std::get<Named>(expiring));
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 2}]).name, name);
+}
+
+TEST_F(BoundedMemoryStateStorageTest, MovesKeepTheRecencyOrder) {
+    Storage storage = make({.maxKeys = 3});
+    for (std::int64_t i = 1; i <= 3; ++i)
+        storage.put({.chatId = i}, Idle{});
+
+    Storage moved{std::move(storage)};
+    EXPECT_EQ(storage.size(), 0); // NOLINT(*-use-after-move)
+    (void)moved[{.chatId = 1}];
+    moved.put({.chatId = 4}, Idle{});
+    EXPECT_EQ(evictions, (std::vector<Eviction>{{2, "<idle>", EvictionReason::capacity}}));
+
+    Storage assigned = make({.maxKeys = 1});
+    assigned.put({.chatId = 10}, Idle{});
+    assigned = std::move(moved);
+    assigned.put({.chatId = 5}, Idle{});
+    EXPECT_EQ(evictions.back(), (Eviction{3, "<idle>", EvictionReason::capacity}));
+    EXPECT_EQ(assigned.size(), 3);
+    EXPECT_NE(assigned[{.chatId = 1}], nullptr);
+
+    // the storages that were moved from stay usable
+    storage.put({.chatId = 1}, Idle{}); // NOLINT(*-use-after-move)
+    EXPECT_NE(storage[{.chatId = 1}], nullptr);
+    moved.put({.chatId = 11}, Idle{}); // NOLINT(*-use-after-move)
+    EXPECT_EQ(moved.size(), 1);
+    EXPECT_EQ(evictions.back(), (Eviction{10, "<idle>", EvictionReason::capacity}));
+}
+
+} // namespace
@@ -0,0 +1,210 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/meta.hpp"
+#include "tg_stater/state_storage/cached.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Named {
+    std::string name;
+};
+using State = std::variant<Idle, Named>;
+
+std::string describe(const State& state) {
+    const auto* named = std::get_if<Named>(&state);
+    return named ? named->name : "<idle>";
+}
+
+// A memory storage that records what reaches it. Copies share the record, so it can be inspected after
+// the backend is moved into the cache.
+class RecordingBackend {
+  public:
+    using StateT = State;
+
+    struct Record {
+        std::mutex mutex;
+        MemoryStateStorage<State> states;
+        std::vector<std::string> writes;
+        std::size_t reads = 0;
+        std::size_t failures = 0; // the next writes to throw
+    };
+
+  private:
+    std::shared_ptr<Record> record = std::make_shared<Record>();
+
+    void write(std::string what) {
+        const std::lock_guard lock{record->mutex};
+        if (record->failures != 0) {
+            --record->failures;
+            throw std::runtime_error{"backend is down"};
+        }
+        record->writes.push_back(std::move(what));
+    }
+
+  public:
+    [[nodiscard]] StateT* operator[](const StateKey& key) {
+        const std::lock_guard lock{record->mutex};
+        ++record->reads;
+        return record->states[key];
+    }
+
+    void erase(const StateKey& key) {
+        write("erase " + std::to_string(key.chatId));
+        const std::lock_guard lock{record->mutex};
+        record->states.erase(key);
+    }
+
+    template <typename T>
+        requires meta::is_part_of_variant<std::remove_cvref_t<T>, StateT>
+    StateT& put(const StateKey& key, T&& state) {
+        State copy{state};
+        write("put " + std::to_string(key.chatId) + " " + describe(copy));
+        const std::lock_guard lock{record->mutex};
+        return record->states.put(key, std::forward<T>(state));
+    }
+
+    [[nodiscard]] std::vector<std::string> writes() const {
+        const std::lock_guard lock{record->mutex};
+        return record->writes;
+    }
+
+    [[nodiscard]] std::size_t reads() const {
+        const std::lock_guard lock{record->mutex};
+        return record->reads;
+    }
+
+    void failNextWrites(std::size_t count) {
+        const std::lock_guard lock{record->mutex};
+        record->failures = count;
+    }
+
+    void seed(const StateKey& key, const State& state) {
+        const std::lock_guard lock{record->mutex};
+        std::visit([&](const auto& option) { record->states.put(key, option); }, state);
+    }
+};
+
+using Storage = CachedStateStorage<RecordingBackend>;
+
+static_assert(concepts::StateStorage<Storage, State>);
+
+// Long enough that only `flush` hands the states over
+constexpr CacheOptions manualFlush{.flushInterval = std::chrono::hours{1}};
+
+TEST(CachedStateStorage, OnlyTheLastChangeWithinAnIntervalIsWritten) {
+    RecordingBackend backend;
+    Storage storage{backend, manualFlush};
+    storage.put({.chatId = 1}, Named{"first"});
+    storage.put({.chatId = 1}, Named{"second"});
+    storage.erase({.chatId = 1});
+    storage.put({.chatId = 2}, Named{"kept"});
+    storage.erase({.chatId = 3});
+    storage.put({.chatId = 3}, Idle{});
+    EXPECT_TRUE(backend.writes().empty());
+
+    storage.flush();
+    auto writes = backend.writes();
+    std::ranges::sort(writes);
+    EXPECT_EQ(writes, (std::vector<std::string>{"erase 1", "put 2 kept", "put 3 <idle>"}));
+}
+
+TEST(CachedStateStorage, FlushesReachTheBackendInOrder) {
+    RecordingBackend backend;
+    Storage storage{backend, manualFlush};
+    storage.put({.chatId = 1}, Named{"first"});
+    storage.flush();
+    storage.put({.chatId = 1}, Named{"second"});
+    storage.flush();
+    storage.erase({.chatId = 1});
+    storage.flush();
+    storage.put({.chatId = 1}, Named{"third"});
+    storage.flush();
+    EXPECT_EQ(backend.writes(), (std::vector<std::string>{"put 1 first", "put 1 second", "erase 1", "put 1 third"}));
+}
+
+TEST(CachedStateStorage, DestructionWritesPendingStates) {
+    RecordingBackend backend;
+    {
+        Storage storage{backend, manualFlush};
+        storage.put({.chatId = 1}, Named{"pending"});
+        storage.put({.chatId = 2}, Idle{});
+        storage.erase({.chatId = 2});
+    }
+    auto writes = backend.writes();
+    std::ranges::sort(writes);
+    EXPECT_EQ(writes, (std::vector<std::string>{"erase 2", "put 1 pending"}));
+}
+
+TEST(CachedStateStorage, MissesReadThroughOnce) {
+    RecordingBackend backend;
+    backend.seed({.chatId = 1}, Named{"stored"});
+    Storage storage{backend, manualFlush};
+
+    ASSERT_NE(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(describe(*storage[{.chatId = 1}]), "stored");
+    EXPECT_EQ(storage[{.chatId = 2}], nullptr);
+    EXPECT_EQ(storage[{.chatId = 2}], nullptr);
+    // a missing state is cached too
+    EXPECT_EQ(backend.reads(), 2);
+}
+
+TEST(CachedStateStorage, EvictedStatesAreReadBackBeforeTheyAreWritten) {
+    RecordingBackend backend;
+    Storage storage{backend, {.flushInterval = std::chrono::hours{1}, .maxKeys = 2}};
+    for (int i = 0; i < 10; ++i)
+        storage.put({.chatId = i}, Named{std::to_string(i)});
+    EXPECT_EQ(storage.cachedKeys(), 2);
+    for (int i = 0; i < 10; ++i) {
+        const State* state = storage[{.chatId = i}];
+        ASSERT_NE(state, nullptr);
+        EXPECT_EQ(describe(*state), std::to_string(i));
+    }
+    storage.flush();
+    EXPECT_EQ(backend.writes().size(), 10);
+}
+
+TEST(CachedStateStorage, FailedWritesAreRetriedByTheNextFlush) {
+    RecordingBackend backend;
+    Storage storage{backend, {.flushInterval = std::chrono::milliseconds{1}}};
+    backend.failNextWrites(1);
+    storage.put({.chatId = 1}, Named{"retried"});
+    EXPECT_THROW(storage.flush(), std::runtime_error);
+    storage.put({.chatId = 2}, Idle{});
+    storage.flush();
+    auto writes = backend.writes();
+    std::ranges::sort(writes);
+    EXPECT_EQ(writes, (std::vector<std::string>{"put 1 retried", "put 2 <idle>"}));
+}
+
+TEST(CachedStateStorage, RetriedWritesDoNotOverwriteNewerStates) {
+    RecordingBackend backend;
+    Storage storage{backend, {.flushInterval = std::chrono::milliseconds{1}}};
+    backend.failNextWrites(1);
+    storage.put({.chatId = 1}, Named{"failed"});
+    EXPECT_THROW(storage.flush(), std::runtime_error);
+    storage.put({.chatId = 1}, Named{"newer"});
+    storage.flush();
+    ASSERT_FALSE(backend.writes().empty());
+    EXPECT_EQ(backend.writes().back(), "put 1 newer");
+}
+
+} // namespace
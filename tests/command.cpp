@@ -0,0 +1,97 @@
+#include "tg_stater/command.hpp"
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace {
+
+using namespace tg_stater;
+using detail::PerfectHashTable;
+
+TEST(ParseCommand, SplitsNameBotAndArgs) {
+    const auto plain = parseCommand("/start");
+    ASSERT_TRUE(plain);
+    EXPECT_EQ(plain->name, "start");
+    EXPECT_EQ(plain->botName, "");
+    EXPECT_EQ(plain->args, "");
+
+    const auto full = parseCommand("/start@my_bot deep link");
+    ASSERT_TRUE(full);
+    EXPECT_EQ(full->name, "start");
+    EXPECT_EQ(full->botName, "my_bot");
+    EXPECT_EQ(full->args, "deep link");
+
+    const auto atInArgs = parseCommand("/mail a@b.c");
+    ASSERT_TRUE(atInArgs);
+    EXPECT_EQ(atInArgs->name, "mail");
+    EXPECT_EQ(atInArgs->botName, "");
+    EXPECT_EQ(atInArgs->args, "a@b.c");
+
+    EXPECT_FALSE(parseCommand("start"));
+    EXPECT_FALSE(parseCommand(""));
+    EXPECT_EQ(parseCommand("/")->name, "");
+}
+
+TEST(PerfectHashTable, Empty) {
+    constexpr PerfectHashTable<0> table{std::array<std::string_view, 0>{}};
+    EXPECT_EQ(table.find("start"), table.npos);
+    EXPECT_EQ(table.find(""), table.npos);
+}
+
+TEST(PerfectHashTable, FindsEveryKeyAndNothingElse) {
+    static constexpr std::array<std::string_view, 12> keys{
+        "start", "help", "cancel", "settings", "s", "", "stop", "st", "a", "b", "help2", "longer_command_name"};
+    constexpr PerfectHashTable<keys.size()> table{keys};
+    // built at compile time
+    static_assert(table.find("settings") == 3);
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        EXPECT_EQ(table.find(keys[i]), i) << keys[i];
+
+    for (const std::string_view miss : {"Start", "star", "starts", "help ", "c", "longer_command_nam", "/start"})
+        EXPECT_EQ(table.find(miss), table.npos) << miss;
+}
+
+// Placing the last buckets needs many seeds when the table is big
+TEST(PerfectHashTable, ManyKeys) {
+    static constexpr auto names = [] {
+        std::array<std::array<char, 4>, 200> result{};
+        for (std::size_t i = 0; i < result.size(); ++i)
+            result[i] = {'c', static_cast<char>('a' + i / 26 % 26), static_cast<char>('a' + i % 26), '\0'};
+        return result;
+    }();
+    static constexpr auto keys = [] {
+        std::array<std::string_view, names.size()> result{};
+        for (std::size_t i = 0; i < names.size(); ++i)
+            result[i] = std::string_view{names[i].data(), 3};
+        return result;
+    }();
+    static constexpr PerfectHashTable<keys.size()> table{keys};
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        ASSERT_EQ(table.find(keys[i]), i);
+    EXPECT_EQ(table.find("czz"), table.npos);
+    EXPECT_EQ(table.find("c"), table.npos);
+}
+
+TEST(GroupStrings, GroupsEqualStringsInFirstOccurrenceOrder) {
+    constexpr auto groups = detail::groupStrings(std::array<std::string_view, 5>{"b", "a", "b", "c", "a"});
+    static_assert(groups.count == 3);
+    EXPECT_EQ(groups.strings[0], "b");
+    EXPECT_EQ(groups.strings[1], "a");
+    EXPECT_EQ(groups.strings[2], "c");
+    // occurrences of "b", "a" and "c"
+    EXPECT_EQ(groups.start[0], 0);
+    EXPECT_EQ(groups.start[1], 2);
+    EXPECT_EQ(groups.start[2], 4);
+    EXPECT_EQ(groups.start[3], 5);
+    EXPECT_EQ(groups.members[0], 0);
+    EXPECT_EQ(groups.members[1], 2);
+    EXPECT_EQ(groups.members[2], 1);
+    EXPECT_EQ(groups.members[3], 4);
+    EXPECT_EQ(groups.members[4], 3);
+}
+
+} // namespace
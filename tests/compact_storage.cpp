@@ -0,0 +1,317 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/compact_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+// Moves of `Throwing` count this down and throw at zero
+int movesUntilThrow = -1;
+
+void maybeThrow() {
+    if (movesUntilThrow >= 0 && movesUntilThrow-- == 0)
+        throw std::runtime_error{"move"};
+}
+
+struct Idle {
+    bool operator==(const Idle&) const = default;
+};
+struct Small {
+    std::int64_t value = 0;
+    bool operator==(const Small&) const = default;
+};
+struct Named {
+    std::string name;
+    bool operator==(const Named&) const = default;
+};
+// Kept in a pool, since its moves may throw
+struct Throwing {
+    std::string name;
+
+    explicit Throwing(std::string name) : name{std::move(name)} {}
+    Throwing(const Throwing&) = default;
+    Throwing(Throwing&& other) noexcept(false) : name{(maybeThrow(), std::move(other.name))} {}
+    Throwing& operator=(const Throwing&) = default;
+    Throwing& operator=(Throwing&& other) noexcept(false) {
+        maybeThrow();
+        name = std::move(other.name);
+        return *this;
+    }
+    ~Throwing() = default;
+    bool operator==(const Throwing&) const = default;
+};
+using State = std::variant<Idle, Small, Named, Throwing>;
+
+// A key without a state and a key left valueless by a throwing put are the same to the handlers
+std::optional<State> stateOf(const State* state) {
+    if (!state || state->valueless_by_exception())
+        return std::nullopt;
+    return *state;
+}
+
+// Names longer than the small string buffer, so that reading a moved-from or freed one is caught
+std::string longName(std::uint64_t n) {
+    return std::string(32, 'x') + std::to_string(n);
+}
+
+template <typename Storage>
+class CompactMemoryStateStorageTest : public ::testing::Test {
+  protected:
+    void TearDown() override {
+        movesUntilThrow = -1;
+    }
+};
+
+// Named is kept in the pool by the first one and inline by the second
+using Storages = ::testing::Types<CompactMemoryStateStorage<State>, CompactMemoryStateStorage<State, sizeof(Named)>>;
+TYPED_TEST_SUITE(CompactMemoryStateStorageTest, Storages);
+
+TYPED_TEST(CompactMemoryStateStorageTest, MatchesMemoryStateStorage) {
+    TypeParam storage;
+    MemoryStateStorage<State> reference;
+    std::mt19937_64 rng{1};
+    constexpr std::int64_t keys = 300;
+    const auto check = [&](const StateKey& key) {
+        movesUntilThrow = -1;
+        ASSERT_EQ(stateOf(storage[key]), stateOf(reference[key])) << "chat " << key.chatId;
+    };
+
+    for (std::uint64_t step = 0; step < 100'000; ++step) {
+        const StateKey key{.chatId = static_cast<std::int64_t>(rng() % keys)};
+        const std::uint64_t action = rng() % 8;
+        // now and then one of the next moves throws
+        if (rng() % 16 == 0)
+            movesUntilThrow = static_cast<int>(rng() % 3);
+
+        try {
+            switch (action) {
+            case 0:
+                storage.erase(key);
+                reference.erase(key);
+                break;
+            case 1:
+                storage.put(key, Idle{});
+                reference.put(key, Idle{});
+                break;
+            case 2:
+                storage.put(key, Small{static_cast<std::int64_t>(step)});
+                reference.put(key, Small{static_cast<std::int64_t>(step)});
+                break;
+            case 3:
+                storage.put(key, Named{longName(step)});
+                reference.put(key, Named{longName(step)});
+                break;
+            case 4: {
+                const Throwing state{longName(step)};
+                storage.put(key, Throwing{state});
+                reference.put(key, state);
+                break;
+            }
+            case 5:
+                // changed in place
+                if (State* state = storage[key]; state && !state->valueless_by_exception()) {
+                    if (auto* named = std::get_if<Named>(state)) {
+                        named->name += "!";
+                        std::get<Named>(*reference[key]).name += "!";
+                    }
+                }
+                break;
+            case 6: {
+                // the state of another key, which is current while the new key is put
+                const StateKey from{.chatId = static_cast<std::int64_t>(rng() % keys)};
+                const State* state = storage[from];
+                if (!state || state->valueless_by_exception())
+                    break;
+                const State copy = *state;
+                std::visit([&](const auto& option) { storage.put(key, option); }, *state);
+                std::visit([&](const auto& option) { reference.put(key, option); }, copy);
+                break;
+            }
+            default:
+                check(key);
+                break;
+            }
+        } catch (const std::runtime_error&) {
+            // the key is either left as it was or loses its state, the other keys are unchanged
+            movesUntilThrow = -1;
+            if (!stateOf(storage[key]))
+                reference.erase(key);
+        }
+        movesUntilThrow = -1;
+        check(key);
+        if (::testing::Test::HasFatalFailure())
+            return;
+    }
+
+    for (std::int64_t i = 0; i < keys; ++i)
+        check({.chatId = i});
+    std::size_t referenceSize = 0;
+    for (std::int64_t i = 0; i < keys; ++i)
+        referenceSize += stateOf(reference[{.chatId = i}]) ? 1 : 0;
+    EXPECT_EQ(storage.size(), referenceSize);
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, ValuelessStateIsRemovedOnceAnotherKeyIsAccessed) {
+    TypeParam storage;
+    storage.put({.chatId = 1}, Named{longName(1)});
+    storage.put({.chatId = 2}, Idle{});
+    ASSERT_NE(storage[{.chatId = 1}], nullptr);
+
+    // switching the current state to another option destroys it before the move throws
+    movesUntilThrow = 0;
+    EXPECT_THROW(storage.put({.chatId = 1}, Throwing{"broken"}), std::runtime_error);
+    ASSERT_TRUE(storage[{.chatId = 1}]->valueless_by_exception());
+    EXPECT_EQ(storage.size(), 2);
+
+    EXPECT_NE(storage[{.chatId = 2}], nullptr);
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(storage.size(), 1);
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, ThrowingMoveIntoThePoolKeepsTheState) {
+    TypeParam storage;
+    storage.put({.chatId = 2}, Small{2});
+    storage.put({.chatId = 1}, Throwing{"kept"});
+    // moving the current state back into its block throws, so the other key is not accessed
+    movesUntilThrow = 0;
+    EXPECT_THROW((void)storage[{.chatId = 2}], std::runtime_error);
+    movesUntilThrow = 0;
+    EXPECT_THROW(storage.put({.chatId = 2}, Idle{}), std::runtime_error);
+    movesUntilThrow = -1;
+    EXPECT_EQ(std::get<Small>(*storage[{.chatId = 2}]).value, 2);
+    ASSERT_NE(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Throwing>(*storage[{.chatId = 1}]).name, "kept");
+    EXPECT_EQ(storage.size(), 2);
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, GrowsWhileAKeyIsCurrent) {
+    TypeParam storage;
+    storage.put({.chatId = 0}, Named{longName(0)});
+    for (std::int64_t i = 1; i < 5000; ++i) {
+        // current while the table grows under the insert
+        ASSERT_NE(storage[{.chatId = 0}], nullptr);
+        if (i % 2 == 0)
+            storage.put({.chatId = i}, Small{i});
+        else
+            storage.put({.chatId = i}, Throwing{longName(i)});
+    }
+    EXPECT_EQ(storage.size(), 5000);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 0}]).name, longName(0));
+    for (std::int64_t i = 1; i < 5000; ++i) {
+        const State* state = storage[{.chatId = i}];
+        ASSERT_NE(state, nullptr);
+        if (i % 2 == 0)
+            EXPECT_EQ(std::get<Small>(*state).value, i);
+        else
+            EXPECT_EQ(std::get<Throwing>(*state).name, longName(i));
+    }
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, PutsTheStateOfTheCurrentKeyUnderAnother) {
+    TypeParam storage;
+    storage.put({.chatId = 0}, Named{longName(0)});
+    for (std::int64_t i = 1; i < 1000; ++i) {
+        const auto& named = std::get<Named>(*storage[{.chatId = i - 1}]);
+        storage.put({.chatId = i}, named);
+    }
+    for (std::int64_t i = 0; i < 1000; ++i)
+        ASSERT_EQ(std::get<Named>(*storage[{.chatId = i}]).name, longName(0)) << i;
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, PoolsReuseFreedBlocks) {
+    TypeParam storage;
+    constexpr std::int64_t keys = 100;
+    for (std::int64_t i = 0; i < keys; ++i)
+        storage.put({.chatId = i}, Throwing{longName(i)});
+    std::mt19937_64 rng{2};
+    const auto churn = [&](int steps) {
+        for (int step = 0; step < steps; ++step) {
+            const StateKey key{.chatId = static_cast<std::int64_t>(rng() % keys)};
+            if (step % 2 == 0) {
+                storage.erase(key);
+                storage.put(key, Throwing{longName(step)});
+            } else {
+                storage.put(key, Idle{});
+                storage.put(key, Throwing{longName(step)});
+            }
+            (void)storage[{.chatId = static_cast<std::int64_t>(rng() % keys)}];
+        }
+    };
+    // until the erased slots have made the table as large as it needs to be
+    churn(10'000);
+    const std::size_t bytes = storage.allocatedBytes();
+    churn(20'000);
+    EXPECT_EQ(storage.size(), keys);
+    EXPECT_EQ(storage.allocatedBytes(), bytes);
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, SmallStatesTakeNoBlocks) {
+    TypeParam storage;
+    for (std::int64_t i = 0; i < 1000; ++i)
+        storage.put({.chatId = i}, Small{i});
+    const std::size_t bytes = storage.allocatedBytes();
+    TypeParam idle;
+    for (std::int64_t i = 0; i < 1000; ++i)
+        idle.put({.chatId = i}, Idle{});
+    EXPECT_EQ(bytes, idle.allocatedBytes());
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, MoveKeepsTheCurrentState) {
+    TypeParam storage;
+    storage.put({.chatId = 1}, Named{longName(1)});
+    storage.put({.chatId = 2}, Throwing{longName(2)});
+    TypeParam moved = std::move(storage);
+    EXPECT_EQ(std::get<Throwing>(*moved[{.chatId = 2}]).name, longName(2));
+    EXPECT_EQ(std::get<Named>(*moved[{.chatId = 1}]).name, longName(1));
+    EXPECT_EQ(moved.size(), 2);
+
+    storage = std::move(moved);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 1}]).name, longName(1));
+    EXPECT_EQ(storage.size(), 2);
+}
+
+TYPED_TEST(CompactMemoryStateStorageTest, MovedFromStorageIsEmptyAndUsable) {
+    TypeParam storage;
+    storage.put({.chatId = 1}, Throwing{longName(1)});
+    // the state of key 1 goes to the pool once another key is accessed
+    storage.put({.chatId = 0}, Idle{});
+    TypeParam moved{std::move(storage)};
+    EXPECT_EQ(storage.size(), 0); // NOLINT(*-use-after-move)
+    EXPECT_EQ(storage.allocatedBytes(), 0);
+
+    // both hand out blocks of their own
+    for (std::int64_t i = 2; i < 100; ++i) {
+        storage.put({.chatId = i}, Throwing{longName(i)});
+        moved.put({.chatId = i}, Throwing{longName(-i)});
+    }
+    for (std::int64_t i = 2; i < 100; ++i) {
+        ASSERT_EQ(std::get<Throwing>(*storage[{.chatId = i}]).name, longName(i)) << i;
+        ASSERT_EQ(std::get<Throwing>(*moved[{.chatId = i}]).name, longName(-i)) << i;
+    }
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Throwing>(*moved[{.chatId = 1}]).name, longName(1));
+
+    TypeParam assigned;
+    assigned = std::move(moved);
+    moved.put({.chatId = 1}, Throwing{longName(0)}); // NOLINT(*-use-after-move)
+    assigned.put({.chatId = 100}, Throwing{longName(100)});
+    EXPECT_EQ(std::get<Throwing>(*moved[{.chatId = 1}]).name, longName(0));
+    EXPECT_EQ(std::get<Throwing>(*assigned[{.chatId = 1}]).name, longName(1));
+    EXPECT_EQ(assigned.size(), 101);
+}
+
+} // namespace
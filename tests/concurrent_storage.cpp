@@ -0,0 +1,86 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <thread>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Typing {
+    std::int64_t counter;
+};
+using State = std::variant<Idle, Typing>;
+using Storage = ConcurrentMemoryStateStorage<State>;
+
+static_assert(concepts::ThreadSafeStateStorage<Storage>);
+
+TEST(ConcurrentMemoryStateStorage, PutGetErase) {
+    Storage storage{4};
+    const StateKey key{.chatId = 1};
+    EXPECT_EQ(storage[key], nullptr);
+
+    State* state = &storage.put(key, Typing{.counter = 1});
+    EXPECT_EQ(storage[key], state);
+    storage.put(key, Typing{.counter = 2});
+    EXPECT_EQ(storage[key], state) << "put for the same key assigns to the same object";
+    EXPECT_EQ(std::get<Typing>(*state).counter, 2);
+
+    storage.erase(key);
+    EXPECT_EQ(storage[key], nullptr);
+}
+
+TEST(ConcurrentMemoryStateStorage, ConstLookup) {
+    Storage storage;
+    storage.put({.chatId = 1}, Idle{});
+    const Storage& view = storage;
+    const State* state = view[{.chatId = 1}];
+    ASSERT_NE(state, nullptr);
+    EXPECT_TRUE(std::holds_alternative<Idle>(*state));
+    EXPECT_EQ(view[{.chatId = 2}], nullptr);
+}
+
+TEST(ConcurrentMemoryStateStorage, StripeCountIsRoundedUp) {
+    EXPECT_EQ(Storage{0}.stripeCount(), 1);
+    EXPECT_EQ(Storage{5}.stripeCount(), 8);
+    EXPECT_EQ(Storage{}.stripeCount(), Storage::defaultStripes);
+}
+
+TEST(ConcurrentMemoryStateStorage, ThreadsOnDisjointKeys) {
+    constexpr int threads = 4;
+    constexpr std::int64_t keysPerThread = 1000;
+    Storage storage{8};
+    std::vector<std::jthread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&storage, t] {
+            for (std::int64_t i = 0; i < keysPerThread; ++i) {
+                const StateKey key{.chatId = t * keysPerThread + i};
+                storage.put(key, Typing{.counter = i});
+                std::get<Typing>(*storage[key]).counter += 1;
+                if (i % 2 == 0)
+                    storage.erase(key);
+            }
+        });
+    }
+    workers.clear();
+
+    for (std::int64_t i = 0; i < threads * keysPerThread; ++i) {
+        const State* state = storage[{.chatId = i}];
+        if (i % keysPerThread % 2 == 0) {
+            EXPECT_EQ(state, nullptr);
+        } else {
+            ASSERT_NE(state, nullptr);
+            EXPECT_EQ(std::get<Typing>(*state).counter, i % keysPerThread + 1);
+        }
+    }
+}
+
+} // namespace
@@ -0,0 +1,90 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "updates.hpp"
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/coroutine.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+
+struct Idle {};
+using State = std::variant<Idle>;
+using Storage = MemoryStateStorage<State>;
+
+std::mutex journalMutex;
+std::map<std::int64_t, std::vector<std::string>> journal;
+
+void note(const TgBot::Message& message, const std::string& what) {
+    const std::lock_guard lock{journalMutex};
+    journal[message.chat->id].push_back(what + ":" + message.text);
+}
+
+// Suspended in a timer while the other chats' updates are handled
+Task<> onMessage(const TgBot::Message& message) {
+    note(message, "start");
+    co_await sleepFor(20ms);
+    note(message, "woke");
+}
+
+using SleepingStater =
+    Stater<State, Storage, Dependencies<>, Handler<Events::Message{}, onMessage, HandlerTypes::AnyState{}>>;
+
+class CoroutineDispatchTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        journal.clear();
+    }
+};
+
+TEST_F(CoroutineDispatchTest, DrainWaitsForSuspendedCoroutines) {
+    TgBot::Bot bot{"token"};
+    SleepingStater stater{};
+    stater.setup(bot);
+    for (const char* text : {"a", "b"})
+        for (std::int64_t chat = 0; chat < 4; ++chat)
+            bot.getEventHandler().handleUpdate(test::makeMessage(chat, text));
+    stater.drain();
+
+    // the updates of a chat run one after another, coroutines included
+    const std::vector<std::string> expected{"start:a", "woke:a", "start:b", "woke:b"};
+    const std::lock_guard lock{journalMutex};
+    for (std::int64_t chat = 0; chat < 4; ++chat)
+        EXPECT_EQ(journal[chat], expected) << "chat " << chat;
+}
+
+TEST_F(CoroutineDispatchTest, DestructionWaitsForSuspendedCoroutines) {
+    {
+        TgBot::Bot bot{"token"};
+        SleepingStater stater{};
+        stater.setup(bot);
+        bot.getEventHandler().handleUpdate(test::makeMessage(1, "a"));
+        bot.getEventHandler().handleUpdate(test::makeMessage(1, "b"));
+    }
+    const std::lock_guard lock{journalMutex};
+    EXPECT_EQ(journal[1], (std::vector<std::string>{"start:a", "woke:a", "start:b", "woke:b"}));
+}
+
+} // namespace
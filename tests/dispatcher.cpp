@@ -0,0 +1,49 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/state_storage/common.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using detail::ShardedDispatcher;
+
+TEST(ShardedDispatcher, ResumptionsDoNotWaitForAFullShard) {
+    ShardedDispatcher dispatcher{1, 1};
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::mutex mutex;
+    std::vector<int> order;
+    const auto record = [&](int i) {
+        const std::lock_guard lock{mutex};
+        order.push_back(i);
+    };
+
+    // the worker is busy and the queue is full
+    dispatcher.post({.chatId = 1}, [&] {
+        released.wait();
+        record(0);
+    });
+    dispatcher.post({.chatId = 1}, [&] { record(1); });
+
+    // as the timer and outbox threads do
+    auto resumed = std::async(std::launch::async, [&] {
+        for (int i = 2; i < 10; ++i)
+            dispatcher.resume({.chatId = 1}, [&record, i] { record(i); });
+    });
+    EXPECT_EQ(resumed.wait_for(std::chrono::seconds{5}), std::future_status::ready);
+
+    release.set_value();
+    dispatcher.drain();
+    const std::lock_guard lock{mutex};
+    EXPECT_EQ(order, (std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9}));
+}
+
+} // namespace
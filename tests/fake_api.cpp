@@ -0,0 +1,196 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/fake_api.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <gtest/gtest.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+using boost::property_tree::ptree;
+
+TEST(ParseForm, DecodesPairs) {
+    std::unordered_map<std::string, std::string> args{{"kept", "1"}};
+    fake_api::detail::parseForm("a=1&text=hello+world%21&plus=%2B%2b&bad=%zz%4&flag&&empty=&a=2", args);
+    EXPECT_EQ(args, (std::unordered_map<std::string, std::string>{{"kept", "1"},
+                                                                  {"a", "2"},
+                                                                  {"text", "hello world!"},
+                                                                  {"plus", "++"},
+                                                                  {"bad", "%zz%4"},
+                                                                  {"flag", ""},
+                                                                  {"empty", ""}}));
+}
+
+std::string message(std::int64_t chat, std::string_view text) {
+    return R"({"message":{"message_id":1,"date":0,"chat":{"id":)" + std::to_string(chat) +
+           R"(,"type":"private"},"text":")" + std::string{text} + R"("}})";
+}
+
+class ServerTest : public ::testing::Test {
+  protected:
+    fake_api::Server server;
+    std::uint16_t port = 0;
+
+    void SetUp() override {
+        const std::string url = server.url();
+        port = static_cast<std::uint16_t>(std::stoi(url.substr(url.rfind(':') + 1)));
+    }
+
+    // Calls a Bot API method with the arguments as a form body, returns the parsed response
+    ptree call(std::string_view method, std::string_view form = {}) const {
+        std::string request = "POST /bottoken/" + std::string{method} +
+                              " HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: " +
+                              std::to_string(form.size()) + "\r\n\r\n";
+        request += form;
+        return send(request);
+    }
+
+    // Calls a Bot API method with the arguments in the query string
+    ptree get(std::string_view method, std::string_view query) const {
+        return send("GET /bottoken/" + std::string{method} + '?' + std::string{query} + " HTTP/1.1\r\n\r\n");
+    }
+
+    [[nodiscard]] ptree send(std::string_view request) const {
+        const fake_api::detail::Socket connection{::socket(AF_INET, SOCK_STREAM, 0)};
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        // NOLINTNEXTLINE(*-reinterpret-cast)
+        if (::connect(connection.get(), reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1)
+            return {};
+        fake_api::detail::sendAll(connection.get(), request);
+        std::string response;
+        std::array<char, 4096> buffer{};
+        ssize_t received = 0;
+        while ((received = ::recv(connection.get(), buffer.data(), buffer.size(), 0)) > 0)
+            response.append(buffer.data(), static_cast<std::size_t>(received));
+
+        std::istringstream body{response.substr(response.find("\r\n\r\n") + 4)};
+        ptree tree;
+        boost::property_tree::read_json(body, tree);
+        return tree;
+    }
+
+    static std::vector<std::int64_t> updateIds(const ptree& response) {
+        EXPECT_TRUE(response.get<bool>("ok"));
+        std::vector<std::int64_t> ids;
+        for (const auto& [_, update] : response.get_child("result"))
+            ids.push_back(update.get<std::int64_t>("update_id"));
+        return ids;
+    }
+};
+
+TEST_F(ServerTest, GetUpdatesHonoursOffsetAndLimit) {
+    for (int i = 0; i < 3; ++i)
+        server.push(message(1, std::to_string(i)));
+    server.push("{}");
+    server.push(" { } ");
+
+    const ptree first = call("getUpdates", "limit=2");
+    EXPECT_EQ(updateIds(first), (std::vector<std::int64_t>{1, 2}));
+    EXPECT_EQ(first.get_child("result").front().second.get<std::string>("message.text"), "0");
+    // an unconfirmed update is delivered again
+    EXPECT_EQ(updateIds(get("getUpdates", "offset=0&limit=1")), (std::vector<std::int64_t>{1}));
+    // the offset confirms the updates before it, and a limit past 100 is clamped
+    EXPECT_EQ(updateIds(get("getUpdates", "offset=3&limit=1000")), (std::vector<std::int64_t>{3, 4, 5}));
+    EXPECT_EQ(updateIds(call("getUpdates", "offset=1")), (std::vector<std::int64_t>{3, 4, 5}));
+    EXPECT_EQ(updateIds(call("getUpdates", "offset=6")), std::vector<std::int64_t>{});
+
+    const fake_api::Stats stats = server.statistics();
+    EXPECT_EQ(stats.updates, 5);
+    EXPECT_EQ(stats.delivered, 5);
+    EXPECT_EQ(stats.apiCalls.at("getUpdates"), 5);
+}
+
+TEST_F(ServerTest, GetUpdatesWaitsUpToTheTimeout) {
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(updateIds(call("getUpdates", "timeout=1")), std::vector<std::int64_t>{});
+    EXPECT_GE(std::chrono::steady_clock::now() - start, 1s);
+
+    // a long poll returns as soon as an update arrives
+    auto poll = std::async(std::launch::async, [this] { return call("getUpdates", "timeout=30"); });
+    std::this_thread::sleep_for(50ms);
+    server.push(message(1, "late"));
+    ASSERT_EQ(poll.wait_for(10s), std::future_status::ready);
+    EXPECT_EQ(updateIds(poll.get()), (std::vector<std::int64_t>{1}));
+}
+
+TEST_F(ServerTest, MatchesMessagesToTheOldestUnansweredUpdateOfTheChat) {
+    server.generate({.updatesPerSecond = 1000, .duration = 3ms, .chats = 1});
+    EXPECT_EQ(updateIds(call("getUpdates")).size(), 3);
+
+    const ptree sent = call("sendMessage", "chat_id=1&text=hi+there");
+    EXPECT_TRUE(sent.get<bool>("ok"));
+    EXPECT_EQ(sent.get<std::int64_t>("result.chat.id"), 1);
+    EXPECT_EQ(sent.get<std::string>("result.text"), "hi there");
+    EXPECT_TRUE(sent.get<bool>("result.from.is_bot"));
+    (void)call("editMessageText", "chat_id=1&message_id=1&text=edited");
+    // another chat has nothing to answer
+    (void)call("sendMessage", "chat_id=2&text=hi");
+    // a call without a chat is not a reply
+    EXPECT_TRUE(call("setMyCommands", "commands=%5B%5D").get<bool>("result"));
+    EXPECT_FALSE(server.waitForReplies(10ms));
+
+    (void)call("sendChatAction", "chat_id=1&action=typing");
+    EXPECT_TRUE(server.waitForReplies(1s));
+    (void)call("sendMessage", "chat_id=1&text=more");
+
+    const fake_api::Stats stats = server.statistics();
+    EXPECT_EQ(stats.replies, 3);
+    EXPECT_EQ(stats.unmatchedReplies, 2);
+    EXPECT_EQ(stats.apiCalls.at("sendMessage"), 3);
+    EXPECT_EQ(stats.latency.count, 3);
+}
+
+TEST_F(ServerTest, MatchesCallbackQueriesByTheirId) {
+    server.generate({.updatesPerSecond = 1000, .duration = 2ms, .chats = 5, .callbackQueryShare = 1});
+    const ptree updates = call("getUpdates");
+    ASSERT_EQ(updateIds(updates).size(), 2);
+    std::vector<std::string> ids;
+    for (const auto& [_, update] : updates.get_child("result")) {
+        EXPECT_EQ(update.get<std::string>("callback_query.data"), "button");
+        ids.push_back(update.get<std::string>("callback_query.id"));
+    }
+
+    EXPECT_TRUE(call("answerCallbackQuery", "callback_query_id=" + ids[1]).get<bool>("result"));
+    // an answered or unknown query is not matched again
+    (void)call("answerCallbackQuery", "callback_query_id=" + ids[1]);
+    (void)call("answerCallbackQuery", "callback_query_id=unknown");
+    EXPECT_FALSE(server.waitForReplies(10ms));
+    (void)get("answerCallbackQuery", "callback_query_id=" + ids[0]);
+    EXPECT_TRUE(server.waitForReplies(1s));
+
+    const fake_api::Stats stats = server.statistics();
+    EXPECT_EQ(stats.replies, 2);
+    EXPECT_EQ(stats.unmatchedReplies, 0);
+    EXPECT_EQ(stats.apiCalls.at("answerCallbackQuery"), 4);
+}
+
+TEST_F(ServerTest, RejectsPathsThatAreNotMethods) {
+    const ptree response = send("GET /metrics HTTP/1.1\r\n\r\n");
+    EXPECT_FALSE(response.get<bool>("ok"));
+    EXPECT_EQ(response.get<int>("error_code"), 404);
+}
+
+} // namespace
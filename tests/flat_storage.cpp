@@ -0,0 +1,156 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Named {
+    std::string name;
+};
+using State = std::variant<Idle, Named>;
+using Storage = FlatMemoryStateStorage<State>;
+
+static_assert(concepts::HandleStateStorage<Storage>);
+
+TEST(FlatMemoryStateStorage, PutGetErase) {
+    Storage storage;
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+    storage.put({.chatId = 1}, Named{"one"});
+    storage.put({.chatId = 1, .threadId = 2}, Idle{});
+    EXPECT_EQ(storage.size(), 2);
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 1}]).name, "one");
+    EXPECT_TRUE(std::holds_alternative<Idle>(*storage[{.chatId = 1, .threadId = 2}]));
+
+    storage.erase({.chatId = 1});
+    storage.erase({.chatId = 42}); // absent
+    EXPECT_EQ(storage.size(), 1);
+    EXPECT_EQ(storage[{.chatId = 1}], nullptr);
+}
+
+TEST(FlatMemoryStateStorage, GrowsKeepingStates) {
+    Storage storage;
+    constexpr std::int64_t keys = 10'000;
+    for (std::int64_t i = 0; i < keys; ++i)
+        storage.put({.chatId = i}, Named{std::to_string(i)});
+    EXPECT_EQ(storage.size(), keys);
+    for (std::int64_t i = 0; i < keys; ++i) {
+        const State* state = storage[{.chatId = i}];
+        ASSERT_NE(state, nullptr);
+        EXPECT_EQ(std::get<Named>(*state).name, std::to_string(i));
+    }
+    EXPECT_EQ(storage[{.chatId = keys}], nullptr);
+}
+
+TEST(FlatMemoryStateStorage, PutsAStateOfTheTableAcrossAGrow) {
+    Storage storage;
+    const std::string name(100, 'x'); // not a small string, so a dangling source is not masked
+    storage.put({.chatId = 0}, Named{name});
+    Storage::Handle handle{{.chatId = -1}};
+    storage.put(handle, std::get<Named>(*storage[{.chatId = 0}]));
+    // the source of each put is moved away by the grow it causes
+    for (std::int64_t i = 1; i < 1000; ++i)
+        storage.put({.chatId = i}, std::get<Named>(*storage[{.chatId = i - 1}]));
+    for (std::int64_t i = -1; i < 1000; ++i)
+        ASSERT_EQ(std::get<Named>(*storage[{.chatId = i}]).name, name) << i;
+}
+
+TEST(FlatMemoryStateStorage, TombstonesDoNotGrowTheTable) {
+    Storage storage;
+    storage.reserve(64);
+    const std::size_t bytes = storage.allocatedBytes();
+    // a constant number of live keys, each erased key leaves a tombstone behind
+    for (std::int64_t i = 0; i < 100'000; ++i) {
+        storage.put({.chatId = i}, Idle{});
+        if (i >= 32)
+            storage.erase({.chatId = i - 32});
+    }
+    EXPECT_EQ(storage.size(), 32);
+    EXPECT_EQ(storage.allocatedBytes(), bytes);
+    for (std::int64_t i = 100'000 - 32; i < 100'000; ++i)
+        EXPECT_NE(storage[{.chatId = i}], nullptr);
+}
+
+TEST(FlatMemoryStateStorage, MatchesUnorderedMap) {
+    Storage storage;
+    std::unordered_map<StateKey, std::string> reference;
+    std::mt19937_64 rng{1};
+    for (int step = 0; step < 200'000; ++step) {
+        const StateKey key{.chatId = static_cast<std::int64_t>(rng() % 2000)};
+        if (rng() % 3 == 0) {
+            storage.erase(key);
+            reference.erase(key);
+        } else {
+            const std::string name = std::to_string(step);
+            storage.put(key, Named{name});
+            reference.insert_or_assign(key, name);
+        }
+    }
+    ASSERT_EQ(storage.size(), reference.size());
+    for (std::int64_t i = 0; i < 2000; ++i) {
+        const State* state = storage[{.chatId = i}];
+        const auto it = reference.find({.chatId = i});
+        ASSERT_EQ(state != nullptr, it != reference.end()) << i;
+        if (state) {
+            EXPECT_EQ(std::get<Named>(*state).name, it->second);
+        }
+    }
+}
+
+TEST(FlatMemoryStateStorage, HandlesFollowInsertsAndErases) {
+    Storage storage;
+    Storage::Handle handle{{.chatId = 1}};
+    EXPECT_EQ(storage[handle], nullptr);
+    storage.put(handle, Named{"one"});
+    EXPECT_EQ(std::get<Named>(*storage[handle]).name, "one");
+
+    // other keys move the slots
+    for (std::int64_t i = 2; i < 1000; ++i)
+        storage.put({.chatId = i}, Idle{});
+    EXPECT_EQ(std::get<Named>(*storage[handle]).name, "one");
+
+    storage.emplace<Named>(handle, "two");
+    EXPECT_EQ(std::get<Named>(*storage[{.chatId = 1}]).name, "two");
+    storage.erase({.chatId = 1});
+    EXPECT_EQ(storage[handle], nullptr);
+    storage.put({.chatId = 1}, Idle{});
+    EXPECT_NE(storage[handle], nullptr);
+}
+
+TEST(FlatMemoryStateStorage, HandlesFollowAReserve) {
+    Storage storage;
+    for (std::int64_t i = 0; i < 10; ++i)
+        storage.put({.chatId = i}, Named{std::to_string(i)});
+    Storage::Handle handle{{.chatId = 3}};
+    ASSERT_NE(storage[handle], nullptr);
+
+    storage.reserve(100'000);
+    ASSERT_NE(storage[handle], nullptr);
+    EXPECT_EQ(std::get<Named>(*storage[handle]).name, "3");
+}
+
+TEST(FlatMemoryStateStorage, MoveKeepsStates) {
+    Storage storage;
+    storage.put({.chatId = 1}, Named{"one"});
+    Storage::Handle handle{{.chatId = 1}};
+    ASSERT_NE(storage[handle], nullptr);
+
+    Storage moved = std::move(storage);
+    EXPECT_EQ(std::get<Named>(*moved[handle]).name, "one");
+    EXPECT_EQ(moved.size(), 1);
+}
+
+} // namespace
@@ -0,0 +1,187 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "temp_dir.hpp"
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/mapped.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Counting {
+    std::int64_t value;
+};
+using State = std::variant<Idle, Counting>;
+using Storage = MappedStateStorage<State>;
+
+// Offsets in the file: a header of 5 words, then the control bytes at the next 64 bytes
+constexpr std::streamoff capacityOffset = 16;
+constexpr std::streamoff countOffset = 24;
+constexpr std::streamoff ctrlOffset = 64;
+
+std::uint64_t readWord(const std::string& file, std::streamoff offset) {
+    std::ifstream in{file, std::ios::binary};
+    in.seekg(offset);
+    std::uint64_t value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value)); // NOLINT(*-reinterpret-cast)
+    return value;
+}
+
+void overwrite(const std::string& file, std::streamoff offset, const std::string& bytes) {
+    std::fstream out{file, std::ios::in | std::ios::out | std::ios::binary};
+    out.seekp(offset);
+    out.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+}
+
+class MappedStateStorageTest : public test::TempDir {};
+
+TEST_F(MappedStateStorageTest, PersistsStates) {
+    const std::string file = path("states");
+    {
+        Storage storage{file};
+        storage.put({.chatId = 1}, Counting{.value = 10});
+        storage.put({.chatId = 2}, Idle{});
+        storage.put({.chatId = 3}, Idle{});
+        storage.erase({.chatId = 3});
+        std::get<Counting>(*storage[{.chatId = 1}]).value += 1; // in place
+        storage.flush();
+    }
+    Storage storage{file};
+    EXPECT_EQ(storage.size(), 2);
+    ASSERT_NE(storage[{.chatId = 1}], nullptr);
+    EXPECT_EQ(std::get<Counting>(*storage[{.chatId = 1}]).value, 11);
+    EXPECT_TRUE(std::holds_alternative<Idle>(*storage[{.chatId = 2}]));
+    EXPECT_EQ(storage[{.chatId = 3}], nullptr);
+}
+
+TEST_F(MappedStateStorageTest, RemapsWhenGrowing) {
+    const std::string file = path("states");
+    constexpr std::int64_t keys = 5000;
+    {
+        Storage storage{file, 0, 16};
+        const auto initialSize = std::filesystem::file_size(file);
+        for (std::int64_t i = 0; i < keys; ++i) {
+            storage.put({.chatId = i}, Counting{.value = i});
+            // the states must stay readable across every remapping
+            ASSERT_EQ(std::get<Counting>(*storage[{.chatId = i / 2}]).value, i / 2);
+        }
+        EXPECT_GT(std::filesystem::file_size(file), initialSize);
+        EXPECT_FALSE(std::filesystem::exists(file + ".grow"));
+    }
+    Storage storage{file};
+    EXPECT_EQ(storage.size(), keys);
+    for (std::int64_t i = 0; i < keys; ++i) {
+        const State* state = storage[{.chatId = i}];
+        ASSERT_NE(state, nullptr);
+        EXPECT_EQ(std::get<Counting>(*state).value, i);
+    }
+}
+
+TEST_F(MappedStateStorageTest, PutsAStateOfTheTableAcrossAGrow) {
+    Storage storage{path("states"), 0, 16};
+    storage.put({.chatId = 0}, Counting{.value = 42});
+    // the source of each put is unmapped by the grow it causes
+    for (std::int64_t i = 1; i < 200; ++i)
+        storage.put({.chatId = i}, std::get<Counting>(*storage[{.chatId = i - 1}]));
+    for (std::int64_t i = 0; i < 200; ++i)
+        ASSERT_EQ(std::get<Counting>(*storage[{.chatId = i}]).value, 42);
+}
+
+TEST_F(MappedStateStorageTest, RecountsAfterAKilledProcess) {
+    const std::string file = path("states");
+    {
+        Storage storage{file, 0, 16};
+        for (std::int64_t i = 0; i < 3; ++i)
+            storage.put({.chatId = i}, Idle{});
+    }
+    // killed between the writes of a put: count and growthLeft do not match the control bytes
+    const std::uint64_t count = 100;
+    const std::uint64_t growthLeft = 0;
+    std::string counters(2 * sizeof(std::uint64_t), '\0');
+    std::memcpy(counters.data(), &count, sizeof(count));
+    std::memcpy(counters.data() + sizeof(count), &growthLeft, sizeof(growthLeft));
+    overwrite(file, countOffset, counters);
+
+    Storage storage{file};
+    EXPECT_EQ(storage.size(), 3);
+    for (std::int64_t i = 3; i < 100; ++i)
+        storage.put({.chatId = i}, Idle{});
+    EXPECT_EQ(storage.size(), 100);
+    EXPECT_EQ(storage[{.chatId = 1000}], nullptr);
+}
+
+TEST_F(MappedStateStorageTest, RejectsCorruptedControlBytes) {
+    const std::string file = path("states");
+    {
+        const Storage storage{file, 0, 16};
+    }
+    const auto capacity = static_cast<std::size_t>(readWord(file, capacityOffset));
+    // no empty slot left to end a probe
+    overwrite(file, ctrlOffset, std::string(capacity, '\x01'));
+    EXPECT_THROW(Storage{file}, std::runtime_error);
+    // not a control byte
+    overwrite(file, ctrlOffset, std::string(capacity, '\x80'));
+    overwrite(file, ctrlOffset + 3, "\x90");
+    EXPECT_THROW(Storage{file}, std::runtime_error);
+}
+
+TEST_F(MappedStateStorageTest, ReusesErasedSlots) {
+    const std::string file = path("states");
+    Storage storage{file, 0, 64};
+    const auto size = std::filesystem::file_size(file);
+    for (std::int64_t round = 0; round < 100; ++round) {
+        for (std::int64_t i = 0; i < 32; ++i)
+            storage.put({.chatId = round * 32 + i}, Idle{});
+        for (std::int64_t i = 0; i < 32; ++i)
+            storage.erase({.chatId = round * 32 + i});
+    }
+    EXPECT_EQ(storage.size(), 0);
+    // tombstones are cleaned up in place, the live set never needs a bigger table
+    EXPECT_LE(std::filesystem::file_size(file), 2 * size);
+}
+
+TEST_F(MappedStateStorageTest, RejectsOtherSchemaVersion) {
+    const std::string file = path("states");
+    {
+        Storage storage{file, 1};
+        storage.put({.chatId = 1}, Idle{});
+    }
+    EXPECT_THROW((Storage{file, 2}), std::runtime_error);
+}
+
+TEST_F(MappedStateStorageTest, RejectsAFileInUse) {
+    const std::string file = path("states");
+    {
+        Storage storage{file, 0, 16};
+        EXPECT_THROW(Storage{file}, std::runtime_error);
+        // the grown file replaces the locked one, so it is locked too
+        for (std::int64_t i = 0; i < 100; ++i)
+            storage.put({.chatId = i}, Idle{});
+        EXPECT_THROW(Storage{file}, std::runtime_error);
+    }
+    const Storage storage{file};
+    EXPECT_EQ(storage.size(), 100);
+}
+
+TEST_F(MappedStateStorageTest, RejectsCorruptedFile) {
+    const std::string file = path("states");
+    {
+        std::ofstream out{file, std::ios::binary};
+        out << std::string(4096, 'x');
+    }
+    EXPECT_THROW(Storage{file}, std::runtime_error);
+}
+
+} // namespace
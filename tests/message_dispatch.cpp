@@ -0,0 +1,214 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "updates.hpp"
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/outbox.hpp"
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+struct Greeting {};
+// Cannot be moved in, so putting it leaves the state valueless
+struct Broken {
+    Broken() = default;
+    Broken(const Broken& /*unused*/) = default;
+    Broken(Broken&& /*unused*/) noexcept(false) {
+        throw std::runtime_error{"broken"};
+    }
+    Broken& operator=(const Broken&) = default;
+    Broken& operator=(Broken&&) = default;
+    ~Broken() = default;
+};
+using State = std::variant<Idle, Greeting, Broken>;
+
+// What the handlers saw, per chat
+std::mutex journalMutex;
+std::map<std::int64_t, std::vector<std::string>> journal;
+
+void note(const TgBot::Message& message, const std::string& what) {
+    const std::lock_guard lock{journalMutex};
+    journal[message.chat->id].push_back(what + ":" + message.text);
+}
+
+void onAny(const TgBot::Message& message) {
+    note(message, "any");
+}
+
+// Switches the state before the message's own handlers run
+template <typename Storage>
+void onAnyIdle(Idle& /*unused*/, const TgBot::Message& message, const StateProxy<Storage>& proxy) {
+    note(message, "any-idle");
+    if (message.text == "/hello" || message.text == "hello")
+        proxy.put(Greeting{});
+}
+
+void onNoState(const TgBot::Message& message) {
+    note(message, "no-state");
+}
+
+void onIdleText(Idle& /*unused*/, const TgBot::Message& message) {
+    note(message, "idle");
+}
+
+template <typename Storage>
+void onGreetingText(Greeting& /*unused*/, const TgBot::Message& message, const StateProxy<Storage>& proxy) {
+    note(message, "greeting");
+    if (message.text == "bye")
+        proxy.put(Idle{});
+}
+
+void onHelloCommand(Greeting& /*unused*/, const TgBot::Message& message) {
+    note(message, "hello-command");
+}
+
+void onUnknown(const TgBot::Message& message) {
+    note(message, "unknown");
+}
+
+constexpr char helloCommand[] = "hello"; // NOLINT(*-avoid-c-arrays)
+
+template <typename Storage>
+using MessageStater =
+    Stater<State,
+           Storage,
+           Dependencies<>,
+           Handler<Events::AnyMessage{}, onAny, HandlerTypes::AnyState{}>,
+           Handler<Events::AnyMessage{}, onAnyIdle<Storage>>,
+           Handler<Events::Message{}, onNoState, HandlerTypes::NoState{}>,
+           Handler<Events::Message{}, onIdleText>,
+           Handler<Events::Message{}, onGreetingText<Storage>>,
+           Handler<Events::Command{helloCommand}, onHelloCommand>,
+           Handler<Events::UnknownCommand{}, onUnknown, HandlerTypes::AnyState{}>>;
+
+class MessageDispatchTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        journal.clear();
+    }
+};
+
+TEST_F(MessageDispatchTest, AnyMessageHandlersRunFirstAndMaySwitchTheState) {
+    using Storage = MemoryStateStorage<State>;
+    TgBot::Bot bot{"token"};
+    Storage storage;
+    storage.put({.chatId = 1}, Idle{});
+    MessageStater<Storage> stater{std::move(storage)};
+    stater.setup(bot);
+
+    for (const char* text : {"hi", "hello", "again", "bye", "/hello", "/hello", "/nope"})
+        bot.getEventHandler().handleUpdate(test::makeMessage(1, text));
+    bot.getEventHandler().handleUpdate(test::makeMessage(2, "stateless"));
+
+    // state handlers of an event run before its AnyState ones
+    const std::vector<std::string> chat1{
+        "any-idle:hi",     "any:hi",     "idle:hi",
+        // switched by the AnyMessage handler, so the Message handlers see the new state
+        "any-idle:hello",  "any:hello",  "greeting:hello",
+        "any:again",       "greeting:again",
+        "any:bye",         "greeting:bye",
+        "any-idle:/hello", "any:/hello", "hello-command:/hello",
+        "any:/hello",      "hello-command:/hello",
+        "any:/nope",       "unknown:/nope",
+    };
+    EXPECT_EQ(journal[1], chat1);
+    EXPECT_EQ(journal[2], (std::vector<std::string>{"any:stateless", "no-state:stateless"}));
+}
+
+TEST_F(MessageDispatchTest, ValuelessStateIsErased) {
+    using Storage = MemoryStateStorage<State>;
+    TgBot::Bot bot{"token"};
+    Storage storage;
+    storage.put({.chatId = 1}, Idle{});
+    EXPECT_THROW(storage.put({.chatId = 1}, Broken{}), std::runtime_error);
+    ASSERT_TRUE(storage[{.chatId = 1}]->valueless_by_exception());
+    MessageStater<Storage> stater{std::move(storage)};
+    stater.setup(bot);
+
+    bot.getEventHandler().handleUpdate(test::makeMessage(1, "hi"));
+    bot.getEventHandler().handleUpdate(test::makeMessage(1, "hello"));
+    EXPECT_EQ(journal[1], (std::vector<std::string>{"any:hi", "no-state:hi", "any:hello", "no-state:hello"}));
+}
+
+TEST_F(MessageDispatchTest, ChannelPostsAreAllowedAndHandledAsMessages) {
+    using Storage = MemoryStateStorage<State>;
+    const auto allowed = MessageStater<Storage>::allowedUpdateTypes();
+    EXPECT_NE(std::ranges::find(allowed, "channel_post"), allowed.end());
+    EXPECT_EQ(std::ranges::find(allowed, "edited_channel_post"), allowed.end());
+
+    TgBot::Bot bot{"token"};
+    MessageStater<Storage> stater{};
+    stater.setup(bot);
+    auto update = test::makeMessage(-100, "post");
+    std::swap(update->message, update->channelPost);
+    bot.getEventHandler().handleUpdate(update);
+    EXPECT_EQ(journal[-100], (std::vector<std::string>{"any:post", "no-state:post"}));
+}
+
+void onQueued(const TgBot::Message& /*unused*/, Outbox& /*unused*/) {}
+
+TEST_F(MessageDispatchTest, SetupRejectsOutboxHandlerWithoutOutbox) {
+    using Storage = MemoryStateStorage<State>;
+    using OutboxStater = Stater<State,
+                                Storage,
+                                Dependencies<>,
+                                Handler<Events::Message{}, onNoState, HandlerTypes::NoState{}>,
+                                Handler<Events::Message{}, onQueued, HandlerTypes::AnyState{}>>;
+    TgBot::Bot bot{"token"};
+    OutboxStater stater{};
+    EXPECT_THROW(stater.setup(bot), std::logic_error);
+}
+
+TEST_F(MessageDispatchTest, ShardedDispatchKeepsTheOrderOfAChat) {
+    using Storage = ConcurrentMemoryStateStorage<State>;
+    constexpr std::int64_t chats = 16;
+    constexpr int rounds = 50;
+    TgBot::Bot bot{"token"};
+    Storage storage;
+    for (std::int64_t chat = 0; chat < chats; ++chat)
+        storage.put({.chatId = chat}, Idle{});
+    MessageStater<Storage> stater{std::move(storage), {}, DispatchOptions{.shards = 4}};
+    stater.setup(bot);
+
+    for (int round = 0; round < rounds; ++round)
+        for (std::int64_t chat = 0; chat < chats; ++chat)
+            bot.getEventHandler().handleUpdate(test::makeMessage(chat, round % 2 == 0 ? "hello" : "bye"));
+    stater.drain();
+
+    std::vector<std::string> expected;
+    for (int round = 0; round < rounds; ++round) {
+        if (round % 2 == 0)
+            expected.insert(expected.end(), {"any-idle:hello", "any:hello", "greeting:hello"});
+        else
+            expected.insert(expected.end(), {"any:bye", "greeting:bye"});
+    }
+    for (std::int64_t chat = 0; chat < chats; ++chat)
+        EXPECT_EQ(journal[chat], expected) << "chat " << chat;
+}
+
+} // namespace
@@ -0,0 +1,163 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/metrics.hpp"
+#include "tg_stater/metrics_exporter.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+namespace {
+
+using namespace tg_stater;
+using metrics::Histogram;
+
+constexpr std::uint64_t octave36 = std::uint64_t{1} << 36U;
+
+// Octave edges: the first bucket ends at 128 ns, the first octave is split at 160 ns, 2^36 ns is past the last one
+static_assert(Histogram::bucketOf(0) == 0);
+static_assert(Histogram::bucketOf(127) == 0);
+static_assert(Histogram::bucketOf(128) == 1);
+static_assert(Histogram::bucketOf(159) == 1);
+static_assert(Histogram::bucketOf(160) == 2);
+static_assert(Histogram::bucketOf(255) == 4);
+static_assert(Histogram::bucketOf(256) == 5);
+static_assert(Histogram::bucketOf(octave36 - 1) == Histogram::bucketCount - 2);
+static_assert(Histogram::bucketOf(octave36) == Histogram::bucketCount - 1);
+static_assert(Histogram::bucketOf(UINT64_MAX) == Histogram::bucketCount - 1);
+static_assert(Histogram::upperBound(0) == 128);
+static_assert(Histogram::upperBound(1) == 160);
+static_assert(Histogram::upperBound(4) == 256);
+static_assert(Histogram::upperBound(Histogram::bucketCount - 2) == octave36);
+
+// Every finite bucket ends where the next one starts, and is at most 25% wide
+static_assert([] {
+    for (std::size_t i = 1; i + 1 < Histogram::bucketCount; ++i) {
+        const std::uint64_t lower = Histogram::upperBound(i - 1);
+        const std::uint64_t upper = Histogram::upperBound(i);
+        if (Histogram::bucketOf(lower) != i || Histogram::bucketOf(upper - 1) != i || (upper - lower) * 4 > lower)
+            return false;
+    }
+    return true;
+}());
+
+TEST(Histogram, QuantilesAreBucketUpperBounds) {
+    Histogram histogram;
+    EXPECT_EQ(histogram.snapshot().quantileNs(0.5), 0);
+    for (int i = 0; i < 90; ++i)
+        histogram.record(100);
+    for (int i = 0; i < 10; ++i)
+        histogram.record(1000);
+
+    const Histogram::Snapshot snapshot = histogram.snapshot();
+    EXPECT_EQ(snapshot.count, 100);
+    EXPECT_EQ(snapshot.sumNs, 90 * 100 + 10 * 1000);
+    EXPECT_EQ(snapshot.quantileNs(0), 128);
+    EXPECT_EQ(snapshot.quantileNs(0.5), 128);
+    EXPECT_EQ(snapshot.quantileNs(0.89), 128);
+    EXPECT_EQ(snapshot.quantileNs(0.9), 1024);
+    EXPECT_EQ(snapshot.quantileNs(1), 1024);
+}
+
+TEST(Histogram, ValuesPastTheLastBucketReportItsBound) {
+    Histogram histogram;
+    histogram.record(octave36 * 4);
+    EXPECT_EQ(histogram.snapshot().quantileNs(0.5), octave36);
+}
+
+bool contains(std::string_view text, std::string_view line) {
+    return text.find(std::string{line} + '\n') != std::string_view::npos;
+}
+
+TEST(Registry, WritesThePrometheusTextFormat) {
+    metrics::Registry registry;
+    metrics::HandlerMetrics& handler = registry.handler("say \"hi\"\\\n");
+    handler.latency.record(150);
+    handler.latency.record(octave36);
+    handler.exceptions.inc(2);
+    (void)registry.handler("idle");
+    // the same name is the same metric
+    registry.event("message").inc(2);
+    registry.event("message").inc();
+    registry.state("Idle").inc();
+    registry.storagePuts.inc(4);
+
+    const std::string text = registry.prometheusText();
+    EXPECT_TRUE(contains(text, "# TYPE tgbotstater_handler_duration_seconds histogram"));
+    const std::string label = R"(handler="say \"hi\"\\\n")";
+    const std::string bucket = "tgbotstater_handler_duration_seconds_bucket{" + label;
+    // cumulative counts with exact decimal bounds
+    EXPECT_TRUE(contains(text, bucket + R"(,le="0.000000128"} 0)"));
+    EXPECT_TRUE(contains(text, bucket + R"(,le="0.00000016"} 1)"));
+    EXPECT_TRUE(contains(text, bucket + R"(,le="0.000000192"} 1)"));
+    EXPECT_TRUE(contains(text, bucket + R"(,le="68.719476736"} 1)"));
+    EXPECT_TRUE(contains(text, bucket + R"(,le="+Inf"} 2)"));
+    EXPECT_TRUE(contains(text, "tgbotstater_handler_duration_seconds_sum{" + label + "} 68.719476886"));
+    EXPECT_TRUE(contains(text, "tgbotstater_handler_duration_seconds_count{" + label + "} 2"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_handler_duration_seconds_sum{handler="idle"} 0)"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_handler_duration_seconds_bucket{handler="idle",le="+Inf"} 0)"));
+    EXPECT_TRUE(contains(text, "tgbotstater_handler_exceptions_total{" + label + "} 2"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_events_total{event="message"} 3)"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_state_updates_total{state="Idle"} 1)"));
+    EXPECT_TRUE(contains(text, "tgbotstater_updates_without_state_total 0"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_storage_operations_total{operation="put"} 4)"));
+    EXPECT_TRUE(contains(text, R"(tgbotstater_storage_operations_total{operation="get"} 0)"));
+}
+
+// Sends a request to the exporter and reads the response until the exporter closes the connection
+std::string request(std::uint16_t port, std::string_view text) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    // NOLINTNEXTLINE(*-reinterpret-cast)
+    if (::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == -1) {
+        ::close(fd);
+        return {};
+    }
+    ::send(fd, text.data(), text.size(), MSG_NOSIGNAL);
+    std::string response;
+    std::array<char, 4096> buffer{};
+    ssize_t received = 0;
+    while ((received = ::recv(fd, buffer.data(), buffer.size(), 0)) > 0)
+        response.append(buffer.data(), static_cast<std::size_t>(received));
+    ::close(fd);
+    return response;
+}
+
+std::string_view bodyOf(std::string_view response) {
+    const std::size_t end = response.find("\r\n\r\n");
+    return end == std::string_view::npos ? std::string_view{} : response.substr(end + 4);
+}
+
+TEST(Exporter, ServesTheRegistryAndNothingElse) {
+    metrics::registry().handler("exported").latency.record(1);
+    const metrics::Exporter exporter{{.address = "127.0.0.1", .port = 0}};
+
+    for (const std::string_view path : {"/metrics", "/metrics?name[]=x"}) {
+        const std::string response = request(exporter.port(), "GET " + std::string{path} + " HTTP/1.1\r\n\r\n");
+        EXPECT_TRUE(response.starts_with("HTTP/1.0 200 OK\r\n")) << response;
+        EXPECT_NE(response.find("\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"), std::string::npos);
+        const std::string_view body = bodyOf(response);
+        EXPECT_NE(response.find("\r\nContent-Length: " + std::to_string(body.size()) + "\r\n"), std::string::npos);
+        EXPECT_TRUE(contains(body, R"(tgbotstater_handler_duration_seconds_count{handler="exported"} 1)"));
+    }
+
+    for (const std::string_view line : {"GET / HTTP/1.1", "GET /metricsx HTTP/1.1", "POST /metrics HTTP/1.1"}) {
+        const std::string response = request(exporter.port(), std::string{line} + "\r\n\r\n");
+        EXPECT_TRUE(response.starts_with("HTTP/1.0 404 Not Found\r\n")) << line;
+        EXPECT_EQ(bodyOf(response), "Not found\n");
+    }
+}
+
+} // namespace
@@ -0,0 +1,305 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "updates.hpp"
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/coroutine.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/outbox.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+#include <tgbot/Bot.h>
+#include <tgbot/TgException.h>
+#include <tgbot/net/HttpClient.h>
+#include <tgbot/net/HttpReqArg.h>
+#include <tgbot/net/Url.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+using Clock = std::chrono::steady_clock;
+
+// Answers sendMessage with 429 as many times as told for its text, and records what was sent and when
+class FakeTelegram : public TgBot::HttpClient {
+  public:
+    struct Sent {
+        std::int64_t chat;
+        std::string text;
+        Clock::time_point at;
+    };
+
+  private:
+    mutable std::mutex mutex;
+    mutable std::unordered_map<std::string, int> refusals;
+    mutable std::unordered_map<std::string, int> attempts;
+    mutable std::vector<Sent> sent;
+    std::string retryAfter;
+
+  public:
+    explicit FakeTelegram(std::string retryAfter = "0") : retryAfter{std::move(retryAfter)} {}
+
+    std::string makeRequest(const TgBot::Url& /*unused*/, const std::vector<TgBot::HttpReqArg>& args) const override {
+        std::int64_t chat = 0;
+        std::string text;
+        for (const TgBot::HttpReqArg& arg : args) {
+            if (arg.name == "chat_id")
+                chat = std::stoll(arg.value);
+            else if (arg.name == "text")
+                text = arg.value;
+        }
+        const std::lock_guard lock{mutex};
+        ++attempts[text];
+        if (int& left = refusals[text]; left > 0) {
+            --left;
+            throw TgBot::TgException{"Too Many Requests: retry after " + retryAfter,
+                                     TgBot::TgException::ErrorCode::TooManyRequests};
+        }
+        sent.push_back({chat, text, Clock::now()});
+        return R"({"ok":true,"result":{"message_id":1,"date":0,"chat":{"id":0,"type":"private"}}})";
+    }
+
+    void refuse(const std::string& text, int times) {
+        const std::lock_guard lock{mutex};
+        refusals[text] = times;
+    }
+
+    [[nodiscard]] int attemptsOf(const std::string& text) const {
+        const std::lock_guard lock{mutex};
+        const auto it = attempts.find(text);
+        return it == attempts.end() ? 0 : it->second;
+    }
+
+    [[nodiscard]] std::vector<Sent> sentMessages() const {
+        const std::lock_guard lock{mutex};
+        return sent;
+    }
+
+    [[nodiscard]] std::map<std::int64_t, std::vector<std::string>> sentByChat() const {
+        std::map<std::int64_t, std::vector<std::string>> byChat;
+        for (const Sent& message : sentMessages())
+            byChat[message.chat].push_back(message.text);
+        return byChat;
+    }
+
+    [[nodiscard]] Clock::time_point sentAt(const std::string& text) const {
+        for (const Sent& message : sentMessages())
+            if (message.text == text)
+                return message.at;
+        return Clock::time_point::max();
+    }
+};
+
+// No limits but the ones a test is about
+constexpr OutboxOptions unlimited{.globalRate = 1e6, .globalBurst = 1e6, .chatRate = 1e6, .chatBurst = 1e6};
+
+TEST(RetryAfter, ParsesTheDescriptionOf429) {
+    using TgBot::TgException;
+    constexpr auto tooManyRequests = TgException::ErrorCode::TooManyRequests;
+    EXPECT_EQ(detail::retryAfter(TgException{"Too Many Requests: retry after 7", tooManyRequests}), 7s);
+    EXPECT_EQ(detail::retryAfter(TgException{"Too Many Requests", tooManyRequests}), 1s);
+    EXPECT_EQ(detail::retryAfter(TgException{"Too Many Requests: retry after 0", tooManyRequests}), 1s);
+    // past any sane pause, or past any integer, is clamped instead of throwing from the worker
+    EXPECT_EQ(detail::retryAfter(TgException{"Too Many Requests: retry after 86400", tooManyRequests}), 1h);
+    const std::string overflowing = "Too Many Requests: retry after 99999999999999999999999";
+    EXPECT_EQ(detail::retryAfter(TgException{overflowing, tooManyRequests}), 1h);
+    EXPECT_EQ(detail::retryAfter(TgException{"Bad Request: chat not found", TgException::ErrorCode::Undefined}),
+              std::nullopt);
+}
+
+TEST(TokenBucket, RefillsAtItsRateUpToTheBurst) {
+    const Clock::time_point start = Clock::now();
+    detail::TokenBucket bucket{10, 2, start};
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(bucket.ready(start));
+        bucket.take();
+    }
+    EXPECT_FALSE(bucket.ready(start));
+    EXPECT_FALSE(bucket.idle(start));
+    EXPECT_EQ(bucket.readyAt(), start + 100ms);
+    EXPECT_FALSE(bucket.ready(start + 99ms));
+    EXPECT_TRUE(bucket.ready(start + 100ms));
+    // no more than the burst is saved up
+    EXPECT_TRUE(bucket.idle(start + 1h));
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_TRUE(bucket.ready(start + 1h));
+        bucket.take();
+    }
+    EXPECT_FALSE(bucket.ready(start + 1h));
+}
+
+TEST(TokenBucket, PauseEmptiesItUntilTheGivenTime) {
+    const Clock::time_point start = Clock::now();
+    detail::TokenBucket bucket{10, 5, start};
+    bucket.pause(start + 1s);
+    EXPECT_FALSE(bucket.ready(start + 999ms));
+    EXPECT_FALSE(bucket.idle(start + 999ms));
+    EXPECT_EQ(bucket.readyAt(), start + 1s);
+    EXPECT_TRUE(bucket.ready(start + 1s));
+    // a shorter pause does not cut the longer one
+    bucket.pause(start + 3s);
+    bucket.pause(start + 2s);
+    EXPECT_FALSE(bucket.ready(start + 2500ms));
+    EXPECT_TRUE(bucket.ready(start + 3s));
+}
+
+TEST(Outbox, RetriesA429UpToMaxAttempts) {
+    FakeTelegram telegram;
+    const TgBot::Bot bot{"token", telegram};
+    OutboxOptions options = unlimited;
+    options.maxAttempts = 3;
+    Outbox outbox{bot.getApi(), options};
+
+    telegram.refuse("twice", 2);
+    telegram.refuse("always", 100);
+    auto twice = outbox.sendMessage(1, "twice");
+    auto always = outbox.sendMessage(2, "always");
+    EXPECT_NE(twice.get(), nullptr);
+    EXPECT_THROW(always.get(), TgBot::TgException);
+    EXPECT_EQ(telegram.attemptsOf("twice"), 3);
+    EXPECT_EQ(telegram.attemptsOf("always"), 3);
+}
+
+TEST(Outbox, KeepsTheOrderOfAChatThroughRetries) {
+    FakeTelegram telegram;
+    const TgBot::Bot bot{"token", telegram};
+    Outbox outbox{bot.getApi(), unlimited};
+
+    constexpr int messages = 50;
+    std::map<std::int64_t, std::vector<std::string>> expected;
+    for (int i = 0; i < messages; ++i) {
+        for (std::int64_t chat = 1; chat <= 4; ++chat) {
+            std::string text = std::to_string(chat) + ":" + std::to_string(i);
+            if (i % 7 == 0)
+                telegram.refuse(text, 1 + static_cast<int>(chat % 2));
+            expected[chat].push_back(text);
+            (void)outbox.sendMessage(chat, std::move(text));
+        }
+    }
+    outbox.flush();
+    EXPECT_EQ(telegram.sentByChat(), expected);
+}
+
+TEST(Outbox, A429PausesOnlyItsChat) {
+    FakeTelegram telegram{"1"};
+    const TgBot::Bot bot{"token", telegram};
+    Outbox outbox{bot.getApi(), unlimited};
+
+    telegram.refuse("paused", 1);
+    const Clock::time_point start = Clock::now();
+    auto paused = outbox.sendMessage(1, "paused");
+    auto behind = outbox.sendMessage(1, "behind");
+    auto other = outbox.sendMessage(2, "other");
+    other.get();
+    paused.get();
+    behind.get();
+
+    EXPECT_LT(telegram.sentAt("other") - start, 500ms);
+    EXPECT_GE(telegram.sentAt("paused") - start, 1s);
+    EXPECT_LT(telegram.sentAt("paused"), telegram.sentAt("behind"));
+}
+
+TEST(Outbox, A429WithoutAChatPausesEverything) {
+    FakeTelegram telegram{"1"};
+    const TgBot::Bot bot{"token", telegram};
+    Outbox outbox{bot.getApi(), unlimited};
+
+    telegram.refuse("global", 1);
+    const Clock::time_point start = Clock::now();
+    auto global = outbox.post(std::nullopt, [](const TgBot::Api& api) { return api.sendMessage(0, "global"); });
+    // sent once the refusal has paused the outbox
+    while (telegram.attemptsOf("global") == 0)
+        std::this_thread::yield();
+    std::this_thread::sleep_for(100ms);
+    auto chat = outbox.sendMessage(1, "chat");
+    chat.get();
+    global.get();
+
+    EXPECT_GE(telegram.sentAt("chat") - start, 1s);
+    EXPECT_GE(telegram.sentAt("global") - start, 1s);
+}
+
+TEST(Outbox, PausedChatsAreNotForgotten) {
+    FakeTelegram telegram{"1"};
+    const TgBot::Bot bot{"token", telegram};
+    Outbox outbox{bot.getApi(), unlimited};
+
+    telegram.refuse("paused", 1);
+    const Clock::time_point start = Clock::now();
+    auto paused = outbox.sendMessage(1, "paused");
+    while (telegram.attemptsOf("paused") == 0)
+        std::this_thread::yield();
+    // enough chats for the idle ones to be forgotten
+    for (std::int64_t chat = 2; chat < 6000; ++chat)
+        (void)outbox.sendMessage(chat, "idle");
+    auto behind = outbox.sendMessage(1, "behind");
+    behind.get();
+    EXPECT_GE(telegram.sentAt("behind") - start, 1s);
+    paused.get();
+}
+
+struct Idle {};
+using State = std::variant<Idle>;
+
+std::mutex journalMutex;
+std::vector<std::string> journal;
+
+Task<> onMessage(const TgBot::Message& message, Outbox& outbox) {
+    const std::int64_t chat = message.chat->id;
+    const TgBot::Message::Ptr sent =
+        co_await outbox.async(chat, [chat](const TgBot::Api& api) { return api.sendMessage(chat, "retried"); });
+    std::string result = sent ? "sent" : "null";
+    try {
+        co_await outbox.async(chat, [chat](const TgBot::Api& api) { return api.sendMessage(chat, "refused"); });
+    } catch (const TgBot::TgException& /*unused*/) {
+        result += ", refused";
+    }
+    const std::lock_guard lock{journalMutex};
+    journal.push_back(message.text + ": " + result);
+}
+
+using OutboxStater = Stater<State,
+                            MemoryStateStorage<State>,
+                            Dependencies<>,
+                            Handler<Events::Message{}, onMessage, HandlerTypes::AnyState{}>>;
+
+TEST(Outbox, AwaitingCoroutinesResumeWithTheResultOrError) {
+    FakeTelegram telegram;
+    TgBot::Bot bot{"token", telegram};
+    OutboxOptions options = unlimited;
+    options.maxAttempts = 2;
+    OutboxStater stater{{}, {}, DispatchOptions{.outbox = options}};
+    stater.setup(bot);
+
+    telegram.refuse("retried", 1);
+    telegram.refuse("refused", 100);
+    bot.getEventHandler().handleUpdate(test::makeMessage(1, "first"));
+    stater.drain();
+
+    const std::lock_guard lock{journalMutex};
+    EXPECT_EQ(journal, (std::vector<std::string>{"first: sent, refused"}));
+    EXPECT_EQ(telegram.attemptsOf("retried"), 2);
+    EXPECT_EQ(telegram.attemptsOf("refused"), 2);
+}
+
+} // namespace
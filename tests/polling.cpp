@@ -0,0 +1,199 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/polling.hpp"
+#include "tg_stater/replay.hpp"
+
+#include <gtest/gtest.h>
+#include <tgbot/Bot.h>
+#include <tgbot/TgException.h>
+#include <tgbot/types/Message.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+using namespace std::chrono_literals;
+
+TEST(PollTuning, GrowsOnAFullBatchAndShrinksBelowHalf) {
+    detail::PollTuning tuning{{.minLimit = 10, .maxLimit = 100, .timeout = 10}};
+    EXPECT_EQ(tuning.limit(), 10);
+    EXPECT_EQ(tuning.timeout(), 10);
+
+    // a backlog: the limit doubles up to the maximum and the requests do not wait
+    for (const std::int32_t expected : {20, 40, 80, 100, 100}) {
+        tuning.onBatch(static_cast<std::size_t>(tuning.limit()));
+        EXPECT_EQ(tuning.limit(), expected);
+        EXPECT_EQ(tuning.timeout(), 0);
+    }
+    // caught up: at least half a batch keeps the limit
+    tuning.onBatch(50);
+    EXPECT_EQ(tuning.limit(), 100);
+    EXPECT_EQ(tuning.timeout(), 10);
+    for (const std::int32_t expected : {50, 25, 12, 10, 10}) {
+        tuning.onBatch(0);
+        EXPECT_EQ(tuning.limit(), expected);
+        EXPECT_EQ(tuning.timeout(), 10);
+    }
+}
+
+TEST(PollTuning, ClampsTheMinimumLimit) {
+    EXPECT_EQ(detail::PollTuning({.minLimit = 0, .maxLimit = 100}).limit(), 1);
+    EXPECT_EQ(detail::PollTuning({.minLimit = 200, .maxLimit = 100}).limit(), 100);
+}
+
+std::string updateJson(std::int32_t id, const std::string& text) {
+    return R"({"update_id":)" + std::to_string(id) +
+           R"(,"message":{"message_id":1,"date":0,"chat":{"id":1,"type":"private"},"text":")" + text + R"("}})";
+}
+
+// Answers getUpdates from a script, and with empty batches once it runs out
+class ScriptedTelegram {
+    std::mutex mutex;
+    std::deque<std::string> responses;
+
+  public:
+    RecordingHttpClient http;
+
+    ScriptedTelegram() {
+        http.respond = [this](std::string_view /*unused*/) {
+            {
+                const std::lock_guard lock{mutex};
+                if (!responses.empty()) {
+                    std::string response = std::move(responses.front());
+                    responses.pop_front();
+                    return response;
+                }
+            }
+            // a long poll that times out
+            std::this_thread::sleep_for(10ms);
+            return std::string{R"({"ok":true,"result":[]})"};
+        };
+    }
+
+    void batch(const std::vector<std::pair<std::int32_t, std::string>>& updates) {
+        std::string response = R"({"ok":true,"result":[)";
+        for (const auto& [id, text] : updates) {
+            if (response.back() != '[')
+                response += ',';
+            response += updateJson(id, text);
+        }
+        response += "]}";
+        const std::lock_guard lock{mutex};
+        responses.push_back(std::move(response));
+    }
+
+    void failure() {
+        const std::lock_guard lock{mutex};
+        responses.emplace_back(R"({"ok":false,"error_code":502,"description":"Bad Gateway"})");
+    }
+
+    // Waits for the fetching thread to make `n` requests
+    [[nodiscard]] std::vector<RecordingHttpClient::Call> calls(std::size_t n) const {
+        const auto deadline = std::chrono::steady_clock::now() + 10s;
+        std::vector<RecordingHttpClient::Call> recorded = http.recordedCalls();
+        while (recorded.size() < n && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(1ms);
+            recorded = http.recordedCalls();
+        }
+        return recorded;
+    }
+};
+
+std::optional<std::string> argOf(const RecordingHttpClient::Call& call, std::string_view name) {
+    for (const auto& [argName, value] : call.args)
+        if (argName == name)
+            return value;
+    return std::nullopt;
+}
+
+class PipelinedLongPollTest : public ::testing::Test {
+  protected:
+    ScriptedTelegram telegram;
+    TgBot::Bot bot{"token", telegram.http};
+    std::vector<std::string> handled; // only touched by the thread calling `start`
+
+    void SetUp() override {
+        bot.getEvents().onAnyMessage([this](const TgBot::Message::Ptr& message) {
+            handled.push_back(message->text);
+            if (message->text == "throw")
+                throw std::runtime_error{"handler failed"};
+        });
+    }
+};
+
+TEST_F(PipelinedLongPollTest, RequestsPastTheLastReceivedUpdate) {
+    telegram.batch({{5, "a"}, {6, "b"}});
+    telegram.batch({{7, "c"}});
+    PipelinedLongPoll poll{bot, {.minLimit = 10, .maxLimit = 100, .timeout = 10}};
+    poll.start();
+    poll.start();
+    EXPECT_EQ(handled, (std::vector<std::string>{"a", "b", "c"}));
+
+    const std::vector<RecordingHttpClient::Call> calls = telegram.calls(3);
+    ASSERT_GE(calls.size(), 3);
+    EXPECT_EQ(calls[0].method, "getUpdates");
+    EXPECT_EQ(argOf(calls[0], "offset"), std::nullopt);
+    EXPECT_EQ(argOf(calls[0], "limit"), "10");
+    EXPECT_EQ(argOf(calls[0], "timeout"), "10");
+    EXPECT_EQ(argOf(calls[1], "offset"), "7");
+    EXPECT_EQ(argOf(calls[2], "offset"), "8");
+    // an empty batch does not move the offset
+    ASSERT_GE(telegram.calls(4).size(), 4);
+    EXPECT_EQ(argOf(telegram.calls(4)[3], "offset"), "8");
+}
+
+TEST_F(PipelinedLongPollTest, KeepsAtMostInFlightBatches) {
+    for (std::int32_t i = 1; i <= 5; ++i)
+        telegram.batch({{i, std::to_string(i)}});
+    PipelinedLongPoll poll{bot, {.inFlight = 2}};
+    ASSERT_EQ(telegram.calls(2).size(), 2);
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(telegram.http.recordedCalls().size(), 2);
+
+    // taking a batch makes room for one more request
+    poll.start();
+    ASSERT_EQ(telegram.calls(3).size(), 3);
+    std::this_thread::sleep_for(100ms);
+    EXPECT_EQ(telegram.http.recordedCalls().size(), 3);
+    EXPECT_EQ(handled, (std::vector<std::string>{"1"}));
+}
+
+TEST_F(PipelinedLongPollTest, RethrowsAFailedRequestAndRequestsItAgain) {
+    telegram.batch({{1, "a"}});
+    telegram.failure();
+    telegram.batch({{2, "b"}});
+    PipelinedLongPoll poll{bot};
+    poll.start();
+    EXPECT_THROW(poll.start(), TgBot::TgException);
+    poll.start();
+    EXPECT_EQ(handled, (std::vector<std::string>{"a", "b"}));
+
+    const std::vector<RecordingHttpClient::Call> calls = telegram.calls(3);
+    ASSERT_GE(calls.size(), 3);
+    EXPECT_EQ(argOf(calls[1], "offset"), "2");
+    EXPECT_EQ(argOf(calls[2], "offset"), "2");
+}
+
+TEST_F(PipelinedLongPollTest, AThrowingHandlerDoesNotDropTheBatch) {
+    telegram.batch({{1, "a"}, {2, "throw"}, {3, "c"}});
+    telegram.batch({{4, "d"}});
+    PipelinedLongPoll poll{bot};
+    EXPECT_NO_THROW(poll.start());
+    EXPECT_EQ(handled, (std::vector<std::string>{"a", "throw", "c"}));
+    poll.start();
+    EXPECT_EQ(handled.back(), "d");
+}
+
+} // namespace
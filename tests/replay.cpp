@@ -0,0 +1,79 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "temp_dir.hpp"
+#include "updates.hpp"
+
+#include "tg_stater/bot.hpp"
+#include "tg_stater/dispatcher.hpp"
+#include "tg_stater/handler/event.hpp"
+#include "tg_stater/handler/handler.hpp"
+#include "tg_stater/handler/type.hpp"
+#include "tg_stater/outbox.hpp"
+#include "tg_stater/replay.hpp"
+#include "tg_stater/state_storage/concurrent_memory.hpp"
+
+#include <gtest/gtest.h>
+#include <tgbot/Bot.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {};
+using State = std::variant<Idle>;
+
+std::mutex sentMutex;
+std::vector<std::future<TgBot::Message::Ptr>> sent;
+
+void echo(const TgBot::Message& message, Outbox& outbox) {
+    auto reply = outbox.sendMessage(message.chat->id, message.text);
+    const std::lock_guard lock{sentMutex};
+    sent.push_back(std::move(reply));
+}
+
+using EchoStater = Stater<State,
+                          ConcurrentMemoryStateStorage<State>,
+                          Dependencies<>,
+                          Handler<Events::Message{}, echo, HandlerTypes::AnyState{}>>;
+
+using ReplayTest = test::TempDir;
+
+TEST_F(ReplayTest, KeepsTheOutboxAndDispatcherOfTheRunningBot) {
+    const std::string path = this->path("updates.jsonl");
+    std::ofstream{path} << R"({"update_id":1,"message":{"chat":{"id":2},"text":"replayed"}})" << '\n';
+
+    const RecordingHttpClient live;
+    TgBot::Bot bot{"token", live};
+    EchoStater stater{{}, {}, DispatchOptions{.shards = 2, .outbox = OutboxOptions{}}};
+    stater.setup(bot);
+
+    const RecordingHttpClient recorded;
+    const ReplayReport report = stater.replay(path, {}, recorded);
+    EXPECT_EQ(report.updates, 1);
+    EXPECT_EQ(report.apiCalls.at("sendMessage"), 1);
+
+    // handled after the replay's bot is gone
+    bot.getEventHandler().handleUpdate(test::makeMessage(1, "live"));
+    stater.drain();
+    {
+        const std::lock_guard lock{sentMutex};
+        for (auto& reply : sent)
+            reply.wait();
+    }
+    const auto calls = live.recordedCalls();
+    ASSERT_EQ(calls.size(), 1);
+    EXPECT_EQ(calls[0].method, "sendMessage");
+    EXPECT_EQ(recorded.recordedCalls().size(), 1);
+}
+
+} // namespace
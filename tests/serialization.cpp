@@ -0,0 +1,91 @@
+#include "tg_stater/serialization.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <optional>
+#include <string>
+#include <tuple>
+#include <variant>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {
+    bool operator==(const Idle&) const = default;
+};
+struct Survey {
+    std::string title;
+    std::vector<std::int32_t> answers;
+    std::optional<std::map<std::string, std::int64_t>> scores;
+
+    static constexpr auto serializedFields = std::tuple{&Survey::title, &Survey::answers, &Survey::scores};
+    bool operator==(const Survey&) const = default;
+};
+struct Pinned {
+    std::int64_t value;
+
+    static constexpr std::uint32_t serializationTag = 100;
+    bool operator==(const Pinned&) const = default;
+};
+struct ByName {
+    static constexpr bool serializationTagFromName = true;
+    bool operator==(const ByName&) const = default;
+};
+
+std::uint32_t tagOfEncoded(const std::string& bytes) {
+    std::uint32_t tag = 0;
+    std::memcpy(&tag, bytes.data(), sizeof(tag));
+    return tag;
+}
+
+TEST(Serialization, RoundTrip) {
+    using State = std::variant<Idle, Survey, Pinned>;
+    const State survey = Survey{"title", {1, 2, 3}, std::map<std::string, std::int64_t>{{"a", 1}, {"b", -2}}};
+    for (const State& state : {State{Idle{}}, survey, State{Pinned{42}}})
+        EXPECT_EQ(serialization::decode<State>(serialization::encode(state)), state);
+}
+
+TEST(Serialization, TagsAreIndicesUnlessDeclared) {
+    using State = std::variant<Idle, Survey, Pinned>;
+    EXPECT_EQ(tagOfEncoded(serialization::encode(State{Idle{}})), 0);
+    EXPECT_EQ(tagOfEncoded(serialization::encode(State{Survey{}})), 1);
+    EXPECT_EQ(tagOfEncoded(serialization::encode(State{Pinned{}})), Pinned::serializationTag);
+
+    // encodeAs writes what the variant would
+    std::string bytes;
+    serialization::encodeAs<State>(Survey{"t", {}, std::nullopt}, bytes);
+    EXPECT_EQ(bytes, serialization::encode(State{Survey{"t", {}, std::nullopt}}));
+}
+
+TEST(Serialization, AppendedAndPinnedAlternativesDecode) {
+    using Before = std::variant<Idle, Survey, Pinned>;
+    // an alternative added, the one with a declared tag moved; the others keep their indices
+    using After = std::variant<Idle, Survey, ByName, Pinned>;
+    static_assert(serialization::Serializable<After>);
+    const Survey survey{"kept", {7}, std::nullopt};
+    EXPECT_EQ(std::get<Survey>(serialization::decode<After>(serialization::encode(Before{survey}))), survey);
+    EXPECT_EQ(std::get<Pinned>(serialization::decode<After>(serialization::encode(Before{Pinned{5}}))), Pinned{5});
+}
+
+TEST(Serialization, NameTagsAreOptIn) {
+    using State = std::variant<Idle, ByName>;
+    EXPECT_NE(tagOfEncoded(serialization::encode(State{ByName{}})), 1);
+    EXPECT_EQ(serialization::decode<State>(serialization::encode(State{ByName{}})), State{ByName{}});
+}
+
+TEST(Serialization, RejectsMalformedData) {
+    using State = std::variant<Idle, Survey>;
+    const std::string bytes = serialization::encode(State{Survey{"title", {1, 2}, std::nullopt}});
+    EXPECT_THROW((void)serialization::decode<State>(bytes.substr(0, bytes.size() - 1)), serialization::DecodeError);
+    EXPECT_THROW((void)serialization::decode<State>(bytes + "x"), serialization::DecodeError);
+    std::string unknownTag = bytes;
+    unknownTag[0] = 9;
+    EXPECT_THROW((void)serialization::decode<State>(unknownTag), serialization::DecodeError);
+}
+
+} // namespace
@@ -0,0 +1,69 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/flat_memory.hpp"
+#include "tg_stater/state_storage/memory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Asking {
+    std::string name;
+};
+struct Greeting {
+    std::string name;
+};
+struct Failing {
+    explicit Failing(const std::string& /*unused*/) {
+        throw std::runtime_error{"failing"};
+    }
+};
+using State = std::variant<Asking, Greeting, Failing>;
+
+template <typename Storage>
+class StateProxyTest : public ::testing::Test {};
+
+using Storages = ::testing::Types<MemoryStateStorage<State>, FlatMemoryStateStorage<State>>;
+TYPED_TEST_SUITE(StateProxyTest, Storages);
+
+// The name is longer than the small string buffer, so reading it after it is freed is caught by ASan
+TYPED_TEST(StateProxyTest, EmplaceReadsArgumentsFromTheCurrentState) {
+    TypeParam storage;
+    storage.put({.chatId = 1}, Asking{std::string(64, 'a')});
+    const StateProxy proxy{storage, {.chatId = 1}};
+    const auto& asking = std::get<Asking>(*proxy.get());
+    proxy.template emplace<Greeting>(asking.name);
+    EXPECT_EQ(std::get<Greeting>(*proxy.get()).name, std::string(64, 'a'));
+}
+
+TYPED_TEST(StateProxyTest, ThrowingConstructorKeepsTheCurrentState) {
+    TypeParam storage;
+    storage.put({.chatId = 1}, Asking{"kept"});
+    const StateProxy proxy{storage, {.chatId = 1}};
+    EXPECT_THROW(proxy.template emplace<Failing>(std::string{"x"}), std::runtime_error);
+    ASSERT_NE(proxy.get(), nullptr);
+    ASSERT_FALSE(proxy.get()->valueless_by_exception());
+    EXPECT_EQ(std::get<Asking>(*proxy.get()).name, "kept");
+}
+
+// A new key may move the other keys' states while growing the table
+TYPED_TEST(StateProxyTest, EmplaceReadsArgumentsFromOtherStatesWhileGrowing) {
+    TypeParam storage;
+    storage.put({.chatId = 0}, Asking{std::string(64, 'a')});
+    for (std::int64_t i = 1; i < 200; ++i) {
+        const auto& asking = std::get<Asking>(*storage[{.chatId = 0}]);
+        const StateProxy proxy{storage, {.chatId = i}};
+        proxy.template emplace<Greeting>(asking.name);
+        ASSERT_EQ(std::get<Greeting>(*proxy.get()).name, std::string(64, 'a'));
+    }
+}
+
+} // namespace
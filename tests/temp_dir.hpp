@@ -0,0 +1,35 @@
+#ifndef INCLUDE_tgbotstater_tests_temp_dir
+#define INCLUDE_tgbotstater_tests_temp_dir
+
+#include <gtest/gtest.h>
+
+#include <filesystem>
+#include <string>
+
+namespace tg_stater::test {
+
+// A fresh directory per test, removed afterwards
+class TempDir : public ::testing::Test {
+  protected:
+    std::filesystem::path dir;
+
+    void SetUp() override {
+        const ::testing::TestInfo* info = ::testing::UnitTest::GetInstance()->current_test_info();
+        dir = std::filesystem::temp_directory_path() /
+              (std::string{"tgbotstater_"} + info->test_suite_name() + "_" + info->name());
+        std::filesystem::remove_all(dir);
+        std::filesystem::create_directories(dir);
+    }
+
+    void TearDown() override {
+        std::filesystem::remove_all(dir);
+    }
+
+    [[nodiscard]] std::string path(const std::string& name) const {
+        return (dir / name).string();
+    }
+};
+
+} // namespace tg_stater::test
+
+#endif // INCLUDE_tgbotstater_tests_temp_dir
@@ -0,0 +1,183 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "temp_dir.hpp"
+
+#include "tg_stater/tracing.hpp"
+
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+#include <gtest/gtest.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace {
+
+using namespace tg_stater;
+using tracing::TracingOptions;
+using Format = TracingOptions::Format;
+using boost::property_tree::ptree;
+
+std::string readFile(const std::string& path) {
+    std::ifstream in{path, std::ios::binary};
+    return {std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+}
+
+ptree parseJson(const std::string& text) {
+    std::istringstream in{text};
+    ptree tree;
+    boost::property_tree::read_json(in, tree);
+    return tree;
+}
+
+// The spans of the lines of an OTLP/JSON file, by name
+std::map<std::string, ptree> otlpSpans(const std::string& path) {
+    std::map<std::string, ptree> spans;
+    std::istringstream lines{readFile(path)};
+    for (std::string line; std::getline(lines, line);) {
+        const ptree request = parseJson(line);
+        for (const auto& [_, resource] : request.get_child("resourceSpans")) {
+            EXPECT_EQ(resource.get_child("resource.attributes").front().second.get<std::string>("value.stringValue"),
+                      "test");
+            for (const auto& [_, scope] : resource.get_child("scopeSpans"))
+                for (const auto& [_, span] : scope.get_child("spans"))
+                    spans.emplace(span.get<std::string>("name"), span);
+        }
+    }
+    return spans;
+}
+
+// Handles one update: a root span with a child span inside
+void traceUpdate(int chat) {
+    const tracing::UpdateSpan root{"message", chat};
+    const tracing::Span handler{"handler \"quoted\""};
+}
+
+class TracerTest : public test::TempDir {};
+
+TEST_F(TracerTest, WritesChromeTraceEvents) {
+    const std::string file = path("trace.json");
+    {
+        tracing::Tracer tracer{{.path = file}};
+        traceUpdate(42);
+        traceUpdate(43);
+    }
+    const ptree events = parseJson(readFile(file));
+    ASSERT_EQ(events.size(), 4);
+    std::map<std::string, std::size_t> names;
+    for (const auto& [_, event] : events) {
+        ++names[event.get<std::string>("name")];
+        EXPECT_EQ(event.get<std::string>("ph"), "X");
+        EXPECT_EQ(event.get<std::string>("cat"), "tg_stater");
+        EXPECT_GE(event.get<double>("dur"), 0);
+        EXPECT_EQ(event.get<std::string>("args.trace").size(), 32);
+    }
+    EXPECT_EQ(names, (std::map<std::string, std::size_t>{{"message", 2}, {"handler \"quoted\"", 2}}));
+    EXPECT_EQ(events.front().second.get<std::string>("args.chat"), "42");
+}
+
+TEST_F(TracerTest, WritesAnOtlpLinePerUpdate) {
+    const std::string file = path("trace.jsonl");
+    {
+        tracing::Tracer tracer{{.path = file, .format = Format::OtlpJson, .serviceName = "test"}};
+        traceUpdate(1);
+        traceUpdate(2);
+    }
+    std::istringstream lines{readFile(file)};
+    std::size_t count = 0;
+    for (std::string line; std::getline(lines, line);)
+        ++count;
+    EXPECT_EQ(count, 2);
+
+    const std::map<std::string, ptree> spans = otlpSpans(file);
+    const ptree& root = spans.at("message");
+    const ptree& handler = spans.at("handler \"quoted\"");
+    EXPECT_EQ(root.count("parentSpanId"), 0);
+    EXPECT_EQ(handler.get<std::string>("parentSpanId"), root.get<std::string>("spanId"));
+    EXPECT_EQ(handler.get<std::string>("traceId").size(), 32);
+    EXPECT_LE(root.get<std::int64_t>("startTimeUnixNano"), handler.get<std::int64_t>("startTimeUnixNano"));
+    EXPECT_LE(handler.get<std::int64_t>("endTimeUnixNano"), root.get<std::int64_t>("endTimeUnixNano"));
+}
+
+TEST_F(TracerTest, ParentsSpansAcrossAHandoff) {
+    const std::string file = path("trace.jsonl");
+    {
+        tracing::Tracer tracer{{.path = file, .format = Format::OtlpJson, .serviceName = "test"}};
+        std::thread worker;
+        {
+            const tracing::UpdateSpan root{"message", 1};
+            const tracing::Span dispatch{"dispatch"};
+            worker = std::thread{[handoff = tracing::Handoff::current()]() mutable {
+                const tracing::Resume resume{std::move(handoff)};
+                const tracing::Span handler{"handler"};
+            }};
+        }
+        // the trace is written by the worker if it lets it go last
+        worker.join();
+        // nothing is left over for the next update of the thread
+        EXPECT_EQ(tracing::Handoff::current().trace, nullptr);
+    }
+    const std::map<std::string, ptree> spans = otlpSpans(file);
+    ASSERT_EQ(spans.size(), 4);
+    const std::string traceId = spans.at("message").get<std::string>("traceId");
+    for (const auto& [name, span] : spans)
+        EXPECT_EQ(span.get<std::string>("traceId"), traceId) << name;
+    const std::string dispatch = spans.at("dispatch").get<std::string>("spanId");
+    EXPECT_EQ(spans.at("dispatch").get<std::string>("parentSpanId"), spans.at("message").get<std::string>("spanId"));
+    EXPECT_EQ(spans.at("queued").get<std::string>("parentSpanId"), dispatch);
+    EXPECT_EQ(spans.at("handler").get<std::string>("parentSpanId"), dispatch);
+}
+
+TEST_F(TracerTest, SamplesNothingAtZeroAndEverythingAtOne) {
+    const std::string none = path("none.json");
+    {
+        tracing::Tracer tracer{{.path = none, .sampleRate = 0}};
+        for (int i = 0; i < 100; ++i) {
+            const tracing::UpdateSpan root{"message", i};
+            EXPECT_EQ(tracing::Handoff::current().trace, nullptr);
+        }
+    }
+    EXPECT_EQ(parseJson(readFile(none)).size(), 0);
+
+    const std::string all = path("all.json");
+    {
+        tracing::Tracer tracer{{.path = all, .sampleRate = 1}};
+        for (int i = 0; i < 100; ++i) {
+            const tracing::UpdateSpan root{"message", i};
+        }
+    }
+    EXPECT_EQ(parseJson(readFile(all)).size(), 100);
+}
+
+TEST_F(TracerTest, WithoutATracerNothingIsTraced) {
+    const tracing::UpdateSpan root{"message", 1};
+    const tracing::Span child{"handler"};
+    EXPECT_EQ(tracing::Handoff::current().trace, nullptr);
+}
+
+TEST_F(TracerTest, ARejectedTracerKeepsTheInstalledTrace) {
+    const std::string file = path("trace.json");
+    {
+        tracing::Tracer tracer{{.path = file}};
+        traceUpdate(1);
+        EXPECT_THROW(tracing::Tracer{{.path = file}}, std::logic_error);
+        traceUpdate(2);
+    }
+    EXPECT_EQ(parseJson(readFile(file)).size(), 4);
+
+    // an installed tracer starts the file over
+    {
+        tracing::Tracer tracer{{.path = file}};
+        traceUpdate(3);
+    }
+    EXPECT_EQ(parseJson(readFile(file)).size(), 2);
+}
+
+} // namespace
@@ -0,0 +1,26 @@
+#ifndef INCLUDE_tgbotstater_tests_updates
+#define INCLUDE_tgbotstater_tests_updates
+
+#include <tgbot/types/Chat.h>
+#include <tgbot/types/Message.h>
+#include <tgbot/types/Update.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+namespace tg_stater::test {
+
+// An update with a text message in the given chat
+inline TgBot::Update::Ptr makeMessage(std::int64_t chat, const std::string& text) {
+    auto update = std::make_shared<TgBot::Update>();
+    update->message = std::make_shared<TgBot::Message>();
+    update->message->chat = std::make_shared<TgBot::Chat>();
+    update->message->chat->id = chat;
+    update->message->text = text;
+    return update;
+}
+
+} // namespace tg_stater::test
+
+#endif // INCLUDE_tgbotstater_tests_updates
@@ -0,0 +1,223 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "temp_dir.hpp"
+
+#include "tg_stater/state_storage/common.hpp"
+#include "tg_stater/state_storage/wal.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <variant>
+
+namespace {
+
+using namespace tg_stater;
+
+struct Idle {
+    static constexpr std::uint32_t serializationTag = 1;
+};
+struct Named {
+    std::string name;
+
+    static constexpr std::uint32_t serializationTag = 2;
+    static constexpr auto serializedFields = std::tuple{&Named::name};
+};
+using State = std::variant<Idle, Named>;
+using Storage = WalStateStorage<State>;
+
+constexpr WalOptions everyWrite{.sync = WalOptions::Sync::EveryWrite};
+
+std::string nameOf(Storage& storage, const StateKey& key) {
+    const State* state = storage[key];
+    if (!state)
+        return "<none>";
+    const auto* named = std::get_if<Named>(state);
+    return named ? named->name : "<idle>";
+}
+
+class WalStateStorageTest : public test::TempDir {};
+
+TEST_F(WalStateStorageTest, RecoversPutsAndErases) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite};
+        storage.put({.chatId = 1}, Named{"one"});
+        storage.put({.chatId = 2}, Idle{});
+        storage.put({.chatId = 3, .threadId = 7}, Named{"topic"});
+        storage.put({.chatId = 1}, Named{"one again"});
+        storage.erase({.chatId = 2});
+    }
+    Storage storage{base, everyWrite};
+    EXPECT_EQ(nameOf(storage, {.chatId = 1}), "one again");
+    EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+    EXPECT_EQ(nameOf(storage, {.chatId = 3, .threadId = 7}), "topic");
+    EXPECT_EQ(nameOf(storage, {.chatId = 3}), "<none>");
+}
+
+TEST_F(WalStateStorageTest, DropsTornRecord) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite};
+        storage.put({.chatId = 1}, Named{"kept"});
+        storage.put({.chatId = 2}, Named{"torn"});
+    }
+    // a crash in the middle of writing the last record
+    const std::string log = base + ".log";
+    std::filesystem::resize_file(log, std::filesystem::file_size(log) - 3);
+    {
+        Storage storage{base, everyWrite};
+        EXPECT_EQ(nameOf(storage, {.chatId = 1}), "kept");
+        EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+        // the torn tail is cut off, so records written after recovery are readable
+        storage.put({.chatId = 3}, Named{"after"});
+    }
+    Storage storage{base, everyWrite};
+    EXPECT_EQ(nameOf(storage, {.chatId = 1}), "kept");
+    EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+    EXPECT_EQ(nameOf(storage, {.chatId = 3}), "after");
+}
+
+TEST_F(WalStateStorageTest, DropsCorruptedRecord) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite};
+        storage.put({.chatId = 1}, Named{"kept"});
+        storage.put({.chatId = 2}, Named{"corrupted"});
+    }
+    {
+        std::fstream log{base + ".log", std::ios::in | std::ios::out | std::ios::binary};
+        log.seekp(-1, std::ios::end);
+        log.put('X');
+    }
+    Storage storage{base, everyWrite};
+    EXPECT_EQ(nameOf(storage, {.chatId = 1}), "kept");
+    EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+}
+
+TEST_F(WalStateStorageTest, RecoversAfterCompaction) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite};
+        for (std::int64_t i = 0; i < 100; ++i)
+            storage.put({.chatId = i}, Named{"before " + std::to_string(i)});
+        storage.compact();
+        EXPECT_FALSE(std::filesystem::exists(base + ".log.compacting"));
+        // after the snapshot: overwritten, erased and new keys
+        storage.put({.chatId = 1}, Named{"after"});
+        storage.erase({.chatId = 2});
+        storage.put({.chatId = 100}, Idle{});
+    }
+    Storage storage{base, everyWrite};
+    EXPECT_EQ(nameOf(storage, {.chatId = 0}), "before 0");
+    EXPECT_EQ(nameOf(storage, {.chatId = 1}), "after");
+    EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+    EXPECT_EQ(nameOf(storage, {.chatId = 99}), "before 99");
+    EXPECT_EQ(nameOf(storage, {.chatId = 100}), "<idle>");
+}
+
+TEST_F(WalStateStorageTest, FinishesInterruptedCompaction) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite};
+        storage.put({.chatId = 1}, Named{"snapshot"});
+        storage.compact();
+        storage.put({.chatId = 2}, Named{"rotated"});
+        storage.erase({.chatId = 1});
+    }
+    // a crash after the log was moved aside, before it was merged
+    std::filesystem::rename(base + ".log", base + ".log.compacting");
+    {
+        Storage storage{base, everyWrite};
+        EXPECT_FALSE(std::filesystem::exists(base + ".log.compacting"));
+        EXPECT_EQ(nameOf(storage, {.chatId = 1}), "<none>");
+        EXPECT_EQ(nameOf(storage, {.chatId = 2}), "rotated");
+    }
+    Storage storage{base, everyWrite};
+    EXPECT_EQ(nameOf(storage, {.chatId = 1}), "<none>");
+    EXPECT_EQ(nameOf(storage, {.chatId = 2}), "rotated");
+}
+
+TEST_F(WalStateStorageTest, ReplaysMergedCompactingLogIdempotently) {
+    const std::string base = path("states");
+    const std::string kept = path("kept.log");
+    {
+        Storage storage{base, everyWrite};
+        storage.put({.chatId = 1}, Named{"merged"});
+        storage.put({.chatId = 2}, Named{"erased"});
+        storage.erase({.chatId = 2});
+        std::filesystem::copy_file(base + ".log", kept);
+        storage.compact();
+        storage.put({.chatId = 1}, Named{"after"});
+    }
+    // a crash after the new snapshot was renamed in, before the merged log was removed
+    std::filesystem::copy_file(kept, base + ".log.compacting");
+    for (int run = 0; run < 2; ++run) {
+        Storage storage{base, everyWrite};
+        EXPECT_FALSE(std::filesystem::exists(base + ".log.compacting"));
+        EXPECT_EQ(nameOf(storage, {.chatId = 1}), "after");
+        EXPECT_EQ(nameOf(storage, {.chatId = 2}), "<none>");
+    }
+}
+
+TEST_F(WalStateStorageTest, CompactsInBackground) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, {.sync = WalOptions::Sync::Periodic, .compactAfterBytes = 1024}};
+        for (std::int64_t i = 0; i < 1000; ++i)
+            storage.put({.chatId = i % 10}, Named{std::to_string(i)});
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+        while (!std::filesystem::exists(base + ".snapshot") && std::chrono::steady_clock::now() < deadline)
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        EXPECT_TRUE(std::filesystem::exists(base + ".snapshot"));
+    }
+    Storage storage{base, everyWrite};
+    for (std::int64_t i = 0; i < 10; ++i)
+        EXPECT_EQ(nameOf(storage, {.chatId = i}), std::to_string(990 + i));
+}
+
+TEST_F(WalStateStorageTest, SyncsPeriodicallyWhileAppending) {
+    const std::string base = path("states");
+    const std::string copy = path("copy");
+    Storage storage{base, {.sync = WalOptions::Sync::Periodic, .syncInterval = std::chrono::milliseconds{1}}};
+    // large enough to fill the buffer while the worker writes it
+    const std::string padding(1000, 'x');
+    for (std::int64_t i = 0; i < 2000; ++i)
+        storage.put({.chatId = i % 10}, Named{std::to_string(i) + padding});
+
+    // the worker writes everything without a sync or the destructor
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    const std::string last = "1999" + padding;
+    const auto logged = [&] {
+        std::ifstream in{base + ".log", std::ios::binary};
+        const std::string log{std::istreambuf_iterator<char>{in}, std::istreambuf_iterator<char>{}};
+        return log.find(last) != std::string::npos;
+    };
+    while (!logged() && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    ASSERT_TRUE(logged());
+
+    std::filesystem::copy_file(base + ".log", copy + ".log");
+    Storage recovered{copy, everyWrite};
+    for (std::int64_t i = 0; i < 10; ++i)
+        EXPECT_EQ(nameOf(recovered, {.chatId = i}), std::to_string(1990 + i) + padding);
+}
+
+TEST_F(WalStateStorageTest, RejectsOtherSchemaVersion) {
+    const std::string base = path("states");
+    {
+        Storage storage{base, everyWrite, 1};
+        storage.put({.chatId = 1}, Idle{});
+    }
+    EXPECT_THROW((Storage{base, everyWrite, 2}), std::runtime_error);
+}
+
+} // namespace
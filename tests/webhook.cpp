@@ -0,0 +1,115 @@
+#define TGBOTSTATER_LOG_OFF
+
+#include "tg_stater/webhook.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <gtest/gtest.h>
+#include <tgbot/types/Update.h>
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using namespace tg_stater;
+
+std::string request(const std::string& body) {
+    return "POST /hook HTTP/1.1\r\nHost: 127.0.0.1\r\nContent-Type: application/json\r\nContent-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+std::string update(std::int32_t updateId) {
+    const std::string id = std::to_string(updateId);
+    return R"({"update_id":)" + id + R"(,"message":{"message_id":)" + id +
+           R"(,"date":0,"chat":{"id":1,"type":"private"},"text":"hello"}})";
+}
+
+// Posts the bodies one after another over one connection, each after the previous one is answered
+std::vector<std::string> post(std::uint16_t port, const std::vector<std::string>& bodies) {
+    const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    ::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+    // NOLINTNEXTLINE(*-reinterpret-cast)
+    EXPECT_EQ(::connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)), 0);
+    std::vector<std::string> statuses;
+    std::array<char, 4096> buffer{}; // NOLINT(*-magic-numbers)
+    for (const std::string& body : bodies) {
+        const std::string data = request(body);
+        EXPECT_EQ(::send(fd, data.data(), data.size(), MSG_NOSIGNAL), static_cast<ssize_t>(data.size()));
+        std::string response;
+        while (response.find("\r\n\r\n") == std::string::npos) {
+            const ssize_t received = ::recv(fd, buffer.data(), buffer.size(), 0);
+            if (received <= 0)
+                break;
+            response.append(buffer.data(), static_cast<std::size_t>(received));
+        }
+        statuses.push_back(response.substr(0, response.find("\r\n")));
+    }
+    ::close(fd);
+    return statuses;
+}
+
+TEST(WebhookServer, HandsUpdatesOverInArrivalOrder) {
+    std::mutex mutex;
+    std::vector<std::int32_t> handled;
+    bool concurrent = false;
+    bool inSink = false;
+    WebhookServer server{{.address = "127.0.0.1", .port = 0, .path = "/hook", .workers = 4},
+                         [&](const TgBot::Update::Ptr& update) {
+                             {
+                                 const std::lock_guard lock{mutex};
+                                 concurrent = concurrent || inSink;
+                                 inSink = true;
+                             }
+                             // slow updates let the other workers parse ahead
+                             if (update->updateId % 3 == 0)
+                                 std::this_thread::sleep_for(std::chrono::milliseconds{1});
+                             const std::lock_guard lock{mutex};
+                             handled.push_back(update->updateId);
+                             inSink = false;
+                         }};
+    std::thread serving{[&] { server.run(); }};
+
+    constexpr std::int32_t updates = 300;
+    std::vector<std::string> bodies;
+    for (std::int32_t id = 1; id <= updates; ++id) {
+        bodies.push_back(update(id));
+        if (id % 50 == 0)
+            bodies.emplace_back("not json"); // skipped without holding the others back
+    }
+    for (const std::string& status : post(server.port(), bodies))
+        EXPECT_EQ(status, "HTTP/1.1 200 OK");
+
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds{10};
+    while (std::chrono::steady_clock::now() < deadline) {
+        {
+            const std::lock_guard lock{mutex};
+            if (handled.size() == updates)
+                break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds{1});
+    }
+    server.stop();
+    serving.join();
+
+    const std::lock_guard lock{mutex};
+    std::vector<std::int32_t> expected;
+    for (std::int32_t id = 1; id <= updates; ++id)
+        expected.push_back(id);
+    EXPECT_EQ(handled, expected);
+    EXPECT_FALSE(concurrent);
+}
+
+} // namespace